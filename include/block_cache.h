@@ -0,0 +1,72 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 默认块大小 (64 KiB)
+#define BLOCK_CACHE_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+// 分片数量（按 (inode, 块索引) 分片，大文件的块分散到各分片）
+#define BLOCK_CACHE_SHARDS 16
+
+// 失效序号的条带数（按 inode 散列）
+#define BLOCK_CACHE_SEQ_STRIPES 256
+
+// 缓存统计
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+    uint64_t used_bytes;
+    uint64_t capacity;
+} block_cache_stats_t;
+
+// 分片 LRU 块缓存，键为 (inode, 块索引)
+typedef struct block_cache block_cache_t;
+
+// 创建缓存，capacity 为总字节数
+block_cache_t* block_cache_new(size_t capacity, size_t block_size);
+void block_cache_free(block_cache_t *cache);
+
+// 块大小
+size_t block_cache_block_size(const block_cache_t *cache);
+
+// 读取块内 [offset, offset + size) 到 buf
+// 命中返回拷贝的字节数（块较短时可能小于 size），未命中返回 -1
+ssize_t block_cache_read(block_cache_t *cache, uint64_t inode, uint64_t index,
+                         void *buf, size_t offset, size_t size);
+
+// 开始从磁盘填充前获取凭证；填充期间该 inode（或散列到同一条带的 inode）发生失效时，插入会被丢弃
+uint64_t block_cache_fill_ticket(block_cache_t *cache, uint64_t inode);
+
+// 分配一个块大小的缓冲区，供调用者直接读入数据后用 block_cache_insert 插入，省去一次拷贝
+void* block_cache_alloc(block_cache_t *cache);
+
+// 插入 block_cache_alloc 分配的缓冲区（len 为块内有效数据长度）并接管它（无论是否插入成功），之后调用者不能再访问
+void block_cache_insert(block_cache_t *cache, uint64_t inode, uint64_t index,
+                        void *data, size_t len, uint64_t ticket);
+
+// 释放未插入的缓冲区
+void block_cache_discard(void *data);
+
+// 失效字节范围 [offset, offset + size) 覆盖的块
+void block_cache_invalidate_range(block_cache_t *cache, uint64_t inode, uint64_t offset, uint64_t size);
+
+// 失效文件的所有块，只访问该文件的块（各分片按 inode 记录块链表）
+void block_cache_invalidate_inode(block_cache_t *cache, uint64_t inode);
+
+// 获取统计信息
+void block_cache_get_stats(block_cache_t *cache, block_cache_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <hiredis/hiredis.h>
+#include "conn_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Redis Cluster 的槽数
+#define CLUSTER_SLOTS 16384
+
+// 重定向的种类
+#define CLUSTER_MOVED 1         // 槽已迁移到其他节点，已更新槽表
+#define CLUSTER_ASK 2           // 槽正在迁移，本次请求需先发送 ASKING 到目标节点
+#define CLUSTER_TRYAGAIN 3      // 多键命令的键在迁移中被拆开，稍后重试
+
+// Redis Cluster 路由：维护槽到主节点的映射，每个主节点有自己的连接池
+// 线程安全：槽表由内部的锁保护，收发只锁住取出的那条连接
+typedef struct cluster cluster_t;
+
+// 创建路由表，reply 为种子节点 addr:port 上 CLUSTER SLOTS 的回复
+// 新建立的节点连接在使用前执行 setup（如加载脚本）
+cluster_t* cluster_new(const char *addr, int port, const char *password, const redisReply *reply,
+                       conn_setup_fn setup, void *setup_arg);
+void cluster_free(cluster_t *cluster);
+
+// 计算键所在的槽（支持 {tag} 哈希标签）
+int cluster_key_slot(const char *key, size_t len);
+
+// 负责某个槽的主节点的连接池，槽未分配时重新加载槽表，失败返回 NULL
+// 连接池在路由表释放前一直有效
+conn_pool_t* cluster_slot_pool(cluster_t *cluster, int slot);
+
+// 取出负责某个槽的主节点的一条连接，节点不可达时重新加载一次槽表，失败返回 NULL
+pool_conn_t* cluster_slot_conn(cluster_t *cluster, int slot);
+
+// 检查回复是否为重定向：MOVED 时更新槽表，ASK 时 *ask 为目标节点的连接池
+// 返回重定向的种类，不是重定向返回 0
+int cluster_redirect(cluster_t *cluster, const redisReply *reply, conn_pool_t **ask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,6 +2,13 @@
 #define CONFIG_H
 
 #include <stdint.h>
+#include "qos.h"
+
+// 最多配置的只读副本数
+#define CONFIG_MAX_REPLICAS 8
+
+// 最多配置的 QoS 权重数
+#define CONFIG_MAX_QOS_WEIGHTS 32
 
 // 文件系统配置
 typedef struct {
@@ -13,6 +20,35 @@ typedef struct {
     char mountpoint[512];
     int foreground;
     int debug;
+    int cache_size;         // 数据块缓存大小（MB），0 表示禁用
+    int inline_threshold;   // 小文件内联存储阈值（字节），0 表示禁用
+    int chunk_size;         // 新卷的数据分块大小（MB），0 表示每个文件一个数据文件
+    int compress;           // 压缩算法（STORAGE_CODEC_*），-1 表示未指定
+    int dedup;              // 新卷是否启用块级去重
+    int delete_threads;     // 后台删除线程数，0 表示在 unlink 中同步删除
+    int delete_rate;        // 每秒最多删除的文件数，0 表示不限制
+    char redis_replicas[CONFIG_MAX_REPLICAS][256];  // 只读副本地址
+    int redis_replica_ports[CONFIG_MAX_REPLICAS];
+    int redis_replica_count;
+    int replica_max_lag;    // 从副本读取时允许的最大延迟（毫秒）
+    int meta_cache;         // 元数据缓存秒数（跨挂载一致），0 表示禁用
+    int meta_cache_size;    // 元数据缓存容量（MB）
+    int negative_timeout;   // 内核缓存名字不存在结果的秒数，0 表示不缓存
+    int writeback_cache;    // 启用内核回写缓存，合并小的写入
+    int sync_aof;           // fsync 时等待元数据写入 AOF
+    int sync_replicas;      // fsync 时等待确认元数据的副本数，0 表示不等待
+    int sync_timeout;       // 等待元数据持久化的超时（毫秒）
+    int journal;            // 创建先写入本地日志，后台批量应用到 Redis
+    char cold_dir[512];     // 分层存储的容量层目录，为空表示不分层
+    int tier_cold_after;    // 多少秒没有读写的文件降级到容量层，0 表示本挂载不迁移
+    int qos;                // 多租户调度区分租户的方式（QOS_KEY_*），-1 表示不调度
+    int qos_meta_rate;      // 每个租户每秒的元数据操作数，0 表示不限制
+    int qos_data_rate;      // 每个租户每秒读写的数据量（MB），0 表示不限制
+    int qos_slots[QOS_CLASSES];     // 各类别的执行槽数
+    int qos_tenant_slots;   // 每个租户在每个类别中最多占用的执行槽，0 表示比类别的槽数少一个
+    char qos_weight_names[CONFIG_MAX_QOS_WEIGHTS][256];    // 租户（uid 或第一级目录名）
+    int qos_weights[CONFIG_MAX_QOS_WEIGHTS];
+    int qos_weight_count;
 } config_t;
 
 // 解析命令行参数
@@ -0,0 +1,59 @@
+#ifndef CONN_POOL_H
+#define CONN_POOL_H
+
+#include <pthread.h>
+#include <hiredis/hiredis.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 每个节点的连接数
+#define CONN_POOL_SIZE 8
+
+// 新建立的连接在认证和选择数据库之后执行的初始化（如加载脚本），返回 -1 时断开连接
+typedef int (*conn_setup_fn)(redisContext *ctx, void *arg);
+
+// 连接池中的一条连接，取出时持有其锁
+typedef struct {
+    pthread_mutex_t lock;
+    redisContext *ctx;          // 首次使用时建立，断开后在下次取出时重连
+    long long tracking;         // 已在此连接上生效的失效通知转发目标（由使用者维护）
+} pool_conn_t;
+
+// 到同一个节点的一组连接：各线程取出不同的连接并发收发，全部在使用时等待其中一条
+typedef struct {
+    char host[256];
+    int port;
+    char *password;
+    int db;
+    conn_setup_fn setup;
+    void *setup_arg;
+    int size;
+    unsigned int next;          // 下一次从哪条连接开始找空闲的（原子访问）
+    pool_conn_t conns[CONN_POOL_SIZE];
+    pool_conn_t wait;           // 只用于可能长时间阻塞的命令（WAIT/WAITAOF）的独立连接
+} conn_pool_t;
+
+// 初始化连接池（不建立连接），size 不超过 CONN_POOL_SIZE，失败返回 -1
+int conn_pool_init(conn_pool_t *pool, const char *host, int port, const char *password, int db,
+                   int size, conn_setup_fn setup, void *setup_arg);
+void conn_pool_destroy(conn_pool_t *pool);
+
+// 取出一条连接，必要时建立连接；建立失败返回 NULL（不持有锁）
+pool_conn_t* conn_pool_get(conn_pool_t *pool);
+
+// 取出指定下标的连接（如维护连接状态的那一条）
+pool_conn_t* conn_pool_get_at(conn_pool_t *pool, int index);
+
+// 取出等待持久化用的独立连接，阻塞期间不占用普通的连接
+pool_conn_t* conn_pool_get_wait(conn_pool_t *pool);
+
+// 归还连接
+void conn_pool_put(pool_conn_t *conn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
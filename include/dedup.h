@@ -0,0 +1,86 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include "conn_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 去重块大小
+#define DEDUP_BLOCK_SIZE (128 * 1024)
+
+// dedup_copy 的范围无法按块共享
+#define DEDUP_UNALIGNED (-2)
+
+// 锁条带数量
+#define DEDUP_LOCK_STRIPES 64
+
+// 截断和删除时每次在 Redis 中处理的块数
+#define DEDUP_DROP_BATCH 1024
+
+// 读取时块文件已被并发的覆盖写入删除，重新读取块映射的次数
+#define DEDUP_READ_RETRIES 8
+
+// 哈希相同而内容不同的块最多保存的个数
+#define DEDUP_MAX_COLLISIONS 16
+
+// Lua 脚本数量
+#define DEDUP_SCRIPTS 2
+
+// 内容寻址块存储
+// 块文件：<base_dir>/cas/<前两位>/<哈希>[-<序号>]，共享前逐字节比较内容，哈希碰撞的块以序号区分
+// Redis：blocks:<inode>（Hash，块索引 -> 哈希，size -> 逻辑大小）
+//        blockref（Hash，哈希 -> 引用计数）
+typedef struct dedup {
+    char cas_dir[600];
+    int lock_fd;                                    // 块存储目录上的排他 flock，同一数据目录只允许一个挂载
+    conn_pool_t pool;                               // 块存储专用的连接池
+    char script_sha[DEDUP_SCRIPTS][41];             // 脚本摘要，连接建立时加载
+    pthread_mutex_t inode_locks[DEDUP_LOCK_STRIPES]; // 同一文件的写入串行化
+    pthread_mutex_t block_locks[DEDUP_LOCK_STRIPES]; // 同一块的引用计数与块文件增删串行化
+} dedup_t;
+
+// 创建去重存储，使用自己的 Redis 连接池；数据目录已被另一挂载使用时失败
+dedup_t* dedup_new(const char *base_dir, const char *addr, int port, const char *password, int db);
+void dedup_free(dedup_t *dedup);
+
+// 写入数据，old_size 返回写入前的文件大小
+ssize_t dedup_write(dedup_t *dedup, uint64_t inode, const void *data, size_t size,
+                    uint64_t offset, uint64_t *old_size);
+
+// 读取数据
+ssize_t dedup_read(dedup_t *dedup, uint64_t inode, void *buf, size_t size, uint64_t offset);
+
+// 复制文件范围：只复制块映射并增加引用计数，不读写数据
+// 偏移未按块对齐，或末尾不完整的块会覆盖目标文件已有数据时返回 DEDUP_UNALIGNED
+ssize_t dedup_copy(dedup_t *dedup, uint64_t src, uint64_t src_offset,
+                   uint64_t dst, uint64_t dst_offset, size_t size);
+
+// 截断文件
+int dedup_truncate(dedup_t *dedup, uint64_t inode, uint64_t size);
+
+// 删除文件，释放所有块引用
+int dedup_delete(dedup_t *dedup, uint64_t inode);
+
+// 查找下一个数据块（SEEK_DATA）或空洞（SEEK_HOLE），没有更多数据时返回 -1 且 errno 为 ENXIO
+int dedup_seek(dedup_t *dedup, uint64_t inode, uint64_t offset, int whence, uint64_t *result);
+
+// 同步块存储到磁盘
+int dedup_sync(dedup_t *dedup);
+
+// 获取文件大小
+int dedup_get_size(dedup_t *dedup, uint64_t inode, uint64_t *size);
+
+// 128 位内容哈希（按 64 字节条带累加，可被编译器向量化）
+void dedup_hash128(const void *data, size_t len, uint64_t out[2]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef DIRSTAT_H
+#define DIRSTAT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 目录统计增量的传播间隔（秒）
+#define DIRSTAT_FLUSH_INTERVAL 1
+
+// 目录用量统计：修改节点时增量记到直接父目录上，
+// 由后台线程定期把累积的增量沿父目录链批量传播到所有祖先
+typedef struct dirstat dirstat_t;
+
+// 创建传播器，使用独立的 Redis 连接
+dirstat_t* dirstat_new(const char *addr, int port, const char *password, int db);
+
+// 启动线程（必须在 FUSE 转入后台之后调用）
+int dirstat_start(dirstat_t *dirstat);
+
+// 停止线程，传播剩余的增量后释放
+void dirstat_free(dirstat_t *dirstat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,15 @@
 #include <fuse3/fuse.h>
 #include "redis_meta.h"
 #include "storage.h"
+#include "reaper.h"
+#include "dirstat.h"
+#include "meta_cache.h"
+#include "invalidator.h"
+#include "syncer.h"
+#include "journal.h"
+#include "openfiles.h"
+#include "migrator.h"
+#include "qos.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,6 +22,17 @@ extern "C" {
 typedef struct {
     redis_meta_t *meta;
     storage_t *storage;
+    reaper_t *reaper;       // 后台删除（可为 NULL）
+    dirstat_t *dirstat;     // 目录用量传播（可为 NULL）
+    meta_cache_t *cache;    // 元数据缓存（可为 NULL）
+    invalidator_t *invalidator; // 其他挂载修改时失效缓存（启用元数据缓存时）
+    int negative_timeout;   // 内核缓存名字不存在结果的秒数
+    int writeback_cache;    // 启用内核回写缓存（内核不支持时在 fs_init 中清除）
+    syncer_t *syncer;       // 合并并发的 fsync
+    journal_t *journal;     // 元数据写后日志（可为 NULL）
+    openfiles_t *openfiles; // 本挂载打开的文件
+    migrator_t *migrator;   // 分层存储的后台迁移（可为 NULL）
+    qos_t *qos;             // 多租户 I/O 调度（可为 NULL）
 } fs_context_t;
 
 // 获取文件属性
@@ -30,6 +50,17 @@ int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_
 // 写入文件
 int fs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
 
+// 在文件之间复制数据
+ssize_t fs_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in,
+                           const char *path_out, struct fuse_file_info *fi_out, off_t offset_out,
+                           size_t size, int flags);
+
+// 预分配、打洞或清零
+int fs_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi);
+
+// 查找数据区或空洞（SEEK_DATA / SEEK_HOLE）
+off_t fs_lseek(const char *path, off_t off, int whence, struct fuse_file_info *fi);
+
 // 释放文件
 int fs_release(const char *path, struct fuse_file_info *fi);
 
@@ -39,9 +70,14 @@ int fs_create(const char *path, mode_t mode, struct fuse_file_info *fi);
 // 截断文件
 int fs_truncate(const char *path, off_t size, struct fuse_file_info *fi);
 
-// 删除文件
+// 删除文件：删除一个链接，最后一个链接删除且没有打开的句柄时删除数据
 int fs_unlink(const char *path);
 
+// 符号链接和硬链接
+int fs_symlink(const char *target, const char *path);
+int fs_readlink(const char *path, char *buf, size_t size);
+int fs_link(const char *oldpath, const char *newpath);
+
 // 创建目录
 int fs_mkdir(const char *path, mode_t mode);
 
@@ -60,6 +96,12 @@ int fs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi);
 // 文件系统统计
 int fs_statfs(const char *path, struct statvfs *stbuf);
 
+// 扩展属性：保存在 Redis 中，另有目录用量的只读虚拟属性（不出现在 listxattr 中）
+int fs_getxattr(const char *path, const char *name, char *value, size_t size);
+int fs_setxattr(const char *path, const char *name, const char *value, size_t size, int flags);
+int fs_listxattr(const char *path, char *list, size_t size);
+int fs_removexattr(const char *path, const char *name);
+
 // 设置文件属性
 int fs_chmod(const char *path, mode_t mode, struct fuse_file_info *fi);
 int fs_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi);
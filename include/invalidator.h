@@ -0,0 +1,37 @@
+#ifndef INVALIDATOR_H
+#define INVALIDATOR_H
+
+#include "redis_meta.h"
+#include "meta_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fuse;
+
+// 订阅连接断开后重连的间隔（秒）
+#define INVALIDATOR_RETRY_INTERVAL 1
+
+// 清理过期缓存项的间隔（秒），每次只清理每个分片的一批
+#define INVALIDATOR_EXPIRE_INTERVAL 1
+
+// 跨挂载的缓存一致性：在独立连接上订阅 Redis 的失效通知，其他挂载修改节点记录或目录后
+// 失效本地元数据缓存，并通知内核丢弃对应路径的属性和页缓存
+typedef struct invalidator invalidator_t;
+
+// 创建订阅连接，并在 meta 的主连接上开启失效通知的转发
+invalidator_t* invalidator_new(redis_meta_t *meta, meta_cache_t *cache,
+                               const char *addr, int port, const char *password);
+
+// 启动线程（必须在 FUSE 转入后台之后调用），fuse 用于通知内核
+int invalidator_start(invalidator_t *inv, struct fuse *fuse);
+
+// 停止线程并释放
+void invalidator_free(invalidator_t *inv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include "redis_meta.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 数据目录中的日志文件名
+#define JOURNAL_FILE "meta.journal"
+
+// 每个事务最多应用的修改数
+#define JOURNAL_BATCH 512
+
+// 后台应用的间隔（毫秒），攒够一批时立即应用
+#define JOURNAL_FLUSH_INTERVAL_MS 10
+
+// 未应用的修改达到该数量后，新的创建等待后台应用
+#define JOURNAL_MAX_PENDING 65536
+
+// 每次从 Redis 预留的 inode 数
+#define JOURNAL_INODE_RESERVE 1024
+
+// 修改全部应用后，日志文件超过该大小时清空
+#define JOURNAL_COMPACT_SIZE (64 * 1024 * 1024)
+
+// 元数据写后日志：创建文件和目录时追加到本地日志后立即返回，后台线程按顺序把修改
+// 成批地在一个事务中应用到 Redis。尚未应用的节点和目录项从日志中读取；
+// 尚未应用的节点的属性修改（写入、截断、chmod、chown、utimens）同样记入日志，
+// 其他修改操作和 readdir 先等待日志全部应用。挂载时重放上次未应用完的日志
+// 只支持单机模式
+typedef struct journal journal_t;
+
+// 打开 dir 中的日志，重放上次未应用的修改后清空。meta 为 FUSE 操作使用的连接，
+// 后台应用使用独立的连接
+journal_t* journal_new(redis_meta_t *meta, const char *dir, const char *addr, int port,
+                       const char *password, int db);
+
+// 启动线程（必须在 FUSE 转入后台之后调用）
+int journal_start(journal_t *journal);
+
+// 停止线程，应用剩余的修改后释放
+void journal_free(journal_t *journal);
+
+// 创建节点：分配 inode 并追加到日志，*attr 为新节点（调用者负责 node_attr_free）
+// 名字在尚未应用的目录项中已存在时返回 1，失败返回 -1；不查询 Redis，调用者先查找名字，
+// 之后其他挂载创建的同名目录项在应用时发现，这次创建被放弃并报告，节点加入待删除集合
+int journal_create(journal_t *journal, uint64_t parent, const char *name, uint32_t mode,
+                   uint32_t uid, uint32_t gid, node_attr_t **attr);
+
+// 查找尚未应用的目录项，找到返回 1
+int journal_lookup(journal_t *journal, uint64_t parent, const char *name, uint64_t *inode);
+
+// 读取尚未应用的节点，找到返回 1（调用者负责 node_attr_free）
+int journal_get_node(journal_t *journal, uint64_t inode, node_attr_t **attr);
+
+// 节点尚未应用时把修改记入日志并返回 1；已应用返回 0，由调用者直接写 Redis
+// 语义分别与 redis_meta_change_node、redis_meta_set_size、redis_meta_touch_node 相同
+int journal_change_node(journal_t *journal, uint64_t inode, int64_t mode, int64_t uid,
+                        int64_t gid, int64_t ctime);
+int journal_set_size(journal_t *journal, uint64_t inode, uint64_t size, int64_t mtime, int64_t ctime);
+int journal_touch_node(journal_t *journal, uint64_t inode, uint64_t min_size,
+                       int64_t atime, int64_t mtime, int64_t ctime);
+
+// 等待此前记入日志的修改全部应用到 Redis，应用失败返回 -1
+int journal_drain(journal_t *journal);
+
+// 日志文件落盘（fsync 时调用），之后崩溃也会在下次挂载时重放
+int journal_commit(journal_t *journal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef MEMPOOL_H
+#define MEMPOOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 最大的缓存块（字节），更大的分配直接使用 malloc
+#define MEMPOOL_MAX_BLOCK 4096
+
+// 每个线程每一级最多保留的空闲块数
+#define MEMPOOL_CACHE_BLOCKS 64
+
+// 小块内存的线程本地缓存：按 2 的幂分级，释放的块留在本线程的空闲链表中供下次分配复用
+// 每次元数据操作都会分配和释放的临时对象（hiredis 的回复和格式化后的命令、回复数组、节点属性）
+// 稳定后不再进入 malloc。块可以在任意线程释放，线程退出时释放它保留的空闲块
+// 这些函数分配的内存只能用 mempool_free / mempool_realloc 处理，反之亦然
+void* mempool_alloc(size_t size);
+void* mempool_calloc(size_t count, size_t size);
+void* mempool_realloc(void *ptr, size_t size);
+char* mempool_strdup(const char *str);
+void mempool_free(void *ptr);
+
+// 线程本地临时缓冲区的用途，同一线程可以同时持有不同用途的缓冲区
+#define MEMPOOL_SCRATCH_COMPRESS 0      // 压缩文件读写一个块的原始数据和压缩数据
+#define MEMPOOL_SCRATCH_DEDUP 1         // 去重文件读写的一个块
+#define MEMPOOL_SCRATCH_BLOCK_MAP 2     // 取回去重块映射的命令参数
+#define MEMPOOL_SCRATCH_SLOTS 3
+
+// 取本线程某个用途的临时缓冲区（至少 size 字节，内容不保留），在下一次取同一用途之前有效
+// 供每次读写都需要整块缓冲区的数据路径复用，不必每次进入 malloc。线程退出时释放，不能 free
+void* mempool_scratch(int slot, size_t size);
+
+// 让 hiredis 使用这些函数分配内存，必须在创建任何连接之前调用
+void mempool_install_hiredis(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
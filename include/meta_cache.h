@@ -0,0 +1,95 @@
+#ifndef META_CACHE_H
+#define META_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "redis_meta.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 缓存项在内核超时之外多保留的秒数，保证内核中的目录项过期之前本地仍记得它的路径
+#define META_CACHE_GRACE 1
+
+// 超过该大小的扩展属性集合不缓存
+#define META_CACHE_XATTR_SIZE (64 * 1024)
+
+// 默认容量（MB）
+#define META_CACHE_DEFAULT_SIZE 64
+
+// 分片数量，每个分片独立加锁，按 LRU 淘汰
+#define META_CACHE_SHARDS 16
+
+// 每次清理每个分片最多丢弃的过期缓存项数
+#define META_CACHE_EXPIRE_BATCH 1024
+
+// 元数据缓存：目录项 (parent, name) -> inode 和节点属性
+// 内核以相同的超时缓存目录项和属性，本地缓存同时记录内核可能缓存了哪些路径，
+// 其他挂载修改元数据时据此失效内核缓存
+// 超出容量时淘汰最久未使用的缓存项；被淘汰的路径无法再主动失效，内核中的缓存最多保留到超时
+typedef struct meta_cache meta_cache_t;
+
+// 创建缓存，timeout 为缓存秒数，capacity 为总字节数
+meta_cache_t* meta_cache_new(int timeout, size_t capacity);
+void meta_cache_free(meta_cache_t *cache);
+
+// 缓存秒数
+int meta_cache_timeout(const meta_cache_t *cache);
+
+// 从 Redis 读取前获取凭证；读取期间发生过失效时插入会被丢弃
+uint64_t meta_cache_ticket(meta_cache_t *cache);
+
+// 凭证之后是否发生过失效（读到的数据可能已过期）
+int meta_cache_stale(meta_cache_t *cache, uint64_t ticket);
+
+// 查找目录项，命中返回 1 并延长过期时间（内核同时延长了它的缓存），未命中返回 0
+// 命中时 *inode 为 0 表示缓存的是名字不存在的结果
+int meta_cache_lookup(meta_cache_t *cache, uint64_t parent, const char *name, uint64_t *inode);
+
+// 插入目录项，inode 为 0 时记录名字不存在（关联目录当前的版本）
+void meta_cache_put_entry(meta_cache_t *cache, uint64_t parent, const char *name,
+                          uint64_t inode, uint64_t ticket);
+
+// 目录中新增了目录项（创建、重命名到该目录）：递增目录版本，其中缓存的不存在结果全部失效
+void meta_cache_bump_dir(meta_cache_t *cache, uint64_t inode);
+
+// 读取缓存的节点属性，命中返回 1
+int meta_cache_get_attr(meta_cache_t *cache, uint64_t inode, node_attr_t *attr);
+void meta_cache_put_attr(meta_cache_t *cache, const node_attr_t *attr, uint64_t ticket);
+
+// 读取缓存的节点全部扩展属性，命中返回 1，*list 为副本（调用者负责 xattr_list_free）
+// 缓存的是整个集合，集合中没有的名字即不存在
+int meta_cache_get_xattrs(meta_cache_t *cache, uint64_t inode, xattr_list_t **list);
+void meta_cache_put_xattrs(meta_cache_t *cache, uint64_t inode, const xattr_list_t *list, uint64_t ticket);
+
+// 读取缓存的符号链接目标，命中返回 1，按 readlink 的约定截断写入 buf（以 \0 结尾）
+// 目标创建后不会改变、inode 不会重用，不需要失效，只在一段时间未使用后清理
+int meta_cache_get_link(meta_cache_t *cache, uint64_t inode, char *buf, size_t size);
+void meta_cache_put_link(meta_cache_t *cache, uint64_t inode, const char *target);
+
+// 本挂载修改元数据后丢弃对应的缓存项（内核缓存由 FUSE 自己维护）
+void meta_cache_forget_entry(meta_cache_t *cache, uint64_t parent, const char *name);
+void meta_cache_forget_attr(meta_cache_t *cache, uint64_t inode);
+
+// 丢弃节点的扩展属性（本挂载修改后或其他挂载修改的通知），内核不缓存扩展属性
+void meta_cache_forget_xattrs(meta_cache_t *cache, uint64_t inode);
+
+// 其他挂载修改了节点记录或目录：丢弃相关缓存项，*paths 返回内核中需要失效的路径
+// 返回路径数，调用者用 meta_cache_paths_free 释放
+int meta_cache_invalidate_node(meta_cache_t *cache, uint64_t inode, char ***paths);
+int meta_cache_invalidate_dir(meta_cache_t *cache, uint64_t inode, char ***paths);
+
+// 丢弃全部缓存项（失效消息可能丢失时），*paths 返回全部已知路径
+int meta_cache_invalidate_all(meta_cache_t *cache, char ***paths);
+
+void meta_cache_paths_free(char **paths, int count);
+
+// 清理已过期的缓存项，每个分片单独加锁并且只清理一批，可以频繁调用
+void meta_cache_expire(meta_cache_t *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
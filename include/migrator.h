@@ -0,0 +1,65 @@
+#ifndef MIGRATOR_H
+#define MIGRATOR_H
+
+#include <stdint.h>
+#include "storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 扫描快速层查找降级文件的间隔（秒）
+#define MIGRATOR_SCAN_INTERVAL 60
+
+// 每轮最多迁移的文件数
+#define MIGRATOR_BATCH 64
+
+// 容量层的文件在 MIGRATOR_WINDOW 秒内被读写 MIGRATOR_PROMOTE_HITS 次后提升到快速层
+#define MIGRATOR_WINDOW 60
+#define MIGRATOR_PROMOTE_HITS 8
+
+// 每个文件最多每 MIGRATOR_STAMP_INTERVAL 秒把访问时间写入 Redis 一次
+#define MIGRATOR_STAMP_INTERVAL 60
+
+// 把待写入的访问时间和提升请求写入 Redis、取出待提升文件的间隔（秒）
+#define MIGRATOR_FLUSH_INTERVAL 1
+
+// 最多跟踪访问记录的文件数，超过后新文件的访问不记录
+#define MIGRATOR_MAX_TRACKED (256 * 1024)
+
+// 分层存储的后台迁移：每个启用分层的挂载记录文件的读写和打开，按 MIGRATOR_STAMP_INTERVAL 节流后
+// 把访问时间写入 Redis，变热的文件加入 Redis 中的待提升集合。迁移的挂载（cold_after > 0）定期扫描
+// 快速层，把各挂载记录的访问时间和后端文件时间都早于 cold_after 秒的文件降级到容量层，
+// 并按节点记录提升待提升集合中位于容量层的文件。
+// 文件所在的层记在节点记录的 NODE_FLAG_COLD 中，其他挂载打开文件时直接访问正确的层
+// 迁移只应在一个挂载上启用
+typedef struct migrator migrator_t;
+
+// 统计信息
+typedef struct {
+    uint64_t demoted;
+    uint64_t promoted;
+    uint64_t failed;
+} migrator_stats_t;
+
+// 创建迁移器，使用独立的 Redis 连接；cold_after 为 0 时本挂载只记录访问，不迁移文件
+migrator_t* migrator_new(storage_t *storage, const char *addr, int port, const char *password, int db,
+                         int cold_after);
+
+// 启动线程（必须在 FUSE 转入后台之后调用）
+int migrator_start(migrator_t *migrator);
+
+// 停止线程并释放，正在进行的迁移先完成
+void migrator_free(migrator_t *migrator);
+
+// 记录一次读写或打开
+void migrator_access(migrator_t *migrator, uint64_t inode);
+
+// 获取统计信息
+void migrator_get_stats(migrator_t *migrator, migrator_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef OPENFILES_H
+#define OPENFILES_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 本挂载打开的文件：按 inode 记录打开的句柄数。文件的最后一个链接被删除时仍有句柄，
+// 数据和节点记录保留到最后一次关闭后再删除
+typedef struct openfiles openfiles_t;
+
+openfiles_t* openfiles_new(void);
+void openfiles_free(openfiles_t *files);
+
+// 打开一个句柄，失败返回 -1
+int openfiles_open(openfiles_t *files, uint64_t inode);
+
+// 关闭一个句柄：这是最后一个句柄且文件的链接已全部删除时返回 1，由调用者删除文件
+int openfiles_release(openfiles_t *files, uint64_t inode);
+
+// 文件是否有打开的句柄
+int openfiles_busy(openfiles_t *files, uint64_t inode);
+
+// 文件的最后一个链接已删除：仍有句柄时记下并返回 1，由最后一次关闭删除；没有句柄时返回 0
+int openfiles_orphan(openfiles_t *files, uint64_t inode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef QOS_H
+#define QOS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 操作的类别，各自排队
+#define QOS_META 0
+#define QOS_DATA 1
+#define QOS_SYNC 2                      // fsync：可能等待元数据持久化，不占用读写的执行槽
+#define QOS_CLASSES 3
+
+// 区分租户的方式：按调用者的 uid 或按路径的第一级目录
+#define QOS_KEY_UID 0
+#define QOS_KEY_DIR 1
+
+// 每个类别默认同时执行的操作数，其余按公平队列等待
+#define QOS_META_SLOTS 4
+#define QOS_DATA_SLOTS 4
+#define QOS_SYNC_SLOTS 16
+
+// 数据操作的最小开销（字节），小读写和 fsync 等按此计算
+#define QOS_MIN_COST 4096
+
+// 最多跟踪的租户数，超过后新租户共用一个队列
+#define QOS_MAX_TENANTS 4096
+
+// 每个租户同时等待（限速或排队）的操作上限，超出的操作返回 EAGAIN。
+// 等待的操作占着 FUSE 工作线程，一个租户不能占满所有线程
+#define QOS_TENANT_WAITERS 16
+
+// 工作线程数在各类别执行槽总数之外留出的余量，足够几个租户同时排满等待
+#define QOS_THREAD_HEADROOM (4 * QOS_TENANT_WAITERS)
+
+// 默认权重和最大权重
+#define QOS_DEFAULT_WEIGHT 1
+#define QOS_MAX_WEIGHT 1000
+
+// 多租户 I/O 调度：FUSE 操作在访问元数据和存储层之前按租户排队。
+// 元数据操作、数据操作和 fsync 各有一定数量的执行槽，槽占满后按开始时间公平队列（SFQ）分配，
+// 每个租户按权重分得执行机会，一个租户的大量读写不会让其他租户的元数据操作长时间排队。
+// 每个租户在每个类别中同时占用的执行槽有上限，长时间的操作（复制、fallocate）不会占满所有槽。
+// 每个租户另有令牌桶限制速率（数据按字节，元数据按操作数），桶容量为一秒的令牌，超出时先等待
+typedef struct qos qos_t;
+
+// qos_begin 取得执行槽的租户记录，交给 qos_end 归还（记录在调度器释放前一直有效），NULL 表示未计入租户
+typedef struct qos_tenant_entry* qos_slot_t;
+
+// 统计信息（按类别）
+typedef struct {
+    uint64_t ops[QOS_CLASSES];          // 执行的操作
+    uint64_t queued[QOS_CLASSES];       // 等待执行槽的操作
+    uint64_t throttled[QOS_CLASSES];    // 因速率限制等待的操作
+    uint64_t rejected[QOS_CLASSES];     // 租户等待的操作已达上限而被拒绝的操作
+    uint64_t tenants;                   // 跟踪的租户数
+} qos_stats_t;
+
+// 创建调度器。meta_rate 为每个租户每秒的元数据操作数，data_rate 为每个租户每秒的数据字节数，0 表示不限速
+// slots 为各类别的执行槽数（按 QOS_META/QOS_DATA/QOS_SYNC 排列）；tenant_slots 为每个租户在每个类别中
+// 最多同时占用的槽数，0 表示比类别的槽数少一个（至少 1），给其他租户留出一个槽
+qos_t* qos_new(int key_type, uint64_t meta_rate, uint64_t data_rate,
+               const int slots[QOS_CLASSES], int tenant_slots);
+
+// 释放调度器，调用前所有操作必须已经结束
+void qos_free(qos_t *qos);
+
+// 设置租户的权重：name 为 uid（QOS_KEY_UID）或第一级目录名（QOS_KEY_DIR）
+int qos_set_weight(qos_t *qos, const char *name, int weight);
+
+// 操作所属的租户。path 为 NULL 或位于根目录时按目录区分的租户为根目录
+uint64_t qos_tenant(qos_t *qos, const char *path, uid_t uid);
+
+// 等待执行：先按速率限制等待，再等待执行槽；cost 为数据操作的字节数，元数据操作忽略
+// 取得执行槽返回 0，slot 交给 qos_end；租户等待的操作已达 QOS_TENANT_WAITERS 时不等待，返回 -1
+int qos_begin(qos_t *qos, int cls, uint64_t tenant, uint64_t cost, qos_slot_t *slot);
+
+// 操作结束，把执行槽交给队列中开始时间最早、所属租户未达到上限的操作
+void qos_end(qos_t *qos, int cls, qos_slot_t slot);
+
+// 建议的 FUSE 工作线程上限：各类别执行槽总数加上等待操作的余量
+int qos_max_threads(const qos_t *qos);
+
+// 获取统计信息
+void qos_get_stats(qos_t *qos, qos_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
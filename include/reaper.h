@@ -0,0 +1,51 @@
+#ifndef REAPER_H
+#define REAPER_H
+
+#include <stdint.h>
+#include "storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 每轮从待删除集合取出的节点数
+#define REAPER_BATCH 256
+
+// 每个任务包含的节点数，节点记录按任务批量删除
+#define REAPER_TASK_SIZE 32
+
+// 删除失败的节点推迟重试的秒数
+#define REAPER_RETRY_DELAY 60
+
+// 后台删除：unlink 只把节点加入 Redis 待删除集合，
+// 由分发线程按批取出，交给工作线程释放数据文件和节点记录
+typedef struct reaper reaper_t;
+
+// 统计信息
+typedef struct {
+    uint64_t deleted;
+    uint64_t failed;
+} reaper_stats_t;
+
+// 创建后台删除器，每个线程使用独立的 Redis 连接
+// threads 为工作线程数，rate 为每秒最多删除的文件数（0 表示不限制）
+reaper_t* reaper_new(storage_t *storage, const char *addr, int port, const char *password, int db,
+                     int threads, int rate);
+
+// 启动线程（必须在 FUSE 转入后台之后调用）
+int reaper_start(reaper_t *reaper);
+
+// 有新的待删除节点时唤醒分发线程
+void reaper_notify(reaper_t *reaper);
+
+// 停止线程并释放，未处理的节点留在 Redis 中，下次挂载时继续删除
+void reaper_free(reaper_t *reaper);
+
+// 获取统计信息
+void reaper_get_stats(reaper_t *reaper, reaper_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
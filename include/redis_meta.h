@@ -3,73 +3,405 @@
 
 #include <stdint.h>
 #include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
 #include <hiredis/hiredis.h>
+#include "cluster.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// 节点属性
+// 节点标志
+#define NODE_FLAG_INLINE 0x1    // 数据内联存储在 Redis 中
+#define NODE_FLAG_COLD   0x2    // 数据文件位于容量层（分层存储）
+
+// 目录项数达到该值后分片：新目录项按名字哈希写入子哈希 dir:<inode>:<k>
+#define DIR_SHARD_THRESHOLD 65536
+
+// 分片目录的子哈希数量
+#define DIR_SHARDS 256
+
+// 分片目录每添加一个目录项，从主哈希迁移到子哈希的分片前目录项数（HSCAN 的 COUNT）
+#define DIR_SHARD_MIGRATE 128
+
+// readdir 一次 MGET 读取的节点记录数
+#define META_READDIR_BATCH 256
+
+// 传播目录统计时每次脚本处理的增量字段数（HSCAN 的 COUNT）
+#define META_DIRSTAT_BATCH 256
+
+// 集群模式下的分组数：键带有所在分组的哈希标签 {g}，同一分组的键落在同一个槽
+// 文件与父目录在同一分组，目录按名字散列到各分组
+#define META_GROUPS 1024
+
+// 遇到 MOVED/ASK/TRYAGAIN 时最多重发的次数
+#define META_REDIRECT_RETRIES 5
+
+// TRYAGAIN（槽迁移中）后等待的微秒数
+#define META_TRYAGAIN_DELAY_US 10000
+
+// redis_meta.c 中的 Lua 脚本数
+#define META_SCRIPTS 16
+
+// 最多使用的只读副本数
+#define META_MAX_REPLICAS 8
+
+// 从副本读取时允许的默认最大延迟（毫秒）
+#define META_REPLICA_MAX_LAG 1000
+
+// 记录其他挂载修改时间的散列槽数（2 的幂），同一槽的 inode 共用时间，只会多读主节点
+#define META_REMOTE_SLOTS 4096
+
+// redis_meta_parse_key 返回的键类型
+#define META_KEY_NODE 1         // 节点记录
+#define META_KEY_DIR 2          // 目录（含分片目录的子哈希）
+#define META_KEY_XATTR 3        // 扩展属性
+
+// redis_meta_set_xattr 的条件（对应 setxattr 的 XATTR_CREATE / XATTR_REPLACE）
+#define META_XATTR_CREATE 1     // 名字必须不存在
+#define META_XATTR_REPLACE 2    // 名字必须已存在
+
+// 文件删除最后一个链接时仍在本挂载打开：在待删除集合中推迟的秒数
+// 最后一次关闭时改为立即删除，挂载崩溃时由之后的回收删除
+#define META_ORPHAN_HOLD (7 * 24 * 3600)
+
+// redis_meta_touch_node 中表示时间戳保持不变
+#define META_TIME_KEEP (-1)
+
+// 元数据日志中的修改类型
+#define META_JOURNAL_CREATE 1   // 创建节点并添加目录项（与 create_node 相同）
+#define META_JOURNAL_SETATTR 2  // 写节点记录（与 update_node 相同）
+
+// 节点属性：只有定长字段，按大小排列没有填充；变长数据（如符号链接目标）不放在这里
+// 由 node_attr_alloc 分配，node_attr_free 释放
 typedef struct {
     uint64_t inode;
-    uint32_t mode;
-    uint32_t uid;
-    uint32_t gid;
     uint64_t size;
     uint64_t blocks;
     uint64_t atime;
     uint64_t mtime;
     uint64_t ctime;
-    char link_target[4096];
+    uint64_t parent;            // 父目录（旧版本创建的节点为 0）
+    uint64_t entries;           // 目录项数
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t flags;
+    uint32_t nlink;             // 链接数，目录为 2 加子目录数，文件为硬链接数（旧记录为 0）
 } node_attr_t;
 
-// 目录项
+// 目录项：名字不内嵌，readdir 把全部名字紧凑地存放在目录项数组之后的同一块内存中
 typedef struct {
-    char name[256];
+    const char *name;
     uint64_t inode;
     uint32_t mode;
 } dir_entry_t;
 
+// 目录用量：子树中文件按 4K 对齐的大小之和、文件数和子目录数
+typedef struct {
+    uint64_t inode;
+    int64_t space;
+    int64_t files;
+    int64_t dirs;
+} dir_usage_t;
+
+// 文件最近一次读写的时间戳（分层存储），hot 非零时同时请求把文件提升到快速层
+typedef struct {
+    uint64_t inode;
+    int64_t last;
+    int hot;
+} access_stamp_t;
+
+// 元数据日志中的一条修改
+typedef struct {
+    int op;                     // META_JOURNAL_*
+    uint64_t parent;            // CREATE：父目录
+    const char *name;           // CREATE：目录项名
+    const node_attr_t *attr;    // 新节点或要写入的节点记录
+} meta_journal_op_t;
+
+// 节点的全部扩展属性：data 中依次存放各项的名字（以 \0 结尾）、值长度（uint32_t）和值
+typedef struct {
+    size_t len;
+    char data[];
+} xattr_list_t;
+
+// 已分片目录表的表项
+typedef struct {
+    uint64_t inode;
+    uint32_t shards;
+    int migrated;               // 主哈希中分片前的目录项已全部移到子哈希
+    uint64_t cursor;            // 迁移分片前目录项的 HSCAN 游标
+} dir_shard_entry_t;
+
+// 只读副本
+typedef struct {
+    conn_pool_t pool;           // 读取使用的连接池，探测线程按其地址建立自己的连接
+    int fresh;                  // 上次探测时落后不超过延迟上限（原子访问）
+} meta_replica_t;
+
 // Redis 元数据存储
 typedef struct {
-    redisContext *ctx;
+    redisContext *ctx;          // 创建时使用的连接（集群模式下为种子节点），收发使用连接池
+    conn_pool_t pool;           // 单机模式下到服务器的连接池（集群模式下各节点的连接池在路由表中）
+    size_t inline_threshold;    // 小于该大小的普通文件数据内联存储，0 表示禁用
+    int dirstat;                // 是否维护目录用量统计（卷格式设置）
+
+    // 已知的分片目录（inode -> 子哈希数量），查找时从分片标记得知
+    pthread_mutex_t shard_lock;
+    dir_shard_entry_t *shard_map;
+    size_t shard_map_size;
+    size_t shard_map_used;
+
+    // Redis Cluster：服务器启用集群时自动按槽路由，单机模式下 cluster 为 NULL、只有一个分组
+    cluster_t *cluster;
+    uint32_t groups;
+    char (*tags)[8];            // 各分组的哈希标签
+    uint32_t delete_group;      // 下一轮从哪个分组开始取待删除节点
+    char script_sha[META_SCRIPTS][41];  // 脚本的 SHA1，连接建立时加载，用 EVALSHA 调用
+
+    // 主节点、集群各节点和副本的收发只锁住从各自连接池取出的那条连接；正在构建的流水线属于各自的线程
+
+    // 只读副本：get_node、lookup、readdir 在副本足够新、且本挂载最近没有修改时从副本读取
+    meta_replica_t replicas[META_MAX_REPLICAS];
+    int replica_count;
+    unsigned int replica_next;  // 轮流使用各副本（原子访问）
+    char *replica_password;
+    int replica_db;
+    uint64_t replica_max_lag;   // 允许的最大延迟（毫秒）
+    uint64_t replica_probe;     // 上次成功探测的时间（毫秒，单调时钟，原子访问）
+    uint64_t last_write;        // 本挂载最近一次修改元数据的时间（毫秒，单调时钟，原子访问）
+    uint64_t remote_write[META_REMOTE_SLOTS]; // 其他挂载最近修改各键的时间（按 inode 散列，原子访问）
+
+    // 副本探测线程：使用独立的连接查询主节点和各副本的复制偏移量，不在读写请求中探测
+    char primary_addr[256];
+    int primary_port;
+    char *primary_password;
+    int primary_db;
+    pthread_t probe_thread;
+    int probe_started;
+    int probe_stopping;
+    pthread_mutex_t probe_lock;
+    pthread_cond_t probe_wake;
+
+    // 失效通知转发到的订阅连接（CLIENT ID），0 表示未开启
+    long long tracking_redirect; // 请求的转发目标
+    long long tracking_active;   // 最近一次在连接上生效的转发目标
 } redis_meta_t;
 
 // 创建 Redis 元数据存储
 redis_meta_t* redis_meta_new(const char *addr, int port, const char *password, int db);
 void redis_meta_free(redis_meta_t *meta);
 
-// 分配 inode
-uint64_t redis_meta_allocate_inode(redis_meta_t *meta);
+// 添加只读副本（仅单机模式），失败返回 -1
+int redis_meta_add_replica(redis_meta_t *meta, const char *addr, int port, const char *password, int db);
+
+// 启动副本探测线程（必须在 FUSE 转入后台之后调用），没有副本时不启动
+// 探测线程启动前不从副本读取
+int redis_meta_start_probe(redis_meta_t *meta);
+
+// 本挂载即将修改元数据：之后一个延迟上限内的读取（包括本次操作中修改前的读取）都走主节点
+// 事务和写节点记录时自动调用，FUSE 的修改操作在开始时调用
+void redis_meta_note_write(redis_meta_t *meta);
+
+// 收到其他挂载修改 inode 的节点记录、目录或扩展属性的失效通知：之后一个延迟上限内
+// 只有读取该 inode 的这些键走主节点（副本可能还没有同步，失效后重新读取时不能读到旧值）
+void redis_meta_note_remote_write(redis_meta_t *meta, uint64_t inode);
+
+// 开启失效通知：其他客户端修改节点记录或目录时，Redis 向客户端 id 为 redirect 的订阅连接
+// 发送被修改的键（CLIENT TRACKING 的 BCAST 模式，NOLOOP 不通知本连接自己的修改）
+// 开启后本挂载修改这些键的命令都经由开启跟踪的连接发送，自己的修改不会通知回来
+// 只支持单机模式，服务器不支持时返回 -1
+int redis_meta_enable_tracking(redis_meta_t *meta, long long redirect);
+
+// 订阅连接重连后改为转发到 redirect，在下一次发往服务器的命令之前生效，可以在其他线程中调用
+void redis_meta_retrack(redis_meta_t *meta, long long redirect);
 
-// 创建节点
+// 已生效的转发目标
+long long redis_meta_tracking(redis_meta_t *meta);
+
+// 解析失效通知中的键，返回 META_KEY_NODE、META_KEY_DIR 或 META_KEY_XATTR，其他键返回 0
+int redis_meta_parse_key(const char *key, uint64_t *inode);
+
+// 在分组中分配 inode（集群模式下 inode 对分组数取模等于分组）
+uint64_t redis_meta_allocate_inode(redis_meta_t *meta, uint32_t group);
+
+// 创建节点，目录项只在名字不存在时添加
+// 返回 0 表示成功，1 表示名字已存在，2 表示父目录已被删除，-1 表示失败
 int redis_meta_create_node(redis_meta_t *meta, uint64_t parent, const char *name,
                           uint32_t mode, uint32_t uid, uint32_t gid, node_attr_t **attr);
 
-// 获取节点
+// 创建符号链接：目标保存在节点的内联数据键中（与普通文件的内联数据相同，随节点一起删除）
+// 返回值与 redis_meta_create_node 相同
+int redis_meta_symlink(redis_meta_t *meta, uint64_t parent, const char *name, const char *target,
+                       uint32_t uid, uint32_t gid, node_attr_t **attr);
+
+// 读取符号链接的目标（可能从副本读取，调用者负责 free）
+int redis_meta_readlink(redis_meta_t *meta, uint64_t inode, char **target);
+
+// 为 attr 对应的文件在 parent 中添加名为 name 的硬链接，链接数加一
+// 返回值与 redis_meta_create_node 相同
+int redis_meta_link(redis_meta_t *meta, const node_attr_t *attr, uint64_t parent, const char *name);
+
+// 获取节点（可能从副本读取）
 int redis_meta_get_node(redis_meta_t *meta, uint64_t inode, node_attr_t **attr);
 
-// 更新节点
-int redis_meta_update_node(redis_meta_t *meta, const node_attr_t *attr);
+// 只修改节点的 mode、uid、gid 和 ctime，值为 -1 的字段保持不变（chmod、chown 使用）
+// 不读出整条记录再写回，不会覆盖同时到达的写入扩展的大小。返回 0 表示成功，1 表示节点不存在，-1 表示失败
+int redis_meta_change_node(redis_meta_t *meta, uint64_t inode, int64_t mode, int64_t uid,
+                           int64_t gid, int64_t ctime);
+
+// 把文件大小精确设置为 size 并设置 mtime、ctime（截断使用），inline_data 非零时同时截断内联数据
+// 返回 0 表示成功，1 表示文件已不是内联文件（只在 inline_data 非零时，未做修改），-1 表示失败或节点不存在
+int redis_meta_set_size(redis_meta_t *meta, uint64_t inode, uint64_t size, int64_t mtime,
+                        int64_t ctime, int inline_data);
+
+// 原子地扩展文件大小并设置时间戳，不覆盖记录中的其他字段：
+// 大小只在 min_size 更大时增大，时间戳为 META_TIME_KEEP 时保持不变
+// 写入可能并发到达（内核回写缓存同时刷出多个范围），读出整条记录再写回会让大小回退
+int redis_meta_touch_node(redis_meta_t *meta, uint64_t inode, uint64_t min_size,
+                          int64_t atime, int64_t mtime, int64_t ctime);
 
-// 查找文件
+// 查找文件（分片目录先查子哈希，再查分片前留在主哈希中的目录项；可能从副本读取）
+// 返回 0 表示找到，1 表示名字不存在，-1 表示失败
 int redis_meta_lookup(redis_meta_t *meta, uint64_t parent, const char *name, uint64_t *inode);
 
-// 读取目录
+// 读取目录（可能从副本读取），*entries 与其中的名字在同一块内存中，用 dir_entries_free 释放
 int redis_meta_readdir(redis_meta_t *meta, uint64_t inode, dir_entry_t **entries, int *count);
 
-// 删除文件/目录
-int redis_meta_unlink(redis_meta_t *meta, uint64_t parent, const char *name);
+// 删除空目录：检查目录为空、移除父目录中的目录项和删除节点原子地完成
+// 返回 0 表示成功，1 表示目录不为空，2 表示目录已被删除或目录项已改变，-1 表示失败
+int redis_meta_rmdir(redis_meta_t *meta, uint64_t parent, const char *name, uint64_t inode);
 
 // 删除节点
 int redis_meta_delete_node(redis_meta_t *meta, uint64_t inode);
 
-// 重命名
+// 重命名，replaced 为被覆盖的目标节点（可为 NULL）
+// 被覆盖的空目录在同一事务中删除，被覆盖的文件减少一个链接，hold 的含义与 redis_meta_defer_delete 相同
+// 返回 1 表示被覆盖文件的最后一个链接被删除（已加入待删除集合），0 表示成功，-1 表示失败
 int redis_meta_rename(redis_meta_t *meta, uint64_t old_parent, const char *old_name,
-                     uint64_t new_parent, const char *new_name);
+                     uint64_t new_parent, const char *new_name, const node_attr_t *replaced, int hold);
+
+// 目录项数：节点记录中有计数时直接返回，旧记录回退到 HLEN
+// 父目录的链接数、目录项数和修改时间在 create_node、rmdir、defer_delete、rename 的事务中
+// 通过脚本原子调整，update_node 不会覆盖这两个计数
+int redis_meta_count_entries(redis_meta_t *meta, const node_attr_t *attr, uint64_t *count);
+
+// 加载卷格式设置（保存在 setting 哈希中）
+// 首次挂载时记录 wanted；卷已有数据但未记录该设置时记录 legacy（旧版本的行为）；
+// 之后始终以记录的值为准
+int redis_meta_load_setting(redis_meta_t *meta, const char *name, uint64_t wanted,
+                            uint64_t legacy, uint64_t *value);
+
+// 读取内联数据：节点属性和数据在一次往返中取回
+// 返回 0 表示已从内联数据读取（*nread 为读取字节数），1 表示文件不是内联文件，-1 表示失败
+int redis_meta_read_inline(redis_meta_t *meta, uint64_t inode, void *buf, size_t size,
+                           off_t offset, ssize_t *nread);
+
+// 写入内联数据，文件大小扩展到写入末尾，mtime 为 META_TIME_KEEP 时保持不变
+// 返回 0 表示已写入，1 表示文件已不是内联文件（未写入），-1 表示失败
+int redis_meta_write_inline(redis_meta_t *meta, uint64_t inode, const void *data, size_t size,
+                            off_t offset, int64_t mtime);
+
+// 获取全部内联数据（调用者负责 free）
+int redis_meta_get_inline(redis_meta_t *meta, uint64_t inode, char **data, size_t *len);
+
+// 清除内联标志并删除内联数据（把 data、len 和文件大小 size 复制到数据文件后调用）
+// 返回 0 表示已清除（或已被其他调用者提升），1 表示内联数据或大小已被修改，需要重新复制，-1 表示失败
+int redis_meta_clear_inline(redis_meta_t *meta, uint64_t inode, const void *data, size_t len,
+                            uint64_t size);
+
+// 删除文件的目录项并减少一个链接，最后一个链接删除时把节点加入待删除集合，数据和节点记录由后台回收
+// hold 非零时（文件仍在本挂载打开）推迟 META_ORPHAN_HOLD 秒才允许删除
+// 返回 1 表示最后一个链接被删除，0 表示还有其他链接，-1 表示失败
+int redis_meta_defer_delete(redis_meta_t *meta, uint64_t parent, const char *name,
+                            const node_attr_t *attr, int hold);
+
+// 取出最多 max 个已到期的待删除节点（不移出集合）
+int redis_meta_pending_deletes(redis_meta_t *meta, int max, uint64_t **inodes, int *count);
+
+// 删除失败的节点推迟 delay 秒后重试
+int redis_meta_retry_delete(redis_meta_t *meta, uint64_t inode, int delay);
+
+// 记录文件数据所在的层（设置或清除 NODE_FLAG_COLD），节点不存在时返回 1
+int redis_meta_set_tier(redis_meta_t *meta, uint64_t inode, int cold);
+
+// 记录一批文件的访问时间（所有挂载共享，迁移的挂载据此判断冷热），并把 hot 非零的文件加入待提升集合
+int redis_meta_stamp_access(redis_meta_t *meta, const access_stamp_t *stamps, int count);
+
+// 读取一批文件记录的访问时间到 times，没有记录时为 0
+int redis_meta_access_times(redis_meta_t *meta, const uint64_t *inodes, int count, time_t *times);
+
+// 删除早于 before 的访问时间记录
+int redis_meta_expire_access(redis_meta_t *meta, time_t before);
+
+// 从每个分组的待提升集合中取出（并移出）最多 max 个文件，*count 最多为 max 乘以分组数
+int redis_meta_take_promotions(redis_meta_t *meta, int max, uint64_t **inodes, int *count);
+
+// 数据已释放后删除节点记录和访问时间记录，并移出待删除集合
+int redis_meta_finish_deletes(redis_meta_t *meta, const uint64_t *inodes, int count);
+
+// 读取全局用量：已用空间（按 4K 对齐的字节数）和节点数
+// 计数器与节点记录在同一事务或脚本中更新，statfs 无需遍历
+int redis_meta_get_usage(redis_meta_t *meta, uint64_t *space, uint64_t *inodes);
+
+// 为没有用量计数器的旧卷扫描一次节点记录并初始化计数器
+int redis_meta_init_usage(redis_meta_t *meta);
+
+// 读取目录用量（已传播到该目录的部分）
+int redis_meta_get_dir_usage(redis_meta_t *meta, uint64_t inode, dir_usage_t *usage);
+
+// 把各目录上累积的增量沿父目录链传播到所有祖先，返回更新的计数器数量，失败返回 -1
+// 增量在修改节点时与节点记录在同一事务中记到直接父目录上，由后台线程定期分批传播
+// 集群模式下不支持，返回 -1
+int redis_meta_flush_dirstat(redis_meta_t *meta);
+
+// 等待本挂载之前写入的元数据持久化：local > 0 时用 WAITAOF 等待写入 AOF（Redis 7.2），
+// 否则用 WAIT 等待 replicas 个副本确认；集群模式下同时等待 inodes 所在的各个节点
+// 在各节点的独立连接上等待，不阻塞其他线程的请求；在超时内未达到要求或服务器不支持时返回 -1
+int redis_meta_wait_durable(redis_meta_t *meta, const uint64_t *inodes, int count,
+                            int local, int replicas, int timeout_ms);
+
+// 预留 count 个连续的 inode，返回第一个，失败或集群模式下返回 0
+uint64_t redis_meta_reserve_inodes(redis_meta_t *meta, uint32_t count);
+
+// 在一个事务中按顺序应用一批日志修改，并把日志 id 已应用到的序号记为 seq（仅单机模式）
+// 崩溃后重放时跳过序号不大于已记录值的修改，事务保证两者同时生效
+// 名字已存在或父目录已被删除的创建被放弃（不覆盖已有目录项），conflicts 非 NULL 时按下标标记为 1
+int redis_meta_apply_journal(redis_meta_t *meta, uint64_t id, const meta_journal_op_t *ops,
+                             int count, uint64_t seq, int *conflicts);
+
+// 读取日志 id 已应用到的序号，没有记录时为 0
+int redis_meta_journal_applied(redis_meta_t *meta, uint64_t id, uint64_t *seq);
+
+// 日志全部应用并清空后删除它的序号记录
+int redis_meta_forget_journal(redis_meta_t *meta, uint64_t id);
+
+// 读取节点的全部扩展属性（可能从副本读取，调用者负责 xattr_list_free）
+int redis_meta_get_xattrs(redis_meta_t *meta, uint64_t inode, xattr_list_t **list);
+
+// 设置扩展属性，flags 为 0 或 META_XATTR_*，条件不满足时返回 1
+int redis_meta_set_xattr(redis_meta_t *meta, uint64_t inode, const char *name,
+                         const void *value, size_t size, int flags);
+
+// 删除扩展属性，名字不存在时返回 1
+int redis_meta_remove_xattr(redis_meta_t *meta, uint64_t inode, const char *name);
+
+// 在集合中查找扩展属性，返回值的位置（*len 为长度），不存在时返回 NULL
+const char* xattr_list_find(const xattr_list_t *list, const char *name, size_t *len);
+
+// 集合中全部名字按 listxattr 的格式（各名字以 \0 结尾）的总长度，size 足够时写入 buf
+size_t xattr_list_names(const xattr_list_t *list, char *buf, size_t size);
+
+// 节点记录的序列化格式（与 Redis 中的 node:<inode> 相同）
+void node_attr_format(const node_attr_t *attr, char *buf, size_t len);
+void node_attr_parse(const char *str, node_attr_t *attr);
 
-// 释放内存
+// 分配和释放节点属性：每个线程保留少量已释放的对象直接复用
+node_attr_t* node_attr_alloc(void);
 void node_attr_free(node_attr_t *attr);
+void xattr_list_free(xattr_list_t *list);
 void dir_entries_free(dir_entry_t *entries, int count);
 
 #ifdef __cplusplus
@@ -4,34 +4,132 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <sys/types.h>
+#include <time.h>
+#include <pthread.h>
+#include "block_cache.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// 压缩算法
+#define STORAGE_CODEC_NONE 0
+#define STORAGE_CODEC_LZ4  1
+#define STORAGE_CODEC_ZSTD 2
+
+// storage_sync 的同步方式
+#define STORAGE_SYNC_START 0    // 只发起回写，不等待完成（批量同步时先让各文件的写入并行进行）
+#define STORAGE_SYNC_DATA  1    // 数据和读取数据所需的元数据（fdatasync）
+#define STORAGE_SYNC_FULL  2    // 数据和全部元数据（fsync）
+
+// 压缩块大小：每块独立压缩，随机读只需解压覆盖到的块
+#define STORAGE_COMPRESS_BLOCK (64 * 1024)
+
+// 压缩文件读改写使用的条带锁数量
+#define STORAGE_LOCK_STRIPES 64
+
+// 数据文件所在的层
+#define STORAGE_TIER_HOT  0     // 快速层（base_dir），新文件写入这里
+#define STORAGE_TIER_COLD 1     // 容量层（cold_dir）
+
+// 记录容量层 inode 的哈希桶数
+#define STORAGE_TIER_BUCKETS 4096
+
+// 后端文件在开始迁移前这么多秒内被修改过时不迁移：之后的修改一定带有更晚的时间戳，
+// 换入前比较文件状态即可发现其他挂载的修改（粗粒度时钟和主机间的时钟偏差都在此之内）
+#define STORAGE_TIER_SETTLE 2
+
+struct dedup;
+struct tier_entry;
+
 // 存储层
 typedef struct {
     char base_dir[512];
+    block_cache_t *cache;   // 热数据块缓存（可为 NULL）
+    uint64_t chunk_size;    // 分块大小，0 表示每个文件一个数据文件
+    int compressed;         // 数据文件是否为分块压缩格式
+    int codec;              // 新写入块使用的压缩算法
+    struct dedup *dedup;    // 内容寻址块存储（启用后接管所有数据读写）
+    pthread_rwlock_t locks[STORAGE_LOCK_STRIPES];
+    char cold_dir[512];     // 容量层目录，为空表示不分层
+    pthread_rwlock_t tier_locks[STORAGE_LOCK_STRIPES];  // 迁移与读写互斥（分层时）
+    uint64_t tier_migrating[STORAGE_LOCK_STRIPES];      // 各条带中正在迁移的 inode（0 表示没有）
+    uint64_t tier_gen[STORAGE_LOCK_STRIPES];            // 正在迁移的文件被修改的次数
+    pthread_rwlock_t tier_map_lock;
+    struct tier_entry **tier_map;   // 本挂载已知位于容量层的 inode
 } storage_t;
 
 // 创建存储层
 storage_t* storage_new(const char *base_dir);
 void storage_free(storage_t *storage);
 
+// 启用块缓存，capacity 为字节数
+int storage_enable_cache(storage_t *storage, size_t capacity);
+
+// 设置分块布局（chunk_size 为 0 时使用单文件布局）
+// 布局决定了数据文件的命名，必须与卷格式一致
+void storage_set_chunk_size(storage_t *storage, uint64_t chunk_size);
+
+// 启用压缩格式，codec 为新写入块使用的算法（可为 STORAGE_CODEC_NONE）
+// 格式同样属于卷格式，已压缩的卷必须始终启用
+int storage_enable_compression(storage_t *storage, int codec);
+
+// 启用去重存储，存储层接管 dedup 的所有权
+// 去重同样属于卷格式，不能与分块布局或压缩格式同时使用
+int storage_enable_dedup(storage_t *storage, struct dedup *dedup);
+
+// 启用分层存储，cold_dir 为容量层目录；不能与去重存储同时使用
+int storage_enable_tiering(storage_t *storage, const char *cold_dir);
+
+// 记录 inode 的数据所在的层（打开文件时取自节点记录）。记录过时（其他挂载迁移了文件）时，
+// 打开数据文件失败后会到另一层查找并更正
+void storage_set_tier(storage_t *storage, uint64_t inode, int tier);
+
+// 本挂载记录的 inode 数据所在的层，未启用分层时总是 STORAGE_TIER_HOT
+int storage_get_tier(storage_t *storage, uint64_t inode);
+
+// 把 inode 的数据文件迁移到 tier：复制到目标层并落盘后，在短暂阻塞该文件读写的窗口内
+// 确认源文件没有被修改，再换入目标层并删除源文件。期间被修改或刚被修改过时返回 -1 且 errno 为 EAGAIN。
+// 换入时持有首个后端文件的排他 flock，其他挂载的修改在此期间等待，之后改到目标层
+// 文件已在 tier 时清理崩溃遗留在另一层的副本。同一时刻只能有一个调用者（迁移线程）
+int storage_migrate(storage_t *storage, uint64_t inode, int tier);
+
+// 列出数据文件位于 tier 目录中的 inode（调用者负责 free）
+int storage_list_tier(storage_t *storage, int tier, uint64_t **inodes, int *count);
+
+// 数据文件最近的访问或修改时间（按后端文件的 atime/mtime），没有数据文件时返回 -1
+int storage_access_time(storage_t *storage, uint64_t inode, time_t *last);
+
+// 当前构建是否支持该压缩算法
+int storage_codec_available(int codec);
+
 // 写入数据
 ssize_t storage_write(storage_t *storage, uint64_t inode, const void *data, size_t size, off_t offset);
 
 // 读取数据
 ssize_t storage_read(storage_t *storage, uint64_t inode, void *buf, size_t size, off_t offset);
 
+// 在文件之间复制数据，返回复制的字节数（不超过源文件末尾）
+// 尽量共享数据块（reflink / 去重块引用），否则由内核或存储层复制
+ssize_t storage_copy_range(storage_t *storage, uint64_t src, uint64_t src_offset,
+                           uint64_t dst, uint64_t dst_offset, size_t size);
+
+// 预分配、打洞或清零（mode 为 fallocate(2) 的 KEEP_SIZE / PUNCH_HOLE / ZERO_RANGE 组合）
+// 失败返回 -1 并设置 errno
+int storage_fallocate(storage_t *storage, uint64_t inode, int mode, uint64_t offset, uint64_t length);
+
+// 从 offset 开始查找下一个数据区（SEEK_DATA）或空洞（SEEK_HOLE）
+// 没有更多数据时返回 -1 且 errno 为 ENXIO
+int storage_seek(storage_t *storage, uint64_t inode, uint64_t offset, int whence, uint64_t *result);
+
 // 删除数据文件
 int storage_delete(storage_t *storage, uint64_t inode);
 
 // 截断文件
 int storage_truncate(storage_t *storage, uint64_t inode, uint64_t size);
 
-// 同步到磁盘
-int storage_sync(storage_t *storage, uint64_t inode);
+// 同步到磁盘，mode 为 STORAGE_SYNC_*
+int storage_sync(storage_t *storage, uint64_t inode, int mode);
 
 // 获取文件大小
 int storage_get_size(storage_t *storage, uint64_t inode, int64_t *size);
@@ -0,0 +1,32 @@
+#ifndef SYNCER_H
+#define SYNCER_H
+
+#include <stdint.h>
+#include "redis_meta.h"
+#include "storage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 等待元数据持久化的默认超时（毫秒）
+#define SYNCER_WAIT_TIMEOUT 1000
+
+// 同步的分组提交：并发的 fsync/fdatasync 排队合并为一批，由其中一个调用者统一执行，
+// 其余调用者等待这一批完成。同一文件在一批中只同步一次，各文件先一起发起回写再逐个等待，
+// 整批共用一次元数据持久化等待（WAIT/WAITAOF）
+typedef struct syncer syncer_t;
+
+// 创建协调器。meta 为 FUSE 操作写入元数据的连接（WAIT 只等待本连接的写入）；
+// aof 非 0 时等待元数据写入 AOF，replicas 为需要确认的副本数，两者都为 0 时不等待元数据
+syncer_t* syncer_new(storage_t *storage, redis_meta_t *meta, int aof, int replicas, int timeout_ms);
+void syncer_free(syncer_t *syncer);
+
+// 同步文件，datasync 非 0 时只保证数据（fdatasync），返回 0 或 -EIO
+int syncer_sync(syncer_t *syncer, uint64_t inode, int datasync);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,400 @@
+#include "block_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <pthread.h>
+
+struct cache_inode;
+
+// 缓存块
+typedef struct cache_block {
+    uint64_t inode;
+    uint64_t index;
+    size_t len;
+    struct cache_block *hnext;  // 哈希链
+    struct cache_block *prev;   // LRU 链表（头部最近使用）
+    struct cache_block *next;
+    struct cache_inode *owner;  // 所属文件在本分片中的块链表
+    struct cache_block *iprev;
+    struct cache_block *inext;
+    char data[];
+} cache_block_t;
+
+// 文件在一个分片中的全部块，失效整个文件时只访问这些块
+typedef struct cache_inode {
+    uint64_t inode;
+    cache_block_t *blocks;
+    struct cache_inode *hnext;
+} cache_inode_t;
+
+// 分片
+typedef struct {
+    pthread_mutex_t lock;
+    cache_block_t **buckets;
+    cache_inode_t **inodes;     // inode -> 本分片中的块，桶数与 buckets 相同
+    size_t nbuckets;            // 2 的幂
+    cache_block_t *lru_head;
+    cache_block_t *lru_tail;
+    size_t used;
+    size_t capacity;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+} cache_shard_t;
+
+struct block_cache {
+    size_t block_size;
+    size_t capacity;
+    cache_shard_t shards[BLOCK_CACHE_SHARDS];
+    int nshards;                // 已初始化的分片数（创建失败时只清理这些分片）
+    // 按 inode 散列的失效序号，用于丢弃过期的填充：同一文件的块分散在各分片中，
+    // 填充开始时取所在条带的序号，插入时在分片锁内核对（原子访问）
+    uint64_t seqs[BLOCK_CACHE_SEQ_STRIPES];
+};
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// 按 (inode, 块索引) 分片：大文件的块分散到各分片，顺序读写不集中在一把锁上
+static inline cache_shard_t* get_shard(block_cache_t *cache, uint64_t inode, uint64_t index) {
+    return &cache->shards[mix64(inode ^ (index * 0x9e3779b97f4a7c15ULL)) % BLOCK_CACHE_SHARDS];
+}
+
+// 低位已用于选择分片，桶取高位
+static inline size_t bucket_of(const cache_shard_t *shard, uint64_t inode, uint64_t index) {
+    return (size_t)(mix64(inode ^ (index * 0x9e3779b97f4a7c15ULL)) >> 16 & (shard->nbuckets - 1));
+}
+
+static inline size_t inode_bucket(const cache_shard_t *shard, uint64_t inode) {
+    return (size_t)(mix64(inode) & (shard->nbuckets - 1));
+}
+
+static inline uint64_t* seq_of(block_cache_t *cache, uint64_t inode) {
+    return &cache->seqs[mix64(inode) % BLOCK_CACHE_SEQ_STRIPES];
+}
+
+block_cache_t* block_cache_new(size_t capacity, size_t block_size) {
+    if (capacity == 0 || block_size == 0) {
+        return NULL;
+    }
+
+    block_cache_t *cache = (block_cache_t*)calloc(1, sizeof(block_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->block_size = block_size;
+    cache->capacity = capacity;
+
+    // 桶数量约等于分片可容纳的块数
+    size_t shard_capacity = capacity / BLOCK_CACHE_SHARDS;
+    size_t nbuckets = 64;
+    while (nbuckets < shard_capacity / block_size) {
+        nbuckets <<= 1;
+    }
+
+    for (int i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        cache->nshards = i + 1;
+        shard->nbuckets = nbuckets;
+        shard->capacity = shard_capacity;
+        shard->buckets = (cache_block_t**)calloc(nbuckets, sizeof(cache_block_t*));
+        shard->inodes = (cache_inode_t**)calloc(nbuckets, sizeof(cache_inode_t*));
+        if (!shard->buckets || !shard->inodes) {
+            block_cache_free(cache);
+            return NULL;
+        }
+    }
+
+    return cache;
+}
+
+void block_cache_free(block_cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+
+    for (int i = 0; i < cache->nshards; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        cache_block_t *blk = shard->lru_head;
+        while (blk) {
+            cache_block_t *next = blk->next;
+            free(blk);
+            blk = next;
+        }
+        for (size_t b = 0; shard->inodes && b < shard->nbuckets; b++) {
+            cache_inode_t *owner = shard->inodes[b];
+            while (owner) {
+                cache_inode_t *next = owner->hnext;
+                free(owner);
+                owner = next;
+            }
+        }
+        free(shard->buckets);
+        free(shard->inodes);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache);
+}
+
+size_t block_cache_block_size(const block_cache_t *cache) {
+    return cache->block_size;
+}
+
+static void lru_unlink(cache_shard_t *shard, cache_block_t *blk) {
+    if (blk->prev) blk->prev->next = blk->next;
+    else shard->lru_head = blk->next;
+    if (blk->next) blk->next->prev = blk->prev;
+    else shard->lru_tail = blk->prev;
+    blk->prev = blk->next = NULL;
+}
+
+static void lru_push_front(cache_shard_t *shard, cache_block_t *blk) {
+    blk->prev = NULL;
+    blk->next = shard->lru_head;
+    if (shard->lru_head) shard->lru_head->prev = blk;
+    shard->lru_head = blk;
+    if (!shard->lru_tail) shard->lru_tail = blk;
+}
+
+static cache_block_t* shard_find(cache_shard_t *shard, uint64_t inode, uint64_t index) {
+    cache_block_t *blk = shard->buckets[bucket_of(shard, inode, index)];
+    while (blk) {
+        if (blk->inode == inode && blk->index == index) {
+            return blk;
+        }
+        blk = blk->hnext;
+    }
+    return NULL;
+}
+
+static cache_inode_t** inode_slot(cache_shard_t *shard, uint64_t inode) {
+    cache_inode_t **pp = &shard->inodes[inode_bucket(shard, inode)];
+    while (*pp && (*pp)->inode != inode) {
+        pp = &(*pp)->hnext;
+    }
+    return pp;
+}
+
+// 把块加入所属文件的块链表，文件在本分片中还没有块时登记，内存不足返回 -1
+static int inode_link(cache_shard_t *shard, cache_block_t *blk) {
+    cache_inode_t **pp = inode_slot(shard, blk->inode);
+    cache_inode_t *owner = *pp;
+    if (!owner) {
+        owner = (cache_inode_t*)malloc(sizeof(cache_inode_t));
+        if (!owner) {
+            return -1;
+        }
+        owner->inode = blk->inode;
+        owner->blocks = NULL;
+        owner->hnext = NULL;
+        *pp = owner;
+    }
+
+    blk->owner = owner;
+    blk->iprev = NULL;
+    blk->inext = owner->blocks;
+    if (owner->blocks) owner->blocks->iprev = blk;
+    owner->blocks = blk;
+    return 0;
+}
+
+// 从所属文件的块链表中摘除，文件在本分片中没有块后注销
+static void inode_unlink(cache_shard_t *shard, cache_block_t *blk) {
+    cache_inode_t *owner = blk->owner;
+    if (blk->iprev) blk->iprev->inext = blk->inext;
+    else owner->blocks = blk->inext;
+    if (blk->inext) blk->inext->iprev = blk->iprev;
+
+    if (!owner->blocks) {
+        cache_inode_t **pp = inode_slot(shard, owner->inode);
+        *pp = owner->hnext;
+        free(owner);
+    }
+}
+
+// 从哈希表、文件的块链表和 LRU 中摘除并释放
+static void shard_remove(cache_shard_t *shard, cache_block_t *blk) {
+    cache_block_t **pp = &shard->buckets[bucket_of(shard, blk->inode, blk->index)];
+    while (*pp && *pp != blk) {
+        pp = &(*pp)->hnext;
+    }
+    if (*pp) {
+        *pp = blk->hnext;
+    }
+    inode_unlink(shard, blk);
+    lru_unlink(shard, blk);
+    shard->used -= sizeof(cache_block_t) + blk->len;
+    free(blk);
+}
+
+ssize_t block_cache_read(block_cache_t *cache, uint64_t inode, uint64_t index,
+                         void *buf, size_t offset, size_t size) {
+    cache_shard_t *shard = get_shard(cache, inode, index);
+
+    pthread_mutex_lock(&shard->lock);
+    cache_block_t *blk = shard_find(shard, inode, index);
+    if (!blk) {
+        shard->misses++;
+        pthread_mutex_unlock(&shard->lock);
+        return -1;
+    }
+
+    shard->hits++;
+    if (blk != shard->lru_head) {
+        lru_unlink(shard, blk);
+        lru_push_front(shard, blk);
+    }
+
+    size_t n = 0;
+    if (offset < blk->len) {
+        n = blk->len - offset;
+        if (n > size) n = size;
+        memcpy(buf, blk->data + offset, n);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return (ssize_t)n;
+}
+
+uint64_t block_cache_fill_ticket(block_cache_t *cache, uint64_t inode) {
+    return __atomic_load_n(seq_of(cache, inode), __ATOMIC_ACQUIRE);
+}
+
+static inline cache_block_t* block_of(void *data) {
+    return (cache_block_t*)((char*)data - offsetof(cache_block_t, data));
+}
+
+void* block_cache_alloc(block_cache_t *cache) {
+    cache_block_t *blk = (cache_block_t*)malloc(sizeof(cache_block_t) + cache->block_size);
+    return blk ? blk->data : NULL;
+}
+
+void block_cache_discard(void *data) {
+    if (data) {
+        free(block_of(data));
+    }
+}
+
+void block_cache_insert(block_cache_t *cache, uint64_t inode, uint64_t index,
+                        void *data, size_t len, uint64_t ticket) {
+    cache_block_t *blk = block_of(data);
+    cache_shard_t *shard = get_shard(cache, inode, index);
+    size_t cost = sizeof(cache_block_t) + len;
+    if (len > cache->block_size || cost > shard->capacity) {
+        free(blk);
+        return;
+    }
+
+    // 在锁外把短块（文件末尾）缩小到实际长度
+    if (len < cache->block_size) {
+        cache_block_t *shrunk = (cache_block_t*)realloc(blk, cost);
+        if (shrunk) {
+            blk = shrunk;
+        }
+    }
+    blk->inode = inode;
+    blk->index = index;
+    blk->len = len;
+    blk->prev = blk->next = NULL;
+
+    pthread_mutex_lock(&shard->lock);
+
+    // 填充期间发生过失效，数据可能已过期；失效先增加序号再在分片锁内移除块，
+    // 序号增加之前插入的块会被随后的移除带走
+    if (__atomic_load_n(seq_of(cache, inode), __ATOMIC_ACQUIRE) != ticket) {
+        pthread_mutex_unlock(&shard->lock);
+        free(blk);
+        return;
+    }
+
+    cache_block_t *old = shard_find(shard, inode, index);
+    if (old) {
+        shard_remove(shard, old);
+    }
+
+    // 淘汰最久未使用的块
+    while (shard->used + cost > shard->capacity && shard->lru_tail) {
+        shard_remove(shard, shard->lru_tail);
+        shard->evictions++;
+    }
+
+    if (inode_link(shard, blk) != 0) {
+        pthread_mutex_unlock(&shard->lock);
+        free(blk);
+        return;
+    }
+    size_t b = bucket_of(shard, inode, index);
+    blk->hnext = shard->buckets[b];
+    shard->buckets[b] = blk;
+    lru_push_front(shard, blk);
+    shard->used += cost;
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void block_cache_invalidate_range(block_cache_t *cache, uint64_t inode, uint64_t offset, uint64_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    uint64_t first = offset / cache->block_size;
+    uint64_t last = (offset + size - 1) / cache->block_size;
+
+    __atomic_add_fetch(seq_of(cache, inode), 1, __ATOMIC_ACQ_REL);
+    for (uint64_t index = first; index <= last; index++) {
+        cache_shard_t *shard = get_shard(cache, inode, index);
+        pthread_mutex_lock(&shard->lock);
+        cache_block_t *blk = shard_find(shard, inode, index);
+        if (blk) {
+            shard_remove(shard, blk);
+            shard->invalidations++;
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+void block_cache_invalidate_inode(block_cache_t *cache, uint64_t inode) {
+    __atomic_add_fetch(seq_of(cache, inode), 1, __ATOMIC_ACQ_REL);
+    for (int i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        cache_inode_t *owner = *inode_slot(shard, inode);
+        // 移除最后一个块时 owner 被释放
+        while (owner) {
+            cache_block_t *blk = owner->blocks;
+            int last = blk->inext == NULL;
+            shard_remove(shard, blk);
+            shard->invalidations++;
+            if (last) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+void block_cache_get_stats(block_cache_t *cache, block_cache_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->capacity = cache->capacity;
+
+    for (int i = 0; i < BLOCK_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->invalidations += shard->invalidations;
+        stats->used_bytes += shard->used;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
@@ -0,0 +1,268 @@
+#include "cluster.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// 主节点：登记后地址不变，连接池在路由表释放前一直有效
+typedef struct {
+    conn_pool_t pool;
+} cluster_node_t;
+
+struct cluster {
+    pthread_mutex_t lock;       // 保护槽表和节点表
+    char *password;
+    conn_setup_fn setup;        // 新连接的初始化（可为 NULL）
+    void *setup_arg;
+    cluster_node_t **nodes;
+    int node_count;
+    int node_cap;
+    int slots[CLUSTER_SLOTS];   // 槽 -> 节点下标，-1 表示未知
+};
+
+// CRC16（XMODEM），与 Redis Cluster 的槽计算一致
+static uint16_t crc16(const char *buf, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)((unsigned char)buf[i] << 8);
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+int cluster_key_slot(const char *key, size_t len) {
+    // 键中有非空的 {tag} 时只对 tag 计算
+    const char *open = memchr(key, '{', len);
+    if (open) {
+        size_t rest = len - (size_t)(open - key) - 1;
+        const char *close = memchr(open + 1, '}', rest);
+        if (close && close > open + 1) {
+            key = open + 1;
+            len = (size_t)(close - key);
+        }
+    }
+    return crc16(key, len) & (CLUSTER_SLOTS - 1);
+}
+
+// 查找或登记节点，返回下标，调用者持有 lock
+static int node_index(cluster_t *cluster, const char *host, int port) {
+    for (int i = 0; i < cluster->node_count; i++) {
+        conn_pool_t *pool = &cluster->nodes[i]->pool;
+        if (pool->port == port && strcmp(pool->host, host) == 0) {
+            return i;
+        }
+    }
+
+    if (cluster->node_count == cluster->node_cap) {
+        int cap = cluster->node_cap ? cluster->node_cap * 2 : 8;
+        cluster_node_t **nodes = (cluster_node_t**)realloc(cluster->nodes, sizeof(cluster_node_t*) * (size_t)cap);
+        if (!nodes) {
+            return -1;
+        }
+        cluster->nodes = nodes;
+        cluster->node_cap = cap;
+    }
+
+    cluster_node_t *node = (cluster_node_t*)malloc(sizeof(cluster_node_t));
+    if (!node) {
+        return -1;
+    }
+    if (conn_pool_init(&node->pool, host, port, cluster->password, 0, CONN_POOL_SIZE,
+                       cluster->setup, cluster->setup_arg) != 0) {
+        conn_pool_destroy(&node->pool);
+        free(node);
+        return -1;
+    }
+    cluster->nodes[cluster->node_count] = node;
+    return cluster->node_count++;
+}
+
+// 按 CLUSTER SLOTS 的回复重建槽表，from 为应答节点的地址（回复中主机名为空时使用），调用者持有 lock
+static int load_slots(cluster_t *cluster, const redisReply *reply, const char *from) {
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements == 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < CLUSTER_SLOTS; i++) {
+        cluster->slots[i] = -1;
+    }
+
+    // 每项为 [起始槽, 结束槽, [主节点地址, 端口, ...], [从节点...]...]
+    for (size_t i = 0; i < reply->elements; i++) {
+        const redisReply *range = reply->element[i];
+        if (range->type != REDIS_REPLY_ARRAY || range->elements < 3 ||
+            range->element[2]->type != REDIS_REPLY_ARRAY || range->element[2]->elements < 2) {
+            continue;
+        }
+        long long start = range->element[0]->integer;
+        long long end = range->element[1]->integer;
+        const redisReply *master = range->element[2];
+        const char *host = master->element[0]->type == REDIS_REPLY_STRING && master->element[0]->len > 0 ?
+                           master->element[0]->str : from;
+
+        int index = node_index(cluster, host, (int)master->element[1]->integer);
+        if (index < 0) {
+            return -1;
+        }
+        for (long long slot = start; slot <= end && slot < CLUSTER_SLOTS; slot++) {
+            if (slot >= 0) {
+                cluster->slots[slot] = index;
+            }
+        }
+    }
+    return 0;
+}
+
+// 从任一可达的节点重新加载槽表（故障转移后主节点会变化）
+// 查询时不持有 lock，其他线程照常路由；节点只增不减，查询期间登记的新节点下一次再试
+static int refresh_slots(cluster_t *cluster) {
+    pthread_mutex_lock(&cluster->lock);
+    int count = cluster->node_count;
+    pthread_mutex_unlock(&cluster->lock);
+
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_lock(&cluster->lock);
+        cluster_node_t *node = cluster->nodes[i];
+        pthread_mutex_unlock(&cluster->lock);
+
+        pool_conn_t *conn = conn_pool_get(&node->pool);
+        if (!conn) {
+            continue;
+        }
+        redisReply *reply = (redisReply*)redisCommand(conn->ctx, "CLUSTER SLOTS");
+        conn_pool_put(conn);
+
+        pthread_mutex_lock(&cluster->lock);
+        int ret = load_slots(cluster, reply, node->pool.host);
+        pthread_mutex_unlock(&cluster->lock);
+        if (reply) freeReplyObject(reply);
+        if (ret == 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+cluster_t* cluster_new(const char *addr, int port, const char *password, const redisReply *reply,
+                       conn_setup_fn setup, void *setup_arg) {
+    cluster_t *cluster = (cluster_t*)calloc(1, sizeof(cluster_t));
+    if (!cluster) {
+        return NULL;
+    }
+    pthread_mutex_init(&cluster->lock, NULL);
+    cluster->setup = setup;
+    cluster->setup_arg = setup_arg;
+
+    if (password && strlen(password) > 0) {
+        cluster->password = strdup(password);
+        if (!cluster->password) {
+            free(cluster);
+            return NULL;
+        }
+    }
+
+    // 种子节点也登记下来，槽表失效时可以从它重新加载
+    if (node_index(cluster, addr, port) < 0 || load_slots(cluster, reply, addr) != 0) {
+        cluster_free(cluster);
+        return NULL;
+    }
+
+    return cluster;
+}
+
+void cluster_free(cluster_t *cluster) {
+    if (!cluster) {
+        return;
+    }
+
+    for (int i = 0; i < cluster->node_count; i++) {
+        conn_pool_destroy(&cluster->nodes[i]->pool);
+        free(cluster->nodes[i]);
+    }
+    free(cluster->nodes);
+    free(cluster->password);
+    pthread_mutex_destroy(&cluster->lock);
+    free(cluster);
+}
+
+// 槽当前所在节点的连接池，未分配时返回 NULL
+static conn_pool_t* slot_pool(cluster_t *cluster, int slot) {
+    pthread_mutex_lock(&cluster->lock);
+    int index = cluster->slots[slot];
+    conn_pool_t *pool = index >= 0 ? &cluster->nodes[index]->pool : NULL;
+    pthread_mutex_unlock(&cluster->lock);
+    return pool;
+}
+
+conn_pool_t* cluster_slot_pool(cluster_t *cluster, int slot) {
+    conn_pool_t *pool = slot_pool(cluster, slot);
+    if (!pool && refresh_slots(cluster) == 0) {
+        pool = slot_pool(cluster, slot);
+    }
+    return pool;
+}
+
+pool_conn_t* cluster_slot_conn(cluster_t *cluster, int slot) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        conn_pool_t *pool = slot_pool(cluster, slot);
+        if (pool) {
+            pool_conn_t *conn = conn_pool_get(pool);
+            if (conn) {
+                return conn;
+            }
+        }
+
+        // 槽未分配或节点不可达，重新加载一次槽表
+        if (attempt == 0 && refresh_slots(cluster) != 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+int cluster_redirect(cluster_t *cluster, const redisReply *reply, conn_pool_t **ask) {
+    if (!reply || reply->type != REDIS_REPLY_ERROR) {
+        return 0;
+    }
+
+    if (strncmp(reply->str, "TRYAGAIN", 8) == 0) {
+        return CLUSTER_TRYAGAIN;
+    }
+
+    // MOVED <slot> <host>:<port> 或 ASK <slot> <host>:<port>
+    int kind;
+    const char *p;
+    if (strncmp(reply->str, "MOVED ", 6) == 0) {
+        kind = CLUSTER_MOVED;
+        p = reply->str + 6;
+    } else if (strncmp(reply->str, "ASK ", 4) == 0) {
+        kind = CLUSTER_ASK;
+        p = reply->str + 4;
+    } else {
+        return 0;
+    }
+
+    char *end;
+    long slot = strtol(p, &end, 10);
+    const char *addr = end + 1;
+    const char *colon = strrchr(addr, ':');
+    if (*end != ' ' || slot < 0 || slot >= CLUSTER_SLOTS || !colon || colon == addr) {
+        return 0;
+    }
+
+    char host[256];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - addr), addr);
+    pthread_mutex_lock(&cluster->lock);
+    int index = node_index(cluster, host, atoi(colon + 1));
+    if (index >= 0) {
+        if (kind == CLUSTER_MOVED) {
+            cluster->slots[slot] = index;
+        } else {
+            *ask = &cluster->nodes[index]->pool;
+        }
+    }
+    pthread_mutex_unlock(&cluster->lock);
+    return index >= 0 ? kind : 0;
+}
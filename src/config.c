@@ -1,4 +1,8 @@
 #include "config.h"
+#include "storage.h"
+#include "syncer.h"
+#include "qos.h"
+#include "meta_cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,6 +17,35 @@ void print_usage(const char *prog_name) {
     fprintf(stderr, "  --redis-db DB          Redis database number (default: 0)\n");
     fprintf(stderr, "  --data-dir DIR         Data storage directory (default: /data/xfs)\n");
     fprintf(stderr, "  --mountpoint PATH      Mount point (required)\n");
+    fprintf(stderr, "  --cache-size MB        In-memory data block cache size (default: 0, disabled)\n");
+    fprintf(stderr, "  --inline-threshold N   Store files up to N bytes inline in Redis (default: 0, disabled)\n");
+    fprintf(stderr, "  --chunk-size MB        Split file data into fixed-size chunks (new volumes only, default: 0)\n");
+    fprintf(stderr, "  --compress CODEC       Compress data blocks: none, lz4 or zstd (default: none)\n");
+    fprintf(stderr, "  --dedup                Deduplicate identical data blocks (new volumes only)\n");
+    fprintf(stderr, "  --delete-threads N     Background deletion threads, 0 deletes synchronously (default: 2)\n");
+    fprintf(stderr, "  --delete-rate N        Delete at most N files per second in the background (default: 0, unlimited)\n");
+    fprintf(stderr, "  --redis-replica ADDR[:PORT]  Read metadata from this replica, may be repeated (default: none)\n");
+    fprintf(stderr, "  --replica-max-lag MS   Maximum staleness of replica reads in milliseconds (default: 1000)\n");
+    fprintf(stderr, "  --meta-cache SEC       Cache entries and attributes for SEC seconds, kept coherent across mounts (default: 0, disabled)\n");
+    fprintf(stderr, "  --meta-cache-size MB   Memory for the metadata cache, least recently used entries are evicted (default: %d)\n",
+            META_CACHE_DEFAULT_SIZE);
+    fprintf(stderr, "  --negative-timeout SEC Let the kernel cache failed lookups for SEC seconds (default: 0)\n");
+    fprintf(stderr, "  --writeback-cache      Let the kernel merge small writes in its page cache before flushing\n");
+    fprintf(stderr, "  --sync-aof             Make fsync wait until metadata is written to the AOF (Redis 7.2)\n");
+    fprintf(stderr, "  --sync-replicas N      Make fsync wait until N replicas have the metadata (default: 0)\n");
+    fprintf(stderr, "  --sync-timeout MS      Fail fsync if metadata is not durable within MS milliseconds (default: 1000)\n");
+    fprintf(stderr, "  --journal              Journal creates in data-dir and apply them to Redis in the background\n");
+    fprintf(stderr, "  --cold-dir DIR         Capacity tier for cold files; data-dir becomes the hot tier (default: none)\n");
+    fprintf(stderr, "  --tier-cold-after SEC  Move files not accessed for SEC seconds to the cold tier, 0 disables\n");
+    fprintf(stderr, "                         migration on this mount (default: 86400)\n");
+    fprintf(stderr, "  --qos KEY              Schedule operations fairly per tenant: uid or dir (top-level directory)\n");
+    fprintf(stderr, "  --qos-meta-rate N      Limit each tenant to N metadata operations per second (default: 0, unlimited)\n");
+    fprintf(stderr, "  --qos-data-rate MB     Limit each tenant to MB megabytes of data per second (default: 0, unlimited)\n");
+    fprintf(stderr, "  --qos-weight NAME=W    Give tenant NAME weight W (default: 1), may be repeated\n");
+    fprintf(stderr, "  --qos-meta-slots N     Run at most N metadata operations at once (default: %d)\n", QOS_META_SLOTS);
+    fprintf(stderr, "  --qos-data-slots N     Run at most N data operations at once (default: %d)\n", QOS_DATA_SLOTS);
+    fprintf(stderr, "  --qos-sync-slots N     Run at most N fsyncs at once (default: %d)\n", QOS_SYNC_SLOTS);
+    fprintf(stderr, "  --qos-tenant-slots N   Let each tenant hold at most N slots of each class (default: 0, one less than the class)\n");
     fprintf(stderr, "  -f, --foreground       Run in foreground\n");
     fprintf(stderr, "  -d, --debug            Enable debug logging\n");
     fprintf(stderr, "  -h, --help             Show this help message\n");
@@ -35,6 +68,33 @@ int parse_config(int argc, char *argv[], config_t *config) {
     config->mountpoint[0] = '\0';
     config->foreground = 0;
     config->debug = 0;
+    config->cache_size = 0;
+    config->inline_threshold = 0;
+    config->chunk_size = 0;
+    config->compress = -1;
+    config->dedup = 0;
+    config->delete_threads = 2;
+    config->delete_rate = 0;
+    config->redis_replica_count = 0;
+    config->replica_max_lag = 1000;
+    config->meta_cache = 0;
+    config->meta_cache_size = META_CACHE_DEFAULT_SIZE;
+    config->negative_timeout = 0;
+    config->writeback_cache = 0;
+    config->sync_aof = 0;
+    config->sync_replicas = 0;
+    config->sync_timeout = SYNCER_WAIT_TIMEOUT;
+    config->journal = 0;
+    config->cold_dir[0] = '\0';
+    config->tier_cold_after = 86400;
+    config->qos = -1;
+    config->qos_meta_rate = 0;
+    config->qos_data_rate = 0;
+    config->qos_slots[QOS_META] = QOS_META_SLOTS;
+    config->qos_slots[QOS_DATA] = QOS_DATA_SLOTS;
+    config->qos_slots[QOS_SYNC] = QOS_SYNC_SLOTS;
+    config->qos_tenant_slots = 0;
+    config->qos_weight_count = 0;
 
     static struct option long_options[] = {
         {"redis-addr", required_argument, 0, 'a'},
@@ -43,6 +103,33 @@ int parse_config(int argc, char *argv[], config_t *config) {
         {"redis-db", required_argument, 0, 'D'},
         {"data-dir", required_argument, 0, 't'},  // 改用 -t
         {"mountpoint", required_argument, 0, 'm'},
+        {"cache-size", required_argument, 0, 'c'},
+        {"inline-threshold", required_argument, 0, 'i'},
+        {"chunk-size", required_argument, 0, 'k'},
+        {"compress", required_argument, 0, 'z'},
+        {"dedup", no_argument, 0, 'u'},
+        {"delete-threads", required_argument, 0, 'T'},
+        {"delete-rate", required_argument, 0, 'R'},
+        {"redis-replica", required_argument, 0, 'r'},
+        {"replica-max-lag", required_argument, 0, 'L'},
+        {"meta-cache", required_argument, 0, 'C'},
+        {"meta-cache-size", required_argument, 0, 'Z'},
+        {"negative-timeout", required_argument, 0, 'N'},
+        {"writeback-cache", no_argument, 0, 'W'},
+        {"sync-aof", no_argument, 0, 'A'},
+        {"sync-replicas", required_argument, 0, 'S'},
+        {"sync-timeout", required_argument, 0, 'O'},
+        {"journal", no_argument, 0, 'J'},
+        {"cold-dir", required_argument, 0, 'K'},
+        {"tier-cold-after", required_argument, 0, 'E'},
+        {"qos", required_argument, 0, 'Q'},
+        {"qos-meta-rate", required_argument, 0, 'M'},
+        {"qos-data-rate", required_argument, 0, 'B'},
+        {"qos-weight", required_argument, 0, 'w'},
+        {"qos-meta-slots", required_argument, 0, 'g'},
+        {"qos-data-slots", required_argument, 0, 'G'},
+        {"qos-sync-slots", required_argument, 0, 'y'},
+        {"qos-tenant-slots", required_argument, 0, 'Y'},
         {"foreground", no_argument, 0, 'f'},
         {"debug", no_argument, 0, 'd'},  // 改用 -d
         {"help", no_argument, 0, 'h'},
@@ -75,6 +162,137 @@ int parse_config(int argc, char *argv[], config_t *config) {
             case 'm':
                 strncpy(config->mountpoint, optarg, sizeof(config->mountpoint) - 1);
                 break;
+            case 'c':
+                config->cache_size = atoi(optarg);
+                break;
+            case 'i':
+                config->inline_threshold = atoi(optarg);
+                break;
+            case 'k':
+                config->chunk_size = atoi(optarg);
+                break;
+            case 'z':
+                if (strcmp(optarg, "none") == 0) {
+                    config->compress = STORAGE_CODEC_NONE;
+                } else if (strcmp(optarg, "lz4") == 0) {
+                    config->compress = STORAGE_CODEC_LZ4;
+                } else if (strcmp(optarg, "zstd") == 0) {
+                    config->compress = STORAGE_CODEC_ZSTD;
+                } else {
+                    fprintf(stderr, "Error: unknown compression codec: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'u':
+                config->dedup = 1;
+                break;
+            case 'T':
+                config->delete_threads = atoi(optarg);
+                break;
+            case 'R':
+                config->delete_rate = atoi(optarg);
+                break;
+            case 'r': {
+                if (config->redis_replica_count >= CONFIG_MAX_REPLICAS) {
+                    fprintf(stderr, "Error: at most %d replicas are supported\n", CONFIG_MAX_REPLICAS);
+                    return -1;
+                }
+                // ADDR:PORT，按最后一个冒号拆分，省略端口时使用 6379
+                int n = config->redis_replica_count;
+                const char *colon = strrchr(optarg, ':');
+                size_t len = colon ? (size_t)(colon - optarg) : strlen(optarg);
+                if (len == 0 || len >= sizeof(config->redis_replicas[n])) {
+                    fprintf(stderr, "Error: invalid replica address: %s\n", optarg);
+                    return -1;
+                }
+                memcpy(config->redis_replicas[n], optarg, len);
+                config->redis_replicas[n][len] = '\0';
+                config->redis_replica_ports[n] = colon ? atoi(colon + 1) : 6379;
+                config->redis_replica_count++;
+                break;
+            }
+            case 'L':
+                config->replica_max_lag = atoi(optarg);
+                break;
+            case 'C':
+                config->meta_cache = atoi(optarg);
+                break;
+            case 'Z':
+                config->meta_cache_size = atoi(optarg);
+                break;
+            case 'N':
+                config->negative_timeout = atoi(optarg);
+                break;
+            case 'W':
+                config->writeback_cache = 1;
+                break;
+            case 'A':
+                config->sync_aof = 1;
+                break;
+            case 'S':
+                config->sync_replicas = atoi(optarg);
+                break;
+            case 'O':
+                config->sync_timeout = atoi(optarg);
+                break;
+            case 'J':
+                config->journal = 1;
+                break;
+            case 'K':
+                strncpy(config->cold_dir, optarg, sizeof(config->cold_dir) - 1);
+                break;
+            case 'E':
+                config->tier_cold_after = atoi(optarg);
+                break;
+            case 'Q':
+                if (strcmp(optarg, "uid") == 0) {
+                    config->qos = QOS_KEY_UID;
+                } else if (strcmp(optarg, "dir") == 0) {
+                    config->qos = QOS_KEY_DIR;
+                } else {
+                    fprintf(stderr, "Error: unknown QoS key: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'M':
+                config->qos_meta_rate = atoi(optarg);
+                break;
+            case 'B':
+                config->qos_data_rate = atoi(optarg);
+                break;
+            case 'g':
+                config->qos_slots[QOS_META] = atoi(optarg);
+                break;
+            case 'G':
+                config->qos_slots[QOS_DATA] = atoi(optarg);
+                break;
+            case 'y':
+                config->qos_slots[QOS_SYNC] = atoi(optarg);
+                break;
+            case 'Y':
+                config->qos_tenant_slots = atoi(optarg);
+                break;
+            case 'w': {
+                if (config->qos_weight_count >= CONFIG_MAX_QOS_WEIGHTS) {
+                    fprintf(stderr, "Error: at most %d QoS weights are supported\n", CONFIG_MAX_QOS_WEIGHTS);
+                    return -1;
+                }
+                // NAME=W，按最后一个等号拆分
+                int n = config->qos_weight_count;
+                const char *eq = strrchr(optarg, '=');
+                size_t len = eq ? (size_t)(eq - optarg) : 0;
+                int weight = eq ? atoi(eq + 1) : 0;
+                if (len == 0 || len >= sizeof(config->qos_weight_names[n]) ||
+                    weight <= 0 || weight > QOS_MAX_WEIGHT) {
+                    fprintf(stderr, "Error: invalid QoS weight: %s\n", optarg);
+                    return -1;
+                }
+                memcpy(config->qos_weight_names[n], optarg, len);
+                config->qos_weight_names[n][len] = '\0';
+                config->qos_weights[n] = weight;
+                config->qos_weight_count++;
+                break;
+            }
             case 'f':
                 config->foreground = 1;
                 break;
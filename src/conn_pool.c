@@ -0,0 +1,129 @@
+#include "conn_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int conn_pool_init(conn_pool_t *pool, const char *host, int port, const char *password, int db,
+                   int size, conn_setup_fn setup, void *setup_arg) {
+    memset(pool, 0, sizeof(*pool));
+    snprintf(pool->host, sizeof(pool->host), "%s", host);
+    pool->port = port;
+    pool->db = db;
+    pool->setup = setup;
+    pool->setup_arg = setup_arg;
+    pool->size = size > 0 && size <= CONN_POOL_SIZE ? size : CONN_POOL_SIZE;
+    if (password && strlen(password) > 0) {
+        pool->password = strdup(password);
+        if (!pool->password) {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < CONN_POOL_SIZE; i++) {
+        pthread_mutex_init(&pool->conns[i].lock, NULL);
+    }
+    pthread_mutex_init(&pool->wait.lock, NULL);
+    return 0;
+}
+
+void conn_pool_destroy(conn_pool_t *pool) {
+    for (int i = 0; i < CONN_POOL_SIZE; i++) {
+        if (pool->conns[i].ctx) {
+            redisFree(pool->conns[i].ctx);
+        }
+        pthread_mutex_destroy(&pool->conns[i].lock);
+    }
+    if (pool->wait.ctx) {
+        redisFree(pool->wait.ctx);
+    }
+    pthread_mutex_destroy(&pool->wait.lock);
+    free(pool->password);
+    pool->password = NULL;
+}
+
+// 连接断开或尚未建立时重新连接、认证并初始化，调用者持有连接的锁
+static int conn_ready(conn_pool_t *pool, pool_conn_t *conn) {
+    if (conn->ctx && !conn->ctx->err) {
+        return 0;
+    }
+    if (conn->ctx) {
+        redisFree(conn->ctx);
+        conn->ctx = NULL;
+    }
+    __atomic_store_n(&conn->tracking, 0, __ATOMIC_RELEASE);
+
+    redisContext *c = redisConnect(pool->host, pool->port);
+    if (!c || c->err) {
+        fprintf(stderr, "Redis %s:%d: %s\n", pool->host, pool->port,
+                c ? c->errstr : "can't allocate redis context");
+        if (c) redisFree(c);
+        return -1;
+    }
+
+    if (pool->password) {
+        redisReply *reply = (redisReply*)redisCommand(c, "AUTH %s", pool->password);
+        int ok = reply && reply->type != REDIS_REPLY_ERROR;
+        if (reply) freeReplyObject(reply);
+        if (!ok) {
+            fprintf(stderr, "Redis %s:%d: authentication failed\n", pool->host, pool->port);
+            redisFree(c);
+            return -1;
+        }
+    }
+    if (pool->db > 0) {
+        redisReply *reply = (redisReply*)redisCommand(c, "SELECT %d", pool->db);
+        if (reply) freeReplyObject(reply);
+    }
+
+    if (pool->setup && pool->setup(c, pool->setup_arg) != 0) {
+        fprintf(stderr, "Redis %s:%d: connection setup failed\n", pool->host, pool->port);
+        redisFree(c);
+        return -1;
+    }
+
+    conn->ctx = c;
+    return 0;
+}
+
+pool_conn_t* conn_pool_get(conn_pool_t *pool) {
+    // 轮流从不同的连接开始找空闲的，都在使用时排在起点那条连接上
+    unsigned int start = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+    pool_conn_t *conn = NULL;
+    for (int i = 0; i < pool->size && !conn; i++) {
+        pool_conn_t *c = &pool->conns[(start + (unsigned int)i) % (unsigned int)pool->size];
+        if (pthread_mutex_trylock(&c->lock) == 0) {
+            conn = c;
+        }
+    }
+    if (!conn) {
+        conn = &pool->conns[start % (unsigned int)pool->size];
+        pthread_mutex_lock(&conn->lock);
+    }
+
+    if (conn_ready(pool, conn) != 0) {
+        pthread_mutex_unlock(&conn->lock);
+        return NULL;
+    }
+    return conn;
+}
+
+static pool_conn_t* get_conn(conn_pool_t *pool, pool_conn_t *conn) {
+    pthread_mutex_lock(&conn->lock);
+    if (conn_ready(pool, conn) != 0) {
+        pthread_mutex_unlock(&conn->lock);
+        return NULL;
+    }
+    return conn;
+}
+
+pool_conn_t* conn_pool_get_at(conn_pool_t *pool, int index) {
+    return get_conn(pool, &pool->conns[index]);
+}
+
+pool_conn_t* conn_pool_get_wait(conn_pool_t *pool) {
+    return get_conn(pool, &pool->wait);
+}
+
+void conn_pool_put(pool_conn_t *conn) {
+    pthread_mutex_unlock(&conn->lock);
+}
@@ -0,0 +1,991 @@
+#define _GNU_SOURCE
+#include "dedup.h"
+#include "mempool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <hiredis/hiredis.h>
+
+static const char *BLOCKS_KEY_PREFIX = "blocks:";
+static const char *BLOCKREF_KEY = "blockref";
+
+// 块标识：128 位哈希的十六进制表示，哈希相同而内容不同的块追加 "-<序号>"
+#define BLOCK_ID_LEN 32
+#define BLOCK_ID_MAX (BLOCK_ID_LEN + 8)
+
+// ---------------------------------------------------------------------------
+// 内容哈希
+//
+// 8 条 64 位累加通道，每次处理 64 字节条带；每条通道只用 32x32->64 乘法，
+// SSE2/AVX2 下可被编译器向量化。非密码学哈希，128 位输出用于识别重复块
+// ---------------------------------------------------------------------------
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static const uint64_t HASH_KEY[16] = {
+    0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL, 0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+    0x78e5c0cc4ee679cbULL, 0x2172ffcc7dd05a82ULL, 0x8e2443f7744608b8ULL, 0x4c263a81e69035e0ULL,
+    0xcb00c391bb52283cULL, 0xa32e531b8b65d088ULL, 0x4ef90da297486471ULL, 0xd8acdea946ef1938ULL,
+    0x3f349ce33f76faa8ULL, 0x1d4f0bc7c7bbdcf9ULL, 0x3159b4cd4be0518aULL, 0x647378d9c97e9fc8ULL,
+};
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t mul_fold64(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= 0x165667919E3779F9ULL;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline void accumulate(uint64_t acc[8], const unsigned char *stripe) {
+    for (int lane = 0; lane < 8; lane++) {
+        uint64_t v = read64(stripe + lane * 8);
+        uint64_t k = v ^ HASH_KEY[lane];
+        acc[lane ^ 1] += v;
+        acc[lane] += (k & 0xffffffffULL) * (k >> 32);
+    }
+}
+
+static inline void scramble(uint64_t acc[8]) {
+    for (int lane = 0; lane < 8; lane++) {
+        acc[lane] ^= acc[lane] >> 47;
+        acc[lane] ^= HASH_KEY[8 + lane];
+        acc[lane] *= PRIME32_1;
+    }
+}
+
+void dedup_hash128(const void *data, size_t len, uint64_t out[2]) {
+    const unsigned char *p = (const unsigned char*)data;
+    uint64_t acc[8] = {
+        PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+        PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1,
+    };
+
+    size_t stripes = len / 64;
+    for (size_t s = 0; s < stripes; s++, p += 64) {
+        accumulate(acc, p);
+        if ((s & 15) == 15) {
+            scramble(acc);
+        }
+    }
+
+    size_t rest = len % 64;
+    if (rest > 0) {
+        unsigned char tail[64] = {0};
+        memcpy(tail, p, rest);
+        accumulate(acc, tail);
+    }
+
+    uint64_t lo = (uint64_t)len * PRIME64_1;
+    uint64_t hi = ~((uint64_t)len * PRIME64_2);
+    for (int i = 0; i < 4; i++) {
+        lo += mul_fold64(acc[2 * i] ^ HASH_KEY[2 * i], acc[2 * i + 1] ^ HASH_KEY[2 * i + 1]);
+        hi += mul_fold64(acc[7 - 2 * i] ^ HASH_KEY[8 + 2 * i], acc[6 - 2 * i] ^ HASH_KEY[9 + 2 * i]);
+    }
+
+    out[0] = avalanche(lo);
+    out[1] = avalanche(hi ^ (lo >> 29));
+}
+
+// ---------------------------------------------------------------------------
+// Redis 访问（独立的连接池，各线程取出不同的连接并发收发）
+// ---------------------------------------------------------------------------
+
+// 把文件的一块指向新块并释放旧块，引用计数和块映射在同一次往返中修改
+// KEYS[1] blocks:<inode>，KEYS[2] blockref；ARGV[1] 块索引，ARGV[2] 新块（空串为全零块），
+// ARGV[3] 旧块（空串为无）。旧块失去最后一个引用时返回 1，由调用者删除块文件
+static const char *SET_BLOCK_SCRIPT =
+    "if ARGV[2] ~= '' then "
+    "redis.call('HINCRBY', KEYS[2], ARGV[2], 1) "
+    "redis.call('HSET', KEYS[1], ARGV[1], ARGV[2]) "
+    "else "
+    "redis.call('HDEL', KEYS[1], ARGV[1]) "
+    "end "
+    "if ARGV[3] ~= '' and redis.call('HINCRBY', KEYS[2], ARGV[3], -1) <= 0 then "
+    "redis.call('HDEL', KEYS[2], ARGV[3]) "
+    "return 1 "
+    "end "
+    "return 0";
+
+// 去掉文件 [ARGV[1], ARGV[2]) 范围内的块映射并释放引用，返回失去最后一个引用的块
+static const char *DROP_BLOCKS_SCRIPT =
+    "local ids = {} "
+    "for i = tonumber(ARGV[1]), tonumber(ARGV[2]) - 1 do "
+    "local field = string.format('%d', i) "
+    "local id = redis.call('HGET', KEYS[1], field) "
+    "if id then "
+    "redis.call('HDEL', KEYS[1], field) "
+    "if redis.call('HINCRBY', KEYS[2], id, -1) <= 0 then "
+    "redis.call('HDEL', KEYS[2], id) "
+    "ids[#ids + 1] = id "
+    "end "
+    "end "
+    "end "
+    "return ids";
+
+enum {
+    SCRIPT_SET_BLOCK,
+    SCRIPT_DROP_BLOCKS,
+};
+
+static const char *const *SCRIPTS[DEDUP_SCRIPTS] = {
+    &SET_BLOCK_SCRIPT,
+    &DROP_BLOCKS_SCRIPT,
+};
+
+// 新连接上加载脚本并记下摘要（第一条连接在创建时建立）
+static int load_scripts(redisContext *ctx, void *arg) {
+    dedup_t *dedup = (dedup_t*)arg;
+    int ret = 0;
+    for (int i = 0; i < DEDUP_SCRIPTS; i++) {
+        redisReply *reply = (redisReply*)redisCommand(ctx, "SCRIPT LOAD %s", *SCRIPTS[i]);
+        if (!reply) {
+            return -1;
+        }
+        if (reply->type != REDIS_REPLY_STRING || reply->len != 40) {
+            ret = -1;
+        } else if (!dedup->script_sha[i][0]) {
+            memcpy(dedup->script_sha[i], reply->str, 40);
+            dedup->script_sha[i][40] = '\0';
+        } else if (memcmp(dedup->script_sha[i], reply->str, 40) != 0) {
+            ret = -1;
+        }
+        freeReplyObject(reply);
+    }
+    return ret;
+}
+
+static redisReply* dedup_command(dedup_t *dedup, const char *format, ...) {
+    pool_conn_t *conn = conn_pool_get(&dedup->pool);
+    if (!conn) {
+        return NULL;
+    }
+
+    va_list ap;
+    va_start(ap, format);
+    redisReply *reply = (redisReply*)redisvCommand(conn->ctx, format, ap);
+    va_end(ap);
+    conn_pool_put(conn);
+    return reply;
+}
+
+static redisReply* dedup_command_argv(dedup_t *dedup, int argc, const char **argv, const size_t *argvlen) {
+    pool_conn_t *conn = conn_pool_get(&dedup->pool);
+    if (!conn) {
+        return NULL;
+    }
+
+    redisReply *reply = (redisReply*)redisCommandArgv(conn->ctx, argc, argv, argvlen);
+    conn_pool_put(conn);
+    return reply;
+}
+
+// 执行脚本，argv[0] 和 argv[1] 留给 EVALSHA 和摘要
+static redisReply* dedup_script(dedup_t *dedup, int script, int argc, const char **argv) {
+    argv[0] = "EVALSHA";
+    argv[1] = dedup->script_sha[script];
+
+    pool_conn_t *conn = conn_pool_get(&dedup->pool);
+    if (!conn) {
+        return NULL;
+    }
+
+    redisReply *reply = (redisReply*)redisCommandArgv(conn->ctx, argc, argv, NULL);
+    // 脚本缓存被清空时在这条连接上重新加载后重发
+    if (reply && reply->type == REDIS_REPLY_ERROR && strncmp(reply->str, "NOSCRIPT", 8) == 0 &&
+        load_scripts(conn->ctx, dedup) == 0) {
+        freeReplyObject(reply);
+        reply = (redisReply*)redisCommandArgv(conn->ctx, argc, argv, NULL);
+    }
+    conn_pool_put(conn);
+    return reply;
+}
+
+// 执行不关心返回值的命令，出错返回 -1
+static int dedup_exec(dedup_t *dedup, const char *format, ...) {
+    pool_conn_t *conn = conn_pool_get(&dedup->pool);
+    if (!conn) {
+        return -1;
+    }
+
+    va_list ap;
+    va_start(ap, format);
+    redisReply *reply = (redisReply*)redisvCommand(conn->ctx, format, ap);
+    va_end(ap);
+    conn_pool_put(conn);
+
+    if (!reply || reply->type == REDIS_REPLY_ERROR) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+    freeReplyObject(reply);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// 块文件
+// ---------------------------------------------------------------------------
+
+dedup_t* dedup_new(const char *base_dir, const char *addr, int port, const char *password, int db) {
+    if (!base_dir || !addr) {
+        return NULL;
+    }
+
+    dedup_t *dedup = (dedup_t*)calloc(1, sizeof(dedup_t));
+    if (!dedup) {
+        return NULL;
+    }
+
+    snprintf(dedup->cas_dir, sizeof(dedup->cas_dir), "%s/cas", base_dir);
+    if (mkdir(dedup->cas_dir, 0755) != 0 && errno != EEXIST) {
+        perror("Failed to create block store directory");
+        free(dedup);
+        return NULL;
+    }
+
+    // 块文件的增删只在本进程内由块锁串行化，另一进程挂载同一数据目录会删除仍被引用的块文件
+    dedup->lock_fd = open(dedup->cas_dir, O_RDONLY | O_DIRECTORY);
+    if (dedup->lock_fd < 0 || flock(dedup->lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        if (errno == EWOULDBLOCK) {
+            fprintf(stderr, "Block store %s is in use by another mount\n", dedup->cas_dir);
+        } else {
+            perror("Failed to lock block store directory");
+        }
+        if (dedup->lock_fd >= 0) close(dedup->lock_fd);
+        free(dedup);
+        return NULL;
+    }
+
+    for (int i = 0; i < DEDUP_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&dedup->inode_locks[i], NULL);
+        pthread_mutex_init(&dedup->block_locks[i], NULL);
+    }
+    if (conn_pool_init(&dedup->pool, addr, port, password, db, CONN_POOL_SIZE, load_scripts, dedup) != 0) {
+        dedup_free(dedup);
+        return NULL;
+    }
+
+    // 先建立一条连接，加载脚本并记下摘要
+    pool_conn_t *conn = conn_pool_get(&dedup->pool);
+    if (!conn) {
+        dedup_free(dedup);
+        return NULL;
+    }
+    conn_pool_put(conn);
+
+    return dedup;
+}
+
+void dedup_free(dedup_t *dedup) {
+    if (!dedup) {
+        return;
+    }
+
+    conn_pool_destroy(&dedup->pool);
+    for (int i = 0; i < DEDUP_LOCK_STRIPES; i++) {
+        pthread_mutex_destroy(&dedup->inode_locks[i]);
+        pthread_mutex_destroy(&dedup->block_locks[i]);
+    }
+    close(dedup->lock_fd);
+    free(dedup);
+}
+
+static void block_path(dedup_t *dedup, const char *id, char *path, size_t len) {
+    snprintf(path, len, "%s/%.2s/%s", dedup->cas_dir, id, id);
+}
+
+// 块标识本身是哈希，直接取前几位选锁
+static pthread_mutex_t* block_lock(dedup_t *dedup, const char *id) {
+    char prefix[5];
+    memcpy(prefix, id, 4);
+    prefix[4] = '\0';
+    return &dedup->block_locks[strtoul(prefix, NULL, 16) % DEDUP_LOCK_STRIPES];
+}
+
+// 写入块文件：先写临时文件并落盘再重命名，块文件要么完整要么不存在；
+// 临时文件名唯一，同时写入同一块的线程不会互相截断
+static int write_block_file(dedup_t *dedup, const char *id, const char *data, size_t len) {
+    char path[700], tmp[710];
+    block_path(dedup, id, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+    int fd = mkstemp(tmp);
+    if (fd < 0 && errno == ENOENT) {
+        char dir[700];
+        snprintf(dir, sizeof(dir), "%s/%.2s", dedup->cas_dir, id);
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            perror("Failed to create block directory");
+            return -1;
+        }
+        snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+        fd = mkstemp(tmp);
+    }
+    if (fd < 0) {
+        perror("Failed to create block file");
+        return -1;
+    }
+
+    ssize_t written = write(fd, data, len);
+    int ok = written == (ssize_t)len && fchmod(fd, 0644) == 0 && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp, path) != 0) {
+        perror("Failed to write block file");
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
+
+// 读取块到 block（DEDUP_BLOCK_SIZE 字节，块文件之外的部分补零）
+static int load_block(dedup_t *dedup, const char *id, char *block) {
+    char path[700];
+    block_path(dedup, id, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Missing block %s\n", id);
+        return -1;
+    }
+
+    ssize_t n = pread(fd, block, DEDUP_BLOCK_SIZE, 0);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+
+    memset(block + n, 0, DEDUP_BLOCK_SIZE - (size_t)n);
+    return 0;
+}
+
+static void remove_block_file(dedup_t *dedup, const char *id) {
+    char path[700];
+    block_path(dedup, id, path, sizeof(path));
+    if (unlink(path) != 0 && errno != ENOENT) {
+        perror("Failed to delete block file");
+    }
+}
+
+static int block_file_exists(dedup_t *dedup, const char *id) {
+    char path[700];
+    block_path(dedup, id, path, sizeof(path));
+    return access(path, F_OK) == 0;
+}
+
+// 比较块文件与 data 的内容（块文件不保存末尾的零，长度不同即内容不同）
+// 相同返回 1，不同返回 0，块文件不存在或读取失败返回 -1 并设置 errno
+static int block_file_matches(dedup_t *dedup, const char *id, const char *data, size_t len) {
+    char path[700];
+    block_path(dedup, id, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    int ret = fstat(fd, &st) == 0 ? (size_t)st.st_size == len : -1;
+    char buf[16384];
+    for (size_t pos = 0; ret == 1 && pos < len; ) {
+        size_t n = len - pos < sizeof(buf) ? len - pos : sizeof(buf);
+        ssize_t nread = pread(fd, buf, n, (off_t)pos);
+        if (nread <= 0) {
+            if (nread == 0) errno = EIO;
+            ret = -1;
+        } else {
+            ret = memcmp(buf, data + pos, (size_t)nread) == 0;
+            pos += (size_t)nread;
+        }
+    }
+
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return ret;
+}
+
+// 在块锁内为内容 data 确定块标识（hash 为内容哈希），依次查看 hash、hash-1、hash-2……
+// 内容相同的块已存在返回 1；遇到不存在的标识返回 0，由调用者以该标识写入新块文件。
+// 哈希由非密码学算法计算，只有逐字节比较相同的块才会被共享
+static int find_block(dedup_t *dedup, const char *hash, const char *data, size_t len, char *id) {
+    for (int i = 0; i < DEDUP_MAX_COLLISIONS; i++) {
+        if (i == 0) {
+            snprintf(id, BLOCK_ID_MAX, "%s", hash);
+        } else {
+            snprintf(id, BLOCK_ID_MAX, "%s-%d", hash, i);
+        }
+
+        int ret = block_file_matches(dedup, id, data, len);
+        if (ret == 1) {
+            return 1;
+        }
+        if (ret < 0) {
+            if (errno == ENOENT) {
+                return 0;
+            }
+            perror("Failed to read block file");
+            return -1;
+        }
+        fprintf(stderr, "Hash collision on block %s\n", id);
+    }
+
+    fprintf(stderr, "Too many hash collisions on block %s\n", hash);
+    return -1;
+}
+
+static int is_zero(const char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 按条带顺序锁住两个块，避免与方向相反的替换互相等待（块可以为 NULL）
+static void lock_blocks(dedup_t *dedup, const char *a, const char *b,
+                        pthread_mutex_t **first, pthread_mutex_t **second) {
+    *first = a ? block_lock(dedup, a) : NULL;
+    *second = b ? block_lock(dedup, b) : NULL;
+    if (*first == *second) {
+        *second = NULL;
+    } else if (!*first || (*second && *first > *second)) {
+        pthread_mutex_t *tmp = *first;
+        *first = *second;
+        *second = tmp;
+    }
+    if (*first) pthread_mutex_lock(*first);
+    if (*second) pthread_mutex_lock(*second);
+}
+
+static void unlock_blocks(pthread_mutex_t *first, pthread_mutex_t *second) {
+    if (second) pthread_mutex_unlock(second);
+    if (first) pthread_mutex_unlock(first);
+}
+
+// 锁住全部块条带，批量释放引用时使用
+static void lock_all_blocks(dedup_t *dedup) {
+    for (int i = 0; i < DEDUP_LOCK_STRIPES; i++) {
+        pthread_mutex_lock(&dedup->block_locks[i]);
+    }
+}
+
+static void unlock_all_blocks(dedup_t *dedup) {
+    for (int i = DEDUP_LOCK_STRIPES - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&dedup->block_locks[i]);
+    }
+}
+
+// 把文件第 index 块指向内容为 data 的块，hash 为内容哈希（空串表示全零块），old_id 为原块标识（可为 NULL）
+// data 为 NULL 时 hash 即已有块的标识，直接共享。引用计数只在持有块锁时增加，块文件只在持有块锁时删除：
+// 块文件不存在时先写入再引用，读取方不会看到指向缺失块文件的映射。
+// 同一哈希的各个块标识前缀相同，落在同一把块锁上
+static int set_block(dedup_t *dedup, uint64_t inode, uint64_t index, const char *old_id,
+                     const char *hash, const char *data, size_t len) {
+    if (!hash[0] ? !old_id : (!data && old_id && strcmp(old_id, hash) == 0)) {
+        return 0;
+    }
+
+    pthread_mutex_t *first, *second;
+    lock_blocks(dedup, hash[0] ? hash : NULL, old_id, &first, &second);
+
+    char id[BLOCK_ID_MAX];
+    int ok;
+    if (!hash[0]) {
+        id[0] = '\0';
+        ok = 1;
+    } else if (!data) {
+        snprintf(id, sizeof(id), "%s", hash);
+        ok = block_file_exists(dedup, id);
+    } else {
+        int found = find_block(dedup, hash, data, len, id);
+        ok = found == 1 || (found == 0 && write_block_file(dedup, id, data, len) == 0);
+    }
+
+    int ret = -1;
+    if (ok && old_id && strcmp(old_id, id) == 0) {
+        // 内容未变
+        ret = 0;
+    } else if (ok) {
+        char key[64], field[24];
+        snprintf(key, sizeof(key), "%s%lu", BLOCKS_KEY_PREFIX, inode);
+        snprintf(field, sizeof(field), "%lu", index);
+        const char *argv[8] = {NULL, NULL, "2", key, BLOCKREF_KEY, field, id, old_id ? old_id : ""};
+
+        redisReply *reply = dedup_script(dedup, SCRIPT_SET_BLOCK, 8, argv);
+        if (reply && reply->type == REDIS_REPLY_INTEGER) {
+            ret = 0;
+            if (reply->integer == 1) {
+                remove_block_file(dedup, old_id);
+            }
+        }
+        if (reply) freeReplyObject(reply);
+    }
+
+    unlock_blocks(first, second);
+    return ret;
+}
+
+// 去掉文件 [first, last) 块的映射并释放引用，按批执行，每批在 Redis 中的执行时间有上限
+// 删除块文件期间持有全部块锁，期间重新引用同一块的写入会等待
+static int drop_blocks(dedup_t *dedup, uint64_t inode, uint64_t first, uint64_t last) {
+    char key[64];
+    snprintf(key, sizeof(key), "%s%lu", BLOCKS_KEY_PREFIX, inode);
+
+    for (uint64_t start = first; start < last; start += DEDUP_DROP_BATCH) {
+        uint64_t end = last - start > DEDUP_DROP_BATCH ? start + DEDUP_DROP_BATCH : last;
+        char from[24], to[24];
+        snprintf(from, sizeof(from), "%lu", start);
+        snprintf(to, sizeof(to), "%lu", end);
+        const char *argv[7] = {NULL, NULL, "2", key, BLOCKREF_KEY, from, to};
+
+        lock_all_blocks(dedup);
+        redisReply *reply = dedup_script(dedup, SCRIPT_DROP_BLOCKS, 7, argv);
+        int ok = reply && reply->type == REDIS_REPLY_ARRAY;
+        for (size_t i = 0; ok && i < reply->elements; i++) {
+            if (reply->element[i]->type == REDIS_REPLY_STRING) {
+                remove_block_file(dedup, reply->element[i]->str);
+            }
+        }
+        unlock_all_blocks(dedup);
+
+        if (reply) freeReplyObject(reply);
+        if (!ok) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 用新内容替换文件的第 index 块，内容相同时不产生任何写入
+static int replace_block(dedup_t *dedup, uint64_t inode, uint64_t index,
+                         const char *old_id, const char *block) {
+    char hash[BLOCK_ID_LEN + 1] = "";
+    size_t len = DEDUP_BLOCK_SIZE;
+
+    // 全零块不存储，读取时补零
+    if (!is_zero(block, DEDUP_BLOCK_SIZE)) {
+        uint64_t h[2];
+        dedup_hash128(block, DEDUP_BLOCK_SIZE, h);
+        snprintf(hash, sizeof(hash), "%016lx%016lx", h[0], h[1]);
+
+        // 块文件不保存末尾的零
+        while (block[len - 1] == 0) {
+            len--;
+        }
+    }
+
+    return set_block(dedup, inode, index, old_id, hash, block, len);
+}
+
+// 一次往返取回文件大小和 [first, first + count) 块的标识
+static redisReply* fetch_blocks(dedup_t *dedup, uint64_t inode, uint64_t first, size_t count) {
+    // 参数数组和字段字符串放在本线程的临时缓冲区中，每次读写不进入 malloc
+    size_t argc = count + 3;
+    const char **argv = (const char**)mempool_scratch(MEMPOOL_SCRATCH_BLOCK_MAP,
+                                                      argc * sizeof(char*) + count * 24 + 64);
+    if (!argv) {
+        return NULL;
+    }
+
+    char *fields = (char*)(argv + argc);
+    char *key = fields + count * 24;
+    snprintf(key, 64, "%s%lu", BLOCKS_KEY_PREFIX, inode);
+    argv[0] = "HMGET";
+    argv[1] = key;
+    argv[2] = "size";
+    for (size_t i = 0; i < count; i++) {
+        char *field = fields + i * 24;
+        snprintf(field, 24, "%lu", first + i);
+        argv[i + 3] = field;
+    }
+
+    redisReply *reply = dedup_command_argv(dedup, (int)argc, argv, NULL);
+
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != argc - 2) {
+        if (reply) freeReplyObject(reply);
+        return NULL;
+    }
+    return reply;
+}
+
+static const char* reply_id(const redisReply *reply) {
+    return reply->type == REDIS_REPLY_STRING ? reply->str : NULL;
+}
+
+static uint64_t reply_size(const redisReply *reply) {
+    return reply->type == REDIS_REPLY_STRING ? strtoull(reply->str, NULL, 10) : 0;
+}
+
+static pthread_mutex_t* inode_lock(dedup_t *dedup, uint64_t inode) {
+    return &dedup->inode_locks[inode % DEDUP_LOCK_STRIPES];
+}
+
+ssize_t dedup_write(dedup_t *dedup, uint64_t inode, const void *data, size_t size,
+                    uint64_t offset, uint64_t *old_size) {
+    if (size == 0) {
+        return dedup_get_size(dedup, inode, old_size) == 0 ? 0 : -1;
+    }
+
+    uint64_t first = offset / DEDUP_BLOCK_SIZE;
+    size_t count = (size_t)((offset + size - 1) / DEDUP_BLOCK_SIZE - first + 1);
+
+    char *block = (char*)mempool_scratch(MEMPOOL_SCRATCH_DEDUP, DEDUP_BLOCK_SIZE);
+    if (!block) {
+        return -1;
+    }
+
+    pthread_mutex_t *lock = inode_lock(dedup, inode);
+    pthread_mutex_lock(lock);
+
+    redisReply *reply = fetch_blocks(dedup, inode, first, count);
+    if (!reply) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+    uint64_t file_size = reply_size(reply->element[0]);
+
+    const char *src = (const char*)data;
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t pos = offset + total;
+        size_t in_block = (size_t)(pos % DEDUP_BLOCK_SIZE);
+        size_t n = DEDUP_BLOCK_SIZE - in_block;
+        if (n > size - total) {
+            n = size - total;
+        }
+
+        // 部分覆盖时先读出原块
+        const char *old_id = reply_id(reply->element[i + 1]);
+        if (n < DEDUP_BLOCK_SIZE) {
+            if (old_id) {
+                if (load_block(dedup, old_id, block) != 0) {
+                    break;
+                }
+            } else {
+                memset(block, 0, DEDUP_BLOCK_SIZE);
+            }
+        }
+        memcpy(block + in_block, src + total, n);
+
+        if (replace_block(dedup, inode, first + i, old_id, block) != 0) {
+            break;
+        }
+        total += n;
+    }
+
+    if (offset + total > file_size) {
+        dedup_exec(dedup, "HSET %s%lu size %lu", BLOCKS_KEY_PREFIX, inode, offset + total);
+    }
+
+    pthread_mutex_unlock(lock);
+    freeReplyObject(reply);
+
+    *old_size = file_size;
+    return total > 0 ? (ssize_t)total : -1;
+}
+
+ssize_t dedup_read(dedup_t *dedup, uint64_t inode, void *buf, size_t size, uint64_t offset) {
+    if (size == 0) {
+        return 0;
+    }
+
+    uint64_t first = offset / DEDUP_BLOCK_SIZE;
+    size_t count = (size_t)((offset + size - 1) / DEDUP_BLOCK_SIZE - first + 1);
+
+    // 读取不持有锁：取得块映射后，同一文件的覆盖写入可能释放最后一个引用并删除块文件，
+    // 这时重新取得块映射（其中已是新写入的块）再读
+    for (int attempt = 0; ; attempt++) {
+        redisReply *reply = fetch_blocks(dedup, inode, first, count);
+        if (!reply) {
+            return -1;
+        }
+
+        uint64_t file_size = reply_size(reply->element[0]);
+        if (offset >= file_size) {
+            freeReplyObject(reply);
+            return 0;
+        }
+        size_t want = size;
+        if (want > file_size - offset) {
+            want = (size_t)(file_size - offset);
+        }
+
+        char *dst = (char*)buf;
+        size_t total = 0;
+        int missing = 0;
+        for (size_t i = 0; total < want; i++) {
+            uint64_t pos = offset + total;
+            size_t in_block = (size_t)(pos % DEDUP_BLOCK_SIZE);
+            size_t n = DEDUP_BLOCK_SIZE - in_block;
+            if (n > want - total) {
+                n = want - total;
+            }
+
+            const char *id = reply_id(reply->element[i + 1]);
+            if (!id) {
+                memset(dst + total, 0, n);
+            } else {
+                char path[700];
+                block_path(dedup, id, path, sizeof(path));
+                int fd = open(path, O_RDONLY);
+                if (fd < 0) {
+                    missing = errno == ENOENT;
+                    if (!missing || attempt + 1 >= DEDUP_READ_RETRIES) {
+                        fprintf(stderr, "Missing block %s\n", id);
+                    }
+                    break;
+                }
+                ssize_t nread = pread(fd, dst + total, n, (off_t)in_block);
+                close(fd);
+                if (nread < 0) {
+                    break;
+                }
+                // 块文件去掉了末尾的零
+                memset(dst + total + nread, 0, n - (size_t)nread);
+            }
+            total += n;
+        }
+
+        freeReplyObject(reply);
+        if (missing && attempt + 1 < DEDUP_READ_RETRIES) {
+            continue;
+        }
+        return total > 0 ? (ssize_t)total : -1;
+    }
+}
+
+// 持有两个文件的锁时复制块映射
+static ssize_t copy_blocks(dedup_t *dedup, uint64_t src, uint64_t src_offset,
+                           uint64_t dst, uint64_t dst_offset, size_t size) {
+    uint64_t count = (size + DEDUP_BLOCK_SIZE - 1) / DEDUP_BLOCK_SIZE;
+    redisReply *src_reply = fetch_blocks(dedup, src, src_offset / DEDUP_BLOCK_SIZE, (size_t)count);
+    if (!src_reply) {
+        return -1;
+    }
+    redisReply *dst_reply = fetch_blocks(dedup, dst, dst_offset / DEDUP_BLOCK_SIZE, (size_t)count);
+    if (!dst_reply) {
+        freeReplyObject(src_reply);
+        return -1;
+    }
+
+    uint64_t src_size = reply_size(src_reply->element[0]);
+    uint64_t dst_size = reply_size(dst_reply->element[0]);
+    if (src_offset >= src_size) {
+        size = 0;
+    } else if (size > src_size - src_offset) {
+        size = (size_t)(src_size - src_offset);
+    }
+
+    // 末尾不完整的块只有在覆盖到目标文件末尾时才能共享（块中文件末尾之后均为零）
+    ssize_t ret = 0;
+    if (size % DEDUP_BLOCK_SIZE != 0 && dst_offset + size < dst_size) {
+        ret = DEDUP_UNALIGNED;
+    } else if (size > 0) {
+        size_t total = 0;
+        for (size_t i = 0; total < size; i++) {
+            const char *id = reply_id(src_reply->element[i + 1]);
+            if (set_block(dedup, dst, dst_offset / DEDUP_BLOCK_SIZE + i,
+                          reply_id(dst_reply->element[i + 1]), id ? id : "", NULL, 0) != 0) {
+                break;
+            }
+            total += DEDUP_BLOCK_SIZE;
+        }
+        if (total > size) {
+            total = size;
+        }
+
+        if (dst_offset + total > dst_size) {
+            dedup_exec(dedup, "HSET %s%lu size %lu", BLOCKS_KEY_PREFIX, dst, dst_offset + total);
+        }
+        ret = total > 0 ? (ssize_t)total : -1;
+    }
+
+    freeReplyObject(src_reply);
+    freeReplyObject(dst_reply);
+    return ret;
+}
+
+ssize_t dedup_copy(dedup_t *dedup, uint64_t src, uint64_t src_offset,
+                   uint64_t dst, uint64_t dst_offset, size_t size) {
+    if (size == 0 || src_offset % DEDUP_BLOCK_SIZE != 0 || dst_offset % DEDUP_BLOCK_SIZE != 0) {
+        return DEDUP_UNALIGNED;
+    }
+
+    // 按条带顺序加锁，避免两个方向相反的复制互相等待
+    pthread_mutex_t *first_lock = inode_lock(dedup, src);
+    pthread_mutex_t *second_lock = inode_lock(dedup, dst);
+    if (first_lock > second_lock) {
+        pthread_mutex_t *tmp = first_lock;
+        first_lock = second_lock;
+        second_lock = tmp;
+    }
+    pthread_mutex_lock(first_lock);
+    if (second_lock != first_lock) {
+        pthread_mutex_lock(second_lock);
+    }
+
+    ssize_t ret = copy_blocks(dedup, src, src_offset, dst, dst_offset, size);
+
+    if (second_lock != first_lock) {
+        pthread_mutex_unlock(second_lock);
+    }
+    pthread_mutex_unlock(first_lock);
+    return ret;
+}
+
+int dedup_truncate(dedup_t *dedup, uint64_t inode, uint64_t size) {
+    pthread_mutex_t *lock = inode_lock(dedup, inode);
+    pthread_mutex_lock(lock);
+
+    uint64_t keep = size / DEDUP_BLOCK_SIZE;
+    size_t in_block = (size_t)(size % DEDUP_BLOCK_SIZE);
+
+    // 一次往返取回原大小和最后保留的块
+    redisReply *reply = fetch_blocks(dedup, inode, keep, 1);
+    if (!reply) {
+        pthread_mutex_unlock(lock);
+        return -1;
+    }
+
+    int ret = 0;
+    uint64_t file_size = reply_size(reply->element[0]);
+    const char *id = reply_id(reply->element[1]);
+    if (size < file_size) {
+        // 最后一块的尾部清零
+        if (in_block > 0 && id) {
+            char *block = (char*)mempool_scratch(MEMPOOL_SCRATCH_DEDUP, DEDUP_BLOCK_SIZE);
+            if (!block || load_block(dedup, id, block) != 0) {
+                ret = -1;
+            } else {
+                memset(block + in_block, 0, DEDUP_BLOCK_SIZE - in_block);
+                if (replace_block(dedup, inode, keep, id, block) != 0) {
+                    ret = -1;
+                }
+            }
+        }
+
+        // 整块超出新大小的块（块映射不会超出文件大小）
+        uint64_t last = (file_size + DEDUP_BLOCK_SIZE - 1) / DEDUP_BLOCK_SIZE;
+        if (drop_blocks(dedup, inode, in_block > 0 ? keep + 1 : keep, last) != 0) {
+            ret = -1;
+        }
+    }
+    freeReplyObject(reply);
+
+    if (dedup_exec(dedup, "HSET %s%lu size %lu", BLOCKS_KEY_PREFIX, inode, size) != 0) {
+        ret = -1;
+    }
+
+    pthread_mutex_unlock(lock);
+    return ret;
+}
+
+int dedup_delete(dedup_t *dedup, uint64_t inode) {
+    pthread_mutex_t *lock = inode_lock(dedup, inode);
+    pthread_mutex_lock(lock);
+
+    uint64_t file_size;
+    int ret = dedup_get_size(dedup, inode, &file_size);
+    if (ret == 0) {
+        ret = drop_blocks(dedup, inode, 0, (file_size + DEDUP_BLOCK_SIZE - 1) / DEDUP_BLOCK_SIZE);
+    }
+    if (ret == 0) {
+        ret = dedup_exec(dedup, "DEL %s%lu", BLOCKS_KEY_PREFIX, inode);
+    }
+
+    pthread_mutex_unlock(lock);
+    return ret;
+}
+
+int dedup_seek(dedup_t *dedup, uint64_t inode, uint64_t offset, int whence, uint64_t *result) {
+    uint64_t file_size;
+    if (dedup_get_size(dedup, inode, &file_size) != 0) {
+        return -1;
+    }
+    if (offset >= file_size) {
+        errno = ENXIO;
+        return -1;
+    }
+
+    // 按批取回块映射，未映射的块即空洞
+    uint64_t count = (file_size + DEDUP_BLOCK_SIZE - 1) / DEDUP_BLOCK_SIZE;
+    uint64_t index = offset / DEDUP_BLOCK_SIZE;
+    while (index < count) {
+        size_t batch = (size_t)(count - index < 1024 ? count - index : 1024);
+        redisReply *reply = fetch_blocks(dedup, inode, index, batch);
+        if (!reply) {
+            return -1;
+        }
+
+        for (size_t i = 0; i < batch; i++, index++) {
+            if ((reply_id(reply->element[i + 1]) != NULL) == (whence == SEEK_DATA)) {
+                freeReplyObject(reply);
+                uint64_t pos = index * DEDUP_BLOCK_SIZE;
+                *result = pos > offset ? pos : offset;
+                return 0;
+            }
+        }
+        freeReplyObject(reply);
+    }
+
+    if (whence == SEEK_DATA) {
+        errno = ENXIO;
+        return -1;
+    }
+    *result = file_size;
+    return 0;
+}
+
+int dedup_sync(dedup_t *dedup) {
+    int fd = open(dedup->cas_dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        perror("Failed to open block store for sync");
+        return -1;
+    }
+
+    // 块文件分散在多个目录中，直接同步整个文件系统
+    int ret = syncfs(fd);
+    close(fd);
+
+    if (ret != 0) {
+        perror("Failed to sync block store");
+        return -1;
+    }
+    return 0;
+}
+
+int dedup_get_size(dedup_t *dedup, uint64_t inode, uint64_t *size) {
+    redisReply *reply = dedup_command(dedup, "HGET %s%lu size", BLOCKS_KEY_PREFIX, inode);
+    if (!reply || (reply->type != REDIS_REPLY_STRING && reply->type != REDIS_REPLY_NIL)) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    *size = reply_size(reply);
+    freeReplyObject(reply);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "dirstat.h"
+#include "redis_meta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+struct dirstat {
+    redis_meta_t *meta;
+    pthread_t thread;
+    int started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int stopping;
+};
+
+dirstat_t* dirstat_new(const char *addr, int port, const char *password, int db) {
+    dirstat_t *dirstat = (dirstat_t*)calloc(1, sizeof(dirstat_t));
+    if (!dirstat) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&dirstat->lock, NULL);
+    pthread_cond_init(&dirstat->wake, NULL);
+
+    dirstat->meta = redis_meta_new(addr, port, password, db);
+    if (!dirstat->meta) {
+        dirstat_free(dirstat);
+        return NULL;
+    }
+
+    return dirstat;
+}
+
+static void* flusher_main(void *arg) {
+    dirstat_t *dirstat = (dirstat_t*)arg;
+    int failing = 0;
+
+    pthread_mutex_lock(&dirstat->lock);
+    while (!dirstat->stopping) {
+        pthread_mutex_unlock(&dirstat->lock);
+
+        // 增量保存在 Redis 中，失败时留到下一轮，只报告一次
+        if (redis_meta_flush_dirstat(dirstat->meta) < 0) {
+            if (!failing) {
+                fprintf(stderr, "Failed to propagate directory usage, retrying\n");
+            }
+            failing = 1;
+        } else {
+            failing = 0;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += DIRSTAT_FLUSH_INTERVAL;
+
+        pthread_mutex_lock(&dirstat->lock);
+        if (!dirstat->stopping) {
+            pthread_cond_timedwait(&dirstat->wake, &dirstat->lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&dirstat->lock);
+
+    return NULL;
+}
+
+int dirstat_start(dirstat_t *dirstat) {
+    if (dirstat->started) {
+        return 0;
+    }
+
+    if (pthread_create(&dirstat->thread, NULL, flusher_main, dirstat) != 0) {
+        return -1;
+    }
+    dirstat->started = 1;
+
+    return 0;
+}
+
+void dirstat_free(dirstat_t *dirstat) {
+    if (!dirstat) {
+        return;
+    }
+
+    pthread_mutex_lock(&dirstat->lock);
+    dirstat->stopping = 1;
+    pthread_cond_signal(&dirstat->wake);
+    pthread_mutex_unlock(&dirstat->lock);
+
+    if (dirstat->started) {
+        pthread_join(dirstat->thread, NULL);
+    }
+
+    if (dirstat->meta) {
+        redis_meta_flush_dirstat(dirstat->meta);
+        redis_meta_free(dirstat->meta);
+    }
+    pthread_mutex_destroy(&dirstat->lock);
+    pthread_cond_destroy(&dirstat->wake);
+    free(dirstat);
+}
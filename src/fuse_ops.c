@@ -1,12 +1,28 @@
 #define FUSE_USE_VERSION 30
+#define _GNU_SOURCE
 #include "fuse_ops.h"
+#include "mempool.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/xattr.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
+#include <limits.h>
+#include <pthread.h>
+
+// 文件句柄（保存在 fi->fh 中）：低位为标志，高位为打开的文件的 inode
+#define FH_INLINE 0x1   // 打开时文件数据内联在 Redis 中
+#define FH_INODE_SHIFT 8
+
+// 目录用量的虚拟扩展属性（只读，不出现在 listxattr 中）
+static const char *XATTR_DIR_RBYTES = "simplefs.dir.rbytes";
+static const char *XATTR_DIR_RFILES = "simplefs.dir.rfiles";
+static const char *XATTR_DIR_RSUBDIRS = "simplefs.dir.rsubdirs";
 
 // 全局文件系统上下文
 static fs_context_t *g_fs_context = NULL;
@@ -15,6 +31,248 @@ void fs_set_context(fs_context_t *ctx) {
     g_fs_context = ctx;
 }
 
+// 读取时最多重试的次数：读取期间发生过失效时重新读取，避免把失效前读到的旧数据交给内核缓存
+#define CACHE_FILL_RETRIES 2
+
+// 查找目录项，启用元数据缓存时先查缓存；名字不存在的结果也会缓存，
+// 编译器、import 和 PATH 搜索反复探测不存在的文件时不必每次查询 Redis
+// 返回 0 表示找到，1 表示名字不存在，-1 表示失败
+// 只用于读取路径：修改操作对最后一个组件直接查询 Redis，避免按过期的 inode 修改
+static int lookup_entry(uint64_t parent, const char *name, uint64_t *inode) {
+    if (g_fs_context->journal && journal_lookup(g_fs_context->journal, parent, name, inode)) {
+        return 0;
+    }
+
+    meta_cache_t *cache = g_fs_context->cache;
+    if (!cache) {
+        return redis_meta_lookup(g_fs_context->meta, parent, name, inode);
+    }
+
+    uint64_t cached;
+    if (meta_cache_lookup(cache, parent, name, &cached)) {
+        if (cached == 0) {
+            return 1;
+        }
+        *inode = cached;
+        return 0;
+    }
+
+    for (int attempt = 0; ; attempt++) {
+        uint64_t ticket = meta_cache_ticket(cache);
+        int ret = redis_meta_lookup(g_fs_context->meta, parent, name, &cached);
+        if (ret < 0) {
+            return -1;
+        }
+        if (!meta_cache_stale(cache, ticket) || attempt + 1 >= CACHE_FILL_RETRIES) {
+            meta_cache_put_entry(cache, parent, name, ret == 0 ? cached : 0, ticket);
+            if (ret == 0) {
+                *inode = cached;
+            }
+            return ret;
+        }
+    }
+}
+
+// 读取节点属性，启用元数据缓存时先查缓存（只用于读取路径）
+static int get_attr(uint64_t inode, node_attr_t **attr) {
+    if (g_fs_context->journal && journal_get_node(g_fs_context->journal, inode, attr)) {
+        return 0;
+    }
+
+    meta_cache_t *cache = g_fs_context->cache;
+    if (!cache) {
+        return redis_meta_get_node(g_fs_context->meta, inode, attr);
+    }
+
+    node_attr_t *cached = node_attr_alloc();
+    if (cached && meta_cache_get_attr(cache, inode, cached)) {
+        *attr = cached;
+        return 0;
+    }
+    node_attr_free(cached);
+
+    for (int attempt = 0; ; attempt++) {
+        uint64_t ticket = meta_cache_ticket(cache);
+        if (redis_meta_get_node(g_fs_context->meta, inode, attr) != 0) {
+            return -1;
+        }
+        if (!meta_cache_stale(cache, ticket) || attempt + 1 >= CACHE_FILL_RETRIES) {
+            meta_cache_put_attr(cache, *attr, ticket);
+            return 0;
+        }
+        node_attr_free(*attr);
+    }
+}
+
+// 未启用元数据缓存时记住最近确认没有扩展属性的节点（按 inode 直接映射），XATTR_ABSENT_TTL 秒内
+// 直接返回空集合。本挂载修改扩展属性时清除并推进代数，修改前开始的读取不再写入；
+// 其他挂载的修改最多在 TTL 之后可见
+#define XATTR_ABSENT_SLOTS 4096
+#define XATTR_ABSENT_STRIPES 64
+#define XATTR_ABSENT_TTL 1
+
+static struct {
+    uint64_t inode;
+    time_t expires;
+} g_xattr_absent[XATTR_ABSENT_SLOTS];
+static pthread_mutex_t g_xattr_absent_locks[XATTR_ABSENT_STRIPES] = {
+    [0 ... XATTR_ABSENT_STRIPES - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+static uint64_t g_xattr_gen;
+
+static time_t coarse_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+static int xattr_absent(uint64_t inode) {
+    size_t slot = inode % XATTR_ABSENT_SLOTS;
+    pthread_mutex_t *lock = &g_xattr_absent_locks[slot % XATTR_ABSENT_STRIPES];
+    pthread_mutex_lock(lock);
+    int absent = g_xattr_absent[slot].inode == inode && g_xattr_absent[slot].expires > coarse_now();
+    pthread_mutex_unlock(lock);
+    return absent;
+}
+
+// gen 为读取 Redis 之前的代数，期间本挂载修改过扩展属性时不写入
+static void xattr_note_absent(uint64_t inode, uint64_t gen) {
+    size_t slot = inode % XATTR_ABSENT_SLOTS;
+    pthread_mutex_t *lock = &g_xattr_absent_locks[slot % XATTR_ABSENT_STRIPES];
+    pthread_mutex_lock(lock);
+    if (__atomic_load_n(&g_xattr_gen, __ATOMIC_ACQUIRE) == gen) {
+        g_xattr_absent[slot].inode = inode;
+        g_xattr_absent[slot].expires = coarse_now() + XATTR_ABSENT_TTL;
+    }
+    pthread_mutex_unlock(lock);
+}
+
+static void xattr_forget_absent(uint64_t inode) {
+    size_t slot = inode % XATTR_ABSENT_SLOTS;
+    pthread_mutex_t *lock = &g_xattr_absent_locks[slot % XATTR_ABSENT_STRIPES];
+    pthread_mutex_lock(lock);
+    __atomic_add_fetch(&g_xattr_gen, 1, __ATOMIC_RELEASE);
+    if (g_xattr_absent[slot].inode == inode) {
+        g_xattr_absent[slot].inode = 0;
+    }
+    pthread_mutex_unlock(lock);
+}
+
+// 读取节点的全部扩展属性，启用元数据缓存时整个集合一起缓存：集合中没有的名字即不存在，
+// 内核在每次写入前探测的 security.capability 等不存在的属性不必查询 Redis。
+// 未启用元数据缓存时（默认、集群模式）由上面的表记住没有扩展属性的节点
+static int get_xattrs(uint64_t inode, xattr_list_t **list) {
+    meta_cache_t *cache = g_fs_context->cache;
+    if (!cache) {
+        if (xattr_absent(inode)) {
+            *list = (xattr_list_t*)mempool_alloc(sizeof(xattr_list_t));
+            if (!*list) {
+                return -1;
+            }
+            (*list)->len = 0;
+            return 0;
+        }
+        uint64_t gen = __atomic_load_n(&g_xattr_gen, __ATOMIC_ACQUIRE);
+        if (redis_meta_get_xattrs(g_fs_context->meta, inode, list) != 0) {
+            return -1;
+        }
+        if ((*list)->len == 0) {
+            xattr_note_absent(inode, gen);
+        }
+        return 0;
+    }
+
+    if (meta_cache_get_xattrs(cache, inode, list)) {
+        return 0;
+    }
+
+    for (int attempt = 0; ; attempt++) {
+        uint64_t ticket = meta_cache_ticket(cache);
+        if (redis_meta_get_xattrs(g_fs_context->meta, inode, list) != 0) {
+            return -1;
+        }
+        if (!meta_cache_stale(cache, ticket) || attempt + 1 >= CACHE_FILL_RETRIES) {
+            meta_cache_put_xattrs(cache, inode, *list, ticket);
+            return 0;
+        }
+        xattr_list_free(*list);
+    }
+}
+
+// 启用元数据日志时，尚未应用到 Redis 的目录项和节点从日志中读取，对它们的属性修改也记入日志
+// 修改操作的最后一个组件和读出再写回的节点记录经过这些函数
+static int meta_lookup(uint64_t parent, const char *name, uint64_t *inode) {
+    if (g_fs_context->journal && journal_lookup(g_fs_context->journal, parent, name, inode)) {
+        return 0;
+    }
+    return redis_meta_lookup(g_fs_context->meta, parent, name, inode);
+}
+
+static int meta_get_node(uint64_t inode, node_attr_t **attr) {
+    if (g_fs_context->journal && journal_get_node(g_fs_context->journal, inode, attr)) {
+        return 0;
+    }
+    return redis_meta_get_node(g_fs_context->meta, inode, attr);
+}
+
+// 只修改给出的字段，返回值与 redis_meta_change_node 相同
+static int meta_change_node(uint64_t inode, int64_t mode, int64_t uid, int64_t gid, int64_t ctime) {
+    int ret = g_fs_context->journal ?
+              journal_change_node(g_fs_context->journal, inode, mode, uid, gid, ctime) : 0;
+    if (ret != 0) {
+        return ret > 0 ? 0 : -1;
+    }
+    return redis_meta_change_node(g_fs_context->meta, inode, mode, uid, gid, ctime);
+}
+
+static int meta_set_size(uint64_t inode, uint64_t size, int64_t mtime, int64_t ctime) {
+    int ret = g_fs_context->journal ? journal_set_size(g_fs_context->journal, inode, size, mtime, ctime) : 0;
+    if (ret != 0) {
+        return ret > 0 ? 0 : -1;
+    }
+    return redis_meta_set_size(g_fs_context->meta, inode, size, mtime, ctime, 0);
+}
+
+static int meta_touch_node(uint64_t inode, uint64_t min_size, int64_t atime, int64_t mtime, int64_t ctime) {
+    int ret = g_fs_context->journal ?
+              journal_touch_node(g_fs_context->journal, inode, min_size, atime, mtime, ctime) : 0;
+    if (ret != 0) {
+        return ret > 0 ? 0 : -1;
+    }
+    return redis_meta_touch_node(g_fs_context->meta, inode, min_size, atime, mtime, ctime);
+}
+
+// 创建节点：启用元数据日志时追加到日志后立即返回
+// 名字经由 lookup_entry 检查：内核创建前已查找过同一名字，启用元数据缓存时通常命中否定缓存，
+// 不再访问 Redis，未启用缓存时查询 Redis；检查之后其他挂载创建的同名目录项在应用时发现
+static int create_node(uint64_t parent, const char *name, uint32_t mode, node_attr_t **attr) {
+    if (g_fs_context->journal) {
+        uint64_t existing;
+        int found = lookup_entry(parent, name, &existing);
+        if (found <= 0) {
+            return found == 0 ? 1 : -1;
+        }
+        return journal_create(g_fs_context->journal, parent, name, mode, 0, 0, attr);
+    }
+    return redis_meta_create_node(g_fs_context->meta, parent, name, mode, 0, 0, attr);
+}
+
+// 创建类操作的返回值（见 redis_meta_create_node）对应的错误码
+static int create_errno(int ret) {
+    if (ret == 1) {
+        return -EEXIST;
+    }
+    return ret == 2 ? -ENOENT : -EIO;
+}
+
+// 其他修改操作和 readdir 之前等待日志中的修改全部应用，之后直接读写 Redis
+static int journal_barrier(void) {
+    if (g_fs_context->journal && journal_drain(g_fs_context->journal) != 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
 // 路径解析：将路径分解为父目录 inode 和文件名
 // 返回：parent_out=父目录的inode, name_out=最后一个组件名
 // 对于 /a/b/c，返回 parent=b的inode, name=c
@@ -47,7 +305,7 @@ static int resolve_to_parent_and_name(const char *path, uint64_t *parent_out, ch
         if (next_token != NULL) {
             // 当前token不是最后一个，需要查找并前进
             uint64_t inode;
-            if (redis_meta_lookup(g_fs_context->meta, parent, token, &inode) != 0) {
+            if (lookup_entry(parent, token, &inode) != 0) {
                 return -ENOENT;
             }
             parent = inode;
@@ -80,63 +338,268 @@ static int resolve_parent_path(const char *path, uint64_t *parent_out, char *nam
     return resolve_to_parent_and_name(path, parent_out, name_out);
 }
 
-int fs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
-    (void)fi;
-    memset(stbuf, 0, sizeof(struct stat));
-
-    fprintf(stderr, "fs_getattr: path=%s\n", path);
+// 解析路径对应的 inode
+static int resolve_inode(const char *path, uint64_t *inode) {
+    if (strcmp(path, "/") == 0) {
+        *inode = 1;
+        return 0;
+    }
 
     uint64_t parent;
     char name[256];
 
-    if (strcmp(path, "/") == 0) {
-        // 根目录
-        node_attr_t *attr;
-        if (redis_meta_get_node(g_fs_context->meta, 1, &attr) != 0) {
-            fprintf(stderr, "fs_getattr: root not found\n");
-            return -ENOENT;
-        }
+    int ret = resolve_path(path, &parent, name);
+    if (ret != 0) {
+        return ret;
+    }
 
-        stbuf->st_ino = attr->inode;
-        stbuf->st_mode = attr->mode;
-        stbuf->st_nlink = 1;
-        stbuf->st_uid = attr->uid;
-        stbuf->st_gid = attr->gid;
-        stbuf->st_size = attr->size;
-        stbuf->st_blocks = attr->blocks;
-        stbuf->st_atim.tv_sec = attr->atime;
-        stbuf->st_mtim.tv_sec = attr->mtime;
-        stbuf->st_ctim.tv_sec = attr->ctime;
+    if (lookup_entry(parent, name, inode) != 0) {
+        return -ENOENT;
+    }
 
-        node_attr_free(attr);
+    return 0;
+}
+
+// 修改操作的目标 inode：最后一个组件直接查询 Redis
+static int resolve_target(const char *path, uint64_t *inode) {
+    if (strcmp(path, "/") == 0) {
+        *inode = 1;
         return 0;
     }
 
+    uint64_t parent;
+    char name[256];
+
     int ret = resolve_path(path, &parent, name);
     if (ret != 0) {
-        fprintf(stderr, "fs_getattr: resolve_path failed: %d\n", ret);
         return ret;
     }
 
-    fprintf(stderr, "fs_getattr: parent=%lu name=%s\n", parent, name);
+    if (meta_lookup(parent, name, inode) != 0) {
+        return -ENOENT;
+    }
+
+    return 0;
+}
+
+// 打开的文件的 inode，没有句柄时为 0
+static inline uint64_t handle_inode(const struct fuse_file_info *fi) {
+    return fi ? fi->fh >> FH_INODE_SHIFT : 0;
+}
+
+// 带句柄的操作直接使用打开的文件：不必解析路径，文件被重命名或删除后仍访问同一个节点
+// （删除后 FUSE 传入的路径为 NULL）。没有句柄时按路径解析，target 非零时按修改操作查询最后一个组件
+static int file_inode(const char *path, const struct fuse_file_info *fi, int target, uint64_t *inode) {
+    *inode = handle_inode(fi);
+    if (*inode != 0) {
+        return 0;
+    }
+    if (!path) {
+        return -ENOENT;
+    }
+    return target ? resolve_target(path, inode) : resolve_inode(path, inode);
+}
+
+// 本挂载修改了 path 对应的节点：丢弃它的缓存属性，entry 非零时（创建、删除、重命名）
+// 同时丢弃目录项和父目录的属性，并递增父目录的版本使其中缓存的不存在结果失效。在修改之后调用，之前开始的填充会因失效序号变化而被丢弃
+static void forget_path(const char *path, int entry) {
+    meta_cache_t *cache = g_fs_context->cache;
+    if (!cache) {
+        return;
+    }
+    if (strcmp(path, "/") == 0) {
+        meta_cache_forget_attr(cache, 1);
+        return;
+    }
+
+    uint64_t parent;
+    char name[256];
+    if (resolve_path(path, &parent, name) != 0) {
+        return;
+    }
 
     uint64_t inode;
-    if (redis_meta_lookup(g_fs_context->meta, parent, name, &inode) != 0) {
-        fprintf(stderr, "fs_getattr: lookup failed\n");
+    if (meta_cache_lookup(cache, parent, name, &inode) && inode != 0) {
+        meta_cache_forget_attr(cache, inode);
+    }
+    if (entry) {
+        meta_cache_forget_entry(cache, parent, name);
+        meta_cache_forget_attr(cache, parent);
+        meta_cache_bump_dir(cache, parent);
+    }
+}
+
+// 本挂载修改了文件的属性：有句柄时按 inode 丢弃缓存的属性，不再解析路径
+static void forget_file(const char *path, const struct fuse_file_info *fi) {
+    uint64_t inode = handle_inode(fi);
+    if (inode == 0) {
+        if (path) {
+            forget_path(path, 0);
+        }
+        return;
+    }
+    if (g_fs_context->cache) {
+        meta_cache_forget_attr(g_fs_context->cache, inode);
+    }
+}
+
+// 回收链接已全部删除的文件（节点已在待删除集合中）：交给后台删除，或立即删除数据和节点记录
+static void reclaim_file(uint64_t inode) {
+    if (g_fs_context->reaper) {
+        reaper_notify(g_fs_context->reaper);
+    } else if (storage_delete(g_fs_context->storage, inode) == 0) {
+        redis_meta_finish_deletes(g_fs_context->meta, &inode, 1);
+    }
+}
+
+// 打开的文件在最后一个链接删除时推迟了删除时间，最后一次关闭后改为立即删除
+static void release_orphan(uint64_t inode) {
+    if (redis_meta_retry_delete(g_fs_context->meta, inode, 0) == 0) {
+        reclaim_file(inode);
+    }
+}
+
+// 文件的最后一个链接已删除，held 为删除时文件是否在本挂载打开：
+// 仍然打开时由最后一次关闭删除，否则（包括期间已经关闭）立即回收
+static void unlinked(uint64_t inode, int held) {
+    if (!held) {
+        reclaim_file(inode);
+    } else if (!openfiles_orphan(g_fs_context->openfiles, inode)) {
+        release_orphan(inode);
+    }
+}
+
+// 分层存储：按节点记录中的标志记下数据所在的层，之后直接访问该层
+static void note_tier(const node_attr_t *attr) {
+    storage_set_tier(g_fs_context->storage, attr->inode,
+                     (attr->flags & NODE_FLAG_COLD) ? STORAGE_TIER_COLD : STORAGE_TIER_HOT);
+}
+
+// QoS 调度：操作在访问元数据和存储层之前按租户排队，未启用时直接执行；取得的执行槽交给 op_end
+// 租户等待的操作已达上限时返回 -1，调用者返回 EAGAIN，不再占用工作线程等待
+static int op_begin(int cls, const char *path, uint64_t cost, qos_slot_t *slot) {
+    *slot = NULL;
+    if (!g_fs_context->qos) {
+        return 0;
+    }
+    uint64_t tenant = qos_tenant(g_fs_context->qos, path, fuse_get_context()->uid);
+    return qos_begin(g_fs_context->qos, cls, tenant, cost, slot);
+}
+
+static void op_end(int cls, qos_slot_t slot) {
+    if (g_fs_context->qos) {
+        qos_end(g_fs_context->qos, cls, slot);
+    }
+}
+
+// 将内联文件提升为普通数据文件：先写数据文件，再清除内联标志
+// 复制期间有其他写入修改了内联数据时，清除失败，重新读取后再复制，已确认的写入不会丢失
+static int promote_inline(node_attr_t *attr) {
+    for (int attempt = 0; ; attempt++) {
+        char *data;
+        size_t len;
+        if (redis_meta_get_inline(g_fs_context->meta, attr->inode, &data, &len) != 0) {
+            return -EIO;
+        }
+
+        // 重试时数据文件中留有上次复制的内容，先清空
+        int ret = 0;
+        if ((attempt > 0 && storage_truncate(g_fs_context->storage, attr->inode, 0) != 0) ||
+            storage_truncate(g_fs_context->storage, attr->inode, attr->size) != 0) {
+            ret = -EIO;
+        } else if (len > 0 &&
+                   storage_write(g_fs_context->storage, attr->inode, data, len, 0) != (ssize_t)len) {
+            ret = -EIO;
+        }
+        if (ret == 0) {
+            ret = redis_meta_clear_inline(g_fs_context->meta, attr->inode, data, len, attr->size);
+            ret = ret < 0 ? -EIO : ret;
+        }
+        free(data);
+        if (ret <= 0) {
+            if (ret == 0) {
+                attr->flags &= ~NODE_FLAG_INLINE;
+            }
+            return ret;
+        }
+
+        node_attr_t *cur;
+        if (redis_meta_get_node(g_fs_context->meta, attr->inode, &cur) != 0) {
+            return -EIO;
+        }
+        *attr = *cur;
+        node_attr_free(cur);
+    }
+}
+
+// 写入后的修改时间：启用回写缓存时 mtime/ctime 由内核维护（刷出脏页时通过 utimens 回写），
+// 这里保持不变，否则延迟到达的写入会把时间改成刷出的时刻
+static int64_t write_time(void) {
+    return g_fs_context->writeback_cache ? META_TIME_KEEP : (int64_t)time(NULL);
+}
+
+// 写入内联文件：返回写入字节数；文件已不是内联文件（或刚被提升）时返回 -EAGAIN
+static int write_inline(uint64_t inode, const char *buf, size_t size, off_t offset) {
+    node_attr_t *attr;
+    if (meta_get_node(inode, &attr) != 0) {
         return -ENOENT;
     }
 
+    if (!(attr->flags & NODE_FLAG_INLINE)) {
+        node_attr_free(attr);
+        return -EAGAIN;
+    }
+
+    int ret;
+    uint64_t end = (uint64_t)offset + size;
+    if (end <= g_fs_context->meta->inline_threshold) {
+        // 写入前文件被其他线程或挂载提升时由调用者改写数据文件
+        ret = redis_meta_write_inline(g_fs_context->meta, inode, buf, size, offset, write_time());
+        ret = ret == 0 ? (int)size : ret > 0 ? -EAGAIN : -EIO;
+    } else {
+        // 超过阈值，提升后由调用者写入数据文件
+        ret = promote_inline(attr);
+        if (ret == 0) {
+            ret = -EAGAIN;
+        }
+    }
+
+    node_attr_free(attr);
+    return ret;
+}
+
+// 链接数：旧记录没有计数字段时按目录 2、其他 1 报告
+static nlink_t node_nlink(const node_attr_t *attr) {
+    if (attr->nlink > 0) {
+        return (nlink_t)attr->nlink;
+    }
+    return S_ISDIR(attr->mode) ? 2 : 1;
+}
+
+static int do_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    memset(stbuf, 0, sizeof(struct stat));
+
+    fprintf(stderr, "fs_getattr: path=%s\n", path ? path : "(open file)");
+
+    // 根目录、路径或打开的文件
+    uint64_t inode;
+    int ret = file_inode(path, fi, 0, &inode);
+    if (ret != 0) {
+        fprintf(stderr, "fs_getattr: lookup failed: %d\n", ret);
+        return ret;
+    }
+
     fprintf(stderr, "fs_getattr: found inode=%lu\n", inode);
 
     node_attr_t *attr;
-    if (redis_meta_get_node(g_fs_context->meta, inode, &attr) != 0) {
+    if (get_attr(inode, &attr) != 0) {
         fprintf(stderr, "fs_getattr: get_node failed\n");
         return -ENOENT;
     }
 
     stbuf->st_ino = attr->inode;
     stbuf->st_mode = attr->mode;
-    stbuf->st_nlink = 1;
+    stbuf->st_nlink = node_nlink(attr);
     stbuf->st_uid = attr->uid;
     stbuf->st_gid = attr->gid;
     stbuf->st_size = attr->size;
@@ -149,6 +612,16 @@ int fs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
     return 0;
 }
 
+int fs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_getattr(path, stbuf, fi);
+    op_end(QOS_META, slot);
+    return ret;
+}
+
 int fs_access(const char *path, int mask) {
     // 简化实现：总是允许访问
     (void)path;
@@ -156,29 +629,68 @@ int fs_access(const char *path, int mask) {
     return 0;
 }
 
-int fs_open(const char *path, struct fuse_file_info *fi) {
-    // 简化实现：总是允许打开
-    (void)path;
-    (void)fi;
+static int do_open(const char *path, struct fuse_file_info *fi) {
+    uint64_t inode;
+    int ret = resolve_inode(path, &inode);
+    if (ret != 0) {
+        return ret;
+    }
+
+    // 记录打开时是否为内联文件。内联文件只会被提升不会降级，
+    // 因此打开时不是内联文件的句柄可以始终直接访问存储层
+    uint64_t flags = 0;
+    node_attr_t *attr;
+    if (meta_get_node(inode, &attr) == 0) {
+        if (attr->flags & NODE_FLAG_INLINE) {
+            flags |= FH_INLINE;
+        }
+        note_tier(attr);
+        node_attr_free(attr);
+    }
+
+    // 命中内核页缓存的读取不经过 FUSE，打开也记为一次访问
+    if (g_fs_context->migrator) {
+        migrator_access(g_fs_context->migrator, inode);
+    }
+
+    if (openfiles_open(g_fs_context->openfiles, inode) != 0) {
+        return -ENOMEM;
+    }
+    fi->fh = inode << FH_INODE_SHIFT | flags;
     return 0;
 }
 
-int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    (void)fi;
-
-    uint64_t parent;
-    char name[256];
+int fs_open(const char *path, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_open(path, fi);
+    op_end(QOS_META, slot);
+    return ret;
+}
 
-    int ret = resolve_path(path, &parent, name);
+static int do_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    uint64_t inode;
+    int ret = file_inode(path, fi, 0, &inode);
     if (ret != 0) {
         return ret;
     }
 
-    uint64_t inode;
-    if (redis_meta_lookup(g_fs_context->meta, parent, name, &inode) != 0) {
-        return -ENOENT;
+    if (fi && (fi->fh & FH_INLINE)) {
+        ssize_t nread;
+        ret = redis_meta_read_inline(g_fs_context->meta, inode, buf, size, offset, &nread);
+        if (ret == 0) {
+            return (int)nread;
+        } else if (ret < 0) {
+            return -EIO;
+        }
+        // 已被提升为数据文件，改从存储层读取
     }
 
+    if (g_fs_context->migrator) {
+        migrator_access(g_fs_context->migrator, inode);
+    }
     ssize_t nread = storage_read(g_fs_context->storage, inode, buf, size, offset);
     if (nread < 0) {
         return -EIO;
@@ -187,51 +699,317 @@ int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_
     return (int)nread;
 }
 
-int fs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
-    (void)fi;
+int fs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_DATA, path, size, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_read(path, buf, size, offset, fi);
+    op_end(QOS_DATA, slot);
+    return ret;
+}
 
-    uint64_t parent;
-    char name[256];
+static int do_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    // 修改操作开始时标记，之后一段时间内（包括本操作中修改前的读取）不从副本读取
+    redis_meta_note_write(g_fs_context->meta);
 
-    int ret = resolve_path(path, &parent, name);
+    uint64_t inode;
+    int ret = file_inode(path, fi, 1, &inode);
     if (ret != 0) {
         return ret;
     }
 
-    uint64_t inode;
-    if (redis_meta_lookup(g_fs_context->meta, parent, name, &inode) != 0) {
-        return -ENOENT;
+    if (fi && (fi->fh & FH_INLINE)) {
+        ret = write_inline(inode, buf, size, offset);
+        if (ret != -EAGAIN) {
+            return ret;
+        }
+        fi->fh &= ~FH_INLINE;
     }
 
+    if (g_fs_context->migrator) {
+        migrator_access(g_fs_context->migrator, inode);
+    }
     ssize_t nwritten = storage_write(g_fs_context->storage, inode, buf, size, offset);
     if (nwritten < 0) {
         return -EIO;
     }
 
-    // 更新文件大小
-    node_attr_t *attr;
-    if (redis_meta_get_node(g_fs_context->meta, inode, &attr) == 0) {
-        attr->size = offset + nwritten;
-        attr->mtime = (uint64_t)time(NULL);
-        redis_meta_update_node(g_fs_context->meta, attr);
-        node_attr_free(attr);
+    // 文件大小扩展到写入末尾（不会缩小）：回写缓存的多个范围可能乱序、并发到达
+    int64_t now = write_time();
+    if (meta_touch_node(inode, (uint64_t)offset + (uint64_t)nwritten,
+                              META_TIME_KEEP, now, now) != 0) {
+        return -EIO;
     }
 
     return (int)nwritten;
 }
 
-int fs_release(const char *path, struct fuse_file_info *fi) {
-    (void)path;
-    (void)fi;
-    return 0;
+int fs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_DATA, path, size, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_write(path, buf, size, offset, fi);
+    op_end(QOS_DATA, slot);
+    forget_file(path, fi);
+    return ret;
 }
 
-int fs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
-    (void)fi;
+static ssize_t do_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in,
+                                  const char *path_out, struct fuse_file_info *fi_out, off_t offset_out,
+                                  size_t size, int flags) {
+    redis_meta_note_write(g_fs_context->meta);
 
-    fprintf(stderr, "fs_create: path=%s mode=%o\n", path, mode);
+    // 先让日志中的修改生效，之后直接修改 Redis
+    int barrier = journal_barrier();
+    if (barrier != 0) {
+        return barrier;
+    }
 
-    uint64_t parent;
+    if (flags != 0) {
+        return -EINVAL;
+    }
+
+    uint64_t src;
+    int ret = file_inode(path_in, fi_in, 1, &src);
+    if (ret != 0) {
+        return ret;
+    }
+
+    uint64_t dst;
+    ret = file_inode(path_out, fi_out, 1, &dst);
+    if (ret != 0) {
+        return ret;
+    }
+
+    // 同一文件内重叠的范围无法安全复制
+    if (src == dst && (uint64_t)offset_in < (uint64_t)offset_out + size &&
+        (uint64_t)offset_out < (uint64_t)offset_in + size) {
+        return -EINVAL;
+    }
+
+    node_attr_t *src_attr;
+    if (meta_get_node(src, &src_attr) != 0) {
+        return -ENOENT;
+    }
+    int src_inline = (src_attr->flags & NODE_FLAG_INLINE) != 0;
+    uint64_t src_size = src_attr->size;
+    node_attr_free(src_attr);
+
+    if ((uint64_t)offset_in >= src_size) {
+        return 0;
+    }
+    if (size > src_size - (uint64_t)offset_in) {
+        size = (size_t)(src_size - (uint64_t)offset_in);
+    }
+
+    node_attr_t *attr;
+    if (meta_get_node(dst, &attr) != 0) {
+        return -ENOENT;
+    }
+
+    // 内联的小文件交给内核回退为普通读写；目标文件放不下时先提升
+    if (attr->flags & NODE_FLAG_INLINE) {
+        if (src_inline || (uint64_t)offset_out + size <= g_fs_context->meta->inline_threshold) {
+            node_attr_free(attr);
+            return -EOPNOTSUPP;
+        }
+        ret = promote_inline(attr);
+        if (ret != 0) {
+            node_attr_free(attr);
+            return ret;
+        }
+        if (fi_out) {
+            fi_out->fh &= ~FH_INLINE;
+        }
+    }
+    if (src_inline) {
+        node_attr_free(attr);
+        return -EOPNOTSUPP;
+    }
+
+    ssize_t copied = storage_copy_range(g_fs_context->storage, src, (uint64_t)offset_in,
+                                        dst, (uint64_t)offset_out, size);
+    if (copied < 0) {
+        node_attr_free(attr);
+        return -EIO;
+    }
+
+    // 大小和时间通过一次写入更新
+    if (copied > 0) {
+        int64_t now = (int64_t)time(NULL);
+        if (meta_touch_node(dst, (uint64_t)offset_out + (uint64_t)copied,
+                                  META_TIME_KEEP, now, now) != 0) {
+            node_attr_free(attr);
+            return -EIO;
+        }
+    }
+
+    node_attr_free(attr);
+    return copied;
+}
+
+ssize_t fs_copy_file_range(const char *path_in, struct fuse_file_info *fi_in, off_t offset_in,
+                           const char *path_out, struct fuse_file_info *fi_out, off_t offset_out,
+                           size_t size, int flags) {
+    qos_slot_t slot;
+    if (op_begin(QOS_DATA, path_in, size, &slot) != 0) {
+        return -EAGAIN;
+    }
+    ssize_t ret = do_copy_file_range(path_in, fi_in, offset_in, path_out, fi_out, offset_out, size, flags);
+    op_end(QOS_DATA, slot);
+    forget_file(path_out, fi_out);
+    return ret;
+}
+
+static int do_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi) {
+    redis_meta_note_write(g_fs_context->meta);
+
+    // 先让日志中的修改生效，之后直接修改 Redis
+    int barrier = journal_barrier();
+    if (barrier != 0) {
+        return barrier;
+    }
+
+    if (offset < 0 || length <= 0) {
+        return -EINVAL;
+    }
+
+    uint64_t inode;
+    int ret = file_inode(path, fi, 1, &inode);
+    if (ret != 0) {
+        return ret;
+    }
+
+    node_attr_t *attr;
+    if (meta_get_node(inode, &attr) != 0) {
+        return -ENOENT;
+    }
+
+    if (!S_ISREG(attr->mode)) {
+        node_attr_free(attr);
+        return -ENODEV;
+    }
+
+    // 内联文件先提升为数据文件
+    if (attr->flags & NODE_FLAG_INLINE) {
+        ret = promote_inline(attr);
+        if (ret != 0) {
+            node_attr_free(attr);
+            return ret;
+        }
+        if (fi) {
+            fi->fh &= ~FH_INLINE;
+        }
+    }
+
+    if (storage_fallocate(g_fs_context->storage, inode, mode, (uint64_t)offset, (uint64_t)length) != 0) {
+        ret = errno == EOPNOTSUPP ? -EOPNOTSUPP : -EIO;
+        node_attr_free(attr);
+        return ret;
+    }
+
+    // 大小和时间保持与数据文件一致
+    uint64_t end = (uint64_t)offset + (uint64_t)length;
+    int grow = !(mode & FALLOC_FL_KEEP_SIZE) && end > attr->size;
+    int64_t now = (int64_t)time(NULL);
+    if ((grow || (mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE))) &&
+        meta_touch_node(inode, grow ? end : 0,
+                              META_TIME_KEEP, now, now) != 0) {
+        node_attr_free(attr);
+        return -EIO;
+    }
+
+    node_attr_free(attr);
+    return 0;
+}
+
+int fs_fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_DATA, path, 0, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_fallocate(path, mode, offset, length, fi);
+    op_end(QOS_DATA, slot);
+    forget_file(path, fi);
+    return ret;
+}
+
+static off_t do_lseek(const char *path, off_t off, int whence, struct fuse_file_info *fi) {
+    // SEEK_SET / SEEK_CUR / SEEK_END 由内核处理
+    if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+        return -EINVAL;
+    }
+    if (off < 0) {
+        return -ENXIO;
+    }
+
+    uint64_t inode;
+    int ret = file_inode(path, fi, 0, &inode);
+    if (ret != 0) {
+        return ret;
+    }
+
+    node_attr_t *attr;
+    if (meta_get_node(inode, &attr) != 0) {
+        return -ENOENT;
+    }
+    uint64_t size = attr->size;
+    int is_inline = (attr->flags & NODE_FLAG_INLINE) != 0;
+    node_attr_free(attr);
+
+    if ((uint64_t)off >= size) {
+        return -ENXIO;
+    }
+
+    // 内联文件没有空洞
+    if (is_inline) {
+        return whence == SEEK_DATA ? off : (off_t)size;
+    }
+
+    // 以元数据中的大小为准
+    uint64_t pos;
+    if (storage_seek(g_fs_context->storage, inode, (uint64_t)off, whence, &pos) != 0) {
+        if (errno != ENXIO) {
+            return -EIO;
+        }
+        return whence == SEEK_DATA ? -ENXIO : (off_t)size;
+    }
+    if (pos >= size) {
+        return whence == SEEK_DATA ? -ENXIO : (off_t)size;
+    }
+
+    return (off_t)pos;
+}
+
+off_t fs_lseek(const char *path, off_t off, int whence, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_DATA, path, 0, &slot) != 0) {
+        return -EAGAIN;
+    }
+    off_t ret = do_lseek(path, off, whence, fi);
+    op_end(QOS_DATA, slot);
+    return ret;
+}
+
+int fs_release(const char *path, struct fuse_file_info *fi) {
+    (void)path;
+
+    // 链接已全部删除的文件在最后一次关闭后删除
+    uint64_t inode = handle_inode(fi);
+    if (inode != 0 && openfiles_release(g_fs_context->openfiles, inode)) {
+        release_orphan(inode);
+    }
+    return 0;
+}
+
+static int do_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    redis_meta_note_write(g_fs_context->meta);
+
+    fprintf(stderr, "fs_create: path=%s mode=%o\n", path, mode);
+
+    uint64_t parent;
     char name[256];
 
     // 使用 resolve_parent_path，因为文件可能不存在
@@ -245,49 +1023,102 @@ int fs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
 
     // 创建文件节点
     node_attr_t *attr;
-    if (redis_meta_create_node(g_fs_context->meta, parent, name, mode | S_IFREG, 0, 0, &attr) != 0) {
-        fprintf(stderr, "fs_create: redis_meta_create_node failed\n");
-        return -EIO;
+    ret = create_node(parent, name, mode | S_IFREG, &attr);
+    if (ret != 0) {
+        fprintf(stderr, "fs_create: create_node failed: %d\n", ret);
+        return create_errno(ret);
     }
 
     fprintf(stderr, "fs_create: created inode=%lu\n", attr->inode);
+    uint64_t inode = attr->inode;
+    uint64_t flags = (attr->flags & NODE_FLAG_INLINE) ? FH_INLINE : 0;
     node_attr_free(attr);
+
+    if (openfiles_open(g_fs_context->openfiles, inode) != 0) {
+        return -ENOMEM;
+    }
+    fi->fh = inode << FH_INODE_SHIFT | flags;
     return 0;
 }
 
-int fs_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
-    (void)fi;
+int fs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_create(path, mode, fi);
+    op_end(QOS_META, slot);
+    forget_path(path, 1);
+    return ret;
+}
 
-    uint64_t parent;
-    char name[256];
+static int do_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
+    redis_meta_note_write(g_fs_context->meta);
 
-    int ret = resolve_path(path, &parent, name);
+    uint64_t inode;
+    int ret = file_inode(path, fi, 1, &inode);
     if (ret != 0) {
         return ret;
     }
 
-    uint64_t inode;
-    if (redis_meta_lookup(g_fs_context->meta, parent, name, &inode) != 0) {
+    node_attr_t *attr;
+    if (meta_get_node(inode, &attr) != 0) {
         return -ENOENT;
     }
+    note_tier(attr);
+
+    int64_t now = (int64_t)time(NULL);
+    if (attr->flags & NODE_FLAG_INLINE) {
+        if ((uint64_t)size <= g_fs_context->meta->inline_threshold) {
+            // 内联数据和大小在一个脚本中截断；文件已被其他写入提升时改为截断数据文件
+            ret = redis_meta_set_size(g_fs_context->meta, inode, (uint64_t)size, now, now, 1);
+            if (ret <= 0) {
+                node_attr_free(attr);
+                return ret == 0 ? 0 : -EIO;
+            }
+        } else {
+            ret = promote_inline(attr);
+            if (ret != 0) {
+                node_attr_free(attr);
+                return ret;
+            }
+        }
+    }
+    node_attr_free(attr);
 
     if (storage_truncate(g_fs_context->storage, inode, (uint64_t)size) != 0) {
         return -EIO;
     }
 
-    // 更新元数据
-    node_attr_t *attr;
-    if (redis_meta_get_node(g_fs_context->meta, inode, &attr) == 0) {
-        attr->size = (uint64_t)size;
-        attr->mtime = (uint64_t)time(NULL);
-        redis_meta_update_node(g_fs_context->meta, attr);
-        node_attr_free(attr);
+    // 更新元数据：截断精确设置大小，只修改大小和时间戳。启用回写缓存时内核在截断前已刷出并等待该文件的脏页，
+    // 不会有更早的写入在之后把大小扩展回去
+    if (meta_set_size(inode, (uint64_t)size, now, now) != 0) {
+        return -EIO;
     }
 
     return 0;
 }
 
-int fs_unlink(const char *path) {
+int fs_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_DATA, path, 0, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_truncate(path, size, fi);
+    op_end(QOS_DATA, slot);
+    forget_file(path, fi);
+    return ret;
+}
+
+static int do_unlink(const char *path) {
+    redis_meta_note_write(g_fs_context->meta);
+
+    // 先让日志中的修改生效，之后直接修改 Redis
+    int barrier = journal_barrier();
+    if (barrier != 0) {
+        return barrier;
+    }
+
     uint64_t parent;
     char name[256];
 
@@ -297,23 +1128,44 @@ int fs_unlink(const char *path) {
     }
 
     uint64_t inode;
-    if (redis_meta_lookup(g_fs_context->meta, parent, name, &inode) != 0) {
+    if (meta_lookup(parent, name, &inode) != 0) {
         return -ENOENT;
     }
 
-    // 从目录删除
-    redis_meta_unlink(g_fs_context->meta, parent, name);
-
-    // 删除数据
-    storage_delete(g_fs_context->storage, inode);
+    node_attr_t *attr;
+    if (meta_get_node(inode, &attr) != 0) {
+        return -ENOENT;
+    }
 
-    // 删除元数据
-    redis_meta_delete_node(g_fs_context->meta, inode);
+    // 移除目录项并减少一个链接，最后一个链接删除时节点加入待删除集合；
+    // 文件仍在本挂载打开时推迟删除，数据和节点记录保留到最后一次关闭
+    int held = openfiles_busy(g_fs_context->openfiles, inode);
+    ret = redis_meta_defer_delete(g_fs_context->meta, parent, name, attr, held);
+    node_attr_free(attr);
+    if (ret < 0) {
+        return -EIO;
+    }
+    if (ret > 0) {
+        unlinked(inode, held);
+    }
 
     return 0;
 }
 
-int fs_mkdir(const char *path, mode_t mode) {
+int fs_unlink(const char *path) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_unlink(path);
+    op_end(QOS_META, slot);
+    forget_path(path, 1);
+    return ret;
+}
+
+static int do_mkdir(const char *path, mode_t mode) {
+    redis_meta_note_write(g_fs_context->meta);
+
     uint64_t parent;
     char name[256];
 
@@ -325,15 +1177,35 @@ int fs_mkdir(const char *path, mode_t mode) {
 
     // 创建目录节点
     node_attr_t *attr;
-    if (redis_meta_create_node(g_fs_context->meta, parent, name, mode | S_IFDIR, 0, 0, &attr) != 0) {
-        return -EIO;
+    ret = create_node(parent, name, mode | S_IFDIR, &attr);
+    if (ret != 0) {
+        return create_errno(ret);
     }
 
     node_attr_free(attr);
     return 0;
 }
 
-int fs_rmdir(const char *path) {
+int fs_mkdir(const char *path, mode_t mode) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_mkdir(path, mode);
+    op_end(QOS_META, slot);
+    forget_path(path, 1);
+    return ret;
+}
+
+static int do_rmdir(const char *path) {
+    redis_meta_note_write(g_fs_context->meta);
+
+    // 先让日志中的修改生效，之后直接修改 Redis
+    int barrier = journal_barrier();
+    if (barrier != 0) {
+        return barrier;
+    }
+
     uint64_t parent;
     char name[256];
 
@@ -343,32 +1215,55 @@ int fs_rmdir(const char *path) {
     }
 
     uint64_t inode;
-    if (redis_meta_lookup(g_fs_context->meta, parent, name, &inode) != 0) {
+    if (meta_lookup(parent, name, &inode) != 0) {
         return -ENOENT;
     }
 
-    // 检查目录是否为空
-    dir_entry_t *entries;
-    int count;
-    if (redis_meta_readdir(g_fs_context->meta, inode, &entries, &count) == 0) {
-        if (count > 0) {
-            dir_entries_free(entries, count);
-            return -ENOTEMPTY;
-        }
-        dir_entries_free(entries, count);
+    node_attr_t *attr;
+    if (meta_get_node(inode, &attr) != 0) {
+        return -ENOENT;
+    }
+    int is_dir = S_ISDIR(attr->mode);
+    node_attr_free(attr);
+    if (!is_dir) {
+        return -ENOTDIR;
     }
 
-    // 从父目录删除
-    redis_meta_unlink(g_fs_context->meta, parent, name);
-
-    // 删除元数据
-    redis_meta_delete_node(g_fs_context->meta, inode);
+    // 检查目录是否为空、从父目录删除和删除元数据原子地完成，检查之后不会有新的目录项加入
+    ret = redis_meta_rmdir(g_fs_context->meta, parent, name, inode);
+    if (ret == 1) {
+        return -ENOTEMPTY;
+    }
+    if (ret == 2) {
+        return -ENOENT;
+    }
+    return ret == 0 ? 0 : -EIO;
+}
 
-    return 0;
+int fs_rmdir(const char *path) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_rmdir(path);
+    op_end(QOS_META, slot);
+    forget_path(path, 1);
+    return ret;
 }
 
-int fs_rename(const char *oldpath, const char *newpath, unsigned int flags) {
-    (void)flags;
+static int do_rename(const char *oldpath, const char *newpath, unsigned int flags) {
+    redis_meta_note_write(g_fs_context->meta);
+
+    // 先让日志中的修改生效，之后直接修改 Redis
+    int barrier = journal_barrier();
+    if (barrier != 0) {
+        return barrier;
+    }
+
+    // 不支持交换两个路径
+    if (flags & ~RENAME_NOREPLACE) {
+        return -EINVAL;
+    }
 
     uint64_t old_parent, new_parent;
     char old_name[256], new_name[256];
@@ -379,28 +1274,223 @@ int fs_rename(const char *oldpath, const char *newpath, unsigned int flags) {
     ret = resolve_path(newpath, &new_parent, new_name);
     if (ret != 0) return ret;
 
-    return redis_meta_rename(g_fs_context->meta, old_parent, old_name, new_parent, new_name);
-}
+    uint64_t inode;
+    if (meta_lookup(old_parent, old_name, &inode) != 0) {
+        return -ENOENT;
+    }
 
-int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
-    (void)offset;
-    (void)fi;
-    (void)flags;
+    // 目标已存在时检查能否覆盖
+    node_attr_t *replaced = NULL;
+    uint64_t target;
+    if (meta_lookup(new_parent, new_name, &target) == 0) {
+        if (flags & RENAME_NOREPLACE) {
+            return -EEXIST;
+        }
+        if (target == inode) {
+            return 0;
+        }
 
-    uint64_t parent;
-    char name[256];
+        node_attr_t *attr;
+        if (meta_get_node(inode, &attr) != 0) {
+            return -ENOENT;
+        }
+        int is_dir = S_ISDIR(attr->mode);
+        node_attr_free(attr);
 
-    if (strcmp(path, "/") == 0) {
-        parent = 1;
-    } else {
-        int ret = resolve_path(path, &parent, name);
+        if (meta_get_node(target, &replaced) != 0) {
+            return -EIO;
+        }
+        if (S_ISDIR(replaced->mode)) {
+            uint64_t count;
+            if (!is_dir) {
+                ret = -EISDIR;
+            } else if (redis_meta_count_entries(g_fs_context->meta, replaced, &count) != 0) {
+                ret = -EIO;
+            } else if (count > 0) {
+                ret = -ENOTEMPTY;
+            }
+        } else if (is_dir) {
+            ret = -ENOTDIR;
+        }
         if (ret != 0) {
+            node_attr_free(replaced);
             return ret;
         }
+    }
 
-        if (redis_meta_lookup(g_fs_context->meta, parent, name, &parent) != 0) {
-            return -ENOENT;
-        }
+    // 被覆盖的文件减少一个链接，与 unlink 相同
+    int held = replaced && openfiles_busy(g_fs_context->openfiles, replaced->inode);
+    ret = redis_meta_rename(g_fs_context->meta, old_parent, old_name, new_parent, new_name, replaced, held);
+    if (ret > 0) {
+        unlinked(replaced->inode, held);
+    }
+    node_attr_free(replaced);
+
+    return ret < 0 ? -EIO : 0;
+}
+
+int fs_rename(const char *oldpath, const char *newpath, unsigned int flags) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, oldpath, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_rename(oldpath, newpath, flags);
+    op_end(QOS_META, slot);
+    forget_path(oldpath, 1);
+    forget_path(newpath, 1);
+    return ret;
+}
+
+static int do_symlink(const char *target, const char *path) {
+    redis_meta_note_write(g_fs_context->meta);
+
+    int barrier = journal_barrier();
+    if (barrier != 0) {
+        return barrier;
+    }
+
+    if (strlen(target) >= PATH_MAX) {
+        return -ENAMETOOLONG;
+    }
+
+    uint64_t parent;
+    char name[256];
+
+    int ret = resolve_parent_path(path, &parent, name);
+    if (ret != 0) {
+        return ret;
+    }
+
+    node_attr_t *attr;
+    ret = redis_meta_symlink(g_fs_context->meta, parent, name, target, 0, 0, &attr);
+    if (ret != 0) {
+        return create_errno(ret);
+    }
+
+    // 目标不会改变，创建时直接放入缓存
+    if (g_fs_context->cache) {
+        meta_cache_put_link(g_fs_context->cache, attr->inode, target);
+    }
+    node_attr_free(attr);
+    return 0;
+}
+
+int fs_symlink(const char *target, const char *path) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_symlink(target, path);
+    op_end(QOS_META, slot);
+    forget_path(path, 1);
+    return ret;
+}
+
+static int do_readlink(const char *path, char *buf, size_t size) {
+    if (size == 0) {
+        return -EINVAL;
+    }
+
+    uint64_t inode;
+    int ret = resolve_inode(path, &inode);
+    if (ret != 0) {
+        return ret;
+    }
+
+    meta_cache_t *cache = g_fs_context->cache;
+    if (cache && meta_cache_get_link(cache, inode, buf, size)) {
+        return 0;
+    }
+
+    char *target;
+    if (redis_meta_readlink(g_fs_context->meta, inode, &target) != 0) {
+        return -EIO;
+    }
+    if (cache) {
+        meta_cache_put_link(cache, inode, target);
+    }
+
+    // 目标超出 buf 时截断（FUSE 约定以 \0 结尾）
+    snprintf(buf, size, "%s", target);
+    free(target);
+    return 0;
+}
+
+int fs_readlink(const char *path, char *buf, size_t size) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_readlink(path, buf, size);
+    op_end(QOS_META, slot);
+    return ret;
+}
+
+static int do_link(const char *oldpath, const char *newpath) {
+    redis_meta_note_write(g_fs_context->meta);
+
+    int barrier = journal_barrier();
+    if (barrier != 0) {
+        return barrier;
+    }
+
+    uint64_t inode;
+    int ret = resolve_target(oldpath, &inode);
+    if (ret != 0) {
+        return ret;
+    }
+
+    uint64_t parent;
+    char name[256];
+
+    ret = resolve_parent_path(newpath, &parent, name);
+    if (ret != 0) {
+        return ret;
+    }
+
+    node_attr_t *attr;
+    if (meta_get_node(inode, &attr) != 0) {
+        return -ENOENT;
+    }
+
+    // 目录不能建立硬链接
+    if (S_ISDIR(attr->mode)) {
+        node_attr_free(attr);
+        return -EPERM;
+    }
+
+    ret = redis_meta_link(g_fs_context->meta, attr, parent, name);
+    node_attr_free(attr);
+    return ret == 0 ? 0 : create_errno(ret);
+}
+
+int fs_link(const char *oldpath, const char *newpath) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, oldpath, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_link(oldpath, newpath);
+    op_end(QOS_META, slot);
+    forget_path(oldpath, 0);
+    forget_path(newpath, 1);
+    return ret;
+}
+
+static int do_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+    (void)offset;
+    (void)flags;
+
+    // 目录项可能还在日志中，列出之前先让它们生效
+    int barrier = journal_barrier();
+    if (barrier != 0) {
+        return barrier;
+    }
+
+    // opendir 与 open 相同，句柄中有目录的 inode
+    uint64_t parent;
+    int ret = file_inode(path, fi, 0, &parent);
+    if (ret != 0) {
+        return ret;
     }
 
     dir_entry_t *entries;
@@ -421,161 +1511,456 @@ int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
     return 0;
 }
 
-int fs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
-    (void)isdatasync;
-    (void)fi;
-
-    uint64_t parent;
-    char name[256];
+int fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi, enum fuse_readdir_flags flags) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_readdir(path, buf, filler, offset, fi, flags);
+    op_end(QOS_META, slot);
+    return ret;
+}
 
-    int ret = resolve_path(path, &parent, name);
+static int do_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
+    uint64_t inode;
+    int ret = file_inode(path, fi, 0, &inode);
     if (ret != 0) {
         return ret;
     }
 
+    // 文件的元数据可能还在日志中：日志落盘后崩溃也会在下次挂载时重放
+    if (g_fs_context->journal && journal_commit(g_fs_context->journal) != 0) {
+        return -EIO;
+    }
+
+    // 与同时到达的其他 fsync 合并为一批执行
+    return syncer_sync(g_fs_context->syncer, inode, isdatasync);
+}
+
+int fs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_SYNC, path, 0, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_fsync(path, isdatasync, fi);
+    op_end(QOS_SYNC, slot);
+    return ret;
+}
+
+static int do_chmod(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    redis_meta_note_write(g_fs_context->meta);
+
     uint64_t inode;
-    if (redis_meta_lookup(g_fs_context->meta, parent, name, &inode) != 0) {
-        return -ENOENT;
+    int ret = file_inode(path, fi, 1, &inode);
+    if (ret != 0) return ret;
+
+    ret = meta_change_node(inode, (int64_t)mode, -1, -1, (int64_t)time(NULL));
+    return ret == 0 ? 0 : ret > 0 ? -ENOENT : -EIO;
+}
+
+int fs_chmod(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
     }
+    int ret = do_chmod(path, mode, fi);
+    op_end(QOS_META, slot);
+    forget_file(path, fi);
+    return ret;
+}
+
+static int do_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi) {
+    redis_meta_note_write(g_fs_context->meta);
+
+    uint64_t inode;
+    int ret = file_inode(path, fi, 1, &inode);
+    if (ret != 0) return ret;
+
+    // uid、gid 为 -1 表示不修改，与 chown(2) 相同
+    ret = meta_change_node(inode, -1, uid == (uid_t)-1 ? -1 : (int64_t)uid,
+                           gid == (gid_t)-1 ? -1 : (int64_t)gid, (int64_t)time(NULL));
+    return ret == 0 ? 0 : ret > 0 ? -ENOENT : -EIO;
+}
 
-    if (storage_sync(g_fs_context->storage, inode) != 0) {
+int fs_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_chown(path, uid, gid, fi);
+    op_end(QOS_META, slot);
+    forget_file(path, fi);
+    return ret;
+}
+
+// utimens 中的时间：UTIME_OMIT 保持不变，UTIME_NOW 取当前时间
+static int64_t utimens_time(const struct timespec *tv, int64_t now) {
+    if (tv->tv_nsec == UTIME_OMIT) {
+        return META_TIME_KEEP;
+    }
+    return tv->tv_nsec == UTIME_NOW ? now : (int64_t)tv->tv_sec;
+}
+
+static int do_utimens(const char *path, const struct timespec tv[2], struct fuse_file_info *fi) {
+    redis_meta_note_write(g_fs_context->meta);
+
+    uint64_t inode;
+    int ret = file_inode(path, fi, 1, &inode);
+    if (ret != 0) return ret;
+
+    // 启用回写缓存时内核刷出脏页后只回写 mtime（atime 为 UTIME_OMIT）；
+    // 只修改时间戳，不覆盖同时到达的写入扩展的大小
+    int64_t now = (int64_t)time(NULL);
+    if (meta_touch_node(inode, 0, utimens_time(&tv[0], now),
+                              utimens_time(&tv[1], now), now) != 0) {
         return -EIO;
     }
 
     return 0;
 }
 
-int fs_chmod(const char *path, mode_t mode, struct fuse_file_info *fi) {
-    (void)fi;
+int fs_utimens(const char *path, const struct timespec tv[2], struct fuse_file_info *fi) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_utimens(path, tv, fi);
+    op_end(QOS_META, slot);
+    forget_file(path, fi);
+    return ret;
+}
 
-    uint64_t parent;
-    char name[256];
+static int do_statfs(const char *path, struct statvfs *stbuf) {
+    (void)path;
+    memset(stbuf, 0, sizeof(struct statvfs));
 
-    if (strcmp(path, "/") == 0) {
-        node_attr_t *attr;
-        if (redis_meta_get_node(g_fs_context->meta, 1, &attr) == 0) {
-            attr->mode = mode;
-            attr->ctime = (uint64_t)time(NULL);
-            redis_meta_update_node(g_fs_context->meta, attr);
-            node_attr_free(attr);
+    // 已用空间和节点数来自 Redis 计数器，剩余空间取数据目录所在的文件系统
+    uint64_t space, inodes;
+    if (redis_meta_get_usage(g_fs_context->meta, &space, &inodes) != 0) {
+        return -EIO;
+    }
+
+    struct statvfs data;
+    if (statvfs(g_fs_context->storage->base_dir, &data) != 0) {
+        return -errno;
+    }
+
+    uint64_t bfree = (uint64_t)data.f_bfree * data.f_frsize / 4096;
+    uint64_t bavail = (uint64_t)data.f_bavail * data.f_frsize / 4096;
+
+    // 分层存储时加上容量层的剩余空间
+    if (g_fs_context->storage->cold_dir[0]) {
+        struct statvfs cold;
+        if (statvfs(g_fs_context->storage->cold_dir, &cold) != 0) {
+            return -errno;
         }
+        bfree += (uint64_t)cold.f_bfree * cold.f_frsize / 4096;
+        bavail += (uint64_t)cold.f_bavail * cold.f_frsize / 4096;
+    }
+
+    // 数据目录所在文件系统不限制 inode 数量（如 btrfs）时按固定值报告
+    uint64_t ffree = data.f_files ? (uint64_t)data.f_ffree : 1024 * 1024;
+    uint64_t favail = data.f_files ? (uint64_t)data.f_favail : 1024 * 1024;
+
+    stbuf->f_bsize = 4096;                          // 块大小
+    stbuf->f_frsize = 4096;                         // 片大小
+    stbuf->f_blocks = space / 4096 + bfree;         // 总块数 = 已用 + 空闲
+    stbuf->f_bfree = bfree;                         // 空闲块数
+    stbuf->f_bavail = bavail;                       // 可用块数（非root用户）
+    stbuf->f_files = inodes + ffree;                // 总 inode 数
+    stbuf->f_ffree = ffree;                         // 空闲 inode 数
+    stbuf->f_favail = favail;                       // 可用 inode 数（非root用户）
+    stbuf->f_namemax = 255;                         // 最大文件名长度
+
+    return 0;
+}
+
+int fs_statfs(const char *path, struct statvfs *stbuf) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_statfs(path, stbuf);
+    op_end(QOS_META, slot);
+    return ret;
+}
+
+// 按 getxattr/listxattr 的约定返回：size 为 0 时只返回长度
+static int xattr_reply(const char *data, size_t len, char *value, size_t size) {
+    if (size == 0) {
+        return (int)len;
+    }
+    if (size < len) {
+        return -ERANGE;
+    }
+    memcpy(value, data, len);
+    return (int)len;
+}
+
+// 目录用量的虚拟属性的下标，其他名字返回 -1
+static int dir_usage_field(const char *name) {
+    if (strcmp(name, XATTR_DIR_RBYTES) == 0) {
         return 0;
+    } else if (strcmp(name, XATTR_DIR_RFILES) == 0) {
+        return 1;
+    } else if (strcmp(name, XATTR_DIR_RSUBDIRS) == 0) {
+        return 2;
     }
+    return -1;
+}
 
-    int ret = resolve_path(path, &parent, name);
-    if (ret != 0) return ret;
+static int dir_usage_xattr(uint64_t inode, int field, char *value, size_t size) {
+    // 集群模式下不维护目录用量统计
+    if (g_fs_context->meta->cluster) {
+        return -EOPNOTSUPP;
+    }
 
-    uint64_t inode;
-    if (redis_meta_lookup(g_fs_context->meta, parent, name, &inode) != 0) {
+    node_attr_t *attr;
+    if (meta_get_node(inode, &attr) != 0) {
         return -ENOENT;
     }
+    int is_dir = S_ISDIR(attr->mode);
+    node_attr_free(attr);
 
-    node_attr_t *attr;
-    if (redis_meta_get_node(g_fs_context->meta, inode, &attr) == 0) {
-        attr->mode = mode;
-        attr->ctime = (uint64_t)time(NULL);
-        redis_meta_update_node(g_fs_context->meta, attr);
-        node_attr_free(attr);
+    if (!is_dir || !g_fs_context->meta->dirstat) {
+        return -ENODATA;
     }
 
-    return 0;
+    // 只读一次目录统计，不遍历子树；最近的修改在一个传播周期后可见
+    dir_usage_t usage;
+    if (redis_meta_get_dir_usage(g_fs_context->meta, inode, &usage) != 0) {
+        return -EIO;
+    }
+    int64_t values[3] = {usage.space, usage.files, usage.dirs};
+
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%ld", values[field] > 0 ? values[field] : 0);
+    return xattr_reply(buf, (size_t)len, value, size);
 }
 
-int fs_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi) {
-    (void)fi;
+static int do_getxattr(const char *path, const char *name, char *value, size_t size) {
+    uint64_t inode;
+    int ret = resolve_inode(path, &inode);
+    if (ret != 0) {
+        return ret;
+    }
 
-    uint64_t parent;
-    char name[256];
+    int field = dir_usage_field(name);
+    if (field >= 0) {
+        return dir_usage_xattr(inode, field, value, size);
+    }
 
-    if (strcmp(path, "/") == 0) {
-        node_attr_t *attr;
-        if (redis_meta_get_node(g_fs_context->meta, 1, &attr) == 0) {
-            attr->uid = uid;
-            attr->gid = gid;
-            attr->ctime = (uint64_t)time(NULL);
-            redis_meta_update_node(g_fs_context->meta, attr);
-            node_attr_free(attr);
-        }
-        return 0;
+    xattr_list_t *list;
+    if (get_xattrs(inode, &list) != 0) {
+        return -EIO;
     }
 
-    int ret = resolve_path(path, &parent, name);
-    if (ret != 0) return ret;
+    size_t len;
+    const char *data = xattr_list_find(list, name, &len);
+    ret = data ? xattr_reply(data, len, value, size) : -ENODATA;
+    xattr_list_free(list);
+    return ret;
+}
+
+int fs_getxattr(const char *path, const char *name, char *value, size_t size) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_getxattr(path, name, value, size);
+    op_end(QOS_META, slot);
+    return ret;
+}
 
+static int do_listxattr(const char *path, char *list, size_t size) {
     uint64_t inode;
-    if (redis_meta_lookup(g_fs_context->meta, parent, name, &inode) != 0) {
-        return -ENOENT;
+    int ret = resolve_inode(path, &inode);
+    if (ret != 0) {
+        return ret;
     }
 
-    node_attr_t *attr;
-    if (redis_meta_get_node(g_fs_context->meta, inode, &attr) == 0) {
-        attr->uid = uid;
-        attr->gid = gid;
-        attr->ctime = (uint64_t)time(NULL);
-        redis_meta_update_node(g_fs_context->meta, attr);
-        node_attr_free(attr);
+    xattr_list_t *xattrs;
+    if (get_xattrs(inode, &xattrs) != 0) {
+        return -EIO;
     }
 
-    return 0;
+    size_t len = xattr_list_names(xattrs, list, size);
+    xattr_list_free(xattrs);
+    if (size > 0 && size < len) {
+        return -ERANGE;
+    }
+    return (int)len;
 }
 
-int fs_utimens(const char *path, const struct timespec tv[2], struct fuse_file_info *fi) {
-    (void)fi;
+int fs_listxattr(const char *path, char *list, size_t size) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_listxattr(path, list, size);
+    op_end(QOS_META, slot);
+    return ret;
+}
 
-    uint64_t parent;
-    char name[256];
+// 修改扩展属性后更新 ctime，并丢弃本挂载缓存的集合（其他挂载由失效通知丢弃）
+static int xattr_changed(uint64_t inode) {
+    if (g_fs_context->cache) {
+        meta_cache_forget_xattrs(g_fs_context->cache, inode);
+    } else {
+        xattr_forget_absent(inode);
+    }
+    if (meta_touch_node(inode, 0, META_TIME_KEEP, META_TIME_KEEP, (int64_t)time(NULL)) != 0) {
+        return -EIO;
+    }
+    return 0;
+}
 
-    if (strcmp(path, "/") == 0) {
-        node_attr_t *attr;
-        if (redis_meta_get_node(g_fs_context->meta, 1, &attr) == 0) {
-            attr->atime = tv[0].tv_sec;
-            attr->mtime = tv[1].tv_sec;
-            redis_meta_update_node(g_fs_context->meta, attr);
-            node_attr_free(attr);
-        }
-        return 0;
+static int do_setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
+    // 目录用量的虚拟属性只读
+    if (dir_usage_field(name) >= 0) {
+        return -EPERM;
     }
 
-    int ret = resolve_path(path, &parent, name);
-    if (ret != 0) return ret;
+    redis_meta_note_write(g_fs_context->meta);
+
+    int ret = journal_barrier();
+    if (ret != 0) {
+        return ret;
+    }
 
     uint64_t inode;
-    if (redis_meta_lookup(g_fs_context->meta, parent, name, &inode) != 0) {
-        return -ENOENT;
+    ret = resolve_target(path, &inode);
+    if (ret != 0) {
+        return ret;
     }
 
-    node_attr_t *attr;
-    if (redis_meta_get_node(g_fs_context->meta, inode, &attr) == 0) {
-        attr->atime = tv[0].tv_sec;
-        attr->mtime = tv[1].tv_sec;
-        redis_meta_update_node(g_fs_context->meta, attr);
-        node_attr_free(attr);
+    int cond = 0;
+    if (flags & XATTR_CREATE) {
+        cond = META_XATTR_CREATE;
+    } else if (flags & XATTR_REPLACE) {
+        cond = META_XATTR_REPLACE;
     }
 
-    return 0;
+    ret = redis_meta_set_xattr(g_fs_context->meta, inode, name, value, size, cond);
+    if (ret < 0) {
+        return -EIO;
+    }
+    if (ret > 0) {
+        return cond == META_XATTR_CREATE ? -EEXIST : -ENODATA;
+    }
+
+    return xattr_changed(inode);
 }
 
-int fs_statfs(const char *path, struct statvfs *stbuf) {
-    (void)path;
-    memset(stbuf, 0, sizeof(struct statvfs));
+int fs_setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_setxattr(path, name, value, size, flags);
+    op_end(QOS_META, slot);
+    forget_path(path, 0);
+    return ret;
+}
+
+static int do_removexattr(const char *path, const char *name) {
+    if (dir_usage_field(name) >= 0) {
+        return -EPERM;
+    }
 
-    // 设置文件系统统计信息
-    stbuf->f_bsize = 4096;              // 块大小
-    stbuf->f_frsize = 4096;             // 片大小
-    stbuf->f_blocks = 256 * 1024 * 1024; // 总块数 (1TB)
-    stbuf->f_bfree = 256 * 1024 * 1024;  // 空闲块数
-    stbuf->f_bavail = 256 * 1024 * 1024;  // 可用块数（非root用户）
-    stbuf->f_files = 1024 * 1024;        // 总 inode 数
-    stbuf->f_ffree = 1024 * 1024;        // 空闲 inode 数
-    stbuf->f_favail = 1024 * 1024;       // 可用 inode 数（非root用户）
-    stbuf->f_namemax = 255;             // 最大文件名长度
+    redis_meta_note_write(g_fs_context->meta);
 
-    return 0;
+    int ret = journal_barrier();
+    if (ret != 0) {
+        return ret;
+    }
+
+    uint64_t inode;
+    ret = resolve_target(path, &inode);
+    if (ret != 0) {
+        return ret;
+    }
+
+    ret = redis_meta_remove_xattr(g_fs_context->meta, inode, name);
+    if (ret < 0) {
+        return -EIO;
+    }
+    if (ret > 0) {
+        return -ENODATA;
+    }
+
+    return xattr_changed(inode);
+}
+
+int fs_removexattr(const char *path, const char *name) {
+    qos_slot_t slot;
+    if (op_begin(QOS_META, path, 1, &slot) != 0) {
+        return -EAGAIN;
+    }
+    int ret = do_removexattr(path, name);
+    op_end(QOS_META, slot);
+    forget_path(path, 0);
+    return ret;
 }
 
 void* fs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
-    (void)conn;
     cfg->kernel_cache = 1;
+
+    // 报告 Redis 中的 inode，同一文件的各个硬链接有相同的 inode 号
+    cfg->use_ino = 1;
+
+    // 删除打开的文件时不改名为 .fuse_hidden，由 openfiles 推迟到最后一次关闭再删除数据；
+    // 之后对该句柄的操作路径为 NULL，通过 fi->fh 中的 inode 访问
+    cfg->hard_remove = 1;
+
+#ifdef FUSE_CAP_CACHE_SYMLINKS
+    // 符号链接的目标不会改变，由内核缓存
+    if (conn->capable & FUSE_CAP_CACHE_SYMLINKS) {
+        conn->want |= FUSE_CAP_CACHE_SYMLINKS;
+    }
+#endif
+
+    // 回写缓存：小的写入先合并在内核页缓存中，再以大块刷出。此时文件大小和 mtime/ctime 以内核为准：
+    // 写入只扩展大小、不修改时间，时间由内核随后通过 utimens 回写；
+    // O_APPEND 由内核按自己的文件大小换算为偏移，写入始终按给定偏移处理
+    if (g_fs_context->writeback_cache) {
+        if (conn->capable & FUSE_CAP_WRITEBACK_CACHE) {
+            conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+        } else {
+            fprintf(stderr, "Kernel does not support the writeback cache, using write-through\n");
+            g_fs_context->writeback_cache = 0;
+        }
+    }
+
+    // 其他挂载的修改会主动失效内核缓存，目录项和属性可以长时间缓存
+    if (g_fs_context->cache) {
+        cfg->entry_timeout = meta_cache_timeout(g_fs_context->cache);
+        cfg->attr_timeout = meta_cache_timeout(g_fs_context->cache);
+    }
+
+    // 查找失败时回复不存在的目录项，重复的探测由内核直接返回 ENOENT
+    cfg->negative_timeout = g_fs_context->negative_timeout;
+
+    // 线程不能跨越 fork，转入后台之后才启动
+    if (redis_meta_start_probe(g_fs_context->meta) != 0) {
+        fprintf(stderr, "Failed to start replica probing, reading from the primary only\n");
+    }
+    if (g_fs_context->reaper && reaper_start(g_fs_context->reaper) != 0) {
+        fprintf(stderr, "Failed to start background deletion threads\n");
+    }
+    if (g_fs_context->dirstat && dirstat_start(g_fs_context->dirstat) != 0) {
+        fprintf(stderr, "Failed to start directory usage propagation\n");
+    }
+    if (g_fs_context->journal && journal_start(g_fs_context->journal) != 0) {
+        fprintf(stderr, "Failed to start metadata journal\n");
+    }
+    if (g_fs_context->migrator && migrator_start(g_fs_context->migrator) != 0) {
+        fprintf(stderr, "Failed to start tier migration\n");
+    }
+    if (g_fs_context->invalidator &&
+        invalidator_start(g_fs_context->invalidator, fuse_get_context()->fuse) != 0) {
+        fprintf(stderr, "Failed to start cache invalidation\n");
+    }
     return NULL;
 }
 
@@ -0,0 +1,279 @@
+#define FUSE_USE_VERSION 30
+#include "invalidator.h"
+#include <fuse3/fuse.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+// Redis 发送失效通知的频道
+static const char *INVALIDATE_CHANNEL = "__redis__:invalidate";
+
+struct invalidator {
+    redis_meta_t *meta;         // 挂载的元数据存储（在它的主连接上开启转发）
+    meta_cache_t *cache;
+    struct fuse *fuse;
+
+    char *addr;
+    int port;
+    char *password;
+    redisContext *ctx;          // 订阅连接
+    long long client_id;
+    long long retracking;       // 重连后等待主连接改为转发到该连接
+
+    pthread_t thread;
+    int started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int stopping;
+};
+
+// 连接、认证并订阅失效通知，返回订阅连接的客户端 id
+static long long subscribe(invalidator_t *inv) {
+    redisContext *c = redisConnect(inv->addr, inv->port);
+    if (!c || c->err) {
+        if (c) redisFree(c);
+        return -1;
+    }
+
+    redisReply *reply;
+    if (inv->password) {
+        reply = (redisReply*)redisCommand(c, "AUTH %s", inv->password);
+        int ok = reply && reply->type != REDIS_REPLY_ERROR;
+        if (reply) freeReplyObject(reply);
+        if (!ok) {
+            redisFree(c);
+            return -1;
+        }
+    }
+
+    reply = (redisReply*)redisCommand(c, "CLIENT ID");
+    long long id = reply && reply->type == REDIS_REPLY_INTEGER ? reply->integer : -1;
+    if (reply) freeReplyObject(reply);
+
+    if (id <= 0) {
+        redisFree(c);
+        return -1;
+    }
+
+    // 之后的消息在线程中读取
+    reply = (redisReply*)redisCommand(c, "SUBSCRIBE %s", INVALIDATE_CHANNEL);
+    int ok = reply && reply->type == REDIS_REPLY_ARRAY;
+    if (reply) freeReplyObject(reply);
+    if (!ok) {
+        redisFree(c);
+        return -1;
+    }
+
+    inv->ctx = c;
+    inv->client_id = id;
+    return id;
+}
+
+invalidator_t* invalidator_new(redis_meta_t *meta, meta_cache_t *cache,
+                               const char *addr, int port, const char *password) {
+    invalidator_t *inv = (invalidator_t*)calloc(1, sizeof(invalidator_t));
+    if (!inv) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&inv->lock, NULL);
+    pthread_cond_init(&inv->wake, NULL);
+    inv->meta = meta;
+    inv->cache = cache;
+    inv->port = port;
+    inv->addr = strdup(addr);
+    if (password && strlen(password) > 0) {
+        inv->password = strdup(password);
+    }
+
+    if (!inv->addr || subscribe(inv) < 0 ||
+        redis_meta_enable_tracking(meta, inv->client_id) != 0) {
+        invalidator_free(inv);
+        return NULL;
+    }
+
+    return inv;
+}
+
+// 通知内核丢弃路径对应节点的属性和页缓存（FUSE 尚未缓存该路径时忽略）
+static void invalidate_paths(invalidator_t *inv, char **paths, int count) {
+    for (int i = 0; i < count; i++) {
+        fuse_invalidate_path(inv->fuse, paths[i]);
+    }
+    meta_cache_paths_free(paths, count);
+}
+
+static void invalidate_all(invalidator_t *inv) {
+    char **paths;
+    int count = meta_cache_invalidate_all(inv->cache, &paths);
+    invalidate_paths(inv, paths, count);
+}
+
+static void handle_key(invalidator_t *inv, const char *key) {
+    uint64_t inode;
+    char **paths;
+    int count;
+
+    int kind = redis_meta_parse_key(key, &inode);
+    if (kind == 0) {
+        return;
+    }
+
+    // 其他挂载刚修改过这个 inode 的键，副本可能还没有同步，之后一段时间只有它的读取走主节点
+    redis_meta_note_remote_write(inv->meta, inode);
+
+    switch (kind) {
+        case META_KEY_NODE:
+            count = meta_cache_invalidate_node(inv->cache, inode, &paths);
+            break;
+        case META_KEY_DIR:
+            count = meta_cache_invalidate_dir(inv->cache, inode, &paths);
+            break;
+        case META_KEY_XATTR:
+            meta_cache_forget_xattrs(inv->cache, inode);
+            return;
+        default:
+            return;
+    }
+    invalidate_paths(inv, paths, count);
+}
+
+// 消息为 [message, 频道, 键数组]，FLUSHDB/FLUSHALL 时键数组为空值
+static void handle_message(invalidator_t *inv, const redisReply *reply) {
+    if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 3 ||
+        reply->element[0]->type != REDIS_REPLY_STRING ||
+        strcmp(reply->element[0]->str, "message") != 0) {
+        return;
+    }
+
+    const redisReply *keys = reply->element[2];
+    if (keys->type == REDIS_REPLY_ARRAY) {
+        for (size_t i = 0; i < keys->elements; i++) {
+            if (keys->element[i]->type == REDIS_REPLY_STRING) {
+                handle_key(inv, keys->element[i]->str);
+            }
+        }
+    } else {
+        invalidate_all(inv);
+    }
+}
+
+// 断开期间的通知已经丢失，重连后丢弃全部缓存
+static void reconnect(invalidator_t *inv) {
+    if (inv->ctx) {
+        redisFree(inv->ctx);
+        inv->ctx = NULL;
+    }
+
+    if (subscribe(inv) < 0) {
+        return;
+    }
+    redis_meta_retrack(inv->meta, inv->client_id);
+    inv->retracking = inv->client_id;
+    invalidate_all(inv);
+}
+
+static void* listener_main(void *arg) {
+    invalidator_t *inv = (invalidator_t*)arg;
+    int failing = 0;
+    time_t next_expire = time(NULL) + INVALIDATOR_EXPIRE_INTERVAL;
+
+    pthread_mutex_lock(&inv->lock);
+    while (!inv->stopping) {
+        pthread_mutex_unlock(&inv->lock);
+
+        if (!inv->ctx) {
+            reconnect(inv);
+            if (!inv->ctx) {
+                if (!failing) {
+                    fprintf(stderr, "Lost the cache invalidation connection, retrying\n");
+                }
+                failing = 1;
+
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_sec += INVALIDATOR_RETRY_INTERVAL;
+                pthread_mutex_lock(&inv->lock);
+                if (!inv->stopping) {
+                    pthread_cond_timedwait(&inv->wake, &inv->lock, &deadline);
+                }
+                continue;
+            }
+            failing = 0;
+        }
+
+        // 主连接改为转发到新连接之前的修改不会通知，生效后再丢弃一次
+        if (inv->retracking && redis_meta_tracking(inv->meta) == inv->retracking) {
+            inv->retracking = 0;
+            invalidate_all(inv);
+        }
+
+        // 先处理已读入的消息，没有时等待连接可读，超时用于检查停止标志和清理过期缓存项
+        redisReply *reply = NULL;
+        int ok = redisReaderGetReply(inv->ctx->reader, (void**)&reply) == REDIS_OK;
+        if (ok && reply) {
+            handle_message(inv, reply);
+            freeReplyObject(reply);
+        } else if (ok) {
+            struct pollfd pfd = {inv->ctx->fd, POLLIN, 0};
+            int ready = poll(&pfd, 1, 1000);
+            ok = ready >= 0 && (ready == 0 || redisBufferRead(inv->ctx) == REDIS_OK);
+        }
+        if (!ok) {
+            redisFree(inv->ctx);
+            inv->ctx = NULL;
+        }
+
+        if (time(NULL) >= next_expire) {
+            meta_cache_expire(inv->cache);
+            next_expire = time(NULL) + INVALIDATOR_EXPIRE_INTERVAL;
+        }
+
+        pthread_mutex_lock(&inv->lock);
+    }
+    pthread_mutex_unlock(&inv->lock);
+
+    return NULL;
+}
+
+int invalidator_start(invalidator_t *inv, struct fuse *fuse) {
+    if (inv->started) {
+        return 0;
+    }
+
+    inv->fuse = fuse;
+    if (pthread_create(&inv->thread, NULL, listener_main, inv) != 0) {
+        return -1;
+    }
+    inv->started = 1;
+
+    return 0;
+}
+
+void invalidator_free(invalidator_t *inv) {
+    if (!inv) {
+        return;
+    }
+
+    pthread_mutex_lock(&inv->lock);
+    inv->stopping = 1;
+    pthread_cond_signal(&inv->wake);
+    pthread_mutex_unlock(&inv->lock);
+
+    if (inv->started) {
+        pthread_join(inv->thread, NULL);
+    }
+
+    if (inv->ctx) {
+        redisFree(inv->ctx);
+    }
+    free(inv->addr);
+    free(inv->password);
+    pthread_mutex_destroy(&inv->lock);
+    pthread_cond_destroy(&inv->wake);
+    free(inv);
+}
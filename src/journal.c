@@ -0,0 +1,817 @@
+#include "journal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+// 文件头：魔数和日志 id（Redis 中 journal:<id> 记录该日志已应用到的序号）
+static const char JOURNAL_MAGIC[4] = {'S', 'F', 'J', '1'};
+#define JOURNAL_HEADER_SIZE 12
+
+// 记录：内容长度、内容的校验和、内容；内容为序号、类型、父目录、名字长度、名字、节点记录
+// 崩溃时最后一条记录可能不完整，校验失败时忽略它及之后的内容
+#define RECORD_HEAD_SIZE 8
+#define RECORD_FIXED_SIZE (8 + 1 + 8 + 2)
+#define RECORD_MAX_SIZE (RECORD_FIXED_SIZE + 255 + 1024)
+
+// 未应用的节点和目录项的哈希桶数
+#define JOURNAL_BUCKETS 16384
+
+// 应用失败后重试的间隔（毫秒）
+#define JOURNAL_RETRY_MS 1000
+
+// 尚未应用的节点，同时按 (parent, name) 和 inode 索引
+typedef struct jnode {
+    uint64_t inode;
+    uint64_t parent;
+    char name[256];
+    node_attr_t attr;           // 最新的节点属性
+    int refs;                   // 引用它的未应用记录数
+    struct jnode *name_next;
+    struct jnode *inode_next;
+} jnode_t;
+
+// 未应用的记录，按序号排队；应用时写入节点当前的属性，之后的记录重复写入相同的值
+typedef struct jrec {
+    uint64_t seq;
+    int op;
+    jnode_t *node;
+    struct jrec *next;
+} jrec_t;
+
+struct journal {
+    redis_meta_t *main;         // FUSE 操作使用的连接（预留 inode，应用后标记写入）
+    redis_meta_t *meta;         // 后台应用使用的连接
+    int fd;
+    uint64_t id;
+    uint64_t size;              // 日志文件大小
+    uint64_t next_seq;          // 下一条记录的序号
+    uint64_t applied;           // 已应用到的序号
+    uint64_t next_inode;        // 预留的 inode 范围 [next_inode, inode_end)
+    uint64_t inode_end;
+
+    jnode_t **by_name;
+    jnode_t **by_inode;
+    jrec_t *head;
+    jrec_t *tail;
+    int pending;                // 未应用的记录数
+
+    // 后台线程组装一批修改使用的缓冲区
+    meta_journal_op_t *batch_ops;
+    node_attr_t *batch_attrs;
+    char (*batch_names)[256];
+    int *batch_conflicts;
+
+    pthread_t thread;
+    int started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // 唤醒后台线程
+    pthread_cond_t progress;    // 应用了一批或应用失败
+    pthread_cond_t reserved;    // 预留 inode 的往返结束
+    int reserving;              // 有线程正在锁外预留 inode
+    int stopping;
+    int urgent;                 // 有调用者在等待，不等攒够一批
+    uint64_t failures;          // 应用失败的次数
+};
+
+static uint32_t fnv1a(uint32_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+#define FNV_OFFSET 2166136261u
+
+static size_t name_bucket(uint64_t parent, const char *name) {
+    uint32_t h = fnv1a(FNV_OFFSET, &parent, sizeof(parent));
+    return fnv1a(h, name, strlen(name)) % JOURNAL_BUCKETS;
+}
+
+static jnode_t* find_name(journal_t *journal, uint64_t parent, const char *name) {
+    jnode_t *node = journal->by_name[name_bucket(parent, name)];
+    while (node && (node->parent != parent || strcmp(node->name, name) != 0)) {
+        node = node->name_next;
+    }
+    return node;
+}
+
+static jnode_t* find_inode(journal_t *journal, uint64_t inode) {
+    jnode_t *node = journal->by_inode[inode % JOURNAL_BUCKETS];
+    while (node && node->inode != inode) {
+        node = node->inode_next;
+    }
+    return node;
+}
+
+static void insert_node(journal_t *journal, jnode_t *node) {
+    size_t b = name_bucket(node->parent, node->name);
+    node->name_next = journal->by_name[b];
+    journal->by_name[b] = node;
+
+    b = node->inode % JOURNAL_BUCKETS;
+    node->inode_next = journal->by_inode[b];
+    journal->by_inode[b] = node;
+}
+
+static void remove_node(journal_t *journal, jnode_t *node) {
+    jnode_t **p = &journal->by_name[name_bucket(node->parent, node->name)];
+    while (*p && *p != node) {
+        p = &(*p)->name_next;
+    }
+    if (*p) {
+        *p = node->name_next;
+    }
+
+    p = &journal->by_inode[node->inode % JOURNAL_BUCKETS];
+    while (*p && *p != node) {
+        p = &(*p)->inode_next;
+    }
+    if (*p) {
+        *p = node->inode_next;
+    }
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// 追加一条记录并排队（持有锁），rec 由调用者分配
+// 写入失败时截掉不完整的部分，之后的记录仍能在重放时读到
+static int log_change(journal_t *journal, jrec_t *rec, int op, jnode_t *node) {
+    char attr_str[1024];
+    node_attr_format(&node->attr, attr_str, sizeof(attr_str));
+
+    uint64_t seq = journal->next_seq;
+    uint16_t name_len = op == META_JOURNAL_CREATE ? (uint16_t)strlen(node->name) : 0;
+    size_t attr_len = strlen(attr_str);
+    uint32_t len = (uint32_t)(RECORD_FIXED_SIZE + name_len + attr_len);
+
+    char buf[RECORD_HEAD_SIZE + RECORD_MAX_SIZE];
+    char *p = buf + RECORD_HEAD_SIZE;
+    memcpy(p, &seq, 8);
+    p[8] = (char)op;
+    memcpy(p + 9, &node->parent, 8);
+    memcpy(p + 17, &name_len, 2);
+    memcpy(p + RECORD_FIXED_SIZE, node->name, name_len);
+    memcpy(p + RECORD_FIXED_SIZE + name_len, attr_str, attr_len);
+    uint32_t sum = fnv1a(FNV_OFFSET, p, len);
+    memcpy(buf, &len, 4);
+    memcpy(buf + 4, &sum, 4);
+
+    if (write_all(journal->fd, buf, RECORD_HEAD_SIZE + len) != 0) {
+        if (ftruncate(journal->fd, (off_t)journal->size) != 0) {
+            perror("Failed to discard partial journal record");
+        }
+        return -1;
+    }
+    journal->size += RECORD_HEAD_SIZE + len;
+
+    rec->seq = seq;
+    rec->op = op;
+    rec->node = node;
+    rec->next = NULL;
+    if (journal->tail) {
+        journal->tail->next = rec;
+    } else {
+        journal->head = rec;
+    }
+    journal->tail = rec;
+    journal->next_seq++;
+    journal->pending++;
+    node->refs++;
+
+    if (journal->pending >= JOURNAL_BATCH) {
+        pthread_cond_signal(&journal->wake);
+    }
+    return 0;
+}
+
+// 从现在起 ms 毫秒后的时刻（CLOCK_REALTIME，用于 pthread_cond_timedwait）
+static struct timespec deadline_after(int ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+// 报告应用时被放弃的创建：创建后、应用前其他挂载添加了同名的目录项，或父目录已被删除
+// 被放弃的节点已在应用的事务中加入待删除集合，已写入的数据由后台删除回收
+static void report_conflicts(const meta_journal_op_t *ops, const int *conflicts, int count) {
+    for (int i = 0; i < count; i++) {
+        if (conflicts[i]) {
+            fprintf(stderr, "Discarded journaled create of '%s' (inode %lu) in directory %lu: name already "
+                    "exists or directory removed, data queued for deletion\n",
+                    ops[i].name, ops[i].attr->inode, ops[i].parent);
+        }
+    }
+}
+
+// 应用队首的一批修改，返回应用的条数，失败返回 -1
+static int apply_batch(journal_t *journal) {
+    pthread_mutex_lock(&journal->lock);
+    int count = 0;
+    uint64_t last = 0;
+    for (jrec_t *rec = journal->head; rec && count < JOURNAL_BATCH; rec = rec->next) {
+        jnode_t *node = rec->node;
+        journal->batch_attrs[count] = node->attr;
+        memcpy(journal->batch_names[count], node->name, sizeof(node->name));
+        journal->batch_ops[count].op = rec->op;
+        journal->batch_ops[count].parent = node->parent;
+        journal->batch_ops[count].name = journal->batch_names[count];
+        journal->batch_ops[count].attr = &journal->batch_attrs[count];
+        last = rec->seq;
+        count++;
+    }
+    journal->urgent = 0;
+    pthread_mutex_unlock(&journal->lock);
+
+    if (count == 0) {
+        return 0;
+    }
+
+    // 一批修改共用一次日志落盘，机器崩溃时最多丢失最近一个间隔内未应用的修改
+    if (fdatasync(journal->fd) != 0) {
+        perror("Failed to sync metadata journal");
+    }
+
+    int ret = redis_meta_apply_journal(journal->meta, journal->id, journal->batch_ops, count, last,
+                                       journal->batch_conflicts);
+    if (ret == 0) {
+        report_conflicts(journal->batch_ops, journal->batch_conflicts, count);
+    }
+
+    // 修改由另一个连接写入，主连接之后一段时间不从副本读取，避免刚移出日志的节点暂时不可见
+    redis_meta_note_write(journal->main);
+
+    pthread_mutex_lock(&journal->lock);
+    if (ret == 0) {
+        for (int i = 0; i < count; i++) {
+            jrec_t *rec = journal->head;
+            journal->head = rec->next;
+            if (--rec->node->refs == 0) {
+                remove_node(journal, rec->node);
+                free(rec->node);
+            }
+            free(rec);
+            journal->pending--;
+        }
+        if (!journal->head) {
+            journal->tail = NULL;
+        }
+        journal->applied = last;
+
+        // 全部应用后清空过大的日志，之后的记录沿用同一个 id 和递增的序号
+        if (!journal->head && journal->size > JOURNAL_COMPACT_SIZE &&
+            ftruncate(journal->fd, JOURNAL_HEADER_SIZE) == 0) {
+            journal->size = JOURNAL_HEADER_SIZE;
+        }
+    } else {
+        journal->failures++;
+    }
+    pthread_cond_broadcast(&journal->progress);
+    pthread_mutex_unlock(&journal->lock);
+
+    return ret == 0 ? count : -1;
+}
+
+static void* applier_main(void *arg) {
+    journal_t *journal = (journal_t*)arg;
+    int failing = 0;
+
+    pthread_mutex_lock(&journal->lock);
+    while (!journal->stopping) {
+        // 等待攒够一批、有调用者等待或间隔到期
+        if (failing || (!journal->urgent && journal->pending < JOURNAL_BATCH)) {
+            struct timespec deadline = deadline_after(failing ? JOURNAL_RETRY_MS : JOURNAL_FLUSH_INTERVAL_MS);
+            pthread_cond_timedwait(&journal->wake, &journal->lock, &deadline);
+            if (journal->stopping) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&journal->lock);
+
+        int n;
+        while ((n = apply_batch(journal)) > 0) {
+        }
+
+        // 修改保留在日志中，失败时稍后重试，只报告一次
+        if (n < 0) {
+            if (!failing) {
+                fprintf(stderr, "Failed to apply metadata journal, retrying\n");
+            }
+            failing = 1;
+        } else {
+            failing = 0;
+        }
+
+        pthread_mutex_lock(&journal->lock);
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    return NULL;
+}
+
+// 新日志的 id
+static uint64_t random_id(void) {
+    uint64_t id = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        if (read(fd, &id, sizeof(id)) != (ssize_t)sizeof(id)) {
+            id = 0;
+        }
+        close(fd);
+    }
+    if (id == 0) {
+        id = ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid();
+    }
+    return id;
+}
+
+// 重放上次挂载未应用的修改，然后换用新的 id 清空日志
+static int recover(journal_t *journal) {
+    struct stat st;
+    if (fstat(journal->fd, &st) != 0) {
+        return -1;
+    }
+
+    uint64_t old_id = 0;
+    char header[JOURNAL_HEADER_SIZE];
+    if (st.st_size >= JOURNAL_HEADER_SIZE &&
+        pread(journal->fd, header, JOURNAL_HEADER_SIZE, 0) == JOURNAL_HEADER_SIZE &&
+        memcmp(header, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0) {
+        memcpy(&old_id, header + sizeof(JOURNAL_MAGIC), 8);
+    }
+
+    if (old_id != 0) {
+        uint64_t applied;
+        if (redis_meta_journal_applied(journal->meta, old_id, &applied) != 0) {
+            return -1;
+        }
+
+        char buf[RECORD_MAX_SIZE];
+        off_t offset = JOURNAL_HEADER_SIZE;
+        int count = 0;
+        int replayed = 0;
+        uint64_t last = 0;
+        for (;;) {
+            uint32_t head[2];
+            if (pread(journal->fd, head, RECORD_HEAD_SIZE, offset) != RECORD_HEAD_SIZE) {
+                break;
+            }
+            uint32_t len = head[0];
+            if (len < RECORD_FIXED_SIZE || len > RECORD_MAX_SIZE ||
+                pread(journal->fd, buf, len, offset + RECORD_HEAD_SIZE) != (ssize_t)len ||
+                fnv1a(FNV_OFFSET, buf, len) != head[1]) {
+                break;
+            }
+            offset += RECORD_HEAD_SIZE + len;
+
+            uint64_t seq;
+            uint16_t name_len;
+            memcpy(&seq, buf, 8);
+            memcpy(&name_len, buf + 17, 2);
+            int op = buf[8];
+            size_t attr_len = len - RECORD_FIXED_SIZE - name_len;
+            if (seq <= applied || name_len > 255 || name_len > len - RECORD_FIXED_SIZE ||
+                (op != META_JOURNAL_CREATE && op != META_JOURNAL_SETATTR)) {
+                continue;
+            }
+
+            char attr_str[1025];
+            memcpy(attr_str, buf + RECORD_FIXED_SIZE + name_len, attr_len);
+            attr_str[attr_len] = '\0';
+            node_attr_parse(attr_str, &journal->batch_attrs[count]);
+            memcpy(journal->batch_names[count], buf + RECORD_FIXED_SIZE, name_len);
+            journal->batch_names[count][name_len] = '\0';
+            journal->batch_ops[count].op = op;
+            memcpy(&journal->batch_ops[count].parent, buf + 9, 8);
+            journal->batch_ops[count].name = journal->batch_names[count];
+            journal->batch_ops[count].attr = &journal->batch_attrs[count];
+            last = seq;
+
+            if (++count == JOURNAL_BATCH) {
+                if (redis_meta_apply_journal(journal->meta, old_id, journal->batch_ops, count, last,
+                                             journal->batch_conflicts) != 0) {
+                    return -1;
+                }
+                report_conflicts(journal->batch_ops, journal->batch_conflicts, count);
+                replayed += count;
+                count = 0;
+            }
+        }
+        if (count > 0) {
+            if (redis_meta_apply_journal(journal->meta, old_id, journal->batch_ops, count, last,
+                                         journal->batch_conflicts) != 0) {
+                return -1;
+            }
+            report_conflicts(journal->batch_ops, journal->batch_conflicts, count);
+            replayed += count;
+        }
+        if (replayed > 0) {
+            printf("Replayed %d metadata changes from the journal\n", replayed);
+        }
+    }
+
+    // 先写入新的文件头再删除旧 id 的序号：中途崩溃时旧记录仍按旧序号跳过
+    uint64_t id = random_id();
+    memcpy(header, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    memcpy(header + sizeof(JOURNAL_MAGIC), &id, 8);
+    if (ftruncate(journal->fd, 0) != 0 ||
+        write_all(journal->fd, header, JOURNAL_HEADER_SIZE) != 0 ||
+        fdatasync(journal->fd) != 0) {
+        return -1;
+    }
+    journal->id = id;
+    journal->size = JOURNAL_HEADER_SIZE;
+
+    if (old_id != 0) {
+        redis_meta_forget_journal(journal->meta, old_id);
+    }
+    return 0;
+}
+
+journal_t* journal_new(redis_meta_t *meta, const char *dir, const char *addr, int port,
+                       const char *password, int db) {
+    journal_t *journal = (journal_t*)calloc(1, sizeof(journal_t));
+    if (!journal) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->wake, NULL);
+    pthread_cond_init(&journal->progress, NULL);
+    pthread_cond_init(&journal->reserved, NULL);
+    journal->main = meta;
+    journal->fd = -1;
+    journal->next_seq = 1;
+
+    journal->by_name = (jnode_t**)calloc(JOURNAL_BUCKETS, sizeof(jnode_t*));
+    journal->by_inode = (jnode_t**)calloc(JOURNAL_BUCKETS, sizeof(jnode_t*));
+    journal->batch_ops = (meta_journal_op_t*)malloc(sizeof(meta_journal_op_t) * JOURNAL_BATCH);
+    journal->batch_attrs = (node_attr_t*)malloc(sizeof(node_attr_t) * JOURNAL_BATCH);
+    journal->batch_names = (char(*)[256])malloc(sizeof(*journal->batch_names) * JOURNAL_BATCH);
+    journal->batch_conflicts = (int*)malloc(sizeof(int) * JOURNAL_BATCH);
+    journal->meta = redis_meta_new(addr, port, password, db);
+    if (!journal->by_name || !journal->by_inode || !journal->batch_ops || !journal->batch_attrs ||
+        !journal->batch_names || !journal->batch_conflicts || !journal->meta) {
+        journal_free(journal);
+        return NULL;
+    }
+    // 与主连接维护相同的目录统计
+    journal->meta->dirstat = meta->dirstat;
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, JOURNAL_FILE);
+    journal->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (journal->fd < 0) {
+        perror("Failed to open metadata journal");
+        journal_free(journal);
+        return NULL;
+    }
+
+    if (recover(journal) != 0) {
+        fprintf(stderr, "Failed to replay metadata journal %s\n", path);
+        journal_free(journal);
+        return NULL;
+    }
+
+    return journal;
+}
+
+int journal_start(journal_t *journal) {
+    if (journal->started) {
+        return 0;
+    }
+
+    if (pthread_create(&journal->thread, NULL, applier_main, journal) != 0) {
+        return -1;
+    }
+    journal->started = 1;
+
+    return 0;
+}
+
+void journal_free(journal_t *journal) {
+    if (!journal) {
+        return;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    journal->stopping = 1;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->lock);
+
+    if (journal->started) {
+        pthread_join(journal->thread, NULL);
+    }
+
+    // 应用剩余的修改，失败时留在日志中，下次挂载时重放
+    if (journal->head) {
+        int n;
+        while ((n = apply_batch(journal)) > 0) {
+        }
+        if (n < 0) {
+            fprintf(stderr, "Metadata journal not fully applied, it will be replayed on the next mount\n");
+        }
+    }
+
+    while (journal->head) {
+        jrec_t *rec = journal->head;
+        journal->head = rec->next;
+        if (--rec->node->refs == 0) {
+            free(rec->node);
+        }
+        free(rec);
+    }
+
+    if (journal->fd >= 0) {
+        fdatasync(journal->fd);
+        close(journal->fd);
+    }
+    if (journal->meta) {
+        redis_meta_free(journal->meta);
+    }
+    free(journal->by_name);
+    free(journal->by_inode);
+    free(journal->batch_ops);
+    free(journal->batch_attrs);
+    free(journal->batch_names);
+    free(journal->batch_conflicts);
+    pthread_mutex_destroy(&journal->lock);
+    pthread_cond_destroy(&journal->wake);
+    pthread_cond_destroy(&journal->progress);
+    pthread_cond_destroy(&journal->reserved);
+    free(journal);
+}
+
+int journal_create(journal_t *journal, uint64_t parent, const char *name, uint32_t mode,
+                   uint32_t uid, uint32_t gid, node_attr_t **result_attr) {
+    if (strlen(name) > 255) {
+        return -1;
+    }
+
+    node_attr_t *attr = node_attr_alloc();
+    jnode_t *node = (jnode_t*)calloc(1, sizeof(jnode_t));
+    jrec_t *rec = (jrec_t*)malloc(sizeof(jrec_t));
+    if (!attr || !node || !rec) {
+        node_attr_free(attr);
+        free(node);
+        free(rec);
+        return -1;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+
+    // 未应用的修改过多时等待后台应用
+    while (journal->pending >= JOURNAL_MAX_PENDING && !journal->stopping) {
+        journal->urgent = 1;
+        pthread_cond_signal(&journal->wake);
+        pthread_cond_wait(&journal->progress, &journal->lock);
+    }
+
+    // 预留的 inode 用完时由一个线程在锁外向 Redis 预留下一段，其他创建等它完成，
+    // 往返期间日志的查找和后台应用不被阻塞
+    while (journal->next_inode == journal->inode_end) {
+        if (journal->reserving) {
+            pthread_cond_wait(&journal->reserved, &journal->lock);
+            continue;
+        }
+        journal->reserving = 1;
+        pthread_mutex_unlock(&journal->lock);
+        uint64_t first = redis_meta_reserve_inodes(journal->main, JOURNAL_INODE_RESERVE);
+        pthread_mutex_lock(&journal->lock);
+        journal->reserving = 0;
+        pthread_cond_broadcast(&journal->reserved);
+        if (first == 0) {
+            pthread_mutex_unlock(&journal->lock);
+            node_attr_free(attr);
+            free(node);
+            free(rec);
+            return -1;
+        }
+        journal->next_inode = first;
+        journal->inode_end = first + JOURNAL_INODE_RESERVE;
+    }
+
+    // 名字在尚未应用的目录项中已存在时不创建；Redis 中已有的名字由调用者在创建前查找，
+    // 之后其他挂载创建的同名目录项在应用时由按条件添加目录项的脚本发现，这次创建被放弃并报告
+    if (find_name(journal, parent, name)) {
+        pthread_mutex_unlock(&journal->lock);
+        node_attr_free(attr);
+        free(node);
+        free(rec);
+        return 1;
+    }
+
+    // 与 redis_meta_create_node 相同的初始属性；数据不内联，写入只修改日志中的属性
+    uint64_t now = (uint64_t)time(NULL);
+    memset(attr, 0, sizeof(node_attr_t));
+    attr->inode = journal->next_inode++;
+    attr->mode = mode;
+    attr->uid = uid;
+    attr->gid = gid;
+    attr->atime = now;
+    attr->mtime = now;
+    attr->ctime = now;
+    attr->parent = parent;
+    attr->nlink = S_ISDIR(mode) ? 2 : 1;
+
+    node->inode = attr->inode;
+    node->parent = parent;
+    strcpy(node->name, name);
+    node->attr = *attr;
+
+    if (log_change(journal, rec, META_JOURNAL_CREATE, node) != 0) {
+        pthread_mutex_unlock(&journal->lock);
+        node_attr_free(attr);
+        free(node);
+        free(rec);
+        return -1;
+    }
+    insert_node(journal, node);
+    pthread_mutex_unlock(&journal->lock);
+
+    *result_attr = attr;
+    return 0;
+}
+
+int journal_lookup(journal_t *journal, uint64_t parent, const char *name, uint64_t *inode) {
+    pthread_mutex_lock(&journal->lock);
+    jnode_t *node = find_name(journal, parent, name);
+    if (node) {
+        *inode = node->inode;
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return node != NULL;
+}
+
+int journal_get_node(journal_t *journal, uint64_t inode, node_attr_t **attr) {
+    node_attr_t *result = node_attr_alloc();
+    if (!result) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    jnode_t *node = find_inode(journal, inode);
+    if (node) {
+        *result = node->attr;
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    if (!node) {
+        node_attr_free(result);
+        return 0;
+    }
+    *attr = result;
+    return 1;
+}
+
+// 把 attr 记入尚未应用的节点，返回 1；节点已应用返回 0，写入日志失败返回 -1
+static int log_attr(journal_t *journal, jnode_t *node, const node_attr_t *attr, jrec_t *rec) {
+    node_attr_t old = node->attr;
+    node->attr = *attr;
+    if (log_change(journal, rec, META_JOURNAL_SETATTR, node) != 0) {
+        node->attr = old;
+        return -1;
+    }
+    return 1;
+}
+
+int journal_change_node(journal_t *journal, uint64_t inode, int64_t mode, int64_t uid,
+                        int64_t gid, int64_t ctime) {
+    jrec_t *rec = (jrec_t*)malloc(sizeof(jrec_t));
+    if (!rec) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    int ret = 0;
+    jnode_t *node = find_inode(journal, inode);
+    if (node) {
+        node_attr_t updated = node->attr;
+        if (mode >= 0) {
+            updated.mode = (uint32_t)mode;
+        }
+        if (uid >= 0) {
+            updated.uid = (uint32_t)uid;
+        }
+        if (gid >= 0) {
+            updated.gid = (uint32_t)gid;
+        }
+        if (ctime != META_TIME_KEEP) {
+            updated.ctime = (uint64_t)ctime;
+        }
+        ret = log_attr(journal, node, &updated, rec);
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    if (ret != 1) {
+        free(rec);
+    }
+    return ret;
+}
+
+int journal_set_size(journal_t *journal, uint64_t inode, uint64_t size, int64_t mtime, int64_t ctime) {
+    jrec_t *rec = (jrec_t*)malloc(sizeof(jrec_t));
+    if (!rec) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    int ret = 0;
+    jnode_t *node = find_inode(journal, inode);
+    if (node) {
+        node_attr_t updated = node->attr;
+        updated.size = size;
+        updated.mtime = (uint64_t)mtime;
+        updated.ctime = (uint64_t)ctime;
+        ret = log_attr(journal, node, &updated, rec);
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    if (ret != 1) {
+        free(rec);
+    }
+    return ret;
+}
+
+int journal_touch_node(journal_t *journal, uint64_t inode, uint64_t min_size,
+                       int64_t atime, int64_t mtime, int64_t ctime) {
+    jrec_t *rec = (jrec_t*)malloc(sizeof(jrec_t));
+    if (!rec) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&journal->lock);
+    int ret = 0;
+    jnode_t *node = find_inode(journal, inode);
+    if (node) {
+        node_attr_t updated = node->attr;
+        if (min_size > updated.size) {
+            updated.size = min_size;
+        }
+        if (atime != META_TIME_KEEP) {
+            updated.atime = (uint64_t)atime;
+        }
+        if (mtime != META_TIME_KEEP) {
+            updated.mtime = (uint64_t)mtime;
+        }
+        if (ctime != META_TIME_KEEP) {
+            updated.ctime = (uint64_t)ctime;
+        }
+        ret = log_attr(journal, node, &updated, rec);
+    }
+    pthread_mutex_unlock(&journal->lock);
+
+    if (ret != 1) {
+        free(rec);
+    }
+    return ret;
+}
+
+int journal_drain(journal_t *journal) {
+    pthread_mutex_lock(&journal->lock);
+    uint64_t target = journal->next_seq - 1;
+    uint64_t failures = journal->failures;
+    int ret = 0;
+    while (journal->applied < target) {
+        if (journal->failures != failures || !journal->started) {
+            ret = -1;
+            break;
+        }
+        journal->urgent = 1;
+        pthread_cond_signal(&journal->wake);
+        pthread_cond_wait(&journal->progress, &journal->lock);
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return ret;
+}
+
+int journal_commit(journal_t *journal) {
+    return fdatasync(journal->fd) == 0 ? 0 : -1;
+}
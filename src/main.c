@@ -9,7 +9,9 @@
 #include "config.h"
 #include "redis_meta.h"
 #include "storage.h"
+#include "dedup.h"
 #include "fuse_ops.h"
+#include "mempool.h"
 
 static volatile int keep_running = 1;
 
@@ -41,6 +43,9 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    // hiredis 的回复和命令从线程本地缓存分配，必须在建立任何连接之前设置
+    mempool_install_hiredis();
+
     // 初始化 Redis 元数据存储
     redis_meta_t *meta = redis_meta_new(config.redis_addr, config.redis_port,
                                         config.redis_password, config.redis_db);
@@ -49,6 +54,32 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     printf("Connected to Redis\n");
+    if (meta->cluster) {
+        printf("Redis Cluster mode: keys spread over %u hash-tagged groups\n", meta->groups);
+    }
+
+    // 只读副本（集群模式下不使用）
+    if (config.redis_replica_count > 0 && meta->cluster) {
+        fprintf(stderr, "Warning: read replicas are ignored in Redis Cluster mode\n");
+    } else if (config.redis_replica_count > 0) {
+        meta->replica_max_lag = config.replica_max_lag > 0 ? (uint64_t)config.replica_max_lag : META_REPLICA_MAX_LAG;
+        for (int i = 0; i < config.redis_replica_count; i++) {
+            if (redis_meta_add_replica(meta, config.redis_replicas[i], config.redis_replica_ports[i],
+                                       config.redis_password, config.redis_db) != 0) {
+                fprintf(stderr, "Failed to connect to replica %s:%d\n",
+                        config.redis_replicas[i], config.redis_replica_ports[i]);
+                redis_meta_free(meta);
+                return 1;
+            }
+        }
+        printf("Read replicas enabled: %d (max lag %lu ms)\n", meta->replica_count,
+               (unsigned long)meta->replica_max_lag);
+    }
+
+    if (config.inline_threshold > 0) {
+        meta->inline_threshold = (size_t)config.inline_threshold;
+        printf("Inline data enabled for files up to %d bytes\n", config.inline_threshold);
+    }
 
     // 初始化存储层
     storage_t *storage = storage_new(config.data_dir);
@@ -59,6 +90,134 @@ int main(int argc, char *argv[]) {
     }
     printf("Initialized storage layer\n");
 
+    // 数据布局在卷首次挂载时确定，之后以 Redis 中的记录为准
+    uint64_t chunk_size;
+    if (redis_meta_load_setting(meta, "chunk_size", (uint64_t)config.chunk_size * 1024 * 1024,
+                                0, &chunk_size) != 0) {
+        fprintf(stderr, "Failed to load volume settings\n");
+        storage_free(storage);
+        redis_meta_free(meta);
+        return 1;
+    }
+    if (chunk_size != (uint64_t)config.chunk_size * 1024 * 1024) {
+        fprintf(stderr, "Warning: volume uses chunk size %lu bytes, ignoring --chunk-size\n", chunk_size);
+    }
+    if (chunk_size > 0) {
+        storage_set_chunk_size(storage, chunk_size);
+        printf("Chunked data layout: %lu bytes per chunk\n", chunk_size);
+    }
+
+    // 压缩格式同样属于卷格式；压缩算法可以按挂载选择，每块记录自己的算法
+    int codec = config.compress > 0 ? config.compress : STORAGE_CODEC_NONE;
+    if (!storage_codec_available(codec)) {
+        fprintf(stderr, "Compression codec not supported by this build\n");
+        storage_free(storage);
+        redis_meta_free(meta);
+        return 1;
+    }
+    uint64_t compress_block;
+    if (redis_meta_load_setting(meta, "compress_block",
+                                codec != STORAGE_CODEC_NONE ? STORAGE_COMPRESS_BLOCK : 0,
+                                0, &compress_block) != 0) {
+        fprintf(stderr, "Failed to load volume settings\n");
+        storage_free(storage);
+        redis_meta_free(meta);
+        return 1;
+    }
+    if (compress_block > 0) {
+        if (compress_block != STORAGE_COMPRESS_BLOCK) {
+            fprintf(stderr, "Unsupported compression block size: %lu\n", compress_block);
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        storage_enable_compression(storage, codec);
+        printf("Compressed data format (codec %d for new blocks)\n", codec);
+    } else if (codec != STORAGE_CODEC_NONE) {
+        fprintf(stderr, "Warning: volume was formatted without compression, ignoring --compress\n");
+    }
+
+    // 去重同样属于卷格式，与分块、压缩互斥；块引用计数是全局的键，集群模式下不支持
+    uint64_t dedup_block;
+    if (redis_meta_load_setting(meta, "dedup_block",
+                                config.dedup && chunk_size == 0 && compress_block == 0 && !meta->cluster ?
+                                DEDUP_BLOCK_SIZE : 0,
+                                0, &dedup_block) != 0) {
+        fprintf(stderr, "Failed to load volume settings\n");
+        storage_free(storage);
+        redis_meta_free(meta);
+        return 1;
+    }
+    if (dedup_block > 0) {
+        if (dedup_block != DEDUP_BLOCK_SIZE || chunk_size > 0 || compress_block > 0 || meta->cluster) {
+            fprintf(stderr, "Unsupported deduplication settings on this volume\n");
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+
+        // 块存储使用独立的 Redis 连接池
+        dedup_t *dedup = dedup_new(config.data_dir, config.redis_addr, config.redis_port,
+                                   config.redis_password, config.redis_db);
+        if (!dedup || storage_enable_dedup(storage, dedup) != 0) {
+            fprintf(stderr, "Failed to initialize block deduplication\n");
+            dedup_free(dedup);
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        printf("Block deduplication enabled: %lu bytes per block\n", dedup_block);
+    } else if (config.dedup) {
+        fprintf(stderr, "Warning: volume was formatted without deduplication, ignoring --dedup\n");
+    }
+
+    // 启用数据块缓存
+    if (config.cache_size > 0) {
+        if (storage_enable_cache(storage, (size_t)config.cache_size * 1024 * 1024) != 0) {
+            fprintf(stderr, "Failed to initialize block cache\n");
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        printf("Block cache enabled: %d MB\n", config.cache_size);
+    }
+
+    // 分层存储：新文件写入数据目录（快速层），冷文件迁移到容量层；去重的块由所有文件共享，不分层
+    if (config.cold_dir[0]) {
+        if (dedup_block > 0) {
+            fprintf(stderr, "Tiered storage is not supported on deduplicated volumes\n");
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        if (storage_enable_tiering(storage, config.cold_dir) != 0) {
+            fprintf(stderr, "Failed to initialize tiered storage\n");
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        printf("Tiered storage enabled: hot %s, cold %s\n", config.data_dir, config.cold_dir);
+    }
+
+    // 目录用量统计依赖节点记录中的父目录，旧版本创建的卷没有该字段，保持关闭；
+    // 传播时沿父目录链访问任意分组的节点，集群模式下也不启用
+    uint64_t dirstat;
+    if (redis_meta_load_setting(meta, "dirstat", meta->cluster ? 0 : 1, 0, &dirstat) != 0) {
+        fprintf(stderr, "Failed to load volume settings\n");
+        storage_free(storage);
+        redis_meta_free(meta);
+        return 1;
+    }
+    meta->dirstat = dirstat && !meta->cluster ? 1 : 0;
+
+    // 初始化用量计数器（旧卷需要扫描一次）
+    if (redis_meta_init_usage(meta) != 0) {
+        fprintf(stderr, "Failed to initialize usage counters\n");
+        storage_free(storage);
+        redis_meta_free(meta);
+        return 1;
+    }
+
     // 创建根目录（如果不存在）
     node_attr_t *root_attr;
     if (redis_meta_get_node(meta, 1, &root_attr) != 0) {
@@ -70,6 +229,172 @@ int main(int argc, char *argv[]) {
     fs_context_t fs_ctx;
     fs_ctx.meta = meta;
     fs_ctx.storage = storage;
+    fs_ctx.reaper = NULL;
+    fs_ctx.dirstat = NULL;
+    fs_ctx.cache = NULL;
+    fs_ctx.invalidator = NULL;
+    fs_ctx.syncer = NULL;
+    fs_ctx.journal = NULL;
+    fs_ctx.migrator = NULL;
+    fs_ctx.qos = NULL;
+    fs_ctx.negative_timeout = config.negative_timeout > 0 ? config.negative_timeout : 0;
+    fs_ctx.writeback_cache = config.writeback_cache;
+
+    // 后台删除
+    if (config.delete_threads > 0) {
+        fs_ctx.reaper = reaper_new(storage, config.redis_addr, config.redis_port,
+                                   config.redis_password, config.redis_db,
+                                   config.delete_threads, config.delete_rate);
+        if (!fs_ctx.reaper) {
+            fprintf(stderr, "Failed to initialize background deletion\n");
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        printf("Background deletion enabled: %d threads\n", config.delete_threads);
+    }
+
+    // 目录用量传播
+    if (meta->dirstat) {
+        fs_ctx.dirstat = dirstat_new(config.redis_addr, config.redis_port,
+                                     config.redis_password, config.redis_db);
+        if (!fs_ctx.dirstat) {
+            fprintf(stderr, "Failed to initialize directory usage propagation\n");
+            reaper_free(fs_ctx.reaper);
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        printf("Directory usage statistics enabled\n");
+    }
+
+    // 元数据缓存：依赖 Redis 6 的失效通知保持各挂载一致，集群模式下不启用
+    if (config.meta_cache > 0 && meta->cluster) {
+        fprintf(stderr, "Warning: metadata cache is not supported in Redis Cluster mode\n");
+    } else if (config.meta_cache > 0) {
+        fs_ctx.cache = meta_cache_new(config.meta_cache, (size_t)config.meta_cache_size * 1024 * 1024);
+        if (fs_ctx.cache) {
+            fs_ctx.invalidator = invalidator_new(meta, fs_ctx.cache, config.redis_addr, config.redis_port,
+                                                 config.redis_password);
+        }
+        if (!fs_ctx.invalidator) {
+            fprintf(stderr, "Failed to initialize metadata cache (requires Redis 6 client tracking)\n");
+            meta_cache_free(fs_ctx.cache);
+            dirstat_free(fs_ctx.dirstat);
+            reaper_free(fs_ctx.reaper);
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        printf("Metadata cache enabled: %d seconds, %d MB\n", config.meta_cache, config.meta_cache_size);
+    }
+
+    // 并发的 fsync 合并为批次，整批共用一次元数据持久化等待
+    fs_ctx.syncer = syncer_new(storage, meta, config.sync_aof, config.sync_replicas, config.sync_timeout);
+    if (!fs_ctx.syncer) {
+        fprintf(stderr, "Failed to initialize sync coordinator\n");
+        invalidator_free(fs_ctx.invalidator);
+        meta_cache_free(fs_ctx.cache);
+        dirstat_free(fs_ctx.dirstat);
+        reaper_free(fs_ctx.reaper);
+        storage_free(storage);
+        redis_meta_free(meta);
+        return 1;
+    }
+    if (config.sync_aof || config.sync_replicas > 0) {
+        printf("fsync waits for metadata durability:%s %d replicas\n",
+               config.sync_aof ? " AOF," : "", config.sync_replicas);
+    }
+
+    // 元数据写后日志：预留 inode 和应用顺序依赖单一的计数器和事务，集群模式下不启用
+    if (config.journal && meta->cluster) {
+        fprintf(stderr, "Warning: metadata journal is not supported in Redis Cluster mode\n");
+    } else if (config.journal) {
+        fs_ctx.journal = journal_new(meta, config.data_dir, config.redis_addr, config.redis_port,
+                                     config.redis_password, config.redis_db);
+        if (!fs_ctx.journal) {
+            fprintf(stderr, "Failed to initialize metadata journal\n");
+            syncer_free(fs_ctx.syncer);
+            invalidator_free(fs_ctx.invalidator);
+            meta_cache_free(fs_ctx.cache);
+            dirstat_free(fs_ctx.dirstat);
+            reaper_free(fs_ctx.reaper);
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        printf("Metadata journal enabled: %s/%s\n", config.data_dir, JOURNAL_FILE);
+    }
+
+    fs_ctx.openfiles = openfiles_new();
+    if (!fs_ctx.openfiles) {
+        fprintf(stderr, "Failed to initialize open file table\n");
+        journal_free(fs_ctx.journal);
+        syncer_free(fs_ctx.syncer);
+        invalidator_free(fs_ctx.invalidator);
+        meta_cache_free(fs_ctx.cache);
+        dirstat_free(fs_ctx.dirstat);
+        reaper_free(fs_ctx.reaper);
+        storage_free(storage);
+        redis_meta_free(meta);
+        return 1;
+    }
+
+    // 分层存储的后台迁移：所有分层的挂载都记录访问，cold_after 为 0 的挂载不迁移
+    if (config.cold_dir[0]) {
+        fs_ctx.migrator = migrator_new(storage, config.redis_addr, config.redis_port,
+                                       config.redis_password, config.redis_db, config.tier_cold_after);
+        if (!fs_ctx.migrator) {
+            fprintf(stderr, "Failed to initialize tier migration\n");
+            openfiles_free(fs_ctx.openfiles);
+            journal_free(fs_ctx.journal);
+            syncer_free(fs_ctx.syncer);
+            invalidator_free(fs_ctx.invalidator);
+            meta_cache_free(fs_ctx.cache);
+            dirstat_free(fs_ctx.dirstat);
+            reaper_free(fs_ctx.reaper);
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        if (config.tier_cold_after > 0) {
+            printf("Tier migration enabled: files idle for %d seconds move to the cold tier\n",
+                   config.tier_cold_after);
+        }
+    }
+
+    // 多租户 I/O 调度
+    if (config.qos >= 0) {
+        uint64_t meta_rate = config.qos_meta_rate > 0 ? (uint64_t)config.qos_meta_rate : 0;
+        uint64_t data_rate = config.qos_data_rate > 0 ? (uint64_t)config.qos_data_rate * 1024 * 1024 : 0;
+        fs_ctx.qos = qos_new(config.qos, meta_rate, data_rate, config.qos_slots, config.qos_tenant_slots);
+        int i = 0;
+        while (fs_ctx.qos && i < config.qos_weight_count &&
+               qos_set_weight(fs_ctx.qos, config.qos_weight_names[i], config.qos_weights[i]) == 0) {
+            i++;
+        }
+        if (!fs_ctx.qos || i < config.qos_weight_count) {
+            if (fs_ctx.qos) {
+                fprintf(stderr, "Invalid QoS tenant: %s\n", config.qos_weight_names[i]);
+            } else {
+                fprintf(stderr, "Failed to initialize QoS scheduler\n");
+            }
+            qos_free(fs_ctx.qos);
+            migrator_free(fs_ctx.migrator);
+            openfiles_free(fs_ctx.openfiles);
+            journal_free(fs_ctx.journal);
+            syncer_free(fs_ctx.syncer);
+            invalidator_free(fs_ctx.invalidator);
+            meta_cache_free(fs_ctx.cache);
+            dirstat_free(fs_ctx.dirstat);
+            reaper_free(fs_ctx.reaper);
+            storage_free(storage);
+            redis_meta_free(meta);
+            return 1;
+        }
+        printf("QoS scheduling enabled: per %s, %d weighted tenants\n",
+               config.qos == QOS_KEY_UID ? "uid" : "top-level directory", config.qos_weight_count);
+    }
 
     // 设置全局上下文
     fs_set_context(&fs_ctx);
@@ -79,6 +404,9 @@ int main(int argc, char *argv[]) {
         .getattr    = fs_getattr,
         .mkdir      = fs_mkdir,
         .unlink     = fs_unlink,
+        .symlink    = fs_symlink,
+        .readlink   = fs_readlink,
+        .link       = fs_link,
         .rmdir      = fs_rmdir,
         .rename     = fs_rename,
         .chmod      = fs_chmod,
@@ -99,6 +427,13 @@ int main(int argc, char *argv[]) {
         .access     = fs_access,
         .create     = fs_create,
         .utimens    = fs_utimens,
+        .copy_file_range = fs_copy_file_range,
+        .fallocate  = fs_fallocate,
+        .lseek      = fs_lseek,
+        .getxattr   = fs_getxattr,
+        .setxattr   = fs_setxattr,
+        .listxattr  = fs_listxattr,
+        .removexattr = fs_removexattr,
     };
 
     // 准备 FUSE 参数
@@ -120,6 +455,17 @@ int main(int argc, char *argv[]) {
         fuse_opt_add_arg(&args, "-d");
     }
 
+    // 限速和排队的操作占着工作线程等待，按执行槽总数放宽 libfuse 默认的 10 个线程
+    // （max_threads 需要 libfuse 3.12；更早的版本按需创建线程，没有上限）
+#if FUSE_MAJOR_VERSION > 3 || (FUSE_MAJOR_VERSION == 3 && FUSE_MINOR_VERSION >= 12)
+    if (fs_ctx.qos) {
+        char max_threads[32];
+        snprintf(max_threads, sizeof(max_threads), "max_threads=%d", qos_max_threads(fs_ctx.qos));
+        fuse_opt_add_arg(&args, "-o");
+        fuse_opt_add_arg(&args, max_threads);
+    }
+#endif
+
     // 设置信号处理
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
@@ -131,6 +477,59 @@ int main(int argc, char *argv[]) {
     // 清理
     printf("\nCleaning up...\n");
     fuse_opt_free_args(&args);
+
+    // FUSE 已经退出，没有正在执行的操作
+    if (fs_ctx.qos) {
+        qos_stats_t stats;
+        qos_get_stats(fs_ctx.qos, &stats);
+        qos_free(fs_ctx.qos);
+        printf("QoS: %lu metadata ops (%lu queued, %lu throttled), %lu data ops (%lu queued, %lu throttled), "
+               "%lu fsyncs (%lu queued), %lu rejected, %lu tenants\n",
+               stats.ops[QOS_META], stats.queued[QOS_META], stats.throttled[QOS_META],
+               stats.ops[QOS_DATA], stats.queued[QOS_DATA], stats.throttled[QOS_DATA],
+               stats.ops[QOS_SYNC], stats.queued[QOS_SYNC],
+               stats.rejected[QOS_META] + stats.rejected[QOS_DATA] + stats.rejected[QOS_SYNC], stats.tenants);
+    }
+
+    // 应用日志中剩余的修改
+    journal_free(fs_ctx.journal);
+
+    // 迁移线程同样使用存储层
+    if (fs_ctx.migrator) {
+        migrator_stats_t stats;
+        migrator_get_stats(fs_ctx.migrator, &stats);
+        migrator_free(fs_ctx.migrator);
+        if (config.tier_cold_after > 0) {
+            printf("Tier migration: %lu files demoted, %lu promoted, %lu failures\n",
+                   stats.demoted, stats.promoted, stats.failed);
+        }
+    }
+
+    // 先停止删除线程，它们仍在使用存储层
+    if (fs_ctx.reaper) {
+        reaper_stats_t stats;
+        reaper_get_stats(fs_ctx.reaper, &stats);
+        reaper_free(fs_ctx.reaper);
+        printf("Background deletion: %lu files deleted, %lu failures\n", stats.deleted, stats.failed);
+    }
+
+    // 传播剩余的目录统计增量
+    dirstat_free(fs_ctx.dirstat);
+
+    invalidator_free(fs_ctx.invalidator);
+    meta_cache_free(fs_ctx.cache);
+    syncer_free(fs_ctx.syncer);
+    openfiles_free(fs_ctx.openfiles);
+
+    if (storage->cache) {
+        block_cache_stats_t stats;
+        block_cache_get_stats(storage->cache, &stats);
+        uint64_t lookups = stats.hits + stats.misses;
+        printf("Block cache: %lu hits, %lu misses (%.1f%% hit rate), %lu evictions, %lu invalidations\n",
+               stats.hits, stats.misses, lookups ? 100.0 * stats.hits / lookups : 0.0,
+               stats.evictions, stats.invalidations);
+    }
+
     storage_free(storage);
     redis_meta_free(meta);
 
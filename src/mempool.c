@@ -0,0 +1,221 @@
+#include "mempool.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <hiredis/hiredis.h>
+
+// 最小的块（字节），各级依次加倍到 MEMPOOL_MAX_BLOCK
+#define MIN_BLOCK 16
+#define CLASSES 9
+#define LARGE_CLASS CLASSES
+
+// 块头，保持返回的地址 16 字节对齐
+typedef struct {
+    size_t cls;                 // 所在的级，LARGE_CLASS 表示直接使用 malloc
+    size_t size;                // LARGE_CLASS：申请的大小
+} block_header_t;
+
+// 线程的空闲链表，空闲块的数据区开头保存下一个空闲块
+typedef struct {
+    void *heads[CLASSES];
+    int counts[CLASSES];
+    void *scratch[MEMPOOL_SCRATCH_SLOTS];
+    size_t scratch_size[MEMPOOL_SCRATCH_SLOTS];
+    int registered;
+    int destroyed;              // 线程退出时已释放，之后释放的块直接还给系统
+} thread_cache_t;
+
+static __thread thread_cache_t tcache;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static void cache_destroy(void *arg) {
+    thread_cache_t *cache = (thread_cache_t*)arg;
+    for (int c = 0; c < CLASSES; c++) {
+        while (cache->heads[c]) {
+            block_header_t *h = (block_header_t*)cache->heads[c];
+            cache->heads[c] = *(void**)(h + 1);
+            free(h);
+        }
+        cache->counts[c] = 0;
+    }
+    for (int i = 0; i < MEMPOOL_SCRATCH_SLOTS; i++) {
+        free(cache->scratch[i]);
+        cache->scratch[i] = NULL;
+        cache->scratch_size[i] = 0;
+    }
+    // 之后运行的其他线程析构函数（如释放 hiredis 命令）还会调用 mempool_free，
+    // 这时不能再放进空闲链表，否则没有人释放
+    cache->registered = 0;
+    cache->destroyed = 1;
+}
+
+static void cache_key_init(void) {
+    pthread_key_create(&cache_key, cache_destroy);
+}
+
+static void cache_register(thread_cache_t *cache) {
+    if (!cache->registered) {
+        pthread_once(&cache_once, cache_key_init);
+        pthread_setspecific(cache_key, cache);
+        cache->registered = 1;
+    }
+}
+
+static inline size_t class_of(size_t size) {
+    size_t c = 0;
+    while (((size_t)MIN_BLOCK << c) < size) {
+        c++;
+    }
+    return c;
+}
+
+static inline size_t block_capacity(const block_header_t *h) {
+    return h->cls == LARGE_CLASS ? h->size : (size_t)MIN_BLOCK << h->cls;
+}
+
+void* mempool_alloc(size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+
+    block_header_t *h;
+    if (size > MEMPOOL_MAX_BLOCK) {
+        if (size > SIZE_MAX - sizeof(block_header_t)) {
+            return NULL;
+        }
+        h = (block_header_t*)malloc(sizeof(block_header_t) + size);
+        if (!h) {
+            return NULL;
+        }
+        h->cls = LARGE_CLASS;
+        h->size = size;
+        return h + 1;
+    }
+
+    size_t c = class_of(size);
+    thread_cache_t *cache = &tcache;
+    if (cache->heads[c]) {
+        h = (block_header_t*)cache->heads[c];
+        cache->heads[c] = *(void**)(h + 1);
+        cache->counts[c]--;
+        return h + 1;
+    }
+
+    h = (block_header_t*)malloc(sizeof(block_header_t) + ((size_t)MIN_BLOCK << c));
+    if (!h) {
+        return NULL;
+    }
+    h->cls = c;
+    h->size = 0;
+    return h + 1;
+}
+
+void* mempool_calloc(size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *ptr = mempool_alloc(count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void* mempool_realloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return mempool_alloc(size);
+    }
+    if (size == 0) {
+        mempool_free(ptr);
+        return NULL;
+    }
+
+    block_header_t *h = (block_header_t*)ptr - 1;
+    if (h->cls == LARGE_CLASS && size > MEMPOOL_MAX_BLOCK) {
+        if (size > SIZE_MAX - sizeof(block_header_t)) {
+            return NULL;
+        }
+        block_header_t *n = (block_header_t*)realloc(h, sizeof(block_header_t) + size);
+        if (!n) {
+            return NULL;
+        }
+        n->size = size;
+        return n + 1;
+    }
+    if (h->cls != LARGE_CLASS && size <= block_capacity(h)) {
+        return ptr;
+    }
+
+    void *n = mempool_alloc(size);
+    if (!n) {
+        return NULL;
+    }
+    size_t old = block_capacity(h);
+    memcpy(n, ptr, old < size ? old : size);
+    mempool_free(ptr);
+    return n;
+}
+
+char* mempool_strdup(const char *str) {
+    size_t len = strlen(str) + 1;
+    char *copy = (char*)mempool_alloc(len);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+void mempool_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    block_header_t *h = (block_header_t*)ptr - 1;
+    thread_cache_t *cache = &tcache;
+    if (h->cls == LARGE_CLASS || cache->destroyed || cache->counts[h->cls] >= MEMPOOL_CACHE_BLOCKS) {
+        free(h);
+        return;
+    }
+    cache_register(cache);
+
+    *(void**)ptr = cache->heads[h->cls];
+    cache->heads[h->cls] = h;
+    cache->counts[h->cls]++;
+}
+
+void* mempool_scratch(int slot, size_t size) {
+    thread_cache_t *cache = &tcache;
+    if (cache->scratch_size[slot] >= size) {
+        return cache->scratch[slot];
+    }
+    // 线程退出之后不再保留缓冲区，没有人释放
+    if (cache->destroyed) {
+        return NULL;
+    }
+
+    void *buf = malloc(size);
+    if (!buf) {
+        return NULL;
+    }
+    free(cache->scratch[slot]);
+    cache->scratch[slot] = buf;
+    cache->scratch_size[slot] = size;
+    cache_register(cache);
+    return buf;
+}
+
+void mempool_install_hiredis(void) {
+    // 自定义分配器需要 hiredis 1.0
+#if defined(HIREDIS_MAJOR) && HIREDIS_MAJOR >= 1
+    hiredisAllocFuncs funcs = {
+        .mallocFn = mempool_alloc,
+        .callocFn = mempool_calloc,
+        .reallocFn = mempool_realloc,
+        .strdupFn = mempool_strdup,
+        .freeFn = mempool_free,
+    };
+    hiredisSetAllocators(&funcs);
+#endif
+}
@@ -0,0 +1,1081 @@
+#include "meta_cache.h"
+#include "mempool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+// 拼接路径时最多向上查找的层数
+#define PATH_DEPTH 256
+
+// 路径的最大长度
+#define PATH_SIZE 4096
+
+// 每个分片各个哈希表的初始桶数（2 的幂），缓存项数超过桶数时加倍
+#define INITIAL_BUCKETS 64
+
+// 每个分片最少的容量（字节）
+#define MIN_SHARD_CAPACITY (64 * 1024)
+
+// 缓存项的种类，各种缓存项挂在所在分片的同一个 LRU 链表上，超出容量时淘汰最久未使用的
+enum {
+    KIND_ENTRY,
+    KIND_ATTR,
+    KIND_XATTR,
+    KIND_LINK,
+    KIND_VERSION
+};
+
+// 各种缓存项共同的头部，必须是结构的第一个成员
+typedef struct lru_item {
+    struct lru_item *prev;      // LRU 链表（头部最近使用）
+    struct lru_item *next;
+    size_t cost;                // 计入容量的字节数
+    time_t expire;
+    int kind;
+} lru_item_t;
+
+// 目录项同时挂在三个哈希链上：按 (parent, name) 查找，按 inode 拼出路径，按 parent 失效整个目录
+// 不存在的结果（inode 为 0）不挂在 inode 链上
+enum {
+    BY_NAME,
+    BY_INODE,
+    BY_PARENT,
+    INDEXES
+};
+
+typedef struct cache_entry {
+    lru_item_t lru;
+    uint64_t parent;
+    uint64_t inode;             // 0 表示名字不存在
+    uint64_t version;           // 不存在的结果对应的目录版本
+    struct cache_entry *links[INDEXES];
+    char name[];
+} cache_entry_t;
+
+// 目录版本：目录中新增目录项时递增，使其中缓存的不存在结果全部失效
+// 被淘汰后重新创建的版本号不同，引用旧版本的不存在结果随之失效
+typedef struct dir_version {
+    lru_item_t lru;             // expire 不早于引用它的不存在结果
+    uint64_t inode;
+    uint64_t version;
+    struct dir_version *next;
+} dir_version_t;
+
+typedef struct cache_attr {
+    lru_item_t lru;
+    uint64_t inode;
+    struct cache_attr *next;
+    node_attr_t attr;
+} cache_attr_t;
+
+// 节点的全部扩展属性，与属性分开保存：写入会丢弃属性（ctime 变化），不影响扩展属性
+typedef struct cache_xattr {
+    lru_item_t lru;
+    uint64_t inode;
+    struct cache_xattr *next;
+    size_t len;
+    char data[];                // xattr_list_t 的 data
+} cache_xattr_t;
+
+// 符号链接的目标：创建后不会改变、inode 不会重用，不需要失效，只按超时清理
+typedef struct cache_link {
+    lru_item_t lru;
+    uint64_t inode;
+    struct cache_link *next;
+    char target[];
+} cache_link_t;
+
+// 分片：目录项和目录版本按父目录分片（同一目录的查找和失效只访问一个分片），
+// 属性、扩展属性和符号链接按 inode 分片
+typedef struct {
+    pthread_mutex_t lock;
+
+    cache_entry_t **buckets[INDEXES];
+    size_t nbuckets;            // 2 的幂
+    size_t entries;
+
+    cache_attr_t **attr_buckets;
+    size_t attr_nbuckets;       // 2 的幂
+    size_t attrs;
+
+    cache_xattr_t **xattr_buckets;
+    size_t xattr_nbuckets;      // 2 的幂
+    size_t xattrs;
+
+    cache_link_t **link_buckets;
+    size_t link_nbuckets;       // 2 的幂
+    size_t links;
+
+    dir_version_t **version_buckets;
+    size_t version_nbuckets;    // 2 的幂
+    size_t versions;
+
+    lru_item_t *lru_head;
+    lru_item_t *lru_tail;
+    size_t used;
+    size_t capacity;
+} cache_shard_t;
+
+struct meta_cache {
+    int timeout;
+    uint64_t seq;               // 失效序号，用于丢弃过期的填充（原子访问）
+    uint64_t next_version;      // 版本号全局递增，重新创建的版本记录不会与旧结果相同（原子访问）
+    cache_shard_t shards[META_CACHE_SHARDS];
+};
+
+// 收集需要在内核中失效的路径
+typedef struct {
+    char **paths;
+    int count;
+    int cap;
+} path_list_t;
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// 用散列的高位选分片，低位用于分片内的桶
+static inline cache_shard_t* shard_of(meta_cache_t *cache, uint64_t key) {
+    return &cache->shards[(mix64(key) >> 32) % META_CACHE_SHARDS];
+}
+
+// FNV-1a
+static uint64_t name_hash(uint64_t parent, const char *name) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char*)name; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return mix64(h ^ parent);
+}
+
+static size_t entry_bucket(const cache_entry_t *e, int index, size_t nbuckets) {
+    switch (index) {
+        case BY_NAME:
+            return (size_t)(name_hash(e->parent, e->name) & (nbuckets - 1));
+        case BY_INODE:
+            return (size_t)(mix64(e->inode) & (nbuckets - 1));
+        default:
+            return (size_t)(mix64(e->parent) & (nbuckets - 1));
+    }
+}
+
+static int shard_init(cache_shard_t *shard, size_t capacity) {
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->capacity = capacity;
+    shard->nbuckets = INITIAL_BUCKETS;
+    shard->attr_nbuckets = INITIAL_BUCKETS;
+    shard->xattr_nbuckets = INITIAL_BUCKETS;
+    shard->link_nbuckets = INITIAL_BUCKETS;
+    shard->version_nbuckets = INITIAL_BUCKETS;
+    for (int i = 0; i < INDEXES; i++) {
+        shard->buckets[i] = (cache_entry_t**)calloc(shard->nbuckets, sizeof(cache_entry_t*));
+        if (!shard->buckets[i]) {
+            return -1;
+        }
+    }
+    shard->attr_buckets = (cache_attr_t**)calloc(shard->attr_nbuckets, sizeof(cache_attr_t*));
+    shard->xattr_buckets = (cache_xattr_t**)calloc(shard->xattr_nbuckets, sizeof(cache_xattr_t*));
+    shard->link_buckets = (cache_link_t**)calloc(shard->link_nbuckets, sizeof(cache_link_t*));
+    shard->version_buckets = (dir_version_t**)calloc(shard->version_nbuckets, sizeof(dir_version_t*));
+    if (!shard->attr_buckets || !shard->xattr_buckets || !shard->link_buckets || !shard->version_buckets) {
+        return -1;
+    }
+    return 0;
+}
+
+meta_cache_t* meta_cache_new(int timeout, size_t capacity) {
+    if (timeout <= 0) {
+        return NULL;
+    }
+
+    meta_cache_t *cache = (meta_cache_t*)calloc(1, sizeof(meta_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+
+    cache->timeout = timeout;
+    size_t shard_capacity = capacity / META_CACHE_SHARDS;
+    if (shard_capacity < MIN_SHARD_CAPACITY) {
+        shard_capacity = MIN_SHARD_CAPACITY;
+    }
+    for (int i = 0; i < META_CACHE_SHARDS; i++) {
+        if (shard_init(&cache->shards[i], shard_capacity) != 0) {
+            meta_cache_free(cache);
+            return NULL;
+        }
+    }
+
+    return cache;
+}
+
+void meta_cache_free(meta_cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+
+    for (int s = 0; s < META_CACHE_SHARDS; s++) {
+        cache_shard_t *shard = &cache->shards[s];
+        // 每个缓存项都在 LRU 链表上
+        lru_item_t *item = shard->lru_head;
+        while (item) {
+            lru_item_t *next = item->next;
+            free(item);
+            item = next;
+        }
+        for (int i = 0; i < INDEXES; i++) {
+            free(shard->buckets[i]);
+        }
+        free(shard->attr_buckets);
+        free(shard->xattr_buckets);
+        free(shard->link_buckets);
+        free(shard->version_buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache);
+}
+
+int meta_cache_timeout(const meta_cache_t *cache) {
+    return cache->timeout;
+}
+
+uint64_t meta_cache_ticket(meta_cache_t *cache) {
+    return __atomic_load_n(&cache->seq, __ATOMIC_ACQUIRE);
+}
+
+int meta_cache_stale(meta_cache_t *cache, uint64_t ticket) {
+    return meta_cache_ticket(cache) != ticket;
+}
+
+// 失效先增加序号再在分片锁内移除缓存项，序号增加之前插入的缓存项会被随后的移除带走
+static inline void bump_seq(meta_cache_t *cache) {
+    __atomic_add_fetch(&cache->seq, 1, __ATOMIC_ACQ_REL);
+}
+
+// 插入时在分片锁内核对凭证
+static inline int ticket_valid(meta_cache_t *cache, uint64_t ticket) {
+    return __atomic_load_n(&cache->seq, __ATOMIC_ACQUIRE) == ticket;
+}
+
+// 按固定顺序锁住全部分片，用于需要跨分片拼接路径的失效
+static void lock_all(meta_cache_t *cache) {
+    for (int i = 0; i < META_CACHE_SHARDS; i++) {
+        pthread_mutex_lock(&cache->shards[i].lock);
+    }
+}
+
+static void unlock_all(meta_cache_t *cache) {
+    for (int i = META_CACHE_SHARDS - 1; i >= 0; i--) {
+        pthread_mutex_unlock(&cache->shards[i].lock);
+    }
+}
+
+static void lru_unlink(cache_shard_t *shard, lru_item_t *item) {
+    if (item->prev) item->prev->next = item->next;
+    else shard->lru_head = item->next;
+    if (item->next) item->next->prev = item->prev;
+    else shard->lru_tail = item->prev;
+    item->prev = item->next = NULL;
+}
+
+static void lru_push_front(cache_shard_t *shard, lru_item_t *item) {
+    item->prev = NULL;
+    item->next = shard->lru_head;
+    if (shard->lru_head) shard->lru_head->prev = item;
+    shard->lru_head = item;
+    if (!shard->lru_tail) shard->lru_tail = item;
+}
+
+static void lru_touch(cache_shard_t *shard, lru_item_t *item) {
+    if (shard->lru_head != item) {
+        lru_unlink(shard, item);
+        lru_push_front(shard, item);
+    }
+}
+
+// 新的缓存项计入分片
+static void item_add(cache_shard_t *shard, lru_item_t *item, int kind, size_t cost, time_t expire) {
+    item->kind = kind;
+    item->cost = cost;
+    item->expire = expire;
+    lru_push_front(shard, item);
+    shard->used += cost;
+}
+
+// 缓存项移出分片并释放，调用者已把它从哈希链上摘下
+static void item_remove(cache_shard_t *shard, lru_item_t *item) {
+    lru_unlink(shard, item);
+    shard->used -= item->cost;
+    free(item);
+}
+
+static void evict(cache_shard_t *shard, lru_item_t *item);
+
+// 淘汰最久未使用的缓存项，直到能放下 cost 字节
+static void make_room(cache_shard_t *shard, size_t cost) {
+    while (shard->used + cost > shard->capacity && shard->lru_tail) {
+        evict(shard, shard->lru_tail);
+    }
+}
+
+static cache_entry_t* find_entry(cache_shard_t *shard, uint64_t parent, const char *name) {
+    size_t b = (size_t)(name_hash(parent, name) & (shard->nbuckets - 1));
+    for (cache_entry_t *e = shard->buckets[BY_NAME][b]; e; e = e->links[BY_NAME]) {
+        if (e->parent == parent && strcmp(e->name, name) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// 节点的任一目录项，它所在的分片由父目录决定，需要查找全部分片（调用者持有全部分片的锁）
+static cache_entry_t* find_inode(meta_cache_t *cache, uint64_t inode) {
+    for (int i = 0; i < META_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        size_t b = (size_t)(mix64(inode) & (shard->nbuckets - 1));
+        for (cache_entry_t *e = shard->buckets[BY_INODE][b]; e; e = e->links[BY_INODE]) {
+            if (e->inode == inode) {
+                return e;
+            }
+        }
+    }
+    return NULL;
+}
+
+static inline int indexed(const cache_entry_t *e, int index) {
+    return index != BY_INODE || e->inode != 0;
+}
+
+static void link_entry(cache_shard_t *shard, cache_entry_t *e) {
+    for (int i = 0; i < INDEXES; i++) {
+        if (!indexed(e, i)) {
+            continue;
+        }
+        size_t b = entry_bucket(e, i, shard->nbuckets);
+        e->links[i] = shard->buckets[i][b];
+        shard->buckets[i][b] = e;
+    }
+    shard->entries++;
+}
+
+static void remove_entry(cache_shard_t *shard, cache_entry_t *e) {
+    for (int i = 0; i < INDEXES; i++) {
+        if (!indexed(e, i)) {
+            continue;
+        }
+        cache_entry_t **pp = &shard->buckets[i][entry_bucket(e, i, shard->nbuckets)];
+        while (*pp && *pp != e) {
+            pp = &(*pp)->links[i];
+        }
+        if (*pp) {
+            *pp = e->links[i];
+        }
+    }
+    shard->entries--;
+    item_remove(shard, &e->lru);
+}
+
+// 目录项数超过桶数时扩容，失败时继续使用原来的桶
+static void grow_entries(cache_shard_t *shard) {
+    size_t nbuckets = shard->nbuckets * 2;
+    cache_entry_t **buckets[INDEXES];
+    for (int i = 0; i < INDEXES; i++) {
+        buckets[i] = (cache_entry_t**)calloc(nbuckets, sizeof(cache_entry_t*));
+        if (!buckets[i]) {
+            for (int j = 0; j < i; j++) {
+                free(buckets[j]);
+            }
+            return;
+        }
+    }
+
+    for (size_t b = 0; b < shard->nbuckets; b++) {
+        cache_entry_t *e = shard->buckets[BY_NAME][b];
+        while (e) {
+            cache_entry_t *next = e->links[BY_NAME];
+            for (int i = 0; i < INDEXES; i++) {
+                if (!indexed(e, i)) {
+                    continue;
+                }
+                size_t nb = entry_bucket(e, i, nbuckets);
+                e->links[i] = buckets[i][nb];
+                buckets[i][nb] = e;
+            }
+            e = next;
+        }
+    }
+
+    for (int i = 0; i < INDEXES; i++) {
+        free(shard->buckets[i]);
+        shard->buckets[i] = buckets[i];
+    }
+    shard->nbuckets = nbuckets;
+}
+
+static dir_version_t** find_version(cache_shard_t *shard, uint64_t inode) {
+    dir_version_t **pp = &shard->version_buckets[mix64(inode) & (shard->version_nbuckets - 1)];
+    while (*pp && (*pp)->inode != inode) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+static void grow_versions(cache_shard_t *shard) {
+    size_t nbuckets = shard->version_nbuckets * 2;
+    dir_version_t **buckets = (dir_version_t**)calloc(nbuckets, sizeof(dir_version_t*));
+    if (!buckets) {
+        return;
+    }
+
+    for (size_t b = 0; b < shard->version_nbuckets; b++) {
+        dir_version_t *v = shard->version_buckets[b];
+        while (v) {
+            dir_version_t *next = v->next;
+            size_t nb = (size_t)(mix64(v->inode) & (nbuckets - 1));
+            v->next = buckets[nb];
+            buckets[nb] = v;
+            v = next;
+        }
+    }
+
+    free(shard->version_buckets);
+    shard->version_buckets = buckets;
+    shard->version_nbuckets = nbuckets;
+}
+
+static void drop_version(cache_shard_t *shard, uint64_t inode) {
+    dir_version_t **pp = find_version(shard, inode);
+    dir_version_t *v = *pp;
+    if (v) {
+        *pp = v->next;
+        shard->versions--;
+        item_remove(shard, &v->lru);
+    }
+}
+
+// 获取目录的版本记录，不存在时创建
+static dir_version_t* get_version(meta_cache_t *cache, cache_shard_t *shard, uint64_t inode) {
+    dir_version_t *v = *find_version(shard, inode);
+    if (v) {
+        lru_touch(shard, &v->lru);
+        return v;
+    }
+
+    v = (dir_version_t*)malloc(sizeof(dir_version_t));
+    if (!v) {
+        return NULL;
+    }
+    v->inode = inode;
+    v->version = __atomic_add_fetch(&cache->next_version, 1, __ATOMIC_RELAXED);
+    make_room(shard, sizeof(dir_version_t));
+    if (shard->versions >= shard->version_nbuckets) {
+        grow_versions(shard);
+    }
+    size_t b = (size_t)(mix64(inode) & (shard->version_nbuckets - 1));
+    v->next = shard->version_buckets[b];
+    shard->version_buckets[b] = v;
+    shard->versions++;
+    item_add(shard, &v->lru, KIND_VERSION, sizeof(dir_version_t), 0);
+    return v;
+}
+
+int meta_cache_lookup(meta_cache_t *cache, uint64_t parent, const char *name, uint64_t *inode) {
+    cache_shard_t *shard = shard_of(cache, parent);
+    pthread_mutex_lock(&shard->lock);
+    cache_entry_t *e = find_entry(shard, parent, name);
+    if (!e) {
+        pthread_mutex_unlock(&shard->lock);
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    // 不存在的结果在目录版本变化后失效
+    dir_version_t *v = NULL;
+    if (e->inode == 0 && e->lru.expire > now) {
+        v = *find_version(shard, parent);
+    }
+    if (e->lru.expire <= now || (e->inode == 0 && (!v || v->version != e->version))) {
+        remove_entry(shard, e);
+        pthread_mutex_unlock(&shard->lock);
+        return 0;
+    }
+
+    e->lru.expire = now + cache->timeout + META_CACHE_GRACE;
+    lru_touch(shard, &e->lru);
+    if (v) {
+        v->lru.expire = e->lru.expire;
+        lru_touch(shard, &v->lru);
+    }
+    *inode = e->inode;
+    pthread_mutex_unlock(&shard->lock);
+    return 1;
+}
+
+void meta_cache_put_entry(meta_cache_t *cache, uint64_t parent, const char *name,
+                          uint64_t inode, uint64_t ticket) {
+    size_t len = strlen(name);
+    size_t cost = sizeof(cache_entry_t) + len + 1;
+    cache_shard_t *shard = shard_of(cache, parent);
+
+    pthread_mutex_lock(&shard->lock);
+    if (!ticket_valid(cache, ticket)) {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+
+    time_t expire = time(NULL) + cache->timeout + META_CACHE_GRACE;
+    uint64_t version = 0;
+    if (inode == 0) {
+        dir_version_t *v = get_version(cache, shard, parent);
+        if (!v) {
+            pthread_mutex_unlock(&shard->lock);
+            return;
+        }
+        v->lru.expire = expire;
+        version = v->version;
+    }
+
+    cache_entry_t *e = find_entry(shard, parent, name);
+    if (e && e->inode == inode) {
+        e->lru.expire = expire;
+        e->version = version;
+        lru_touch(shard, &e->lru);
+    } else {
+        if (e) {
+            remove_entry(shard, e);
+        }
+        e = (cache_entry_t*)malloc(cost);
+        if (e) {
+            e->parent = parent;
+            e->inode = inode;
+            e->version = version;
+            memcpy(e->name, name, len + 1);
+            make_room(shard, cost);
+            if (shard->entries >= shard->nbuckets) {
+                grow_entries(shard);
+            }
+            link_entry(shard, e);
+            item_add(shard, &e->lru, KIND_ENTRY, cost, expire);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static cache_attr_t** find_attr(cache_shard_t *shard, uint64_t inode) {
+    cache_attr_t **pp = &shard->attr_buckets[mix64(inode) & (shard->attr_nbuckets - 1)];
+    while (*pp && (*pp)->inode != inode) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+static void grow_attrs(cache_shard_t *shard) {
+    size_t nbuckets = shard->attr_nbuckets * 2;
+    cache_attr_t **buckets = (cache_attr_t**)calloc(nbuckets, sizeof(cache_attr_t*));
+    if (!buckets) {
+        return;
+    }
+
+    for (size_t b = 0; b < shard->attr_nbuckets; b++) {
+        cache_attr_t *a = shard->attr_buckets[b];
+        while (a) {
+            cache_attr_t *next = a->next;
+            size_t nb = (size_t)(mix64(a->inode) & (nbuckets - 1));
+            a->next = buckets[nb];
+            buckets[nb] = a;
+            a = next;
+        }
+    }
+
+    free(shard->attr_buckets);
+    shard->attr_buckets = buckets;
+    shard->attr_nbuckets = nbuckets;
+}
+
+static void drop_attr(cache_shard_t *shard, uint64_t inode) {
+    cache_attr_t **pp = find_attr(shard, inode);
+    cache_attr_t *a = *pp;
+    if (a) {
+        *pp = a->next;
+        shard->attrs--;
+        item_remove(shard, &a->lru);
+    }
+}
+
+int meta_cache_get_attr(meta_cache_t *cache, uint64_t inode, node_attr_t *attr) {
+    cache_shard_t *shard = shard_of(cache, inode);
+    pthread_mutex_lock(&shard->lock);
+    cache_attr_t *a = *find_attr(shard, inode);
+    if (a && a->lru.expire > time(NULL)) {
+        *attr = a->attr;
+        lru_touch(shard, &a->lru);
+        pthread_mutex_unlock(&shard->lock);
+        return 1;
+    }
+    if (a) {
+        drop_attr(shard, inode);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+void meta_cache_put_attr(meta_cache_t *cache, const node_attr_t *attr, uint64_t ticket) {
+    cache_shard_t *shard = shard_of(cache, attr->inode);
+    pthread_mutex_lock(&shard->lock);
+    if (!ticket_valid(cache, ticket)) {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+
+    time_t expire = time(NULL) + cache->timeout;
+    cache_attr_t *a = *find_attr(shard, attr->inode);
+    if (a) {
+        a->lru.expire = expire;
+        lru_touch(shard, &a->lru);
+    } else {
+        a = (cache_attr_t*)malloc(sizeof(cache_attr_t));
+        if (!a) {
+            pthread_mutex_unlock(&shard->lock);
+            return;
+        }
+        a->inode = attr->inode;
+        make_room(shard, sizeof(cache_attr_t));
+        if (shard->attrs >= shard->attr_nbuckets) {
+            grow_attrs(shard);
+        }
+        size_t b = (size_t)(mix64(a->inode) & (shard->attr_nbuckets - 1));
+        a->next = shard->attr_buckets[b];
+        shard->attr_buckets[b] = a;
+        shard->attrs++;
+        item_add(shard, &a->lru, KIND_ATTR, sizeof(cache_attr_t), expire);
+    }
+    a->attr = *attr;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static cache_xattr_t** find_xattr(cache_shard_t *shard, uint64_t inode) {
+    cache_xattr_t **pp = &shard->xattr_buckets[mix64(inode) & (shard->xattr_nbuckets - 1)];
+    while (*pp && (*pp)->inode != inode) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+static void grow_xattrs(cache_shard_t *shard) {
+    size_t nbuckets = shard->xattr_nbuckets * 2;
+    cache_xattr_t **buckets = (cache_xattr_t**)calloc(nbuckets, sizeof(cache_xattr_t*));
+    if (!buckets) {
+        return;
+    }
+
+    for (size_t b = 0; b < shard->xattr_nbuckets; b++) {
+        cache_xattr_t *x = shard->xattr_buckets[b];
+        while (x) {
+            cache_xattr_t *next = x->next;
+            size_t nb = (size_t)(mix64(x->inode) & (nbuckets - 1));
+            x->next = buckets[nb];
+            buckets[nb] = x;
+            x = next;
+        }
+    }
+
+    free(shard->xattr_buckets);
+    shard->xattr_buckets = buckets;
+    shard->xattr_nbuckets = nbuckets;
+}
+
+static void drop_xattr(cache_shard_t *shard, uint64_t inode) {
+    cache_xattr_t **pp = find_xattr(shard, inode);
+    cache_xattr_t *x = *pp;
+    if (x) {
+        *pp = x->next;
+        shard->xattrs--;
+        item_remove(shard, &x->lru);
+    }
+}
+
+int meta_cache_get_xattrs(meta_cache_t *cache, uint64_t inode, xattr_list_t **list) {
+    cache_shard_t *shard = shard_of(cache, inode);
+    pthread_mutex_lock(&shard->lock);
+    cache_xattr_t *x = *find_xattr(shard, inode);
+    if (x && x->lru.expire > time(NULL)) {
+        xattr_list_t *l = (xattr_list_t*)mempool_alloc(sizeof(xattr_list_t) + x->len);
+        if (l) {
+            l->len = x->len;
+            memcpy(l->data, x->data, x->len);
+            *list = l;
+            lru_touch(shard, &x->lru);
+        }
+        pthread_mutex_unlock(&shard->lock);
+        return l != NULL;
+    }
+    if (x) {
+        drop_xattr(shard, inode);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+void meta_cache_put_xattrs(meta_cache_t *cache, uint64_t inode, const xattr_list_t *list, uint64_t ticket) {
+    cache_shard_t *shard = shard_of(cache, inode);
+    size_t cost = sizeof(cache_xattr_t) + list->len;
+    if (list->len > META_CACHE_XATTR_SIZE || cost > shard->capacity) {
+        return;
+    }
+
+    cache_xattr_t *x = (cache_xattr_t*)malloc(cost);
+    if (!x) {
+        return;
+    }
+    x->inode = inode;
+    x->len = list->len;
+    memcpy(x->data, list->data, list->len);
+
+    pthread_mutex_lock(&shard->lock);
+    if (!ticket_valid(cache, ticket)) {
+        pthread_mutex_unlock(&shard->lock);
+        free(x);
+        return;
+    }
+
+    drop_xattr(shard, inode);
+    make_room(shard, cost);
+    if (shard->xattrs >= shard->xattr_nbuckets) {
+        grow_xattrs(shard);
+    }
+    size_t b = (size_t)(mix64(inode) & (shard->xattr_nbuckets - 1));
+    x->next = shard->xattr_buckets[b];
+    shard->xattr_buckets[b] = x;
+    shard->xattrs++;
+    item_add(shard, &x->lru, KIND_XATTR, cost, time(NULL) + cache->timeout);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void meta_cache_forget_xattrs(meta_cache_t *cache, uint64_t inode) {
+    cache_shard_t *shard = shard_of(cache, inode);
+    bump_seq(cache);
+    pthread_mutex_lock(&shard->lock);
+    drop_xattr(shard, inode);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static cache_link_t** find_link(cache_shard_t *shard, uint64_t inode) {
+    cache_link_t **pp = &shard->link_buckets[mix64(inode) & (shard->link_nbuckets - 1)];
+    while (*pp && (*pp)->inode != inode) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+static void grow_links(cache_shard_t *shard) {
+    size_t nbuckets = shard->link_nbuckets * 2;
+    cache_link_t **buckets = (cache_link_t**)calloc(nbuckets, sizeof(cache_link_t*));
+    if (!buckets) {
+        return;
+    }
+
+    for (size_t b = 0; b < shard->link_nbuckets; b++) {
+        cache_link_t *l = shard->link_buckets[b];
+        while (l) {
+            cache_link_t *next = l->next;
+            size_t nb = (size_t)(mix64(l->inode) & (nbuckets - 1));
+            l->next = buckets[nb];
+            buckets[nb] = l;
+            l = next;
+        }
+    }
+
+    free(shard->link_buckets);
+    shard->link_buckets = buckets;
+    shard->link_nbuckets = nbuckets;
+}
+
+static void drop_link(cache_shard_t *shard, uint64_t inode) {
+    cache_link_t **pp = find_link(shard, inode);
+    cache_link_t *l = *pp;
+    if (l) {
+        *pp = l->next;
+        shard->links--;
+        item_remove(shard, &l->lru);
+    }
+}
+
+int meta_cache_get_link(meta_cache_t *cache, uint64_t inode, char *buf, size_t size) {
+    cache_shard_t *shard = shard_of(cache, inode);
+    pthread_mutex_lock(&shard->lock);
+    cache_link_t *l = *find_link(shard, inode);
+    time_t now = time(NULL);
+    if (l && l->lru.expire > now) {
+        snprintf(buf, size, "%s", l->target);
+        l->lru.expire = now + cache->timeout;
+        lru_touch(shard, &l->lru);
+        pthread_mutex_unlock(&shard->lock);
+        return 1;
+    }
+    if (l) {
+        drop_link(shard, inode);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return 0;
+}
+
+void meta_cache_put_link(meta_cache_t *cache, uint64_t inode, const char *target) {
+    cache_shard_t *shard = shard_of(cache, inode);
+    size_t len = strlen(target) + 1;
+    size_t cost = sizeof(cache_link_t) + len;
+    cache_link_t *l = (cache_link_t*)malloc(cost);
+    if (!l) {
+        return;
+    }
+    l->inode = inode;
+    memcpy(l->target, target, len);
+
+    pthread_mutex_lock(&shard->lock);
+    drop_link(shard, inode);
+    make_room(shard, cost);
+    if (shard->links >= shard->link_nbuckets) {
+        grow_links(shard);
+    }
+    size_t b = (size_t)(mix64(inode) & (shard->link_nbuckets - 1));
+    l->next = shard->link_buckets[b];
+    shard->link_buckets[b] = l;
+    shard->links++;
+    item_add(shard, &l->lru, KIND_LINK, cost, time(NULL) + cache->timeout);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+static void evict(cache_shard_t *shard, lru_item_t *item) {
+    switch (item->kind) {
+        case KIND_ENTRY:
+            remove_entry(shard, (cache_entry_t*)item);
+            break;
+        case KIND_ATTR:
+            drop_attr(shard, ((cache_attr_t*)item)->inode);
+            break;
+        case KIND_XATTR:
+            drop_xattr(shard, ((cache_xattr_t*)item)->inode);
+            break;
+        case KIND_LINK:
+            drop_link(shard, ((cache_link_t*)item)->inode);
+            break;
+        default:
+            drop_version(shard, ((dir_version_t*)item)->inode);
+            break;
+    }
+}
+
+void meta_cache_forget_entry(meta_cache_t *cache, uint64_t parent, const char *name) {
+    cache_shard_t *shard = shard_of(cache, parent);
+    bump_seq(cache);
+    pthread_mutex_lock(&shard->lock);
+    cache_entry_t *e = find_entry(shard, parent, name);
+    if (e) {
+        remove_entry(shard, e);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void meta_cache_bump_dir(meta_cache_t *cache, uint64_t inode) {
+    cache_shard_t *shard = shard_of(cache, inode);
+    bump_seq(cache);
+    pthread_mutex_lock(&shard->lock);
+    dir_version_t *v = *find_version(shard, inode);
+    if (v) {
+        v->version = __atomic_add_fetch(&cache->next_version, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void meta_cache_forget_attr(meta_cache_t *cache, uint64_t inode) {
+    cache_shard_t *shard = shard_of(cache, inode);
+    bump_seq(cache);
+    pthread_mutex_lock(&shard->lock);
+    drop_attr(shard, inode);
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// 拼出目录项的路径（父目录任取一个已知的目录项），未知时返回 -1，调用者持有全部分片的锁
+static int entry_path(meta_cache_t *cache, const cache_entry_t *e, char *buf, size_t size) {
+    const char *names[PATH_DEPTH];
+    int depth = 0;
+
+    names[depth++] = e->name;
+    uint64_t inode = e->parent;
+    while (inode != 1) {
+        const cache_entry_t *up = find_inode(cache, inode);
+        if (!up || depth == PATH_DEPTH) {
+            return -1;
+        }
+        names[depth++] = up->name;
+        inode = up->parent;
+    }
+
+    size_t len = 0;
+    for (int i = depth - 1; i >= 0; i--) {
+        size_t n = strlen(names[i]);
+        if (len + 1 + n + 1 > size) {
+            return -1;
+        }
+        buf[len++] = '/';
+        memcpy(buf + len, names[i], n);
+        len += n;
+    }
+    buf[len] = '\0';
+    return 0;
+}
+
+static void add_path(path_list_t *list, const char *path) {
+    if (list->count == list->cap) {
+        int cap = list->cap ? list->cap * 2 : 16;
+        char **paths = (char**)realloc(list->paths, sizeof(char*) * (size_t)cap);
+        if (!paths) {
+            return;
+        }
+        list->paths = paths;
+        list->cap = cap;
+    }
+    char *copy = strdup(path);
+    if (copy) {
+        list->paths[list->count++] = copy;
+    }
+}
+
+// 节点的全部已知路径，调用者持有全部分片的锁
+static void add_node_paths(meta_cache_t *cache, uint64_t inode, path_list_t *list) {
+    char path[PATH_SIZE];
+    if (inode == 1) {
+        add_path(list, "/");
+        return;
+    }
+
+    for (int i = 0; i < META_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        size_t b = (size_t)(mix64(inode) & (shard->nbuckets - 1));
+        for (cache_entry_t *e = shard->buckets[BY_INODE][b]; e; e = e->links[BY_INODE]) {
+            if (e->inode == inode && entry_path(cache, e, path, sizeof(path)) == 0) {
+                add_path(list, path);
+            }
+        }
+    }
+}
+
+int meta_cache_invalidate_node(meta_cache_t *cache, uint64_t inode, char ***paths) {
+    path_list_t list = {NULL, 0, 0};
+
+    bump_seq(cache);
+    lock_all(cache);
+    drop_attr(shard_of(cache, inode), inode);
+    add_node_paths(cache, inode, &list);
+    unlock_all(cache);
+
+    *paths = list.paths;
+    return list.count;
+}
+
+int meta_cache_invalidate_dir(meta_cache_t *cache, uint64_t inode, char ***paths) {
+    path_list_t list = {NULL, 0, 0};
+    char path[PATH_SIZE];
+
+    bump_seq(cache);
+    lock_all(cache);
+
+    // 目录本身（读目录的缓存）和它下面已知的子节点：子节点可能已被删除或替换，
+    // 内核丢弃它们的属性后会重新按路径查询
+    add_node_paths(cache, inode, &list);
+
+    cache_shard_t *shard = shard_of(cache, inode);
+    size_t b = (size_t)(mix64(inode) & (shard->nbuckets - 1));
+    cache_entry_t *e = shard->buckets[BY_PARENT][b];
+    while (e) {
+        cache_entry_t *next = e->links[BY_PARENT];
+        if (e->parent == inode) {
+            if (e->inode != 0) {
+                if (entry_path(cache, e, path, sizeof(path)) == 0) {
+                    add_path(&list, path);
+                }
+                drop_attr(shard_of(cache, e->inode), e->inode);
+            }
+            remove_entry(shard, e);
+        }
+        e = next;
+    }
+    unlock_all(cache);
+
+    *paths = list.paths;
+    return list.count;
+}
+
+int meta_cache_invalidate_all(meta_cache_t *cache, char ***paths) {
+    path_list_t list = {NULL, 0, 0};
+    char path[PATH_SIZE];
+
+    bump_seq(cache);
+    lock_all(cache);
+
+    // 先拼出全部路径再删除，删除过程中父目录的目录项还需要用到
+    add_path(&list, "/");
+    for (int i = 0; i < META_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        for (size_t b = 0; b < shard->nbuckets; b++) {
+            for (cache_entry_t *e = shard->buckets[BY_NAME][b]; e; e = e->links[BY_NAME]) {
+                if (e->inode != 0 && entry_path(cache, e, path, sizeof(path)) == 0) {
+                    add_path(&list, path);
+                }
+            }
+        }
+    }
+    for (int i = 0; i < META_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        for (size_t b = 0; b < shard->nbuckets; b++) {
+            while (shard->buckets[BY_NAME][b]) {
+                remove_entry(shard, shard->buckets[BY_NAME][b]);
+            }
+        }
+        for (size_t b = 0; b < shard->attr_nbuckets; b++) {
+            while (shard->attr_buckets[b]) {
+                drop_attr(shard, shard->attr_buckets[b]->inode);
+            }
+        }
+        for (size_t b = 0; b < shard->xattr_nbuckets; b++) {
+            while (shard->xattr_buckets[b]) {
+                drop_xattr(shard, shard->xattr_buckets[b]->inode);
+            }
+        }
+    }
+    unlock_all(cache);
+
+    *paths = list.paths;
+    return list.count;
+}
+
+void meta_cache_paths_free(char **paths, int count) {
+    for (int i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+void meta_cache_expire(meta_cache_t *cache) {
+    time_t now = time(NULL);
+
+    // 逐个分片从最久未使用的一端清理，遇到未过期的缓存项或清理了一批后停止；
+    // 访问时发现的过期项直接丢弃，剩余的随容量淘汰
+    for (int i = 0; i < META_CACHE_SHARDS; i++) {
+        cache_shard_t *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (int n = 0; n < META_CACHE_EXPIRE_BATCH && shard->lru_tail; n++) {
+            if (shard->lru_tail->expire > now) {
+                break;
+            }
+            evict(shard, shard->lru_tail);
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
@@ -0,0 +1,424 @@
+#include "migrator.h"
+#include "redis_meta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+// 访问记录的哈希桶数（2 的幂）
+#define MIGRATOR_BUCKETS 4096
+
+// 保护访问记录的锁条带数（2 的幂，不超过桶数），桶 b 由条带 b % MIGRATOR_LOCK_STRIPES 保护
+#define MIGRATOR_LOCK_STRIPES 64
+
+// 扫描快速层时每次从 Redis 读取访问时间的文件数
+#define MIGRATOR_SCAN_CHUNK 1024
+
+typedef struct access_entry {
+    uint64_t inode;
+    time_t last;                // 最近一次读写
+    time_t stamped;             // 最近一次写入 Redis 的访问时间
+    time_t window;              // 当前统计窗口的开始
+    int hits;                   // 窗口内的读写次数
+    int hot;                    // 本窗口请求了提升：1 为待写入 Redis，2 为已写入
+    int dirty;                  // 有待写入 Redis 的访问时间或提升请求
+    struct access_entry *next;
+} access_entry_t;
+
+struct migrator {
+    storage_t *storage;
+    redis_meta_t *meta;
+    int cold_after;             // 0 表示本挂载只记录访问
+    pthread_t thread;
+    int started;
+
+    pthread_mutex_t stripes[MIGRATOR_LOCK_STRIPES];
+    access_entry_t *buckets[MIGRATOR_BUCKETS];
+    int tracked;                // 原子访问
+
+    pthread_mutex_t lock;       // 保护以下字段
+    pthread_cond_t wake;
+    int stopping;
+
+    uint64_t demoted;
+    uint64_t promoted;
+    uint64_t failed;
+};
+
+static inline size_t bucket_of(uint64_t inode) {
+    uint64_t h = inode * 0x9e3779b97f4a7c15ULL;
+    return (size_t)((h >> 32) & (MIGRATOR_BUCKETS - 1));
+}
+
+static inline pthread_mutex_t* stripe_lock(migrator_t *migrator, size_t bucket) {
+    return &migrator->stripes[bucket & (MIGRATOR_LOCK_STRIPES - 1)];
+}
+
+// 调用者持有 bucket 所在条带的锁
+static inline access_entry_t** find_entry(migrator_t *migrator, size_t bucket, uint64_t inode) {
+    access_entry_t **pp = &migrator->buckets[bucket];
+    while (*pp && (*pp)->inode != inode) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+migrator_t* migrator_new(storage_t *storage, const char *addr, int port, const char *password, int db,
+                         int cold_after) {
+    if (!storage || !storage->cold_dir[0]) {
+        return NULL;
+    }
+
+    migrator_t *migrator = (migrator_t*)calloc(1, sizeof(migrator_t));
+    if (!migrator) {
+        return NULL;
+    }
+
+    migrator->storage = storage;
+    migrator->cold_after = cold_after > 0 ? cold_after : 0;
+    for (int i = 0; i < MIGRATOR_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&migrator->stripes[i], NULL);
+    }
+    pthread_mutex_init(&migrator->lock, NULL);
+    pthread_cond_init(&migrator->wake, NULL);
+
+    migrator->meta = redis_meta_new(addr, port, password, db);
+    if (!migrator->meta) {
+        migrator_free(migrator);
+        return NULL;
+    }
+
+    return migrator;
+}
+
+void migrator_access(migrator_t *migrator, uint64_t inode) {
+    time_t now = time(NULL);
+    size_t bucket = bucket_of(inode);
+    pthread_mutex_t *lock = stripe_lock(migrator, bucket);
+
+    pthread_mutex_lock(lock);
+    access_entry_t **pp = find_entry(migrator, bucket, inode);
+    if (!*pp) {
+        if (__atomic_load_n(&migrator->tracked, __ATOMIC_RELAXED) >= MIGRATOR_MAX_TRACKED) {
+            pthread_mutex_unlock(lock);
+            return;
+        }
+        access_entry_t *entry = (access_entry_t*)calloc(1, sizeof(access_entry_t));
+        if (!entry) {
+            pthread_mutex_unlock(lock);
+            return;
+        }
+        entry->inode = inode;
+        entry->window = now;
+        *pp = entry;
+        __atomic_add_fetch(&migrator->tracked, 1, __ATOMIC_RELAXED);
+    }
+
+    access_entry_t *entry = *pp;
+    if (now - entry->window >= MIGRATOR_WINDOW) {
+        entry->window = now;
+        entry->hits = 0;
+        entry->hot = 0;
+    }
+    entry->hits++;
+    entry->last = now;
+
+    // 访问时间按间隔节流后写入 Redis；变热的文件每个窗口请求一次提升，
+    // 由迁移的挂载按节点记录判断文件是否在容量层（本挂载记下的层可能已经过时）
+    if (now - entry->stamped >= MIGRATOR_STAMP_INTERVAL) {
+        entry->dirty = 1;
+    }
+    if (entry->hits >= MIGRATOR_PROMOTE_HITS && !entry->hot) {
+        entry->hot = 1;
+        entry->dirty = 1;
+    }
+    pthread_mutex_unlock(lock);
+}
+
+// 把待写入的访问时间和提升请求写入 Redis；写入失败的记录丢弃，文件下次访问时重新写入
+static void flush_stamps(migrator_t *migrator, int *failing) {
+    access_stamp_t *stamps = NULL;
+    int count = 0, cap = 0;
+
+    for (size_t s = 0; s < MIGRATOR_LOCK_STRIPES; s++) {
+        pthread_mutex_lock(&migrator->stripes[s]);
+        for (size_t b = s; b < MIGRATOR_BUCKETS; b += MIGRATOR_LOCK_STRIPES) {
+            for (access_entry_t *entry = migrator->buckets[b]; entry; entry = entry->next) {
+                if (!entry->dirty) {
+                    continue;
+                }
+                if (count == cap) {
+                    int new_cap = cap ? cap * 2 : 256;
+                    access_stamp_t *grown = (access_stamp_t*)realloc(stamps, sizeof(access_stamp_t) * (size_t)new_cap);
+                    if (!grown) {
+                        break;
+                    }
+                    stamps = grown;
+                    cap = new_cap;
+                }
+                stamps[count].inode = entry->inode;
+                stamps[count].last = entry->last;
+                stamps[count].hot = entry->hot == 1;
+                count++;
+                if (entry->hot) {
+                    entry->hot = 2;
+                }
+                entry->stamped = entry->last;
+                entry->dirty = 0;
+            }
+        }
+        pthread_mutex_unlock(&migrator->stripes[s]);
+    }
+
+    if (count > 0) {
+        if (redis_meta_stamp_access(migrator->meta, stamps, count) != 0) {
+            if (!*failing) {
+                fprintf(stderr, "Failed to record file access times\n");
+            }
+            *failing = 1;
+        } else {
+            *failing = 0;
+        }
+    }
+    free(stamps);
+}
+
+// 丢弃已写入 Redis 且一个窗口内没有访问的记录
+static void prune_entries(migrator_t *migrator, time_t now) {
+    for (size_t s = 0; s < MIGRATOR_LOCK_STRIPES; s++) {
+        pthread_mutex_lock(&migrator->stripes[s]);
+        for (size_t b = s; b < MIGRATOR_BUCKETS; b += MIGRATOR_LOCK_STRIPES) {
+            access_entry_t **pp = &migrator->buckets[b];
+            while (*pp) {
+                access_entry_t *entry = *pp;
+                if (!entry->dirty && now - entry->last >= MIGRATOR_WINDOW) {
+                    *pp = entry->next;
+                    free(entry);
+                    __atomic_sub_fetch(&migrator->tracked, 1, __ATOMIC_RELAXED);
+                } else {
+                    pp = &entry->next;
+                }
+            }
+        }
+        pthread_mutex_unlock(&migrator->stripes[s]);
+    }
+}
+
+// 把文件迁移到 tier 并更新节点记录；返回 1 表示迁移了文件
+static int migrate_file(migrator_t *migrator, uint64_t inode, int tier, int *failing) {
+    // 已删除或创建尚在日志中的节点不迁移，内联文件没有数据文件
+    node_attr_t *attr;
+    if (redis_meta_get_node(migrator->meta, inode, &attr) != 0) {
+        return 0;
+    }
+    int regular = S_ISREG(attr->mode) && !(attr->flags & NODE_FLAG_INLINE);
+    int cold = (attr->flags & NODE_FLAG_COLD) != 0;
+    node_attr_free(attr);
+    if (!regular) {
+        return 0;
+    }
+
+    // 请求提升的文件大多已在快速层
+    if (tier == STORAGE_TIER_HOT && !cold) {
+        return 0;
+    }
+
+    // 以节点记录中的层为准，崩溃遗留在另一层的副本在迁移时清理
+    storage_set_tier(migrator->storage, inode, cold ? STORAGE_TIER_COLD : STORAGE_TIER_HOT);
+    if (storage_migrate(migrator->storage, inode, tier) != 0) {
+        // 复制期间被修改的文件留到下一轮
+        if (errno != EAGAIN) {
+            if (!*failing) {
+                fprintf(stderr, "Failed to migrate data of inode %lu: %s\n", inode, strerror(errno));
+            }
+            *failing = 1;
+            pthread_mutex_lock(&migrator->lock);
+            migrator->failed++;
+            pthread_mutex_unlock(&migrator->lock);
+        }
+        return 0;
+    }
+    *failing = 0;
+
+    // 数据已在目标层；记录更新失败时其他挂载打开文件后会从另一层找到数据
+    if (cold == (tier == STORAGE_TIER_COLD)) {
+        return 0;
+    }
+    if (redis_meta_set_tier(migrator->meta, inode, tier == STORAGE_TIER_COLD) < 0) {
+        fprintf(stderr, "Failed to record tier of inode %lu\n", inode);
+    }
+
+    pthread_mutex_lock(&migrator->lock);
+    if (tier == STORAGE_TIER_COLD) {
+        migrator->demoted++;
+    } else {
+        migrator->promoted++;
+    }
+    pthread_mutex_unlock(&migrator->lock);
+    return 1;
+}
+
+static int is_stopping(migrator_t *migrator) {
+    pthread_mutex_lock(&migrator->lock);
+    int stopping = migrator->stopping;
+    pthread_mutex_unlock(&migrator->lock);
+    return stopping;
+}
+
+// 提升各挂载请求提升的文件
+static void promote_files(migrator_t *migrator, int *failing) {
+    uint64_t *inodes;
+    int count;
+    if (redis_meta_take_promotions(migrator->meta, MIGRATOR_BATCH, &inodes, &count) != 0 || count == 0) {
+        return;
+    }
+
+    // 停止时未处理的请求丢弃，文件仍然热时会再次请求
+    for (int i = 0; i < count && !is_stopping(migrator); i++) {
+        migrate_file(migrator, inodes[i], STORAGE_TIER_HOT, failing);
+    }
+    free(inodes);
+}
+
+// 降级快速层中 cold_after 秒内没有读写的文件：取各挂载记录在 Redis 中的访问时间
+// 和后端文件的 atime/mtime 中较晚者；读取不到访问时间时本轮不降级
+static void scan_hot_tier(migrator_t *migrator, time_t now, int *failing) {
+    uint64_t *inodes;
+    int count;
+    if (storage_list_tier(migrator->storage, STORAGE_TIER_HOT, &inodes, &count) != 0) {
+        if (!*failing) {
+            perror("Failed to scan the hot data directory");
+        }
+        *failing = 1;
+        return;
+    }
+
+    time_t stamps[MIGRATOR_SCAN_CHUNK];
+    int moved = 0;
+    for (int start = 0; start < count && moved < MIGRATOR_BATCH && !is_stopping(migrator);
+         start += MIGRATOR_SCAN_CHUNK) {
+        int n = count - start < MIGRATOR_SCAN_CHUNK ? count - start : MIGRATOR_SCAN_CHUNK;
+        if (redis_meta_access_times(migrator->meta, inodes + start, n, stamps) != 0) {
+            if (!*failing) {
+                fprintf(stderr, "Failed to read file access times\n");
+            }
+            *failing = 1;
+            break;
+        }
+
+        for (int i = 0; i < n && moved < MIGRATOR_BATCH && !is_stopping(migrator); i++) {
+            time_t last;
+            if (storage_access_time(migrator->storage, inodes[start + i], &last) != 0) {
+                continue;
+            }
+            if (stamps[i] > last) {
+                last = stamps[i];
+            }
+            if (now - last < migrator->cold_after) {
+                continue;
+            }
+            moved += migrate_file(migrator, inodes[start + i], STORAGE_TIER_COLD, failing);
+        }
+    }
+
+    free(inodes);
+
+    // 早于 cold_after 的访问时间不再影响判断
+    redis_meta_expire_access(migrator->meta, now - migrator->cold_after);
+}
+
+static void* migrator_main(void *arg) {
+    migrator_t *migrator = (migrator_t*)arg;
+    int failing = 0;
+    int stamp_failing = 0;
+    time_t next_scan = 0;
+
+    pthread_mutex_lock(&migrator->lock);
+    while (!migrator->stopping) {
+        pthread_mutex_unlock(&migrator->lock);
+
+        flush_stamps(migrator, &stamp_failing);
+
+        // 先提升变热的文件
+        if (migrator->cold_after > 0) {
+            promote_files(migrator, &failing);
+        }
+
+        time_t now = time(NULL);
+        if (now >= next_scan) {
+            if (migrator->cold_after > 0) {
+                scan_hot_tier(migrator, now, &failing);
+            }
+            prune_entries(migrator, now);
+            next_scan = now + MIGRATOR_SCAN_INTERVAL;
+        }
+
+        struct timespec deadline = { .tv_sec = time(NULL) + MIGRATOR_FLUSH_INTERVAL, .tv_nsec = 0 };
+        pthread_mutex_lock(&migrator->lock);
+        if (!migrator->stopping) {
+            pthread_cond_timedwait(&migrator->wake, &migrator->lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&migrator->lock);
+
+    // 卸载前写入最后的访问时间
+    flush_stamps(migrator, &stamp_failing);
+    return NULL;
+}
+
+int migrator_start(migrator_t *migrator) {
+    if (migrator->started) {
+        return 0;
+    }
+
+    if (pthread_create(&migrator->thread, NULL, migrator_main, migrator) != 0) {
+        return -1;
+    }
+    migrator->started = 1;
+
+    return 0;
+}
+
+void migrator_free(migrator_t *migrator) {
+    if (!migrator) {
+        return;
+    }
+
+    pthread_mutex_lock(&migrator->lock);
+    migrator->stopping = 1;
+    pthread_cond_signal(&migrator->wake);
+    pthread_mutex_unlock(&migrator->lock);
+
+    if (migrator->started) {
+        pthread_join(migrator->thread, NULL);
+    }
+
+    for (size_t b = 0; b < MIGRATOR_BUCKETS; b++) {
+        access_entry_t *entry = migrator->buckets[b];
+        while (entry) {
+            access_entry_t *next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+    if (migrator->meta) {
+        redis_meta_free(migrator->meta);
+    }
+    for (int i = 0; i < MIGRATOR_LOCK_STRIPES; i++) {
+        pthread_mutex_destroy(&migrator->stripes[i]);
+    }
+    pthread_mutex_destroy(&migrator->lock);
+    pthread_cond_destroy(&migrator->wake);
+    free(migrator);
+}
+
+void migrator_get_stats(migrator_t *migrator, migrator_stats_t *stats) {
+    pthread_mutex_lock(&migrator->lock);
+    stats->demoted = migrator->demoted;
+    stats->promoted = migrator->promoted;
+    stats->failed = migrator->failed;
+    pthread_mutex_unlock(&migrator->lock);
+}
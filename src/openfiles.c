@@ -0,0 +1,104 @@
+#include "openfiles.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+// 哈希桶数（2 的幂），打开的文件数通常远小于此
+#define OPENFILES_BUCKETS 4096
+
+typedef struct open_file {
+    uint64_t inode;
+    int count;                  // 打开的句柄数
+    int orphan;                 // 链接已全部删除
+    struct open_file *next;
+} open_file_t;
+
+struct openfiles {
+    pthread_mutex_t lock;
+    open_file_t *buckets[OPENFILES_BUCKETS];
+};
+
+static inline open_file_t** find_file(openfiles_t *files, uint64_t inode) {
+    uint64_t h = inode * 0x9e3779b97f4a7c15ULL;
+    open_file_t **pp = &files->buckets[(h >> 32) & (OPENFILES_BUCKETS - 1)];
+    while (*pp && (*pp)->inode != inode) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+openfiles_t* openfiles_new(void) {
+    openfiles_t *files = (openfiles_t*)calloc(1, sizeof(openfiles_t));
+    if (!files) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&files->lock, NULL);
+    return files;
+}
+
+void openfiles_free(openfiles_t *files) {
+    if (!files) {
+        return;
+    }
+
+    for (size_t b = 0; b < OPENFILES_BUCKETS; b++) {
+        open_file_t *f = files->buckets[b];
+        while (f) {
+            open_file_t *next = f->next;
+            free(f);
+            f = next;
+        }
+    }
+
+    pthread_mutex_destroy(&files->lock);
+    free(files);
+}
+
+int openfiles_open(openfiles_t *files, uint64_t inode) {
+    pthread_mutex_lock(&files->lock);
+    open_file_t **pp = find_file(files, inode);
+    if (!*pp) {
+        open_file_t *f = (open_file_t*)calloc(1, sizeof(open_file_t));
+        if (!f) {
+            pthread_mutex_unlock(&files->lock);
+            return -1;
+        }
+        f->inode = inode;
+        *pp = f;
+    }
+    (*pp)->count++;
+    pthread_mutex_unlock(&files->lock);
+    return 0;
+}
+
+int openfiles_release(openfiles_t *files, uint64_t inode) {
+    int orphan = 0;
+
+    pthread_mutex_lock(&files->lock);
+    open_file_t **pp = find_file(files, inode);
+    open_file_t *f = *pp;
+    if (f && --f->count == 0) {
+        orphan = f->orphan;
+        *pp = f->next;
+        free(f);
+    }
+    pthread_mutex_unlock(&files->lock);
+    return orphan;
+}
+
+int openfiles_busy(openfiles_t *files, uint64_t inode) {
+    pthread_mutex_lock(&files->lock);
+    int busy = *find_file(files, inode) != NULL;
+    pthread_mutex_unlock(&files->lock);
+    return busy;
+}
+
+int openfiles_orphan(openfiles_t *files, uint64_t inode) {
+    pthread_mutex_lock(&files->lock);
+    open_file_t *f = *find_file(files, inode);
+    if (f) {
+        f->orphan = 1;
+    }
+    pthread_mutex_unlock(&files->lock);
+    return f != NULL;
+}
@@ -0,0 +1,362 @@
+#include "qos.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+// 租户的哈希桶数（2 的幂）
+#define QOS_BUCKETS 1024
+
+// 租户数达到上限后新租户共用的键
+#define QOS_OVERFLOW_KEY UINT64_MAX
+
+typedef struct qos_tenant_entry {
+    uint64_t key;
+    int weight;
+    double finish[QOS_CLASSES];         // 上一个操作的结束标签
+    double tokens[QOS_CLASSES];         // 令牌桶，可以为负（欠下的令牌）
+    uint64_t refill[QOS_CLASSES];       // 上次补充令牌的时间（纳秒）
+    int running[QOS_CLASSES];           // 占用的执行槽
+    int waiting;                        // 各类别中限速等待和排队的操作
+    struct qos_tenant_entry *next;
+} qos_tenant_entry_t;
+
+// 等待执行槽的操作，分配在等待线程的栈上
+typedef struct qos_waiter {
+    double start;
+    qos_tenant_entry_t *tenant;
+    int granted;
+    pthread_cond_t cond;
+    struct qos_waiter *next;
+} qos_waiter_t;
+
+typedef struct {
+    int slots;
+    int tenant_slots;                   // 每个租户最多占用的执行槽
+    int busy;
+    double vtime;                       // 虚拟时间：最近开始执行的操作的开始标签
+    qos_waiter_t *waiting;              // 按开始标签排序
+    double rate;                        // 每个租户每秒的令牌，0 表示不限速
+    uint64_t ops;
+    uint64_t queued;
+    uint64_t throttled;
+    uint64_t rejected;
+} qos_class_t;
+
+struct qos {
+    int key_type;
+    pthread_mutex_t lock;
+    qos_class_t classes[QOS_CLASSES];
+    qos_tenant_entry_t *buckets[QOS_BUCKETS];
+    uint64_t tenants;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// FNV-1a
+static uint64_t hash_name(const char *name, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static inline qos_tenant_entry_t** find_tenant(qos_t *qos, uint64_t key) {
+    uint64_t h = key * 0x9e3779b97f4a7c15ULL;
+    qos_tenant_entry_t **pp = &qos->buckets[(h >> 32) & (QOS_BUCKETS - 1)];
+    while (*pp && (*pp)->key != key) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+// 查找或创建租户（调用者持有锁），内存不足或超过上限时使用共用的租户
+static qos_tenant_entry_t* get_tenant(qos_t *qos, uint64_t key) {
+    qos_tenant_entry_t **pp = find_tenant(qos, key);
+    if (*pp) {
+        return *pp;
+    }
+
+    qos_tenant_entry_t *tenant = NULL;
+    if (qos->tenants < QOS_MAX_TENANTS || key == QOS_OVERFLOW_KEY) {
+        tenant = (qos_tenant_entry_t*)calloc(1, sizeof(qos_tenant_entry_t));
+    }
+    if (!tenant) {
+        if (key == QOS_OVERFLOW_KEY) {
+            return NULL;
+        }
+        return get_tenant(qos, QOS_OVERFLOW_KEY);
+    }
+
+    uint64_t now = now_ns();
+    tenant->key = key;
+    tenant->weight = QOS_DEFAULT_WEIGHT;
+    for (int c = 0; c < QOS_CLASSES; c++) {
+        tenant->tokens[c] = qos->classes[c].rate;
+        tenant->refill[c] = now;
+    }
+    *pp = tenant;
+    qos->tenants++;
+    return tenant;
+}
+
+qos_t* qos_new(int key_type, uint64_t meta_rate, uint64_t data_rate,
+               const int slots[QOS_CLASSES], int tenant_slots) {
+    if ((key_type != QOS_KEY_UID && key_type != QOS_KEY_DIR) || tenant_slots < 0) {
+        return NULL;
+    }
+    for (int c = 0; c < QOS_CLASSES; c++) {
+        if (slots[c] <= 0) {
+            return NULL;
+        }
+    }
+
+    qos_t *qos = (qos_t*)calloc(1, sizeof(qos_t));
+    if (!qos) {
+        return NULL;
+    }
+
+    qos->key_type = key_type;
+    for (int c = 0; c < QOS_CLASSES; c++) {
+        qos_class_t *cls = &qos->classes[c];
+        cls->slots = slots[c];
+        cls->tenant_slots = tenant_slots > 0 ? tenant_slots : slots[c] - 1;
+        if (cls->tenant_slots > slots[c]) {
+            cls->tenant_slots = slots[c];
+        }
+        if (cls->tenant_slots < 1) {
+            cls->tenant_slots = 1;
+        }
+    }
+    qos->classes[QOS_META].rate = (double)meta_rate;
+    qos->classes[QOS_DATA].rate = (double)data_rate;
+    pthread_mutex_init(&qos->lock, NULL);
+
+    return qos;
+}
+
+void qos_free(qos_t *qos) {
+    if (!qos) {
+        return;
+    }
+
+    for (size_t b = 0; b < QOS_BUCKETS; b++) {
+        qos_tenant_entry_t *tenant = qos->buckets[b];
+        while (tenant) {
+            qos_tenant_entry_t *next = tenant->next;
+            free(tenant);
+            tenant = next;
+        }
+    }
+    pthread_mutex_destroy(&qos->lock);
+    free(qos);
+}
+
+int qos_set_weight(qos_t *qos, const char *name, int weight) {
+    if (!name || !name[0] || weight <= 0 || weight > QOS_MAX_WEIGHT) {
+        return -1;
+    }
+
+    uint64_t key;
+    if (qos->key_type == QOS_KEY_UID) {
+        char *end;
+        errno = 0;
+        unsigned long uid = strtoul(name, &end, 10);
+        if (errno != 0 || *end != '\0' || uid > (uid_t)-1) {
+            return -1;
+        }
+        key = uid;
+    } else {
+        if (strchr(name, '/')) {
+            return -1;
+        }
+        key = hash_name(name, strlen(name));
+    }
+
+    pthread_mutex_lock(&qos->lock);
+    qos_tenant_entry_t *tenant = get_tenant(qos, key);
+    if (!tenant || tenant->key != key) {
+        pthread_mutex_unlock(&qos->lock);
+        return -1;
+    }
+    tenant->weight = weight;
+    pthread_mutex_unlock(&qos->lock);
+    return 0;
+}
+
+uint64_t qos_tenant(qos_t *qos, const char *path, uid_t uid) {
+    if (qos->key_type == QOS_KEY_UID) {
+        return uid;
+    }
+
+    // 第一级目录；根目录下的文件和没有路径的操作归根目录
+    if (!path) {
+        return hash_name("", 0);
+    }
+    while (*path == '/') {
+        path++;
+    }
+    const char *end = strchr(path, '/');
+    if (!end) {
+        return hash_name("", 0);
+    }
+    return hash_name(path, (size_t)(end - path));
+}
+
+// 补充令牌并扣除本次开销，返回需要等待的纳秒数（调用者持有锁）
+static uint64_t take_tokens(qos_class_t *c, qos_tenant_entry_t *tenant, int cls, double cost) {
+    if (c->rate <= 0) {
+        return 0;
+    }
+
+    uint64_t now = now_ns();
+    double tokens = tenant->tokens[cls] + (double)(now - tenant->refill[cls]) * c->rate / 1e9;
+    if (tokens > c->rate) {
+        tokens = c->rate;
+    }
+    tenant->refill[cls] = now;
+
+    // 先扣除，欠下的令牌由等待偿还，之后的操作排在后面
+    tokens -= cost;
+    tenant->tokens[cls] = tokens;
+    if (tokens >= 0) {
+        return 0;
+    }
+    return (uint64_t)(-tokens * 1e9 / c->rate);
+}
+
+int qos_begin(qos_t *qos, int cls, uint64_t tenant_key, uint64_t cost, qos_slot_t *slot) {
+    qos_class_t *c = &qos->classes[cls];
+    double units = 1;
+    if (cls == QOS_DATA) {
+        units = (double)(cost < QOS_MIN_COST ? QOS_MIN_COST : cost);
+    }
+
+    pthread_mutex_lock(&qos->lock);
+    qos_tenant_entry_t *tenant = get_tenant(qos, tenant_key);
+    *slot = tenant;
+    if (!tenant) {
+        // 没有租户记录（内存不足）时不做限制，只占用类别的槽
+        c->ops++;
+        c->busy++;
+        pthread_mutex_unlock(&qos->lock);
+        return 0;
+    }
+
+    uint64_t delay = take_tokens(c, tenant, cls, units);
+    if (delay > 0) {
+        if (tenant->waiting >= QOS_TENANT_WAITERS) {
+            // 退回令牌，被拒绝的操作不计入速率
+            tenant->tokens[cls] += units;
+            c->rejected++;
+            pthread_mutex_unlock(&qos->lock);
+            return -1;
+        }
+        c->throttled++;
+        tenant->waiting++;
+        pthread_mutex_unlock(&qos->lock);
+        struct timespec ts = { .tv_sec = (time_t)(delay / 1000000000ULL),
+                               .tv_nsec = (long)(delay % 1000000000ULL) };
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        }
+        pthread_mutex_lock(&qos->lock);
+        tenant->waiting--;
+    }
+
+    // 有空闲的槽时队列中的操作都属于已达到上限的租户，本租户未达到上限即可直接执行
+    double start = c->vtime > tenant->finish[cls] ? c->vtime : tenant->finish[cls];
+    int ready = c->busy < c->slots && tenant->running[cls] < c->tenant_slots;
+    if (!ready && tenant->waiting >= QOS_TENANT_WAITERS) {
+        c->rejected++;
+        pthread_mutex_unlock(&qos->lock);
+        return -1;
+    }
+
+    // 开始标签取虚拟时间和本租户上一个操作结束标签中的较大者，按权重推进结束标签
+    double size = cls == QOS_DATA ? units / QOS_MIN_COST : units;
+    tenant->finish[cls] = start + size / tenant->weight;
+    c->ops++;
+
+    if (ready) {
+        c->busy++;
+        tenant->running[cls]++;
+        c->vtime = start;
+        pthread_mutex_unlock(&qos->lock);
+        return 0;
+    }
+
+    // 按开始标签插入队列，标签相同时先到先得
+    qos_waiter_t waiter = { .start = start, .tenant = tenant, .granted = 0, .next = NULL };
+    pthread_cond_init(&waiter.cond, NULL);
+    qos_waiter_t **pp = &c->waiting;
+    while (*pp && (*pp)->start <= start) {
+        pp = &(*pp)->next;
+    }
+    waiter.next = *pp;
+    *pp = &waiter;
+    c->queued++;
+    tenant->waiting++;
+
+    while (!waiter.granted) {
+        pthread_cond_wait(&waiter.cond, &qos->lock);
+    }
+    tenant->waiting--;
+    pthread_mutex_unlock(&qos->lock);
+    pthread_cond_destroy(&waiter.cond);
+    return 0;
+}
+
+void qos_end(qos_t *qos, int cls, qos_slot_t tenant) {
+    qos_class_t *c = &qos->classes[cls];
+
+    pthread_mutex_lock(&qos->lock);
+    c->busy--;
+    if (tenant) {
+        tenant->running[cls]--;
+    }
+
+    // 空出的槽交给队列中第一个所属租户未达到上限的操作（队列按开始标签排序）
+    qos_waiter_t **pp = &c->waiting;
+    while (*pp && c->busy < c->slots) {
+        qos_waiter_t *waiter = *pp;
+        if (waiter->tenant->running[cls] >= c->tenant_slots) {
+            pp = &waiter->next;
+            continue;
+        }
+        *pp = waiter->next;
+        c->busy++;
+        waiter->tenant->running[cls]++;
+        c->vtime = waiter->start;
+        waiter->granted = 1;
+        pthread_cond_signal(&waiter->cond);
+    }
+    pthread_mutex_unlock(&qos->lock);
+}
+
+int qos_max_threads(const qos_t *qos) {
+    int threads = QOS_THREAD_HEADROOM;
+    for (int c = 0; c < QOS_CLASSES; c++) {
+        threads += qos->classes[c].slots;
+    }
+    return threads;
+}
+
+void qos_get_stats(qos_t *qos, qos_stats_t *stats) {
+    pthread_mutex_lock(&qos->lock);
+    for (int c = 0; c < QOS_CLASSES; c++) {
+        stats->ops[c] = qos->classes[c].ops;
+        stats->queued[c] = qos->classes[c].queued;
+        stats->throttled[c] = qos->classes[c].throttled;
+        stats->rejected[c] = qos->classes[c].rejected;
+    }
+    stats->tenants = qos->tenants;
+    pthread_mutex_unlock(&qos->lock);
+}
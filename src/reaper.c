@@ -0,0 +1,304 @@
+#include "reaper.h"
+#include "redis_meta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+struct reaper {
+    storage_t *storage;
+    int nthreads;
+    int rate;
+
+    redis_meta_t *meta;             // 分发线程的连接
+    redis_meta_t **worker_meta;     // 每个工作线程一个连接
+    pthread_t dispatcher;
+    pthread_t *workers;
+    int started;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            // 唤醒分发线程
+    pthread_cond_t work;            // 有新任务
+    pthread_cond_t done;            // 本轮任务完成
+    uint64_t *queue;                // 本轮待删除的节点
+    int queue_len;
+    int queue_pos;
+    int in_progress;
+    int notified;
+    int stopping;
+
+    uint64_t deleted;
+    uint64_t failed;
+};
+
+reaper_t* reaper_new(storage_t *storage, const char *addr, int port, const char *password, int db,
+                     int threads, int rate) {
+    if (!storage || threads <= 0) {
+        return NULL;
+    }
+
+    reaper_t *reaper = (reaper_t*)calloc(1, sizeof(reaper_t));
+    if (!reaper) {
+        return NULL;
+    }
+
+    reaper->storage = storage;
+    reaper->nthreads = threads;
+    reaper->rate = rate;
+    pthread_mutex_init(&reaper->lock, NULL);
+    pthread_cond_init(&reaper->wake, NULL);
+    pthread_cond_init(&reaper->work, NULL);
+    pthread_cond_init(&reaper->done, NULL);
+
+    reaper->worker_meta = (redis_meta_t**)calloc((size_t)threads, sizeof(redis_meta_t*));
+    reaper->workers = (pthread_t*)calloc((size_t)threads, sizeof(pthread_t));
+    if (!reaper->worker_meta || !reaper->workers) {
+        reaper_free(reaper);
+        return NULL;
+    }
+
+    // 连接在转入后台之前建立，便于尽早报告错误
+    reaper->meta = redis_meta_new(addr, port, password, db);
+    if (!reaper->meta) {
+        reaper_free(reaper);
+        return NULL;
+    }
+    for (int i = 0; i < threads; i++) {
+        reaper->worker_meta[i] = redis_meta_new(addr, port, password, db);
+        if (!reaper->worker_meta[i]) {
+            reaper_free(reaper);
+            return NULL;
+        }
+    }
+
+    return reaper;
+}
+
+// 等待到 deadline，被唤醒或停止时提前返回
+static void wait_until(reaper_t *reaper, pthread_cond_t *cond, const struct timespec *deadline) {
+    pthread_mutex_lock(&reaper->lock);
+    if (!reaper->stopping && !reaper->notified) {
+        pthread_cond_timedwait(cond, &reaper->lock, deadline);
+    }
+    reaper->notified = 0;
+    pthread_mutex_unlock(&reaper->lock);
+}
+
+static void deadline_after(struct timespec *ts, const struct timespec *start, double seconds) {
+    *ts = *start;
+    ts->tv_sec += (time_t)seconds;
+    ts->tv_nsec += (long)((seconds - (double)(time_t)seconds) * 1e9);
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+typedef struct {
+    reaper_t *reaper;
+    int index;
+} worker_arg_t;
+
+static void* worker_main(void *arg) {
+    worker_arg_t *wa = (worker_arg_t*)arg;
+    reaper_t *reaper = wa->reaper;
+    redis_meta_t *meta = reaper->worker_meta[wa->index];
+    free(wa);
+
+    uint64_t done[REAPER_TASK_SIZE];
+
+    pthread_mutex_lock(&reaper->lock);
+    for (;;) {
+        while (!reaper->stopping && reaper->queue_pos >= reaper->queue_len) {
+            pthread_cond_wait(&reaper->work, &reaper->lock);
+        }
+        if (reaper->stopping) {
+            break;
+        }
+
+        // 领取一个任务
+        int start = reaper->queue_pos;
+        int n = reaper->queue_len - start;
+        if (n > REAPER_TASK_SIZE) {
+            n = REAPER_TASK_SIZE;
+        }
+        reaper->queue_pos += n;
+        reaper->in_progress++;
+        const uint64_t *task = reaper->queue + start;
+        pthread_mutex_unlock(&reaper->lock);
+
+        // 先释放数据，再批量删除节点记录；中途崩溃时节点仍在待删除集合中
+        int count = 0;
+        int failed = 0;
+        for (int i = 0; i < n; i++) {
+            if (storage_delete(reaper->storage, task[i]) == 0) {
+                done[count++] = task[i];
+            } else {
+                fprintf(stderr, "Failed to delete data of inode %lu, retrying later\n", task[i]);
+                redis_meta_retry_delete(meta, task[i], REAPER_RETRY_DELAY);
+                failed++;
+            }
+        }
+        if (redis_meta_finish_deletes(meta, done, count) != 0) {
+            fprintf(stderr, "Failed to remove deleted nodes from Redis\n");
+            failed += count;
+            count = 0;
+        }
+
+        pthread_mutex_lock(&reaper->lock);
+        reaper->deleted += (uint64_t)count;
+        reaper->failed += (uint64_t)failed;
+        reaper->in_progress--;
+        if (reaper->in_progress == 0) {
+            pthread_cond_signal(&reaper->done);
+        }
+    }
+    pthread_mutex_unlock(&reaper->lock);
+
+    return NULL;
+}
+
+static void* dispatcher_main(void *arg) {
+    reaper_t *reaper = (reaper_t*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&reaper->lock);
+        int stopping = reaper->stopping;
+        pthread_mutex_unlock(&reaper->lock);
+        if (stopping) {
+            break;
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_REALTIME, &start);
+
+        // 限速时每轮最多取出一秒的配额
+        int max = REAPER_BATCH;
+        if (reaper->rate > 0 && reaper->rate < max) {
+            max = reaper->rate;
+        }
+
+        uint64_t *inodes = NULL;
+        int count = 0;
+        if (redis_meta_pending_deletes(reaper->meta, max, &inodes, &count) != 0 || count == 0) {
+            free(inodes);
+            struct timespec deadline;
+            deadline_after(&deadline, &start, 1.0);
+            wait_until(reaper, &reaper->wake, &deadline);
+            continue;
+        }
+
+        // 分发给工作线程并等待本轮完成
+        pthread_mutex_lock(&reaper->lock);
+        reaper->queue = inodes;
+        reaper->queue_len = count;
+        reaper->queue_pos = 0;
+        pthread_cond_broadcast(&reaper->work);
+        while (reaper->in_progress > 0 ||
+               (!reaper->stopping && reaper->queue_pos < reaper->queue_len)) {
+            pthread_cond_wait(&reaper->done, &reaper->lock);
+        }
+        reaper->queue = NULL;
+        reaper->queue_len = 0;
+        reaper->queue_pos = 0;
+        pthread_mutex_unlock(&reaper->lock);
+        free(inodes);
+
+        // 按速率限制补足本轮应占用的时间
+        if (reaper->rate > 0) {
+            struct timespec deadline;
+            deadline_after(&deadline, &start, (double)count / reaper->rate);
+            pthread_mutex_lock(&reaper->lock);
+            while (!reaper->stopping &&
+                   pthread_cond_timedwait(&reaper->wake, &reaper->lock, &deadline) != ETIMEDOUT) {
+                // 新的删除请求不打断限速等待
+            }
+            pthread_mutex_unlock(&reaper->lock);
+        }
+    }
+
+    return NULL;
+}
+
+int reaper_start(reaper_t *reaper) {
+    if (reaper->started) {
+        return 0;
+    }
+
+    for (int i = 0; i < reaper->nthreads; i++) {
+        worker_arg_t *wa = (worker_arg_t*)malloc(sizeof(worker_arg_t));
+        if (!wa) {
+            return -1;
+        }
+        wa->reaper = reaper;
+        wa->index = i;
+        if (pthread_create(&reaper->workers[i], NULL, worker_main, wa) != 0) {
+            free(wa);
+            return -1;
+        }
+        reaper->started = i + 1;
+    }
+
+    if (pthread_create(&reaper->dispatcher, NULL, dispatcher_main, reaper) != 0) {
+        return -1;
+    }
+    reaper->started = reaper->nthreads + 1;
+
+    return 0;
+}
+
+void reaper_notify(reaper_t *reaper) {
+    pthread_mutex_lock(&reaper->lock);
+    reaper->notified = 1;
+    pthread_cond_signal(&reaper->wake);
+    pthread_mutex_unlock(&reaper->lock);
+}
+
+void reaper_free(reaper_t *reaper) {
+    if (!reaper) {
+        return;
+    }
+
+    pthread_mutex_lock(&reaper->lock);
+    reaper->stopping = 1;
+    pthread_cond_broadcast(&reaper->wake);
+    pthread_cond_broadcast(&reaper->work);
+    pthread_cond_broadcast(&reaper->done);
+    pthread_mutex_unlock(&reaper->lock);
+
+    // 先等工作线程，分发线程在它们退出后才能结束本轮
+    int workers = reaper->started < reaper->nthreads ? reaper->started : reaper->nthreads;
+    for (int i = 0; i < workers; i++) {
+        pthread_join(reaper->workers[i], NULL);
+    }
+    if (reaper->started > reaper->nthreads) {
+        pthread_join(reaper->dispatcher, NULL);
+    }
+
+    if (reaper->worker_meta) {
+        for (int i = 0; i < reaper->nthreads; i++) {
+            if (reaper->worker_meta[i]) {
+                redis_meta_free(reaper->worker_meta[i]);
+            }
+        }
+    }
+    if (reaper->meta) {
+        redis_meta_free(reaper->meta);
+    }
+    free(reaper->worker_meta);
+    free(reaper->workers);
+    pthread_mutex_destroy(&reaper->lock);
+    pthread_cond_destroy(&reaper->wake);
+    pthread_cond_destroy(&reaper->work);
+    pthread_cond_destroy(&reaper->done);
+    free(reaper);
+}
+
+void reaper_get_stats(reaper_t *reaper, reaper_stats_t *stats) {
+    pthread_mutex_lock(&reaper->lock);
+    stats->deleted = reaper->deleted;
+    stats->failed = reaper->failed;
+    pthread_mutex_unlock(&reaper->lock);
+}
@@ -1,291 +1,3339 @@
 #include "redis_meta.h"
+#include "mempool.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <hiredis/hiredis.h>
 
 static const char *NODE_KEY_PREFIX = "node:";
 static const char *DIR_KEY_PREFIX = "dir:";
+static const char *INLINE_KEY_PREFIX = "inline:";
 static const char *LOOKUP_COUNTER_KEY = "lookup";
+static const char *SETTING_KEY = "setting";
+static const char *PENDING_DELETE_KEY = "delfiles";
+static const char *USAGE_KEY = "usage";
+static const char *DIRSTAT_KEY_PREFIX = "dirstat:";
+static const char *DIRDELTA_KEY = "dirdelta";
+static const char *JOURNAL_KEY_PREFIX = "journal:";
+static const char *XATTR_KEY_PREFIX = "xattr:";
+static const char *SYNC_KEY = "sync";
+static const char *ACCESS_KEY = "atime";
+static const char *PROMOTE_KEY = "promote";
 
-static char* get_node_key(uint64_t inode) {
-    char *key = (char*)malloc(32);
-    if (!key) return NULL;
-    sprintf(key, "%s%lu", NODE_KEY_PREFIX, inode);
-    return key;
+// 分片目录在主哈希中的标记字段（文件名不含 '/'，不会与目录项冲突），值为子哈希数量
+static const char *DIR_SHARDS_FIELD = "/shards";
+
+// 脚本共用的函数：
+// space(r) 取节点记录的 size 字段按 4K 向上对齐，作为已用空间
+// parent(r) 取节点记录的 parent 字段
+// split(r) 把节点记录拆分为字段数组
+// adjust(key, nlink, entries, now) 调整链接数和目录项数并更新修改时间，返回调整后的目录项数
+// （节点不存在时返回 0，没有计数字段的旧记录只更新时间，返回 -1）
+// charge(k, old, value, dirstat) 按节点记录从 old 改为 value 的已用空间之差调整 usage（k[2]），
+// dirstat 为 '1' 时把差值记到父目录在 dirdelta（k[3]）中的待传播增量上
+#define NODE_SCRIPT_FUNCS \
+    "local function space(r) " \
+    "if not r then return 0 end " \
+    "local s = tonumber(string.match(r, '^[^:]*:[^:]*:[^:]*:[^:]*:(%d+)')) or 0 " \
+    "return math.ceil(s / 4096) * 4096 end " \
+    "local function parent(r) " \
+    "return r and string.match(r, '^' .. string.rep('[^:]*:', 10) .. '(%d+)') end " \
+    "local function split(r) " \
+    "local t = {} " \
+    "for f in string.gmatch(r, '[^:]+') do t[#t + 1] = f end " \
+    "return t end " \
+    "local function adjust(key, nlink, entries, now) " \
+    "local r = redis.call('GET', key) " \
+    "if not r then return 0 end " \
+    "local t = split(r) " \
+    "for i = #t + 1, 11 do t[i] = '0' end " \
+    "t[8], t[9] = now, now " \
+    "if t[12] then " \
+    "t[12] = string.format('%d', tonumber(t[12]) + tonumber(nlink)) " \
+    "t[13] = string.format('%d', (tonumber(t[13]) or 0) + tonumber(entries)) " \
+    "end " \
+    "redis.call('SET', key, table.concat(t, ':')) " \
+    "return tonumber(t[13]) or -1 end " \
+    "local function charge(k, old, value, dirstat) " \
+    "local d = space(value) - space(old) " \
+    "if d == 0 then return end " \
+    "redis.call('HINCRBY', k[2], 'space', string.format('%d', d)) " \
+    "local p = dirstat == '1' and parent(value) " \
+    "if p and p ~= '0' then redis.call('HINCRBY', k[3], p .. '.space', string.format('%d', d)) end end "
+
+// 删除节点记录、内联数据和目录统计，并扣除其用量；
+// 目录尚未传播的增量转交给父目录，避免删除后断开传播链
+// k = {node:<inode>, inline:<inode>, usage, dirstat:<inode>, dirdelta, dir:<inode>（分片目录的标记）, xattr:<inode>}
+#define DELETE_NODE_FUNC \
+    "local function delete_node(k, inode, dirstat) " \
+    "local old = redis.call('GET', k[1]) " \
+    "if old then " \
+    "redis.call('HINCRBY', k[3], 'space', string.format('%d', -space(old))) " \
+    "redis.call('HINCRBY', k[3], 'inodes', -1) " \
+    "end " \
+    "if dirstat == '1' then " \
+    "local p = parent(old) " \
+    "for _, kind in ipairs({'space', 'files', 'dirs'}) do " \
+    "local f = inode .. '.' .. kind " \
+    "local v = redis.call('HGET', k[5], f) " \
+    "if v then " \
+    "redis.call('HDEL', k[5], f) " \
+    "if p and p ~= '0' then redis.call('HINCRBY', k[5], p .. '.' .. kind, v) end " \
+    "end " \
+    "end " \
+    "end " \
+    "redis.call('DEL', k[1], k[2], k[4], k[6], k[7]) end "
+
+// 写节点记录，并按新旧大小之差调整已用空间；启用目录统计时把差值记到父目录的待传播增量上
+// 链接数和目录项数只由 ADJUST_NODE_SCRIPT 修改，容量层标志只由 SET_TIER_SCRIPT 修改，
+// 内联标志只由 CLEAR_INLINE_SCRIPT 清除，这里保留记录中已有的值
+// ARGV[3] 为 1 时只修改已有的记录，节点不存在时返回 1
+// KEYS[1] = node:<inode>，KEYS[2] = usage，KEYS[3] = dirdelta
+// ARGV[1] = 节点属性，ARGV[2] = 是否启用目录统计，ARGV[3] = 是否只修改已有的记录
+static const char *SET_NODE_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    "local old = redis.call('GET', KEYS[1]) "
+    "if not old and ARGV[3] == '1' then return 1 end "
+    "local value = ARGV[1] "
+    "if old then "
+    "local o = split(old) "
+    "local n = split(value) "
+    "if o[12] then n[12], n[13] = o[12], o[13] or '0' end "
+    "if n[10] and o[10] then "
+    "n[10] = string.format('%d', bit.bor(bit.band(tonumber(n[10]) or 0, bit.bnot(3)), bit.band(tonumber(o[10]) or 0, 3))) "
+    "end "
+    "value = table.concat(n, ':') "
+    "end "
+    "redis.call('SET', KEYS[1], value) "
+    "charge(KEYS, old, value, ARGV[2]) "
+    "return 0";
+
+// 调整链接数和目录项数，并更新修改时间；没有计数字段的旧记录只更新时间
+// 返回调整后的目录项数，旧记录返回 -1
+// KEYS[1] = node:<inode>，ARGV[1] = 链接数增量，ARGV[2] = 目录项数增量，ARGV[3] = 当前时间
+static const char *ADJUST_NODE_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    "return adjust(KEYS[1], ARGV[1], ARGV[2], ARGV[3])";
+
+// 只修改大小和时间戳：大小只增不减，时间戳为 -1 时保持不变，已用空间的调整与 SET_NODE_SCRIPT 相同
+// 并发的写入各自扩展大小，不会用读到的旧记录覆盖其他写入的结果
+// k = {node:<inode>, usage, dirdelta}，a = {大小下限, atime, mtime, ctime, 是否启用目录统计}
+#define TOUCH_NODE_FUNC \
+    "local function touch(k, a, old) " \
+    "local t = split(old) " \
+    "for i = #t + 1, 11 do t[i] = '0' end " \
+    "if tonumber(a[1]) > (tonumber(t[5]) or 0) then t[5] = a[1] end " \
+    "for i = 2, 4 do " \
+    "if a[i] ~= '-1' then t[i + 5] = a[i] end " \
+    "end " \
+    "local value = table.concat(t, ':') " \
+    "redis.call('SET', k[1], value) " \
+    "charge(k, old, value, a[5]) end "
+
+// 扩展大小、设置时间戳（见 TOUCH_NODE_FUNC）
+// KEYS[1] = node:<inode>，KEYS[2] = usage，KEYS[3] = dirdelta
+// ARGV[1] = 大小下限，ARGV[2..4] = atime、mtime、ctime，ARGV[5] = 是否启用目录统计
+static const char *TOUCH_NODE_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    TOUCH_NODE_FUNC
+    "local old = redis.call('GET', KEYS[1]) "
+    "if not old then return 0 end "
+    "touch(KEYS, ARGV, old) "
+    "return 0";
+
+// 写入内联数据并扩展大小、设置时间戳：节点已不是内联文件（已被提升）时返回 1，不做任何修改，
+// 提升与写入在服务器上串行，已确认的写入不会被提升丢弃
+// KEYS[1] = node:<inode>，KEYS[2] = usage，KEYS[3] = dirdelta，KEYS[4] = inline:<inode>
+// ARGV[1..5] 与 TOUCH_NODE_SCRIPT 相同，ARGV[6] = 偏移，ARGV[7] = 数据
+static const char *WRITE_INLINE_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    TOUCH_NODE_FUNC
+    "local old = redis.call('GET', KEYS[1]) "
+    "if not old then return 1 end "
+    "if bit.band(tonumber(split(old)[10]) or 0, 1) == 0 then return 1 end "
+    "redis.call('SETRANGE', KEYS[4], ARGV[6], ARGV[7]) "
+    "touch(KEYS, ARGV, old) "
+    "return 0";
+
+// 清除内联标志（0x1）并删除内联数据：内联数据或大小与调用者复制到数据文件的不同时返回 1，不做任何修改，
+// 调用者重新复制后重试；节点不存在时返回 -1，已不是内联文件时返回 0
+// KEYS[1] = node:<inode>，KEYS[2] = inline:<inode>，ARGV[1] = 已复制的数据，ARGV[2] = 已复制时的大小
+static const char *CLEAR_INLINE_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    "local r = redis.call('GET', KEYS[1]) "
+    "if not r then return -1 end "
+    "local t = split(r) "
+    "for i = #t + 1, 11 do t[i] = '0' end "
+    "local f = tonumber(t[10]) or 0 "
+    "if bit.band(f, 1) == 0 then return 0 end "
+    "if tonumber(t[5]) ~= tonumber(ARGV[2]) or (redis.call('GET', KEYS[2]) or '') ~= ARGV[1] then return 1 end "
+    "t[10] = string.format('%d', bit.band(f, bit.bnot(1))) "
+    "redis.call('SET', KEYS[1], table.concat(t, ':')) "
+    "redis.call('DEL', KEYS[2]) "
+    "return 0";
+
+// 只修改 mode、uid、gid、ctime 和 parent 中给出的字段（值为 -1 时保持不变），节点不存在时返回 1；
+// 不读出整条记录再写回，不会让同时扩展的大小和清除的内联标志回退
+// KEYS[1] = node:<inode>，ARGV[1..5] = mode、uid、gid、ctime、parent
+static const char *CHANGE_NODE_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    "local r = redis.call('GET', KEYS[1]) "
+    "if not r then return 1 end "
+    "local t = split(r) "
+    "for i = #t + 1, 11 do t[i] = '0' end "
+    "for i, f in ipairs({2, 3, 4, 9, 11}) do "
+    "if ARGV[i] ~= '-1' then t[f] = ARGV[i] end "
+    "end "
+    "redis.call('SET', KEYS[1], table.concat(t, ':')) "
+    "return 0";
+
+// 把大小精确设置为 ARGV[1]（截断使用）并设置 mtime、ctime，已用空间的调整与 SET_NODE_SCRIPT 相同，节点不存在时返回 -1。
+// 传入 KEYS[4] 时截断内联数据：节点已不是内联文件时返回 1，不做任何修改，调用者改为截断数据文件；
+// 扩展时不写内联数据，由读取方补零
+// KEYS[1] = node:<inode>，KEYS[2] = usage，KEYS[3] = dirdelta，KEYS[4] = inline:<inode>（可选）
+// ARGV[1] = 大小，ARGV[2..3] = mtime、ctime，ARGV[4] = 是否启用目录统计
+static const char *SET_SIZE_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    "local old = redis.call('GET', KEYS[1]) "
+    "if not old then return -1 end "
+    "local t = split(old) "
+    "for i = #t + 1, 11 do t[i] = '0' end "
+    "if KEYS[4] then "
+    "if bit.band(tonumber(t[10]) or 0, 1) == 0 then return 1 end "
+    "local data = redis.call('GET', KEYS[4]) "
+    "local size = tonumber(ARGV[1]) "
+    "if data and #data > size then redis.call('SET', KEYS[4], string.sub(data, 1, size)) end "
+    "end "
+    "t[5], t[8], t[9] = ARGV[1], ARGV[2], ARGV[3] "
+    "local value = table.concat(t, ':') "
+    "redis.call('SET', KEYS[1], value) "
+    "charge(KEYS, old, value, ARGV[4]) "
+    "return 0";
+
+// 删除节点（见 DELETE_NODE_FUNC）
+// KEYS[1] = node:<inode>，KEYS[2] = inline:<inode>，KEYS[3] = usage，
+// KEYS[4] = dirstat:<inode>，KEYS[5] = dirdelta，KEYS[6] = dir:<inode>（分片目录的标记），
+// KEYS[7] = xattr:<inode>
+// ARGV[1] = inode，ARGV[2] = 是否启用目录统计
+static const char *DELETE_NODE_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    DELETE_NODE_FUNC
+    "delete_node(KEYS, ARGV[1], ARGV[2]) "
+    "return 0";
+
+// 添加目录项：名字已存在时返回 -2，父目录已被删除时返回 -3，都不做任何修改；
+// 写节点记录时名字已指向该节点（结果未知的创建被重试）返回 0，不重复调整计数；
+// 添加后调整父目录的链接数、目录项数和修改时间并记下目录统计增量，返回值与 ADJUST_NODE_SCRIPT 相同。
+// 主哈希中有分片标记时写入子哈希，未分片时写入主哈希（由脚本读取标记，不依赖挂载是否已知分片）。
+// 新节点与父目录在同一分组时节点记录也在这里写入（ARGV[12] 非空），节点数和记录的已用空间随之计入用量，名字冲突时不会留下节点记录和节点数
+// KEYS[1] = dir:<parent>，KEYS[2] = 名字所在的子哈希，KEYS[3] = node:<parent>，KEYS[4] = dirdelta，
+// 传入 KEYS[8] 时（应用日志中已向应用报告成功的创建）名字冲突的新节点加入待删除集合，由后台回收已写入的数据
+// KEYS[5] = node:<inode>，KEYS[6] = usage，KEYS[7] = inline:<inode>（后三个只在写节点记录时传入），KEYS[8] = delfiles
+// ARGV[1] = 名字，ARGV[2] = inode，ARGV[3] = 父目录链接数增量，ARGV[4] = 当前时间，ARGV[5] = 是否启用目录统计，
+// ARGV[6..8] = 父目录的 space、files、dirs 增量，ARGV[9] = 父目录，ARGV[10] = 分片标记字段，
+// ARGV[11] = 计算 KEYS[2] 所用的子哈希数，ARGV[12] = 节点记录，ARGV[13] = 符号链接的目标
+static const char *ADD_ENTRY_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    "local function discard(r) "
+    "if KEYS[8] then redis.call('ZADD', KEYS[8], ARGV[4], ARGV[2]) end "
+    "return r end "
+    "if redis.call('EXISTS', KEYS[3]) == 0 then return discard(-3) end "
+    "local shards = redis.call('HGET', KEYS[1], ARGV[10]) "
+    "if shards and shards ~= ARGV[11] then return redis.error_reply('ERR unexpected directory shard count') end "
+    "local cur = redis.call('HGET', KEYS[1], ARGV[1]) or (shards and redis.call('HGET', KEYS[2], ARGV[1])) "
+    "if cur then "
+    "if cur == ARGV[2] and ARGV[12] ~= '' then return 0 end "
+    "return discard(-2) end "
+    "redis.call('HSET', shards and KEYS[2] or KEYS[1], ARGV[1], ARGV[2]) "
+    "if ARGV[12] ~= '' then "
+    "redis.call('SET', KEYS[5], ARGV[12]) "
+    "redis.call('HINCRBY', KEYS[6], 'inodes', 1) "
+    "local s = space(ARGV[12]) "
+    "if s ~= 0 then redis.call('HINCRBY', KEYS[6], 'space', string.format('%d', s)) end "
+    "if ARGV[13] then redis.call('SET', KEYS[7], ARGV[13]) end "
+    "end "
+    "if ARGV[5] == '1' then "
+    "for i, kind in ipairs({'space', 'files', 'dirs'}) do "
+    "if ARGV[5 + i] ~= '0' then redis.call('HINCRBY', KEYS[4], ARGV[9] .. '.' .. kind, ARGV[5 + i]) end "
+    "end "
+    "end "
+    "return adjust(KEYS[3], ARGV[3], 1, ARGV[4])";
+
+// 删除空目录：目录项数不为 0 时返回 1，节点不存在时返回 -1，都不做任何修改。
+// 与父目录在同一分组时（传入 10 个键）同时移除父目录中的目录项并调整父目录的计数和统计，
+// 目录项已不指向该目录时返回 -1；不在同一分组时由调用者随后移除目录项
+// KEYS[1..7] 与 DELETE_NODE_SCRIPT 相同，KEYS[8] = dir:<parent>，KEYS[9] = 目录项所在的哈希，KEYS[10] = node:<parent>
+// ARGV[1..2] 与 DELETE_NODE_SCRIPT 相同，ARGV[3] = 名字，ARGV[4] = 父目录，ARGV[5] = 当前时间
+static const char *RMDIR_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    DELETE_NODE_FUNC
+    "local r = redis.call('GET', KEYS[1]) "
+    "if not r then return -1 end "
+    "local t = split(r) "
+    "local n = tonumber(t[13]) or 0 "
+    "if not t[12] then n = redis.call('HLEN', KEYS[6]) end "
+    "if n > 0 then return 1 end "
+    "if KEYS[8] then "
+    "if (redis.call('HGET', KEYS[9], ARGV[3]) or redis.call('HGET', KEYS[8], ARGV[3])) ~= ARGV[1] then return -1 end "
+    "redis.call('HDEL', KEYS[8], ARGV[3]) "
+    "redis.call('HDEL', KEYS[9], ARGV[3]) "
+    "adjust(KEYS[10], -1, -1, ARGV[5]) "
+    "if ARGV[2] == '1' then redis.call('HINCRBY', KEYS[5], ARGV[4] .. '.dirs', -1) end "
+    "end "
+    "delete_node(KEYS, ARGV[1], ARGV[2]) "
+    "return 0";
+
+// 写入目录项，覆盖同名目录项（重命名使用）：主哈希中有分片标记时写入子哈希，并删除主哈希中的同名旧目录项
+// KEYS[1] = dir:<parent>，KEYS[2] = 名字所在的子哈希
+// ARGV[1] = 名字，ARGV[2] = inode，ARGV[3] = 分片标记字段，ARGV[4] = 计算 KEYS[2] 所用的子哈希数
+static const char *PUT_ENTRY_SCRIPT =
+    "local shards = redis.call('HGET', KEYS[1], ARGV[3]) "
+    "if not shards then "
+    "redis.call('HSET', KEYS[1], ARGV[1], ARGV[2]) "
+    "return 0 end "
+    "if shards ~= ARGV[4] then return redis.error_reply('ERR unexpected directory shard count') end "
+    "redis.call('HDEL', KEYS[1], ARGV[1]) "
+    "redis.call('HSET', KEYS[2], ARGV[1], ARGV[2]) "
+    "return 1";
+
+// 把分片前留在主哈希中的目录项移到子哈希：目录项已被删除或已指向其他节点时不做修改，返回 0；
+// 子哈希中已有同名目录项时以子哈希为准，只删除主哈希中的旧目录项
+// KEYS[1] = dir:<parent>，KEYS[2] = 名字所在的子哈希，ARGV[1] = 名字，ARGV[2] = 扫描时读到的 inode
+static const char *MOVE_ENTRY_SCRIPT =
+    "if redis.call('HGET', KEYS[1], ARGV[1]) ~= ARGV[2] then return 0 end "
+    "redis.call('HSETNX', KEYS[2], ARGV[1], ARGV[2]) "
+    "redis.call('HDEL', KEYS[1], ARGV[1]) "
+    "return 1";
+
+// 调整文件的链接数并更新 ctime，链接数减到 0 时把节点加入待删除集合（分数为可以开始删除的时间）
+// 没有计数字段的旧记录按 1 个链接处理。返回调整后的链接数，节点不存在时返回 -1
+// KEYS[1] = node:<inode>，KEYS[2] = delfiles
+// ARGV[1] = 链接数增量，ARGV[2] = 当前时间，ARGV[3] = inode，ARGV[4] = 可以开始删除的时间
+static const char *LINK_NODE_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    "local r = redis.call('GET', KEYS[1]) "
+    "if not r then return -1 end "
+    "local t = split(r) "
+    "for i = #t + 1, 11 do t[i] = '0' end "
+    "local n = math.max((tonumber(t[12]) or 1) + tonumber(ARGV[1]), 0) "
+    "t[9], t[12], t[13] = ARGV[2], string.format('%d', n), t[13] or '0' "
+    "redis.call('SET', KEYS[1], table.concat(t, ':')) "
+    "if n == 0 then redis.call('ZADD', KEYS[2], ARGV[4], ARGV[3]) end "
+    "return n";
+
+// 设置或清除容量层标志（0x2），节点不存在时返回 1
+// KEYS[1] = node:<inode>，ARGV[1] = 1 表示位于容量层
+static const char *SET_TIER_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    "local r = redis.call('GET', KEYS[1]) "
+    "if not r then return 1 end "
+    "local t = split(r) "
+    "for i = #t + 1, 11 do t[i] = '0' end "
+    "local f = bit.band(tonumber(t[10]) or 0, bit.bnot(2)) "
+    "if ARGV[1] == '1' then f = bit.bor(f, 2) end "
+    "t[10] = string.format('%d', f) "
+    "redis.call('SET', KEYS[1], table.concat(t, ':')) "
+    "return 0";
+
+// 设置扩展属性：ARGV[3] 为 1 时名字必须不存在，为 2 时必须已存在，不满足时返回 1
+// KEYS[1] = xattr:<inode>，ARGV[1] = 名字，ARGV[2] = 值
+static const char *SET_XATTR_SCRIPT =
+    "local exists = redis.call('HEXISTS', KEYS[1], ARGV[1]) "
+    "if (ARGV[3] == '1' and exists == 1) or (ARGV[3] == '2' and exists == 0) then return 1 end "
+    "redis.call('HSET', KEYS[1], ARGV[1], ARGV[2]) "
+    "return 0";
+
+// 传播一批增量：ARGV[3] 起为调用者用 HSCAN 取得的 dirdelta 字段，读出并删除这些字段，
+// 沿父目录链累加后写入各级目录统计，同一批次中共同的祖先只读取和更新一次
+// KEYS[1] = dirdelta，ARGV[1] = 节点键前缀，ARGV[2] = 目录统计键前缀
+static const char *FLUSH_DIRSTAT_SCRIPT =
+    NODE_SCRIPT_FUNCS
+    "local fields = {unpack(ARGV, 3)} "
+    "if #fields == 0 then return 0 end "
+    "local values = redis.call('HMGET', KEYS[1], unpack(fields)) "
+    "redis.call('HDEL', KEYS[1], unpack(fields)) "
+    "local parents, sums = {}, {} "
+    "for i = 1, #fields do "
+    "local ino, kind = string.match(fields[i], '^(%d+)%.(%a+)$') "
+    "local v = tonumber(values[i]) or 0 "
+    "local depth = 0 "
+    "while ino and ino ~= '0' and v ~= 0 and depth < 4096 do "
+    "local s = sums[ino] or {} "
+    "sums[ino] = s "
+    "s[kind] = (s[kind] or 0) + v "
+    "if parents[ino] == nil then parents[ino] = parent(redis.call('GET', ARGV[1] .. ino)) or false end "
+    "ino = parents[ino] "
+    "depth = depth + 1 "
+    "end "
+    "end "
+    "local n = 0 "
+    "for ino, s in pairs(sums) do "
+    "for kind, v in pairs(s) do "
+    "if v ~= 0 then "
+    "redis.call('HINCRBY', ARGV[2] .. ino, kind, string.format('%d', v)) "
+    "n = n + 1 "
+    "end "
+    "end "
+    "end "
+    "return n";
+
+// 脚本在连接建立时用 SCRIPT LOAD 加载，之后用 EVALSHA 按摘要调用，
+// 服务器不必每次解析和哈希脚本内容（下标与 SCRIPTS 一致）
+enum {
+    SCRIPT_SET_NODE,
+    SCRIPT_ADJUST_NODE,
+    SCRIPT_TOUCH_NODE,
+    SCRIPT_DELETE_NODE,
+    SCRIPT_LINK_NODE,
+    SCRIPT_SET_TIER,
+    SCRIPT_SET_XATTR,
+    SCRIPT_FLUSH_DIRSTAT,
+    SCRIPT_ADD_ENTRY,
+    SCRIPT_RMDIR,
+    SCRIPT_PUT_ENTRY,
+    SCRIPT_MOVE_ENTRY,
+    SCRIPT_WRITE_INLINE,
+    SCRIPT_CLEAR_INLINE,
+    SCRIPT_CHANGE_NODE,
+    SCRIPT_SET_SIZE,
+};
+
+static const char *const *SCRIPTS[META_SCRIPTS] = {
+    &SET_NODE_SCRIPT,
+    &ADJUST_NODE_SCRIPT,
+    &TOUCH_NODE_SCRIPT,
+    &DELETE_NODE_SCRIPT,
+    &LINK_NODE_SCRIPT,
+    &SET_TIER_SCRIPT,
+    &SET_XATTR_SCRIPT,
+    &FLUSH_DIRSTAT_SCRIPT,
+    &ADD_ENTRY_SCRIPT,
+    &RMDIR_SCRIPT,
+    &PUT_ENTRY_SCRIPT,
+    &MOVE_ENTRY_SCRIPT,
+    &WRITE_INLINE_SCRIPT,
+    &CLEAR_INLINE_SCRIPT,
+    &CHANGE_NODE_SCRIPT,
+    &SET_SIZE_SCRIPT,
+};
+
+// 在连接上加载全部脚本并记下摘要（集群各节点上的摘要相同）
+static int load_scripts(redisContext *ctx, void *arg) {
+    redis_meta_t *meta = (redis_meta_t*)arg;
+    for (int i = 0; i < META_SCRIPTS; i++) {
+        redisAppendCommand(ctx, "SCRIPT LOAD %s", *SCRIPTS[i]);
+    }
+
+    int ret = 0;
+    for (int i = 0; i < META_SCRIPTS; i++) {
+        redisReply *reply = NULL;
+        if (redisGetReply(ctx, (void**)&reply) != REDIS_OK || !reply) {
+            return -1;
+        }
+        // 摘要在创建时记下，之后的加载（其他线程中）只核对
+        if (reply->type != REDIS_REPLY_STRING || reply->len != 40) {
+            ret = -1;
+        } else if (!meta->script_sha[i][0]) {
+            memcpy(meta->script_sha[i], reply->str, 40);
+            meta->script_sha[i][40] = '\0';
+        } else if (memcmp(meta->script_sha[i], reply->str, 40) != 0) {
+            ret = -1;
+        }
+        freeReplyObject(reply);
+    }
+    return ret;
+}
+
+// 脚本缓存被清空（SCRIPT FLUSH 或服务器换成了没有加载脚本的实例）
+static int is_noscript(const redisReply *reply) {
+    if (reply->type == REDIS_REPLY_ERROR) {
+        return strncmp(reply->str, "NOSCRIPT", 8) == 0;
+    }
+    if (reply->type == REDIS_REPLY_ARRAY) {
+        for (size_t i = 0; i < reply->elements; i++) {
+            if (reply->element[i] && reply->element[i]->type == REDIS_REPLY_ERROR &&
+                strncmp(reply->element[i]->str, "NOSCRIPT", 8) == 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// 序列化节点属性：inode:mode:uid:gid:size:blocks:atime:mtime:ctime:flags:parent:nlink:entries
+// nlink 为 0 表示旧记录没有计数字段，序列化时保持省略
+static void format_attr(const node_attr_t *attr, char *buf, size_t len) {
+    int n = snprintf(buf, len,
+                     "%lu:%u:%u:%u:%lu:%lu:%lu:%lu:%lu:%u:%lu",
+                     attr->inode, attr->mode, attr->uid, attr->gid,
+                     attr->size, attr->blocks, attr->atime, attr->mtime, attr->ctime,
+                     attr->flags, attr->parent);
+    if (attr->nlink > 0 && n > 0 && (size_t)n < len) {
+        snprintf(buf + n, len - (size_t)n, ":%u:%lu", attr->nlink, attr->entries);
+    }
+}
+
+// 解析节点属性，兼容没有 flags、parent 和计数字段的旧记录
+static void parse_attr(const char *str, node_attr_t *attr) {
+    attr->flags = 0;
+    attr->parent = 0;
+    attr->nlink = 0;
+    attr->entries = 0;
+    sscanf(str, "%lu:%u:%u:%u:%lu:%lu:%lu:%lu:%lu:%u:%lu:%u:%lu",
+           &attr->inode, &attr->mode, &attr->uid, &attr->gid,
+           &attr->size, &attr->blocks, &attr->atime, &attr->mtime, &attr->ctime,
+           &attr->flags, &attr->parent, &attr->nlink, &attr->entries);
+}
+
+// 与 USAGE_SPACE_FUNC 相同的对齐规则
+static uint64_t usage_space(uint64_t size) {
+    return (size + 4095) / 4096 * 4096;
+}
+
+// 节点所在的分组：集群模式下为 inode 对分组数取模，单机模式下只有一个分组
+static inline uint32_t group_of(const redis_meta_t *meta, uint64_t inode) {
+    return (uint32_t)(inode % meta->groups);
+}
+
+// 分组的哈希标签，单机模式下为空，键名与旧版本相同
+static inline const char* group_tag(const redis_meta_t *meta, uint32_t group) {
+    return meta->tags ? meta->tags[group] : "";
+}
+
+static inline const char* key_tag(const redis_meta_t *meta, uint64_t inode) {
+    return group_tag(meta, group_of(meta, inode));
+}
+
+static void free_replies(redisReply **replies, int count) {
+    if (replies) {
+        for (int i = 0; i < count; i++) {
+            if (replies[i]) freeReplyObject(replies[i]);
+        }
+        mempool_free(replies);
+    }
+}
+
+// 命令流水线：保留格式化后的命令，集群模式下遇到重定向时整体重发
+typedef struct {
+    char **cmds;
+    size_t *lens;
+    int count;
+    int cap;
+    uint32_t group;             // 命令涉及的分组，决定发送到哪个节点
+    int multi;                  // 是否为 MULTI/EXEC 事务
+    int failed;                 // 格式化命令失败
+    int replica;                // 发送到的副本下标，-1 表示主节点
+    int write;                  // 修改节点、目录或扩展属性（开启失效通知时经由转发通知的连接发送）
+    int registered;             // 已注册线程退出时的释放
+} meta_pipe_t;
+
+// 每个线程构建自己的流水线，一个线程同一时间只构建一条（从开始到发送之间不调用其他操作）
+static __thread meta_pipe_t tls_pipe;
+static pthread_key_t pipe_key;
+static pthread_once_t pipe_once = PTHREAD_ONCE_INIT;
+
+static void pipe_clear(meta_pipe_t *p) {
+    for (int i = 0; i < p->count; i++) {
+        redisFreeCommand(p->cmds[i]);
+    }
+    p->count = 0;
+    p->failed = 0;
+    p->replica = -1;
+}
+
+static void pipe_destroy(void *arg) {
+    meta_pipe_t *p = (meta_pipe_t*)arg;
+    pipe_clear(p);
+    free(p->cmds);
+    free(p->lens);
+    p->cmds = NULL;
+    p->lens = NULL;
+    p->cap = 0;
+}
+
+static void pipe_key_init(void) {
+    pthread_key_create(&pipe_key, pipe_destroy);
+}
+
+// 调用线程的流水线
+static meta_pipe_t* meta_pipe(redis_meta_t *meta) {
+    (void)meta;
+    meta_pipe_t *p = &tls_pipe;
+    if (!p->registered) {
+        pthread_once(&pipe_once, pipe_key_init);
+        pthread_setspecific(pipe_key, p);
+        p->registered = 1;
+    }
+    return p;
+}
+
+static void pipe_reset(redis_meta_t *meta) {
+    pipe_clear(meta_pipe(meta));
+}
+
+// 开始一条发送到 group 所在节点的流水线
+static void pipe_begin(redis_meta_t *meta, uint32_t group) {
+    meta_pipe_t *p = meta_pipe(meta);
+    pipe_clear(p);
+    p->group = group;
+    p->multi = 0;
+    p->write = 0;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// 认证并选择数据库
+static int setup_connection(redisContext *ctx, const char *password, int db) {
+    if (password && strlen(password) > 0) {
+        redisReply *reply = (redisReply*)redisCommand(ctx, "AUTH %s", password);
+        int ok = reply && reply->type != REDIS_REPLY_ERROR;
+        if (reply) freeReplyObject(reply);
+        if (!ok) {
+            return -1;
+        }
+    }
+    if (db > 0) {
+        redisReply *reply = (redisReply*)redisCommand(ctx, "SELECT %d", db);
+        if (reply) freeReplyObject(reply);
+    }
+    return 0;
+}
+
+// 读取 INFO replication 中的复制偏移量（副本上为已接收的偏移量）
+static int repl_offset(redisContext *ctx, uint64_t *offset) {
+    redisReply *reply = (redisReply*)redisCommand(ctx, "INFO replication");
+    int ret = -1;
+    if (reply && reply->type == REDIS_REPLY_STRING) {
+        const char *p = strstr(reply->str, "master_repl_offset:");
+        if (p) {
+            *offset = strtoull(p + strlen("master_repl_offset:"), NULL, 10);
+            ret = 0;
+        }
+    }
+    if (reply) freeReplyObject(reply);
+    return ret;
+}
+
+// 探测连接断开时重新建立（不输出错误，下一轮继续尝试）
+static int probe_connect(redisContext **ctx, const char *addr, int port, const char *password, int db) {
+    if (*ctx && !(*ctx)->err) {
+        return 0;
+    }
+    if (*ctx) {
+        redisFree(*ctx);
+    }
+    struct timeval timeout = { 1, 0 };
+    *ctx = redisConnectWithTimeout(addr, port, timeout);
+    if (!*ctx || (*ctx)->err ||
+        redisSetTimeout(*ctx, timeout) != REDIS_OK ||
+        setup_connection(*ctx, password, db) != 0) {
+        if (*ctx) {
+            redisFree(*ctx);
+        }
+        *ctx = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// 探测副本：副本的偏移量达到上次探测时主节点的偏移量，说明它包含那时主节点上的全部修改
+// 每 1/8 延迟上限探测一次，两次探测相隔不超过 3/4 上限时，到探测后 1/4 上限内读到的数据
+// 落后不超过上限；探测失败或太久之前时不使用副本
+// 先写各副本的状态再写探测时间，读取方先读探测时间再读状态
+static void* probe_main(void *arg) {
+    redis_meta_t *meta = (redis_meta_t*)arg;
+    redisContext *primary = NULL;
+    redisContext *conns[META_MAX_REPLICAS] = {0};
+    uint64_t last = 0;
+    uint64_t primary_offset = 0;
+    uint64_t interval = meta->replica_max_lag / 8 > 0 ? meta->replica_max_lag / 8 : 1;
+
+    pthread_mutex_lock(&meta->probe_lock);
+    while (!meta->probe_stopping) {
+        pthread_mutex_unlock(&meta->probe_lock);
+
+        uint64_t now = now_ms();
+        uint64_t offset = 0;
+        int ok = probe_connect(&primary, meta->primary_addr, meta->primary_port,
+                               meta->primary_password, meta->primary_db) == 0 &&
+                 repl_offset(primary, &offset) == 0;
+        int recent = last > 0 && now - last <= meta->replica_max_lag * 3 / 4;
+
+        for (int i = 0; i < meta->replica_count; i++) {
+            meta_replica_t *r = &meta->replicas[i];
+            uint64_t replica_offset;
+            int fresh = ok && recent &&
+                        probe_connect(&conns[i], r->pool.host, r->pool.port, meta->replica_password, meta->replica_db) == 0 &&
+                        repl_offset(conns[i], &replica_offset) == 0 && replica_offset >= primary_offset;
+            __atomic_store_n(&r->fresh, fresh, __ATOMIC_RELEASE);
+        }
+
+        primary_offset = ok ? offset : 0;
+        last = ok ? now : 0;
+        __atomic_store_n(&meta->replica_probe, last, __ATOMIC_RELEASE);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (time_t)(interval / 1000);
+        deadline.tv_nsec += (long)(interval % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_mutex_lock(&meta->probe_lock);
+        if (!meta->probe_stopping) {
+            pthread_cond_timedwait(&meta->probe_wake, &meta->probe_lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&meta->probe_lock);
+
+    if (primary) {
+        redisFree(primary);
+    }
+    for (int i = 0; i < META_MAX_REPLICAS; i++) {
+        if (conns[i]) {
+            redisFree(conns[i]);
+        }
+    }
+    return NULL;
+}
+
+// inode 在 remote_write 中的槽
+static inline size_t remote_slot(uint64_t inode) {
+    return (size_t)((inode * 0x9e3779b97f4a7c15ULL) >> 32) & (META_REMOTE_SLOTS - 1);
+}
+
+// 延迟上限内收到过其他挂载修改 inode 的通知，读取它的键要走主节点
+static inline int remote_pinned(redis_meta_t *meta, uint64_t inode, uint64_t now) {
+    return now - __atomic_load_n(&meta->remote_write[remote_slot(inode)], __ATOMIC_RELAXED) < meta->replica_max_lag;
+}
+
+// 选择读取 inode 的键时可以使用的副本：副本足够新，本挂载在延迟上限内没有修改过元数据
+// （读到自己的修改），且延迟上限内没有收到其他挂载修改该 inode 的通知
+// 返回副本下标，没有时返回 -1
+static int pick_replica(redis_meta_t *meta, uint64_t inode) {
+    if (meta->replica_count == 0) {
+        return -1;
+    }
+
+    uint64_t now = now_ms();
+    if (now - __atomic_load_n(&meta->last_write, __ATOMIC_RELAXED) < meta->replica_max_lag ||
+        remote_pinned(meta, inode, now)) {
+        return -1;
+    }
+    uint64_t probe = __atomic_load_n(&meta->replica_probe, __ATOMIC_ACQUIRE);
+    if (probe == 0 || now - probe >= meta->replica_max_lag / 4) {
+        return -1;
+    }
+
+    unsigned int next = __atomic_fetch_add(&meta->replica_next, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < meta->replica_count; i++) {
+        int k = (int)((next + (unsigned int)i) % (unsigned int)meta->replica_count);
+        if (__atomic_load_n(&meta->replicas[k].fresh, __ATOMIC_ACQUIRE)) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+// 开始一条读取 inode 的键的只读流水线，可能发送到副本
+static void pipe_begin_read(redis_meta_t *meta, uint64_t inode) {
+    pipe_begin(meta, group_of(meta, inode));
+    meta_pipe(meta)->replica = pick_replica(meta, inode);
+}
+
+// 开始一条修改 group 中的节点、目录或扩展属性的流水线
+static void pipe_begin_write(redis_meta_t *meta, uint32_t group) {
+    redis_meta_note_write(meta);
+    pipe_begin(meta, group);
+    meta_pipe(meta)->write = 1;
+}
+
+// 保存一条格式化后的命令
+static void pipe_push(redis_meta_t *meta, char *cmd, long long len) {
+    meta_pipe_t *p = meta_pipe(meta);
+    if (len < 0 || p->failed) {
+        if (len >= 0) redisFreeCommand(cmd);
+        p->failed = 1;
+        return;
+    }
+
+    if (p->count == p->cap) {
+        int cap = p->cap ? p->cap * 2 : 16;
+        char **cmds = (char**)realloc(p->cmds, sizeof(char*) * (size_t)cap);
+        if (cmds) {
+            p->cmds = cmds;
+        }
+        size_t *lens = cmds ? (size_t*)realloc(p->lens, sizeof(size_t) * (size_t)cap) : NULL;
+        if (!lens) {
+            redisFreeCommand(cmd);
+            p->failed = 1;
+            return;
+        }
+        p->lens = lens;
+        p->cap = cap;
+    }
+
+    p->cmds[p->count] = cmd;
+    p->lens[p->count] = (size_t)len;
+    p->count++;
+}
+
+static void meta_vappend(redis_meta_t *meta, const char *format, va_list ap) {
+    char *cmd = NULL;
+    int len = redisvFormatCommand(&cmd, format, ap);
+    pipe_push(meta, cmd, len);
+}
+
+// 追加一条命令到当前流水线
+static void meta_append(redis_meta_t *meta, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    meta_vappend(meta, format, ap);
+    va_end(ap);
+}
+
+// 在主节点的连接上开启失效通知的转发（集群模式下不支持），调用者持有该连接
+static int apply_tracking(redis_meta_t *meta, pool_conn_t *conn, long long redirect) {
+    redisReply *reply = (redisReply*)redisCommand(conn->ctx,
+        "CLIENT TRACKING on REDIRECT %lld BCAST PREFIX %s PREFIX %s PREFIX %s NOLOOP",
+        redirect, NODE_KEY_PREFIX, DIR_KEY_PREFIX, XATTR_KEY_PREFIX);
+    int ok = reply && reply->type != REDIS_REPLY_ERROR;
+    if (reply) freeReplyObject(reply);
+    if (!ok) {
+        return -1;
+    }
+    __atomic_store_n(&conn->tracking, redirect, __ATOMIC_RELEASE);
+    __atomic_store_n(&meta->tracking_active, redirect, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// 取出分组所在节点的一条连接，write 为是否修改节点、目录或扩展属性，失败返回 NULL
+// 失效通知的转发只开在主节点的 0 号连接上：NOLOOP 只排除开启转发的那条连接自己的修改，
+// 每条连接都开启时本挂载经由其他连接的修改仍会通知回来（且一次修改收到多份通知），
+// 因此开启转发后修改都经由 0 号连接发送，只读命令使用任意连接；
+// 订阅连接或 0 号连接重连后，下一次收发取 0 号连接并在其上重新开启
+static pool_conn_t* group_conn(redis_meta_t *meta, uint32_t group, int write) {
+    if (meta->cluster) {
+        const char *tag = meta->tags[group];
+        return cluster_slot_conn(meta->cluster, cluster_key_slot(tag, strlen(tag)));
+    }
+
+    long long redirect = __atomic_load_n(&meta->tracking_redirect, __ATOMIC_ACQUIRE);
+    if (redirect != 0 && (write || __atomic_load_n(&meta->pool.conns[0].tracking, __ATOMIC_ACQUIRE) != redirect)) {
+        pool_conn_t *conn = conn_pool_get_at(&meta->pool, 0);
+        if (conn && conn->tracking != redirect) {
+            apply_tracking(meta, conn, redirect);
+        }
+        return conn;
+    }
+    return conn_pool_get(&meta->pool);
+}
+
+// 发送当前流水线并读取全部回复，返回回复数组（由 free_replies 释放），*count 为回复数
+// 只在收发期间持有所用的那条连接，其他线程经由其他连接（或其他节点）并发收发
+// 集群模式下遇到 MOVED/ASK/TRYAGAIN 时整体重发：被拒绝的命令没有执行，
+// 事务中任一命令被拒绝时 EXEC 放弃整个事务，因此重发是安全的
+static redisReply** pipe_exec(redis_meta_t *meta, int *count) {
+    meta_pipe_t *p = meta_pipe(meta);
+
+    *count = p->count;
+    redisReply **replies = NULL;
+    if (!p->failed && p->count > 0) {
+        replies = (redisReply**)mempool_calloc((size_t)p->count, sizeof(redisReply*));
+    }
+    if (!replies) {
+        pipe_reset(meta);
+        return NULL;
+    }
+
+    conn_pool_t *ask = NULL;
+    for (int attempt = 0; ; attempt++) {
+        // 断开的副本连接在读取前重连，失败时改读主节点，由探测线程重新判断
+        pool_conn_t *conn = NULL;
+        if (!ask && p->replica >= 0) {
+            conn = conn_pool_get(&meta->replicas[p->replica].pool);
+            if (!conn) {
+                __atomic_store_n(&meta->replicas[p->replica].fresh, 0, __ATOMIC_RELEASE);
+                p->replica = -1;
+            }
+        }
+        if (!conn) {
+            conn = ask ? conn_pool_get(ask) : group_conn(meta, p->group, p->write);
+        }
+        if (!conn) {
+            free_replies(replies, p->count);
+            replies = NULL;
+            break;
+        }
+        redisContext *ctx = conn->ctx;
+
+        // ASKING 只对下一条命令有效，在 MULTI 之前发送时对整个事务有效
+        int asking = ask != NULL;
+        for (int i = 0; i < p->count; i++) {
+            if (asking && (i == 0 || !p->multi)) {
+                redisAppendCommand(ctx, "ASKING");
+            }
+            redisAppendFormattedCommand(ctx, p->cmds[i], p->lens[i]);
+        }
+
+        ask = NULL;
+        int redirect = 0;
+        int replica_error = 0;
+        int ok = 1;
+        for (int i = 0; ok && i < p->count; i++) {
+            if (asking && (i == 0 || !p->multi)) {
+                redisReply *reply = NULL;
+                ok = redisGetReply(ctx, (void**)&reply) == REDIS_OK && reply;
+                if (reply) freeReplyObject(reply);
+            }
+            ok = ok && redisGetReply(ctx, (void**)&replies[i]) == REDIS_OK && replies[i];
+            // 副本正在加载或与主节点断开时返回错误（LOADING、MASTERDOWN），读完其余回复后改读主节点
+            if (ok && p->replica >= 0 && replies[i]->type == REDIS_REPLY_ERROR) {
+                replica_error = 1;
+            }
+            if (ok && meta->cluster && !redirect) {
+                redirect = cluster_redirect(meta->cluster, replies[i], &ask);
+            }
+        }
+
+        // 脚本缓存被清空时在这条连接上重新加载
+        int noscript = 0;
+        for (int i = 0; ok && i < p->count && !noscript; i++) {
+            noscript = is_noscript(replies[i]);
+        }
+        int reloaded = noscript && !redirect && load_scripts(ctx, meta) == 0;
+
+        conn_pool_put(conn);
+
+        // 副本不可用时改从主节点读取，下次探测时重新连接
+        if ((!ok || replica_error) && p->replica >= 0) {
+            __atomic_store_n(&meta->replicas[p->replica].fresh, 0, __ATOMIC_RELEASE);
+            p->replica = -1;
+            for (int i = 0; i < p->count; i++) {
+                if (replies[i]) freeReplyObject(replies[i]);
+                replies[i] = NULL;
+            }
+            continue;
+        }
+        if (!ok) {
+            free_replies(replies, p->count);
+            replies = NULL;
+            break;
+        }
+
+        // 单条命令没有执行，直接重发；流水线和事务中的其他命令可能已经执行，
+        // 把错误回复交给调用者，本次操作失败
+        if (noscript && !redirect) {
+            if (!reloaded || p->count > 1 || attempt >= META_REDIRECT_RETRIES) {
+                break;
+            }
+            freeReplyObject(replies[0]);
+            replies[0] = NULL;
+            continue;
+        }
+        if (!redirect || attempt >= META_REDIRECT_RETRIES) {
+            break;
+        }
+
+        for (int i = 0; i < p->count; i++) {
+            freeReplyObject(replies[i]);
+            replies[i] = NULL;
+        }
+        if (redirect == CLUSTER_TRYAGAIN) {
+            usleep(META_TRYAGAIN_DELAY_US);
+        }
+    }
+
+    pipe_reset(meta);
+    return replies;
+}
+
+// 发送当前流水线，任一命令出错返回 -1
+static int pipe_exec_status(redis_meta_t *meta) {
+    int count;
+    redisReply **replies = pipe_exec(meta, &count);
+    if (!replies) {
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < count; i++) {
+        if (replies[i]->type == REDIS_REPLY_ERROR) {
+            ret = -1;
+        }
+    }
+    free_replies(replies, count);
+    return ret;
+}
+
+static redisReply* take_reply(redis_meta_t *meta) {
+    int count;
+    redisReply **replies = pipe_exec(meta, &count);
+    if (!replies) {
+        return NULL;
+    }
+
+    redisReply *reply = replies[0];
+    replies[0] = NULL;
+    free_replies(replies, count);
+    return reply;
+}
+
+// 在 group 所在节点上执行单条命令，调用者用 freeReplyObject 释放回复
+static redisReply* meta_command(redis_meta_t *meta, uint32_t group, const char *format, ...) {
+    pipe_begin(meta, group);
+    va_list ap;
+    va_start(ap, format);
+    meta_vappend(meta, format, ap);
+    va_end(ap);
+    return take_reply(meta);
+}
+
+// 执行单条读取 inode 的键的只读命令，可能发送到副本
+static redisReply* meta_read(redis_meta_t *meta, uint64_t inode, const char *format, ...) {
+    pipe_begin_read(meta, inode);
+    va_list ap;
+    va_start(ap, format);
+    meta_vappend(meta, format, ap);
+    va_end(ap);
+    return take_reply(meta);
+}
+
+// 执行单条修改节点、目录或扩展属性的命令
+static redisReply* meta_write(redis_meta_t *meta, uint32_t group, const char *format, ...) {
+    pipe_begin_write(meta, group);
+    va_list ap;
+    va_start(ap, format);
+    meta_vappend(meta, format, ap);
+    va_end(ap);
+    return take_reply(meta);
+}
+
+static redisReply* meta_command_argv(redis_meta_t *meta, uint32_t group, int argc, const char **argv) {
+    pipe_begin(meta, group);
+    char *cmd = NULL;
+    long long len = redisFormatCommandArgv(&cmd, argc, argv, NULL);
+    pipe_push(meta, cmd, len);
+    return take_reply(meta);
+}
+
+// 分组所在节点的连接池，失败返回 NULL
+static conn_pool_t* group_pool(redis_meta_t *meta, uint32_t group) {
+    if (!meta->cluster) {
+        return &meta->pool;
+    }
+    const char *tag = meta->tags[group];
+    return cluster_slot_pool(meta->cluster, cluster_key_slot(tag, strlen(tag)));
+}
+
+// 在从 first 开始的 n 个分组上各执行一条命令，argv[1] 为键名（加上各分组的标签）
+// 发往同一节点的命令在一次流水线中发送；返回各分组的回复，失败的分组为 NULL
+static redisReply** group_commands(redis_meta_t *meta, uint32_t first, uint32_t n,
+                                   int argc, const char **argv) {
+    redisReply **replies = (redisReply**)mempool_calloc(n, sizeof(redisReply*));
+    conn_pool_t **pools = (conn_pool_t**)calloc(n, sizeof(conn_pool_t*));
+    pool_conn_t **conns = (pool_conn_t**)calloc(n, sizeof(pool_conn_t*));
+    pool_conn_t **held = (pool_conn_t**)calloc(n, sizeof(pool_conn_t*));
+    char (*keys)[64] = (char(*)[64])malloc(sizeof(*keys) * n);
+    const char **args = (const char**)malloc(sizeof(char*) * (size_t)argc);
+    if (!replies || !pools || !conns || !held || !keys || !args) {
+        mempool_free(replies);
+        free(pools);
+        free(conns);
+        free(held);
+        free(keys);
+        free(args);
+        return NULL;
+    }
+    memcpy(args, argv, sizeof(char*) * (size_t)argc);
+
+    for (uint32_t i = 0; i < n; i++) {
+        pools[i] = group_pool(meta, (first + i) % meta->groups);
+    }
+
+    // 每个节点取一条连接：同时持有多条连接时都按连接池的地址从小到大获取，不会互相等待
+    uint32_t nheld = 0;
+    uintptr_t last = 0;
+    for (;;) {
+        conn_pool_t *next = NULL;
+        for (uint32_t i = 0; i < n; i++) {
+            if (pools[i] && (uintptr_t)pools[i] > last && (!next || pools[i] < next)) {
+                next = pools[i];
+            }
+        }
+        if (!next) {
+            break;
+        }
+        last = (uintptr_t)next;
+
+        pool_conn_t *conn = meta->cluster ? conn_pool_get(next) : group_conn(meta, first, 0);
+        if (conn) {
+            held[nheld++] = conn;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (pools[i] == next) {
+                conns[i] = conn;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "%s%s", group_tag(meta, (first + i) % meta->groups), argv[1]);
+        args[1] = keys[i];
+        if (conns[i]) {
+            redisAppendCommandArgv(conns[i]->ctx, argc, args, NULL);
+        }
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (conns[i] && redisGetReply(conns[i]->ctx, (void**)&replies[i]) != REDIS_OK) {
+            replies[i] = NULL;
+        }
+    }
+    for (uint32_t i = 0; i < nheld; i++) {
+        conn_pool_put(held[i]);
+    }
+
+    // 正在迁移的分组单独重试（处理重定向）
+    for (uint32_t i = 0; meta->cluster && i < n; i++) {
+        conn_pool_t *ask = NULL;
+        if (replies[i] && cluster_redirect(meta->cluster, replies[i], &ask)) {
+            freeReplyObject(replies[i]);
+            args[1] = keys[i];
+            replies[i] = meta_command_argv(meta, (first + i) % meta->groups, argc, args);
+        }
+    }
+
+    free(pools);
+    free(conns);
+    free(held);
+    free(keys);
+    free(args);
+    return replies;
+}
+
+// 开始发送到 group 所在节点的事务
+static void tx_begin(redis_meta_t *meta, uint32_t group) {
+    pipe_begin_write(meta, group);
+    meta_pipe(meta)->multi = 1;
+    meta_append(meta, "MULTI");
+}
+
+// 事务中下一条命令在 EXEC 回复中的下标
+static inline int tx_index(redis_meta_t *meta) {
+    return meta_pipe(meta)->count - 1;
+}
+
+// 提交事务，index >= 0 时取出第 index 条命令的整数回复（没有时为 -1）
+static int tx_commit_integer(redis_meta_t *meta, int index, long long *value) {
+    *value = -1;
+    meta_append(meta, "EXEC");
+
+    int count;
+    redisReply **replies = pipe_exec(meta, &count);
+    if (!replies) {
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < count; i++) {
+        if (replies[i]->type == REDIS_REPLY_ERROR) {
+            ret = -1;
+        }
+    }
+    redisReply *exec = replies[count - 1];
+    if (exec->type != REDIS_REPLY_ARRAY) {
+        ret = -1;
+    } else if (index >= 0 && (size_t)index < exec->elements) {
+        // 脚本执行出错时不能当作成功
+        if (exec->element[index]->type == REDIS_REPLY_INTEGER) {
+            *value = exec->element[index]->integer;
+        } else if (exec->element[index]->type == REDIS_REPLY_ERROR) {
+            ret = -1;
+        }
+    }
+
+    free_replies(replies, count);
+    return ret;
+}
+
+static int tx_commit(redis_meta_t *meta) {
+    long long value;
+    return tx_commit_integer(meta, -1, &value);
+}
+
+// 后续命令涉及 group 中的键：与当前事务不在同一分组时先提交当前事务，再开始新的事务
+// 单机模式下只有一个分组，所有命令留在同一个事务中
+static int tx_switch(redis_meta_t *meta, uint32_t group) {
+    meta_pipe_t *p = meta_pipe(meta);
+    if (p->group == group) {
+        return 0;
+    }
+    if (p->count > 1 && tx_commit(meta) != 0) {
+        return -1;
+    }
+    tx_begin(meta, group);
+    return 0;
+}
+
+// 与 tx_switch 相同；*index >= 0 时切换前提交的事务中有需要取出的整数回复，取出到 *value 后清除 *index
+static int tx_switch_integer(redis_meta_t *meta, uint32_t group, int *index, long long *value) {
+    if (*index < 0 || meta_pipe(meta)->group == group) {
+        return tx_switch(meta, group);
+    }
+    int ret = tx_commit_integer(meta, *index, value);
+    *index = -1;
+    if (ret == 0) {
+        tx_begin(meta, group);
+    }
+    return ret;
+}
+
+// 追加写节点记录的命令，existing 非零时只修改已有的记录
+static void append_set_node(redis_meta_t *meta, const node_attr_t *attr, int existing) {
+    char attr_str[1024];
+    format_attr(attr, attr_str, sizeof(attr_str));
+
+    const char *tag = key_tag(meta, attr->inode);
+    meta_append(meta, "EVALSHA %s 3 %s%s%lu %s%s %s%s %s %d %d", meta->script_sha[SCRIPT_SET_NODE],
+                tag, NODE_KEY_PREFIX, attr->inode, tag, USAGE_KEY, tag, DIRDELTA_KEY,
+                attr_str, meta->dirstat, existing ? 1 : 0);
+}
+
+// 追加扩展大小、设置时间戳的命令
+static void append_touch_node(redis_meta_t *meta, uint64_t inode, uint64_t min_size,
+                              int64_t atime, int64_t mtime, int64_t ctime) {
+    const char *tag = key_tag(meta, inode);
+    meta_append(meta, "EVALSHA %s 3 %s%s%lu %s%s %s%s %lu %lld %lld %lld %d", meta->script_sha[SCRIPT_TOUCH_NODE],
+                tag, NODE_KEY_PREFIX, inode, tag, USAGE_KEY, tag, DIRDELTA_KEY,
+                min_size, (long long)atime, (long long)mtime, (long long)ctime, meta->dirstat);
+}
+
+// 追加只修改给出字段的命令（见 CHANGE_NODE_SCRIPT），不修改的字段传 -1
+static void append_change_node(redis_meta_t *meta, uint64_t inode, int64_t mode, int64_t uid,
+                               int64_t gid, int64_t ctime, int64_t parent) {
+    meta_append(meta, "EVALSHA %s 1 %s%s%lu %lld %lld %lld %lld %lld", meta->script_sha[SCRIPT_CHANGE_NODE],
+                key_tag(meta, inode), NODE_KEY_PREFIX, inode, (long long)mode, (long long)uid,
+                (long long)gid, (long long)ctime, (long long)parent);
+}
+
+// 追加删除节点的命令
+static void append_delete_node(redis_meta_t *meta, uint64_t inode) {
+    const char *tag = key_tag(meta, inode);
+    meta_append(meta, "EVALSHA %s 7 %s%s%lu %s%s%lu %s%s %s%s%lu %s%s %s%s%lu %s%s%lu %lu %d", meta->script_sha[SCRIPT_DELETE_NODE],
+                tag, NODE_KEY_PREFIX, inode, tag, INLINE_KEY_PREFIX, inode, tag, USAGE_KEY,
+                tag, DIRSTAT_KEY_PREFIX, inode, tag, DIRDELTA_KEY, tag, DIR_KEY_PREFIX, inode,
+                tag, XATTR_KEY_PREFIX, inode, inode, meta->dirstat);
+}
+
+// 追加调整链接数和目录项数的命令
+static void append_adjust_node(redis_meta_t *meta, uint64_t inode, int nlink, int entries) {
+    if (inode == 0) {
+        return;
+    }
+
+    meta_append(meta, "EVALSHA %s 1 %s%s%lu %d %d %lu", meta->script_sha[SCRIPT_ADJUST_NODE],
+                key_tag(meta, inode), NODE_KEY_PREFIX, inode, nlink, entries, (uint64_t)time(NULL));
+}
+
+// 追加调整文件链接数的命令，hold 非零时最后一个链接删除后推迟 META_ORPHAN_HOLD 秒才允许删除
+static void append_link_node(redis_meta_t *meta, uint64_t inode, int delta, int hold) {
+    uint64_t now = (uint64_t)time(NULL);
+    const char *tag = key_tag(meta, inode);
+    meta_append(meta, "EVALSHA %s 2 %s%s%lu %s%s %d %lu %lu %lu", meta->script_sha[SCRIPT_LINK_NODE],
+                tag, NODE_KEY_PREFIX, inode, tag, PENDING_DELETE_KEY,
+                delta, now, inode, hold ? now + META_ORPHAN_HOLD : now);
+}
+
+// 追加目录统计增量（记在直接父目录上，由 redis_meta_flush_dirstat 向上传播）
+static void append_dir_delta(redis_meta_t *meta, uint64_t parent, int64_t space,
+                             int64_t files, int64_t dirs) {
+    if (!meta->dirstat || parent == 0) {
+        return;
+    }
+
+    const char *tag = key_tag(meta, parent);
+    if (space != 0) {
+        meta_append(meta, "HINCRBY %s%s %lu.space %lld", tag, DIRDELTA_KEY, parent, (long long)space);
+    }
+    if (files != 0) {
+        meta_append(meta, "HINCRBY %s%s %lu.files %lld", tag, DIRDELTA_KEY, parent, (long long)files);
+    }
+    if (dirs != 0) {
+        meta_append(meta, "HINCRBY %s%s %lu.dirs %lld", tag, DIRDELTA_KEY, parent, (long long)dirs);
+    }
+}
+
+// 节点在父目录统计中所占的份额：文件为自身大小，目录为子树统计加上自身
+static int node_dir_usage(redis_meta_t *meta, const node_attr_t *attr, dir_usage_t *usage) {
+    if (S_ISDIR(attr->mode)) {
+        if (redis_meta_get_dir_usage(meta, attr->inode, usage) != 0) {
+            return -1;
+        }
+        usage->dirs++;
+    } else {
+        usage->inode = attr->inode;
+        usage->space = (int64_t)usage_space(attr->size);
+        usage->files = 1;
+        usage->dirs = 0;
+    }
+    return 0;
+}
+
+// 目录项名字的哈希（FNV-1a），用于选择子哈希
+static uint64_t name_hash(const char *name) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const unsigned char *p = (const unsigned char*)name; *p; p++) {
+        h ^= *p;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// 新节点的分组：文件与父目录在同一分组，创建文件只涉及一个槽；
+// 目录按父目录和名字散列到各分组，目录树分散到集群的各个节点
+static uint32_t new_node_group(const redis_meta_t *meta, uint64_t parent, const char *name, uint32_t mode) {
+    if (meta->groups == 1) {
+        return 0;
+    }
+    if (parent == 0) {
+        return group_of(meta, 1);
+    }
+    if (!S_ISDIR(mode)) {
+        return group_of(meta, parent);
+    }
+
+    // 分组 0 不分配 inode（inode 0 无效）
+    uint64_t h = name_hash(name) ^ (parent * 0x9e3779b97f4a7c15ULL);
+    return 1 + (uint32_t)(h % (meta->groups - 1));
+}
+
+static inline size_t shard_slot(uint64_t inode, size_t size) {
+    inode ^= inode >> 33;
+    inode *= 0xff51afd7ed558ccdULL;
+    inode ^= inode >> 33;
+    return (size_t)(inode & (size - 1));
+}
+
+// 已知的分片目录的表项（调用者持有 shard_lock），未分片或未知返回 NULL
+static dir_shard_entry_t* find_shards(redis_meta_t *meta, uint64_t inode) {
+    if (meta->shard_map_used == 0) {
+        return NULL;
+    }
+    size_t i = shard_slot(inode, meta->shard_map_size);
+    while (meta->shard_map[i].inode != 0) {
+        if (meta->shard_map[i].inode == inode) {
+            return &meta->shard_map[i];
+        }
+        i = (i + 1) & (meta->shard_map_size - 1);
+    }
+    return NULL;
+}
+
+// 已知的分片目录的子哈希数量，未分片或未知返回 0
+static uint32_t known_shards(redis_meta_t *meta, uint64_t inode) {
+    pthread_mutex_lock(&meta->shard_lock);
+    dir_shard_entry_t *entry = find_shards(meta, inode);
+    uint32_t shards = entry ? entry->shards : 0;
+    pthread_mutex_unlock(&meta->shard_lock);
+    return shards;
+}
+
+static dir_shard_entry_t* insert_shards(dir_shard_entry_t *map, size_t size, uint64_t inode) {
+    size_t i = shard_slot(inode, size);
+    while (map[i].inode != 0 && map[i].inode != inode) {
+        i = (i + 1) & (size - 1);
+    }
+    map[i].inode = inode;
+    return &map[i];
+}
+
+// 记录分片目录（分片不会撤销，表只增不减）
+static void remember_shards(redis_meta_t *meta, uint64_t inode, uint32_t shards) {
+    if (shards == 0 || known_shards(meta, inode) == shards) {
+        return;
+    }
+
+    pthread_mutex_lock(&meta->shard_lock);
+    if ((meta->shard_map_used + 1) * 2 > meta->shard_map_size) {
+        size_t size = meta->shard_map_size ? meta->shard_map_size * 2 : 64;
+        dir_shard_entry_t *map = (dir_shard_entry_t*)calloc(size, sizeof(dir_shard_entry_t));
+        if (!map) {
+            pthread_mutex_unlock(&meta->shard_lock);
+            return;
+        }
+        for (size_t i = 0; i < meta->shard_map_size; i++) {
+            if (meta->shard_map[i].inode != 0) {
+                *insert_shards(map, size, meta->shard_map[i].inode) = meta->shard_map[i];
+            }
+        }
+        free(meta->shard_map);
+        meta->shard_map = map;
+        meta->shard_map_size = size;
+    }
+    dir_shard_entry_t *entry = insert_shards(meta->shard_map, meta->shard_map_size, inode);
+    entry->shards = shards;
+    entry->migrated = 0;
+    entry->cursor = 0;
+    meta->shard_map_used++;
+    pthread_mutex_unlock(&meta->shard_lock);
+}
+
+// 目录项所在子哈希的键（与父目录在同一分组）
+static void shard_key(const redis_meta_t *meta, uint64_t parent, const char *name, uint32_t shards,
+                      char *buf, size_t len) {
+    snprintf(buf, len, "%s%s%lu:%lu", key_tag(meta, parent), DIR_KEY_PREFIX, parent,
+             name_hash(name) % shards);
+}
+
+// 目录项所在的主哈希和子哈希的键，返回计算子哈希所用的数量
+// 挂载可能还不知道目录已分片（由其他挂载分片，或重启后尚未查找过），子哈希按 DIR_SHARDS 计算，
+// 由脚本读取主哈希中的分片标记决定写入哪个哈希
+static uint32_t entry_keys(redis_meta_t *meta, uint64_t parent, const char *name,
+                           char *dir, char *key, size_t len) {
+    uint32_t shards = known_shards(meta, parent);
+    if (shards == 0) {
+        shards = DIR_SHARDS;
+    }
+    snprintf(dir, len, "%s%s%lu", key_tag(meta, parent), DIR_KEY_PREFIX, parent);
+    shard_key(meta, parent, name, shards, key, len);
+    return shards;
+}
+
+// 追加写入目录项的命令（覆盖同名目录项，见 PUT_ENTRY_SCRIPT）
+static void append_add_entry(redis_meta_t *meta, uint64_t parent, const char *name, uint64_t inode) {
+    char dir[96], key[96];
+    uint32_t shards = entry_keys(meta, parent, name, dir, key, sizeof(dir));
+    meta_append(meta, "EVALSHA %s 2 %s %s %s %lu %s %u", meta->script_sha[SCRIPT_PUT_ENTRY],
+                dir, key, name, inode, DIR_SHARDS_FIELD, shards);
+}
+
+// 追加删除目录项的命令：主哈希和子哈希中的同名目录项都删除（未分片的目录没有子哈希）
+static void append_remove_entry(redis_meta_t *meta, uint64_t parent, const char *name) {
+    char dir[96], key[96];
+    entry_keys(meta, parent, name, dir, key, sizeof(dir));
+    meta_append(meta, "HDEL %s %s", dir, name);
+    meta_append(meta, "HDEL %s %s", key, name);
+}
+
+// 追加按条件添加目录项的命令（见 ADD_ENTRY_SCRIPT），父目录的链接数增加 nlink，目录统计增加 usage；
+// record 非 NULL 时新节点与父目录在同一分组，节点记录（以及符号链接的目标 target）在同一脚本中写入；
+// discard 非零时（只用于没有 target 的记录）名字冲突的新节点加入待删除集合
+static void append_new_entry(redis_meta_t *meta, uint64_t parent, const char *name, uint64_t inode, int nlink,
+                             const dir_usage_t *usage, const char *record, const char *target, int discard) {
+    const char *tag = key_tag(meta, parent);
+    char dir[96], key[96];
+    uint32_t shards = entry_keys(meta, parent, name, dir, key, sizeof(dir));
+
+    const char *sha = meta->script_sha[SCRIPT_ADD_ENTRY];
+    uint64_t now = (uint64_t)time(NULL);
+    long long space = (long long)usage->space, files = (long long)usage->files, dirs = (long long)usage->dirs;
+    if (!record) {
+        meta_append(meta, "EVALSHA %s 4 %s %s %s%s%lu %s%s %s %lu %d %lu %d %lld %lld %lld %lu %s %u %s",
+                    sha, dir, key, tag, NODE_KEY_PREFIX, parent, tag, DIRDELTA_KEY,
+                    name, inode, nlink, now, meta->dirstat, space, files, dirs, parent,
+                    DIR_SHARDS_FIELD, shards, "");
+    } else if (discard) {
+        meta_append(meta, "EVALSHA %s 8 %s %s %s%s%lu %s%s %s%s%lu %s%s %s%s%lu %s%s "
+                    "%s %lu %d %lu %d %lld %lld %lld %lu %s %u %s",
+                    sha, dir, key, tag, NODE_KEY_PREFIX, parent, tag, DIRDELTA_KEY,
+                    tag, NODE_KEY_PREFIX, inode, tag, USAGE_KEY, tag, INLINE_KEY_PREFIX, inode,
+                    tag, PENDING_DELETE_KEY,
+                    name, inode, nlink, now, meta->dirstat, space, files, dirs, parent,
+                    DIR_SHARDS_FIELD, shards, record);
+    } else if (!target) {
+        meta_append(meta, "EVALSHA %s 7 %s %s %s%s%lu %s%s %s%s%lu %s%s %s%s%lu "
+                    "%s %lu %d %lu %d %lld %lld %lld %lu %s %u %s",
+                    sha, dir, key, tag, NODE_KEY_PREFIX, parent, tag, DIRDELTA_KEY,
+                    tag, NODE_KEY_PREFIX, inode, tag, USAGE_KEY, tag, INLINE_KEY_PREFIX, inode,
+                    name, inode, nlink, now, meta->dirstat, space, files, dirs, parent,
+                    DIR_SHARDS_FIELD, shards, record);
+    } else {
+        meta_append(meta, "EVALSHA %s 7 %s %s %s%s%lu %s%s %s%s%lu %s%s %s%s%lu "
+                    "%s %lu %d %lu %d %lld %lld %lld %lu %s %u %s %b",
+                    sha, dir, key, tag, NODE_KEY_PREFIX, parent, tag, DIRDELTA_KEY,
+                    tag, NODE_KEY_PREFIX, inode, tag, USAGE_KEY, tag, INLINE_KEY_PREFIX, inode,
+                    name, inode, nlink, now, meta->dirstat, space, files, dirs, parent,
+                    DIR_SHARDS_FIELD, shards, record, target, strlen(target));
+    }
+}
+
+// ADD_ENTRY_SCRIPT 的返回值：名字已存在、父目录已被删除
+#define ADD_ENTRY_EXISTS (-2)
+#define ADD_ENTRY_NO_PARENT (-3)
+
+// 目录项数超过阈值后在主哈希中写入分片标记；已有目录项之后由 migrate_entries 逐批移到子哈希
+static void split_dir(redis_meta_t *meta, uint64_t inode) {
+    const char *tag = key_tag(meta, inode);
+    pipe_begin_write(meta, group_of(meta, inode));
+    meta_append(meta, "HSETNX %s%s%lu %s %d", tag, DIR_KEY_PREFIX, inode, DIR_SHARDS_FIELD, DIR_SHARDS);
+    meta_append(meta, "HGET %s%s%lu %s", tag, DIR_KEY_PREFIX, inode, DIR_SHARDS_FIELD);
+
+    int count;
+    redisReply **replies = pipe_exec(meta, &count);
+
+    // 以实际记录的值为准（可能由其他挂载先写入）
+    if (replies && replies[1]->type == REDIS_REPLY_STRING) {
+        remember_shards(meta, inode, (uint32_t)strtoul(replies[1]->str, NULL, 10));
+    }
+    free_replies(replies, count);
+}
+
+// 把分片前留在主哈希中的目录项移到子哈希：沿 HSCAN 游标每次取一批，逐项用脚本移动。
+// 分片后新目录项不再写入主哈希，游标回到 0 时主哈希中只剩标记，之后不再扫描；
+// 重启或其他挂载从头扫描一遍，已迁移完的主哈希只有标记，一次即可完成
+static void migrate_entries(redis_meta_t *meta, uint64_t inode) {
+    pthread_mutex_lock(&meta->shard_lock);
+    dir_shard_entry_t *entry = find_shards(meta, inode);
+    if (!entry || entry->migrated) {
+        pthread_mutex_unlock(&meta->shard_lock);
+        return;
+    }
+    uint32_t shards = entry->shards;
+    uint64_t cursor = entry->cursor;
+    pthread_mutex_unlock(&meta->shard_lock);
+
+    uint32_t group = group_of(meta, inode);
+    const char *tag = key_tag(meta, inode);
+    redisReply *reply = meta_command(meta, group, "HSCAN %s%s%lu %lu COUNT %d",
+                                     tag, DIR_KEY_PREFIX, inode, cursor, DIR_SHARD_MIGRATE);
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2 ||
+        reply->element[0]->type != REDIS_REPLY_STRING || reply->element[1]->type != REDIS_REPLY_ARRAY) {
+        if (reply) freeReplyObject(reply);
+        return;
+    }
+
+    redisReply *fields = reply->element[1];
+    pipe_begin_write(meta, group);
+    for (size_t i = 0; i + 1 < fields->elements; i += 2) {
+        const char *name = fields->element[i]->str;
+        if (fields->element[i]->type != REDIS_REPLY_STRING || strcmp(name, DIR_SHARDS_FIELD) == 0 ||
+            fields->element[i + 1]->type != REDIS_REPLY_STRING) {
+            continue;
+        }
+        char key[96];
+        shard_key(meta, inode, name, shards, key, sizeof(key));
+        meta_append(meta, "EVALSHA %s 2 %s%s%lu %s %s %s", meta->script_sha[SCRIPT_MOVE_ENTRY],
+                    tag, DIR_KEY_PREFIX, inode, key, name, fields->element[i + 1]->str);
+    }
+    uint64_t next = strtoull(reply->element[0]->str, NULL, 10);
+    int ret = meta_pipe(meta)->count > 0 ? pipe_exec_status(meta) : 0;
+    freeReplyObject(reply);
+    if (ret != 0) {
+        return;
+    }
+
+    // 并发的迁移可能已推进游标，只在游标未变时更新
+    pthread_mutex_lock(&meta->shard_lock);
+    entry = find_shards(meta, inode);
+    if (entry && entry->cursor == cursor) {
+        entry->cursor = next;
+        entry->migrated = next == 0;
+    }
+    pthread_mutex_unlock(&meta->shard_lock);
+}
+
+// 目录中添加目录项之后：目录项数达到阈值时分片，已分片时迁移一批分片前的目录项
+static void grow_dir(redis_meta_t *meta, uint64_t inode, long long entries) {
+    if (entries >= DIR_SHARD_THRESHOLD && known_shards(meta, inode) == 0) {
+        split_dir(meta, inode);
+    }
+    migrate_entries(meta, inode);
+}
+
+static redisContext* redis_connect(const char *addr, int port) {
+    redisContext *c = redisConnect(addr, port);
+    if (c == NULL || c->err) {
+        if (c) {
+            fprintf(stderr, "Redis connection error: %s\n", c->errstr);
+            redisFree(c);
+        } else {
+            fprintf(stderr, "Redis connection error: can't allocate redis context\n");
+        }
+        return NULL;
+    }
+    return c;
+}
+
+// 服务器启用了集群时建立槽路由，并为每个分组生成哈希标签
+static int detect_cluster(redis_meta_t *meta, const char *addr, int port, const char *password, int db) {
+    redisReply *reply = (redisReply*)redisCommand(meta->ctx, "CLUSTER SLOTS");
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements == 0) {
+        // 未启用集群的服务器返回错误
+        if (reply) freeReplyObject(reply);
+        return 0;
+    }
+
+    if (db > 0) {
+        fprintf(stderr, "Redis Cluster only supports database 0\n");
+        freeReplyObject(reply);
+        return -1;
+    }
+
+    meta->cluster = cluster_new(addr, port, password, reply, load_scripts, meta);
+    freeReplyObject(reply);
+    meta->tags = (char(*)[8])malloc(sizeof(*meta->tags) * META_GROUPS);
+    if (!meta->cluster || !meta->tags) {
+        fprintf(stderr, "Failed to load Redis Cluster slots\n");
+        return -1;
+    }
+
+    for (uint32_t g = 0; g < META_GROUPS; g++) {
+        snprintf(meta->tags[g], sizeof(meta->tags[g]), "{%u}", g);
+    }
+    meta->groups = META_GROUPS;
+    return 0;
+}
+
+redis_meta_t* redis_meta_new(const char *addr, int port, const char *password, int db) {
+    redis_meta_t *meta = (redis_meta_t*)calloc(1, sizeof(redis_meta_t));
+    if (!meta) {
+        return NULL;
+    }
+
+    meta->inline_threshold = 0;
+    meta->dirstat = 0;
+    meta->groups = 1;
+    meta->replica_max_lag = META_REPLICA_MAX_LAG;
+    pthread_mutex_init(&meta->shard_lock, NULL);
+    pthread_mutex_init(&meta->probe_lock, NULL);
+    conn_pool_init(&meta->pool, addr, port, password, db, CONN_POOL_SIZE, load_scripts, meta);
+    pthread_cond_init(&meta->probe_wake, NULL);
+    snprintf(meta->primary_addr, sizeof(meta->primary_addr), "%s", addr);
+    meta->primary_port = port;
+    meta->primary_db = db;
+    if (password && strlen(password) > 0) {
+        meta->primary_password = strdup(password);
+    }
+    meta->ctx = redis_connect(addr, port);
+    if (!meta->ctx) {
+        redis_meta_free(meta);
+        return NULL;
+    }
+
+    // 如果有密码，认证
+    if (password && strlen(password) > 0) {
+        redisReply *reply = (redisReply*)redisCommand(meta->ctx, "AUTH %s", password);
+        if (!reply || reply->type == REDIS_REPLY_ERROR) {
+            fprintf(stderr, "Redis authentication failed\n");
+            if (reply) freeReplyObject(reply);
+            redis_meta_free(meta);
+            return NULL;
+        }
+        freeReplyObject(reply);
+    }
+
+    if (detect_cluster(meta, addr, port, password, db) != 0) {
+        redis_meta_free(meta);
+        return NULL;
+    }
+
+    // 选择数据库
+    if (db > 0) {
+        redisReply *reply = (redisReply*)redisCommand(meta->ctx, "SELECT %d", db);
+        if (reply) freeReplyObject(reply);
+    }
+
+    // 加载脚本并记下摘要，连接池中的各条连接（集群模式下各节点的连接）在建立时加载
+    if (load_scripts(meta->ctx, meta) != 0) {
+        fprintf(stderr, "Failed to load Redis scripts\n");
+        redis_meta_free(meta);
+        return NULL;
+    }
+
+    return meta;
+}
+
+void redis_meta_free(redis_meta_t *meta) {
+    if (meta) {
+        if (meta->probe_started) {
+            pthread_mutex_lock(&meta->probe_lock);
+            meta->probe_stopping = 1;
+            pthread_cond_signal(&meta->probe_wake);
+            pthread_mutex_unlock(&meta->probe_lock);
+            pthread_join(meta->probe_thread, NULL);
+        }
+        if (meta->ctx) {
+            redisFree(meta->ctx);
+        }
+        cluster_free(meta->cluster);
+        conn_pool_destroy(&meta->pool);
+        for (int i = 0; i < meta->replica_count; i++) {
+            conn_pool_destroy(&meta->replicas[i].pool);
+        }
+        free(meta->replica_password);
+        free(meta->primary_password);
+        free(meta->tags);
+        free(meta->shard_map);
+        pthread_mutex_destroy(&meta->shard_lock);
+        pthread_mutex_destroy(&meta->probe_lock);
+        pthread_cond_destroy(&meta->probe_wake);
+        free(meta);
+    }
+}
+
+int redis_meta_add_replica(redis_meta_t *meta, const char *addr, int port, const char *password, int db) {
+    // 集群的副本需要按槽路由，暂不支持
+    if (meta->cluster || meta->replica_count >= META_MAX_REPLICAS) {
+        return -1;
+    }
+
+    redisContext *ctx = redis_connect(addr, port);
+    if (!ctx) {
+        return -1;
+    }
+
+    // 只接受正在复制的副本，避免误把其他实例当作副本读取
+    redisReply *reply = NULL;
+    if (setup_connection(ctx, password, db) == 0) {
+        reply = (redisReply*)redisCommand(ctx, "INFO replication");
+    }
+    int ok = reply && reply->type == REDIS_REPLY_STRING && strstr(reply->str, "role:slave") != NULL;
+    if (reply) freeReplyObject(reply);
+    redisFree(ctx);
+    if (!ok) {
+        fprintf(stderr, "%s:%d is not a Redis replica\n", addr, port);
+        return -1;
+    }
+
+    // 读取使用副本自己的连接池，连接在首次读取时建立
+    meta_replica_t *r = &meta->replicas[meta->replica_count];
+    if (conn_pool_init(&r->pool, addr, port, password, db, CONN_POOL_SIZE, NULL, NULL) != 0) {
+        conn_pool_destroy(&r->pool);
+        return -1;
+    }
+    if (!meta->replica_password && password && strlen(password) > 0) {
+        meta->replica_password = strdup(password);
+    }
+    meta->replica_db = db;
+    r->fresh = 0;
+    meta->replica_count++;
+    return 0;
+}
+
+int redis_meta_enable_tracking(redis_meta_t *meta, long long redirect) {
+    if (meta->cluster) {
+        return -1;
+    }
+    __atomic_store_n(&meta->tracking_redirect, redirect, __ATOMIC_RELEASE);
+    pool_conn_t *conn = conn_pool_get_at(&meta->pool, 0);
+    if (!conn) {
+        return -1;
+    }
+    int ret = apply_tracking(meta, conn, redirect);
+    conn_pool_put(conn);
+    return ret;
+}
+
+void redis_meta_retrack(redis_meta_t *meta, long long redirect) {
+    __atomic_store_n(&meta->tracking_redirect, redirect, __ATOMIC_RELEASE);
+}
+
+long long redis_meta_tracking(redis_meta_t *meta) {
+    return __atomic_load_n(&meta->tracking_active, __ATOMIC_ACQUIRE);
+}
+
+int redis_meta_parse_key(const char *key, uint64_t *inode) {
+    int kind;
+    if (strncmp(key, NODE_KEY_PREFIX, strlen(NODE_KEY_PREFIX)) == 0) {
+        key += strlen(NODE_KEY_PREFIX);
+        kind = META_KEY_NODE;
+    } else if (strncmp(key, DIR_KEY_PREFIX, strlen(DIR_KEY_PREFIX)) == 0) {
+        key += strlen(DIR_KEY_PREFIX);
+        kind = META_KEY_DIR;
+    } else if (strncmp(key, XATTR_KEY_PREFIX, strlen(XATTR_KEY_PREFIX)) == 0) {
+        key += strlen(XATTR_KEY_PREFIX);
+        kind = META_KEY_XATTR;
+    } else {
+        return 0;
+    }
+
+    // 分片目录的子哈希为 dir:<inode>:<k>
+    char *end;
+    *inode = strtoull(key, &end, 10);
+    if (end == key || (*end != '\0' && !(kind == META_KEY_DIR && *end == ':'))) {
+        return 0;
+    }
+    return kind;
+}
+
+void redis_meta_note_write(redis_meta_t *meta) {
+    if (meta->replica_count > 0) {
+        __atomic_store_n(&meta->last_write, now_ms(), __ATOMIC_RELAXED);
+    }
+}
+
+void redis_meta_note_remote_write(redis_meta_t *meta, uint64_t inode) {
+    if (meta->replica_count > 0) {
+        __atomic_store_n(&meta->remote_write[remote_slot(inode)], now_ms(), __ATOMIC_RELAXED);
+    }
+}
+
+int redis_meta_start_probe(redis_meta_t *meta) {
+    if (meta->replica_count == 0 || meta->probe_started) {
+        return 0;
+    }
+    if (pthread_create(&meta->probe_thread, NULL, probe_main, meta) != 0) {
+        return -1;
+    }
+    meta->probe_started = 1;
+    return 0;
+}
+
+uint64_t redis_meta_allocate_inode(redis_meta_t *meta, uint32_t group) {
+    redisReply *reply = meta_command(meta, group, "INCR %s%s", group_tag(meta, group), LOOKUP_COUNTER_KEY);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+        if (reply) freeReplyObject(reply);
+        return 0;
+    }
+
+    // 集群模式下每个分组有自己的计数器，inode 对分组数取模等于分组
+    uint64_t n = (uint64_t)reply->integer;
+    freeReplyObject(reply);
+    return meta->cluster ? (n - 1) * meta->groups + group : n;
+}
+
+// 创建节点，target 非 NULL 时为符号链接：目标原样保存在节点的内联数据键中，大小为目标的长度
+static int create_node(redis_meta_t *meta, uint64_t parent, const char *name, uint32_t mode,
+                       uint32_t uid, uint32_t gid, const char *target, node_attr_t **result_attr) {
+    uint32_t group = new_node_group(meta, parent, name, mode);
+    uint64_t inode = redis_meta_allocate_inode(meta, group);
+    if (inode == 0) {
+        return -1;
+    }
+
+    node_attr_t *attr = node_attr_alloc();
+    if (!attr) {
+        return -1;
+    }
+
+    uint64_t now = (uint64_t)time(NULL);
+    attr->inode = inode;
+    attr->mode = mode;
+    attr->uid = uid;
+    attr->gid = gid;
+    attr->size = target ? strlen(target) : 0;
+    attr->blocks = 0;
+    attr->atime = now;
+    attr->mtime = now;
+    attr->ctime = now;
+    attr->flags = 0;
+    attr->parent = parent;
+    attr->nlink = S_ISDIR(mode) ? 2 : 1;
+    attr->entries = 0;
+
+    // 新建的普通文件先以内联方式存储
+    if (meta->inline_threshold > 0 && (mode & S_IFMT) == S_IFREG) {
+        attr->flags |= NODE_FLAG_INLINE;
+    }
+
+    // 序列化属性
+    char attr_str[1024];
+    format_attr(attr, attr_str, sizeof(attr_str));
+
+    // 目录项按条件添加，名字已存在时不做任何修改；父目录的链接数、目录项数和统计随之更新
+    // （新文件大小为 0，不占用空间）。新节点与父目录在同一分组时节点记录和节点数也在同一脚本中写入；
+    // 集群模式下新目录在其他分组，先写节点记录，再在父目录的分组中添加目录项，
+    // 名字已存在时删除刚写入的节点记录，中途失败最多留下无人引用的节点记录
+    dir_usage_t usage = {inode, (int64_t)usage_space(attr->size), S_ISDIR(mode) ? 0 : 1, S_ISDIR(mode) ? 1 : 0};
+    int same = parent != 0 && group == group_of(meta, parent);
+    tx_begin(meta, group);
+    if (!same) {
+        meta_append(meta, "SET %s%s%lu %s", key_tag(meta, inode), NODE_KEY_PREFIX, inode, attr_str);
+        meta_append(meta, "HINCRBY %s%s inodes 1", group_tag(meta, group), USAGE_KEY);
+        if (target) {
+            meta_append(meta, "SET %s%s%lu %b", key_tag(meta, inode), INLINE_KEY_PREFIX, inode,
+                        target, (size_t)attr->size);
+            meta_append(meta, "HINCRBY %s%s space %ld", group_tag(meta, group), USAGE_KEY, (long)usage.space);
+        }
+    }
+
+    // 根目录没有父目录，只写节点记录
+    if (parent == 0) {
+        if (tx_commit(meta) != 0) {
+            node_attr_free(attr);
+            return -1;
+        }
+        *result_attr = attr;
+        return 0;
+    }
+
+    if (tx_switch(meta, group_of(meta, parent)) != 0) {
+        node_attr_free(attr);
+        return -1;
+    }
+    int add = tx_index(meta);
+    append_new_entry(meta, parent, name, inode, S_ISDIR(mode) ? 1 : 0, &usage, same ? attr_str : NULL, target, 0);
+
+    long long entries;
+    if (tx_commit_integer(meta, add, &entries) != 0) {
+        node_attr_free(attr);
+        return -1;
+    }
+    if (entries == ADD_ENTRY_EXISTS || entries == ADD_ENTRY_NO_PARENT) {
+        if (!same) {
+            redis_meta_delete_node(meta, inode);
+        }
+        node_attr_free(attr);
+        return entries == ADD_ENTRY_EXISTS ? 1 : 2;
+    }
+
+    // 父目录变大后分片，之后的新目录项分散到子哈希中
+    grow_dir(meta, parent, entries);
+
+    *result_attr = attr;
+    return 0;
+}
+
+int redis_meta_create_node(redis_meta_t *meta, uint64_t parent, const char *name,
+                          uint32_t mode, uint32_t uid, uint32_t gid, node_attr_t **attr) {
+    return create_node(meta, parent, name, mode, uid, gid, NULL, attr);
+}
+
+int redis_meta_symlink(redis_meta_t *meta, uint64_t parent, const char *name, const char *target,
+                       uint32_t uid, uint32_t gid, node_attr_t **attr) {
+    return create_node(meta, parent, name, S_IFLNK | 0777, uid, gid, target, attr);
+}
+
+int redis_meta_readlink(redis_meta_t *meta, uint64_t inode, char **target) {
+    redisReply *reply = meta_read(meta, inode, "GET %s%s%lu",
+                                  key_tag(meta, inode), INLINE_KEY_PREFIX, inode);
+    if (!reply || reply->type != REDIS_REPLY_STRING) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    *target = (char*)malloc(reply->len + 1);
+    if (*target) {
+        memcpy(*target, reply->str, reply->len);
+        (*target)[reply->len] = '\0';
+    }
+
+    freeReplyObject(reply);
+    return *target ? 0 : -1;
+}
+
+int redis_meta_link(redis_meta_t *meta, const node_attr_t *attr, uint64_t parent, const char *name) {
+    // 每个链接在所在目录的统计中各计一份
+    dir_usage_t usage = {0, 0, 0, 0};
+    if (meta->dirstat && node_dir_usage(meta, attr, &usage) != 0) {
+        return -1;
+    }
+
+    // 先增加链接数再按条件添加目录项，中途失败最多留下偏大的链接数，不会删除仍被引用的节点；
+    // 名字已存在或父目录已被删除时撤销增加的链接数
+    tx_begin(meta, group_of(meta, attr->inode));
+    append_link_node(meta, attr->inode, 1, 0);
+    if (tx_switch(meta, group_of(meta, parent)) != 0) {
+        return -1;
+    }
+    int add = tx_index(meta);
+    append_new_entry(meta, parent, name, attr->inode, 0, &usage, NULL, NULL, 0);
+
+    long long entries;
+    if (tx_commit_integer(meta, add, &entries) != 0) {
+        return -1;
+    }
+    if (entries == ADD_ENTRY_EXISTS || entries == ADD_ENTRY_NO_PARENT) {
+        pipe_begin_write(meta, group_of(meta, attr->inode));
+        append_link_node(meta, attr->inode, -1, 0);
+        if (pipe_exec_status(meta) != 0) {
+            return -1;
+        }
+        return entries == ADD_ENTRY_EXISTS ? 1 : 2;
+    }
+
+    grow_dir(meta, parent, entries);
+    return 0;
+}
+
+// 读取节点记录到调用者提供的结构中
+static int read_node(redis_meta_t *meta, uint64_t inode, node_attr_t *attr) {
+    redisReply *reply = meta_read(meta, inode, "GET %s%s%lu",
+                                  key_tag(meta, inode), NODE_KEY_PREFIX, inode);
+    if (!reply || reply->type != REDIS_REPLY_STRING) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    // 解析属性字符串
+    parse_attr(reply->str, attr);
+
+    freeReplyObject(reply);
+    return 0;
+}
+
+int redis_meta_get_node(redis_meta_t *meta, uint64_t inode, node_attr_t **result_attr) {
+    node_attr_t *attr = node_attr_alloc();
+    if (!attr) {
+        return -1;
+    }
+
+    if (read_node(meta, inode, attr) != 0) {
+        node_attr_free(attr);
+        return -1;
+    }
+
+    *result_attr = attr;
+    return 0;
+}
+
+int redis_meta_change_node(redis_meta_t *meta, uint64_t inode, int64_t mode, int64_t uid,
+                           int64_t gid, int64_t ctime) {
+    pipe_begin_write(meta, group_of(meta, inode));
+    append_change_node(meta, inode, mode, uid, gid, ctime, -1);
+    redisReply *reply = take_reply(meta);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    int ret = reply->integer == 0 ? 0 : 1;
+    freeReplyObject(reply);
+    return ret;
+}
+
+int redis_meta_set_size(redis_meta_t *meta, uint64_t inode, uint64_t size, int64_t mtime,
+                        int64_t ctime, int inline_data) {
+    const char *tag = key_tag(meta, inode);
+    redisReply *reply;
+    if (inline_data) {
+        reply = meta_write(meta, group_of(meta, inode), "EVALSHA %s 4 %s%s%lu %s%s %s%s %s%s%lu %lu %lld %lld %d",
+                           meta->script_sha[SCRIPT_SET_SIZE], tag, NODE_KEY_PREFIX, inode, tag, USAGE_KEY,
+                           tag, DIRDELTA_KEY, tag, INLINE_KEY_PREFIX, inode, size, (long long)mtime,
+                           (long long)ctime, meta->dirstat);
+    } else {
+        reply = meta_write(meta, group_of(meta, inode), "EVALSHA %s 3 %s%s%lu %s%s %s%s %lu %lld %lld %d",
+                           meta->script_sha[SCRIPT_SET_SIZE], tag, NODE_KEY_PREFIX, inode, tag, USAGE_KEY,
+                           tag, DIRDELTA_KEY, size, (long long)mtime, (long long)ctime, meta->dirstat);
+    }
+    if (!reply || reply->type != REDIS_REPLY_INTEGER || reply->integer < 0) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    int ret = reply->integer == 0 ? 0 : 1;
+    freeReplyObject(reply);
+    return ret;
+}
+
+int redis_meta_touch_node(redis_meta_t *meta, uint64_t inode, uint64_t min_size,
+                          int64_t atime, int64_t mtime, int64_t ctime) {
+    pipe_begin_write(meta, group_of(meta, inode));
+    append_touch_node(meta, inode, min_size, atime, mtime, ctime);
+    return pipe_exec_status(meta);
+}
+
+int redis_meta_lookup(redis_meta_t *meta, uint64_t parent, const char *name, uint64_t *inode) {
+    const char *tag = key_tag(meta, parent);
+    uint32_t shards = known_shards(meta, parent);
+    if (shards == 0) {
+        // 未知是否分片时同时取回分片标记，未分片的目录仍只需一次 HMGET
+        redisReply *reply = meta_read(meta, parent, "HMGET %s%s%lu %s %s",
+                                      tag, DIR_KEY_PREFIX, parent, name, DIR_SHARDS_FIELD);
+        if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+            if (reply) freeReplyObject(reply);
+            return -1;
+        }
+
+        int ret = 1;
+        if (reply->element[0]->type == REDIS_REPLY_STRING) {
+            *inode = (uint64_t)atoll(reply->element[0]->str);
+            ret = 0;
+        } else if (reply->element[1]->type == REDIS_REPLY_STRING) {
+            shards = (uint32_t)strtoul(reply->element[1]->str, NULL, 10);
+            remember_shards(meta, parent, shards);
+        }
+        freeReplyObject(reply);
+        if (ret == 0 || shards == 0) {
+            return ret;
+        }
+
+        // 主哈希中没有，再查子哈希
+        char key[96];
+        shard_key(meta, parent, name, shards, key, sizeof(key));
+        reply = meta_read(meta, parent, "HGET %s %s", key, name);
+        if (!reply || (reply->type != REDIS_REPLY_STRING && reply->type != REDIS_REPLY_NIL)) {
+            if (reply) freeReplyObject(reply);
+            return -1;
+        }
+        if (reply->type == REDIS_REPLY_NIL) {
+            freeReplyObject(reply);
+            return 1;
+        }
+        *inode = (uint64_t)atoll(reply->str);
+        freeReplyObject(reply);
+        return 0;
+    }
+
+    // 已知的分片目录：子哈希和主哈希（分片前的目录项）在一次往返中查询
+    char key[96];
+    shard_key(meta, parent, name, shards, key, sizeof(key));
+    pipe_begin_read(meta, parent);
+    meta_append(meta, "HGET %s %s", key, name);
+    meta_append(meta, "HGET %s%s%lu %s", tag, DIR_KEY_PREFIX, parent, name);
+
+    int count;
+    redisReply **replies = pipe_exec(meta, &count);
+    if (!replies) {
+        return -1;
+    }
+
+    int ret = 1;
+    for (int i = 0; i < count && ret != 0; i++) {
+        if (replies[i]->type == REDIS_REPLY_STRING) {
+            *inode = (uint64_t)atoll(replies[i]->str);
+            ret = 0;
+        } else if (replies[i]->type != REDIS_REPLY_NIL) {
+            ret = -1;
+        }
+    }
+
+    free_replies(replies, count);
+    return ret;
+}
+
+typedef struct {
+    uint32_t group;
+    int index;
+} entry_order_t;
+
+static int compare_order(const void *a, const void *b) {
+    const entry_order_t *x = (const entry_order_t*)a;
+    const entry_order_t *y = (const entry_order_t*)b;
+    if (x->group != y->group) {
+        return x->group < y->group ? -1 : 1;
+    }
+    return x->index - y->index;
+}
+
+// 读取目录项的节点类型：同一分组的节点记录在同一个槽，按分组每 META_READDIR_BATCH 个用一次 MGET 读取
+// 读不到的节点（已被删除）类型保持为 0
+static void read_modes(redis_meta_t *meta, uint64_t dir, dir_entry_t *entries, int n) {
+    entry_order_t *order = (entry_order_t*)malloc(sizeof(entry_order_t) * (size_t)(n > 0 ? n : 1));
+    char (*keys)[48] = (char(*)[48])malloc(sizeof(*keys) * META_READDIR_BATCH);
+    const char **argv = (const char**)malloc(sizeof(char*) * (META_READDIR_BATCH + 1));
+    if (!order || !keys || !argv) {
+        free(order);
+        free(keys);
+        free(argv);
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        order[i].group = group_of(meta, entries[i].inode);
+        order[i].index = i;
+    }
+    if (meta->groups > 1) {
+        qsort(order, (size_t)n, sizeof(entry_order_t), compare_order);
+    }
+
+    argv[0] = "MGET";
+    uint64_t now = now_ms();
+    for (int i = 0; i < n; ) {
+        uint32_t group = order[i].group;
+        int replica = pick_replica(meta, dir);
+        int m = 0;
+        while (i + m < n && m < META_READDIR_BATCH && order[i + m].group == group) {
+            uint64_t ino = entries[order[i + m].index].inode;
+            snprintf(keys[m], sizeof(keys[m]), "%s%s%lu", group_tag(meta, group), NODE_KEY_PREFIX, ino);
+            argv[m + 1] = keys[m];
+            if (replica >= 0 && remote_pinned(meta, ino, now)) {
+                replica = -1;
+            }
+            m++;
+        }
+
+        pipe_begin(meta, group);
+        meta_pipe(meta)->replica = replica;
+        char *cmd = NULL;
+        long long len = redisFormatCommandArgv(&cmd, m + 1, argv, NULL);
+        pipe_push(meta, cmd, len);
+        redisReply *reply = take_reply(meta);
+        if (reply && reply->type == REDIS_REPLY_ARRAY && reply->elements == (size_t)m) {
+            for (int j = 0; j < m; j++) {
+                if (reply->element[j]->type == REDIS_REPLY_STRING) {
+                    node_attr_t attr;
+                    parse_attr(reply->element[j]->str, &attr);
+                    entries[order[i + j].index].mode = attr.mode;
+                }
+            }
+        }
+        if (reply) freeReplyObject(reply);
+        i += m;
+    }
+
+    free(order);
+    free(keys);
+    free(argv);
+}
+
+int redis_meta_readdir(redis_meta_t *meta, uint64_t inode, dir_entry_t **entries, int *count) {
+    redisReply *reply = meta_read(meta, inode, "HGETALL %s%s%lu", key_tag(meta, inode),
+                                  DIR_KEY_PREFIX, inode);
+    if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    // 分片目录的主哈希带有标记，子哈希在一次流水线中全部取回
+    uint32_t shards = 0;
+    for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+        if (strcmp(reply->element[i]->str, DIR_SHARDS_FIELD) == 0) {
+            shards = (uint32_t)strtoul(reply->element[i + 1]->str, NULL, 10);
+            remember_shards(meta, inode, shards);
+        }
+    }
+
+    redisReply **shard_replies = NULL;
+    int nshards = 0;
+    int ret = 0;
+    if (shards > 0) {
+        pipe_begin_read(meta, inode);
+        for (uint32_t k = 0; k < shards; k++) {
+            meta_append(meta, "HGETALL %s%s%lu:%u", key_tag(meta, inode), DIR_KEY_PREFIX, inode, k);
+        }
+        shard_replies = pipe_exec(meta, &nshards);
+        if (!shard_replies) {
+            ret = -1;
+        }
+        for (int k = 0; ret == 0 && k < nshards; k++) {
+            if (shard_replies[k]->type != REDIS_REPLY_ARRAY) {
+                ret = -1;
+            }
+        }
+    }
+
+    // 目录项数组和全部名字一次分配：名字依次存放在数组之后
+    size_t total = 0;
+    size_t names = 0;
+    for (int k = 0; ret == 0 && k <= nshards; k++) {
+        redisReply *r = k == 0 ? reply : shard_replies[k - 1];
+        for (size_t i = 0; i + 1 < r->elements; i += 2) {
+            total++;
+            names += r->element[i]->len + 1;
+        }
+    }
+
+    dir_entry_t *result = NULL;
+    if (ret == 0) {
+        result = (dir_entry_t*)malloc(sizeof(dir_entry_t) * total + names + 1);
+        if (!result) {
+            ret = -1;
+        }
+    }
+
+    int n = 0;
+    char *name = result ? (char*)(result + total) : NULL;
+    for (int k = 0; ret == 0 && k <= nshards; k++) {
+        redisReply *r = k == 0 ? reply : shard_replies[k - 1];
+        for (size_t i = 0; i + 1 < r->elements; i += 2) {
+            if (r->element[i]->str[0] == '/') {
+                continue;
+            }
+            memcpy(name, r->element[i]->str, r->element[i]->len + 1);
+            result[n].name = name;
+            name += r->element[i]->len + 1;
+            result[n].inode = (uint64_t)atoll(r->element[i + 1]->str);
+            result[n].mode = 0;
+            n++;
+        }
+    }
+
+    freeReplyObject(reply);
+    free_replies(shard_replies, nshards);
+    if (ret == 0) {
+        read_modes(meta, inode, result, n);
+    }
+
+    if (ret != 0) {
+        free(result);
+        return -1;
+    }
+
+    *count = n;
+    *entries = result;
+    return 0;
+}
+
+int redis_meta_rmdir(redis_meta_t *meta, uint64_t parent, const char *name, uint64_t inode) {
+    const char *tag = key_tag(meta, inode);
+    const char *ptag = key_tag(meta, parent);
+    char dir[96], key[96];
+    entry_keys(meta, parent, name, dir, key, sizeof(dir));
+
+    // 检查是否为空、删除节点（与父目录在同一分组时还有移除目录项和调整父目录）在一个脚本中完成，
+    // 检查之后不会有新的目录项加入；集群模式下目录与父目录通常不在同一分组，删除节点后再移除目录项，
+    // 之后在已删除的目录中创建会失败
+    int same = group_of(meta, inode) == group_of(meta, parent);
+    pipe_begin_write(meta, group_of(meta, inode));
+    uint64_t now = (uint64_t)time(NULL);
+    if (same) {
+        meta_append(meta, "EVALSHA %s 10 %s%s%lu %s%s%lu %s%s %s%s%lu %s%s %s%s%lu %s%s%lu %s %s %s%s%lu "
+                    "%lu %d %s %lu %lu", meta->script_sha[SCRIPT_RMDIR],
+                    tag, NODE_KEY_PREFIX, inode, tag, INLINE_KEY_PREFIX, inode, tag, USAGE_KEY,
+                    tag, DIRSTAT_KEY_PREFIX, inode, tag, DIRDELTA_KEY, tag, DIR_KEY_PREFIX, inode,
+                    tag, XATTR_KEY_PREFIX, inode, dir, key, ptag, NODE_KEY_PREFIX, parent,
+                    inode, meta->dirstat, name, parent, now);
+    } else {
+        meta_append(meta, "EVALSHA %s 7 %s%s%lu %s%s%lu %s%s %s%s%lu %s%s %s%s%lu %s%s%lu "
+                    "%lu %d %s %lu %lu", meta->script_sha[SCRIPT_RMDIR],
+                    tag, NODE_KEY_PREFIX, inode, tag, INLINE_KEY_PREFIX, inode, tag, USAGE_KEY,
+                    tag, DIRSTAT_KEY_PREFIX, inode, tag, DIRDELTA_KEY, tag, DIR_KEY_PREFIX, inode,
+                    tag, XATTR_KEY_PREFIX, inode, inode, meta->dirstat, name, parent, now);
+    }
+
+    redisReply *reply = take_reply(meta);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+    long long ret = reply->integer;
+    freeReplyObject(reply);
+    if (ret != 0) {
+        return ret > 0 ? 1 : 2;
+    }
+    if (same) {
+        return 0;
+    }
+
+    tx_begin(meta, group_of(meta, parent));
+    append_remove_entry(meta, parent, name);
+    append_adjust_node(meta, parent, -1, -1);
+    append_dir_delta(meta, parent, 0, 0, -1);
+    return tx_commit(meta);
+}
+
+int redis_meta_delete_node(redis_meta_t *meta, uint64_t inode) {
+    pipe_begin_write(meta, group_of(meta, inode));
+    append_delete_node(meta, inode);
+    return pipe_exec_status(meta);
+}
+
+int redis_meta_rename(redis_meta_t *meta, uint64_t old_parent, const char *old_name,
+                     uint64_t new_parent, const char *new_name, const node_attr_t *replaced, int hold) {
+    // 事务前的查找也要读主节点
+    redis_meta_note_write(meta);
+    uint64_t inode;
+    if (redis_meta_lookup(meta, old_parent, old_name, &inode) != 0) {
+        return -1;
+    }
+
+    node_attr_t *attr;
+    if (redis_meta_get_node(meta, inode, &attr) != 0) {
+        return -1;
+    }
+
+    // 跨目录移动时把节点的份额从旧父目录移到新父目录，子树中尚未传播的增量随后沿新的父目录链传播
+    dir_usage_t usage = {0, 0, 0, 0};
+    if (old_parent != new_parent && meta->dirstat && node_dir_usage(meta, attr, &usage) != 0) {
+        node_attr_free(attr);
+        return -1;
+    }
+
+    // 被覆盖的目标从新父目录中移除：文件减少一个链接（最后一个链接删除时加入待删除集合），空目录直接删除
+    dir_usage_t replaced_usage = {0, 0, 0, 0};
+    int replaced_dir = replaced && S_ISDIR(replaced->mode);
+    if (replaced && meta->dirstat) {
+        if (replaced_dir) {
+            replaced_usage.dirs = 1;
+        } else if (node_dir_usage(meta, replaced, &replaced_usage) != 0) {
+            node_attr_free(attr);
+            return -1;
+        }
+    }
+
+    int is_dir = S_ISDIR(attr->mode);
+
+    // 使用事务；集群模式下按分组依次提交：先在新父目录中添加目录项，再更新节点和被覆盖的目标，
+    // 最后移除旧目录项，中途失败时节点仍可从某个目录访问
+    tx_begin(meta, group_of(meta, new_parent));
+    append_add_entry(meta, new_parent, new_name, inode);
+    if (old_parent == new_parent) {
+        append_remove_entry(meta, old_parent, old_name);
+        append_adjust_node(meta, new_parent, -(replaced_dir ? 1 : 0), replaced ? -1 : 0);
+    } else {
+        append_adjust_node(meta, new_parent, (is_dir ? 1 : 0) - (replaced_dir ? 1 : 0), replaced ? 0 : 1);
+    }
+    append_dir_delta(meta, new_parent, usage.space - replaced_usage.space,
+                     usage.files - replaced_usage.files, usage.dirs - replaced_usage.dirs);
+
+    int ret = tx_switch(meta, group_of(meta, inode));
+    if (ret == 0) {
+        append_change_node(meta, inode, -1, -1, -1, -1, (int64_t)new_parent);
+    }
+    int unlink_index = -1;
+    long long links = -1;
+    if (ret == 0 && replaced) {
+        ret = tx_switch(meta, group_of(meta, replaced->inode));
+        if (ret == 0 && replaced_dir) {
+            append_delete_node(meta, replaced->inode);
+        } else if (ret == 0) {
+            unlink_index = tx_index(meta);
+            append_link_node(meta, replaced->inode, -1, hold);
+        }
+    }
+    if (ret == 0 && old_parent != new_parent) {
+        ret = tx_switch_integer(meta, group_of(meta, old_parent), &unlink_index, &links);
+        if (ret == 0) {
+            append_remove_entry(meta, old_parent, old_name);
+            append_adjust_node(meta, old_parent, is_dir ? -1 : 0, -1);
+            append_dir_delta(meta, old_parent, -usage.space, -usage.files, -usage.dirs);
+        }
+    }
+    if (ret == 0) {
+        ret = tx_commit_integer(meta, unlink_index, &links);
+    }
+
+    node_attr_free(attr);
+    if (ret != 0) {
+        return -1;
+    }
+    return replaced && !replaced_dir && links == 0 ? 1 : 0;
+}
+
+int redis_meta_count_entries(redis_meta_t *meta, const node_attr_t *attr, uint64_t *count) {
+    if (attr->nlink > 0) {
+        *count = attr->entries;
+        return 0;
+    }
+
+    // 旧记录没有目录项数，回退到 HLEN
+    redisReply *reply = meta_command(meta, group_of(meta, attr->inode), "HLEN %s%s%lu",
+                                     key_tag(meta, attr->inode), DIR_KEY_PREFIX, attr->inode);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    *count = (uint64_t)reply->integer;
+    freeReplyObject(reply);
+    return 0;
+}
+
+int redis_meta_load_setting(redis_meta_t *meta, const char *name, uint64_t wanted,
+                            uint64_t legacy, uint64_t *value) {
+    // 卷级别的键与根目录在同一分组
+    uint32_t group = group_of(meta, 1);
+    const char *tag = group_tag(meta, group);
+
+    redisReply *reply = meta_command(meta, group, "EXISTS %s%s", tag, LOOKUP_COUNTER_KEY);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+    uint64_t initial = reply->integer > 0 ? legacy : wanted;
+    freeReplyObject(reply);
+
+    // HSETNX 保证多个挂载同时初始化时只有一个值生效
+    reply = meta_command(meta, group, "HSETNX %s%s %s %lu", tag, SETTING_KEY, name, initial);
+    if (!reply || reply->type == REDIS_REPLY_ERROR) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+    freeReplyObject(reply);
+
+    reply = meta_command(meta, group, "HGET %s%s %s", tag, SETTING_KEY, name);
+    if (!reply || reply->type != REDIS_REPLY_STRING) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    *value = strtoull(reply->str, NULL, 10);
+    freeReplyObject(reply);
+    return 0;
+}
+
+int redis_meta_read_inline(redis_meta_t *meta, uint64_t inode, void *buf, size_t size,
+                           off_t offset, ssize_t *nread) {
+    if (size == 0) {
+        *nread = 0;
+        return 0;
+    }
+
+    // 流水线：节点属性和数据范围一次往返取回
+    const char *tag = key_tag(meta, inode);
+    pipe_begin(meta, group_of(meta, inode));
+    meta_append(meta, "GET %s%s%lu", tag, NODE_KEY_PREFIX, inode);
+    meta_append(meta, "GETRANGE %s%s%lu %lld %lld", tag, INLINE_KEY_PREFIX, inode,
+                (long long)offset, (long long)(offset + size - 1));
+
+    int count;
+    redisReply **replies = pipe_exec(meta, &count);
+    if (!replies) {
+        return -1;
+    }
+    redisReply *reply1 = replies[0];
+    redisReply *reply2 = replies[1];
+
+    int ret = -1;
+    if (reply1->type == REDIS_REPLY_STRING && reply2->type == REDIS_REPLY_STRING) {
+        node_attr_t attr;
+        parse_attr(reply1->str, &attr);
+
+        if (!(attr.flags & NODE_FLAG_INLINE)) {
+            ret = 1;
+        } else {
+            size_t len = reply2->len;
+            if (len > size) len = size;
+            if ((uint64_t)offset >= attr.size) {
+                len = 0;
+            } else if (len > attr.size - (uint64_t)offset) {
+                len = (size_t)(attr.size - (uint64_t)offset);
+            }
+            memcpy(buf, reply2->str, len);
+
+            // 数据短于文件大小的部分（截断扩展产生）补零
+            if ((uint64_t)offset + len < attr.size) {
+                size_t fill = (size_t)(attr.size - (uint64_t)offset - len);
+                if (fill > size - len) fill = size - len;
+                memset((char*)buf + len, 0, fill);
+                len += fill;
+            }
+            *nread = (ssize_t)len;
+            ret = 0;
+        }
+    }
+
+    free_replies(replies, count);
+    return ret;
+}
+
+int redis_meta_write_inline(redis_meta_t *meta, uint64_t inode, const void *data, size_t size,
+                            off_t offset, int64_t mtime) {
+    const char *tag = key_tag(meta, inode);
+    redisReply *reply = meta_write(meta, group_of(meta, inode),
+                                   "EVALSHA %s 4 %s%s%lu %s%s %s%s %s%s%lu %lu %lld %lld %lld %d %lld %b",
+                                   meta->script_sha[SCRIPT_WRITE_INLINE], tag, NODE_KEY_PREFIX, inode,
+                                   tag, USAGE_KEY, tag, DIRDELTA_KEY, tag, INLINE_KEY_PREFIX, inode,
+                                   (uint64_t)offset + size, (long long)META_TIME_KEEP, (long long)mtime,
+                                   (long long)META_TIME_KEEP, meta->dirstat, (long long)offset, data, size);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    int ret = reply->integer == 0 ? 0 : 1;
+    freeReplyObject(reply);
+    return ret;
+}
+
+int redis_meta_get_inline(redis_meta_t *meta, uint64_t inode, char **data, size_t *len) {
+    redisReply *reply = meta_command(meta, group_of(meta, inode), "GET %s%s%lu",
+                                     key_tag(meta, inode), INLINE_KEY_PREFIX, inode);
+    if (!reply || (reply->type != REDIS_REPLY_STRING && reply->type != REDIS_REPLY_NIL)) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    *data = NULL;
+    *len = 0;
+    if (reply->type == REDIS_REPLY_STRING && reply->len > 0) {
+        *data = (char*)malloc(reply->len);
+        if (!*data) {
+            freeReplyObject(reply);
+            return -1;
+        }
+        memcpy(*data, reply->str, reply->len);
+        *len = reply->len;
+    }
+
+    freeReplyObject(reply);
+    return 0;
+}
+
+int redis_meta_clear_inline(redis_meta_t *meta, uint64_t inode, const void *data, size_t len,
+                            uint64_t size) {
+    const char *tag = key_tag(meta, inode);
+    redisReply *reply = meta_write(meta, group_of(meta, inode), "EVALSHA %s 2 %s%s%lu %s%s%lu %b %lu",
+                                   meta->script_sha[SCRIPT_CLEAR_INLINE], tag, NODE_KEY_PREFIX, inode,
+                                   tag, INLINE_KEY_PREFIX, inode, data ? data : "", len, size);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER || reply->integer < 0) {
+        if (reply) freeReplyObject(reply);
+        return -1;
+    }
+
+    int ret = reply->integer == 0 ? 0 : 1;
+    freeReplyObject(reply);
+    return ret;
+}
+
+int redis_meta_defer_delete(redis_meta_t *meta, uint64_t parent, const char *name,
+                            const node_attr_t *attr, int hold) {
+    dir_usage_t usage = {0, 0, 0, 0};
+    if (meta->dirstat && node_dir_usage(meta, attr, &usage) != 0) {
+        return -1;
+    }
+
+    // 目录项删除与减少链接数（减到 0 时加入待删除集合）在同一事务中，崩溃后不会留下无人引用的节点
+    // 集群模式下节点可能已被移到其他分组的目录中，先删除目录项再调整节点所在分组中的链接数
+    tx_begin(meta, group_of(meta, parent));
+    append_remove_entry(meta, parent, name);
+    append_adjust_node(meta, parent, 0, -1);
+    append_dir_delta(meta, parent, -usage.space, -usage.files, -usage.dirs);
+    if (tx_switch(meta, group_of(meta, attr->inode)) != 0) {
+        return -1;
+    }
+    int index = tx_index(meta);
+    append_link_node(meta, attr->inode, -1, hold);
+
+    long long links;
+    if (tx_commit_integer(meta, index, &links) != 0) {
+        return -1;
+    }
+    return links == 0 ? 1 : 0;
 }
 
-static char* get_dir_key(uint64_t inode) {
-    char *key = (char*)malloc(32);
-    if (!key) return NULL;
-    sprintf(key, "%s%lu", DIR_KEY_PREFIX, inode);
-    return key;
-}
+int redis_meta_pending_deletes(redis_meta_t *meta, int max, uint64_t **inodes, int *count) {
+    // 分数为可以开始删除的时间，推迟重试的节点暂不取出
+    char now[32], limit[16];
+    snprintf(now, sizeof(now), "%lu", (uint64_t)time(NULL));
+    snprintf(limit, sizeof(limit), "%d", max);
+    const char *argv[] = {"ZRANGEBYSCORE", PENDING_DELETE_KEY, "-inf", now, "LIMIT", "0", limit};
 
-static redisContext* redis_connect(const char *addr, int port) {
-    redisContext *c = redisConnect(addr, port);
-    if (c == NULL || c->err) {
-        if (c) {
-            fprintf(stderr, "Redis connection error: %s\n", c->errstr);
-            redisFree(c);
-        } else {
-            fprintf(stderr, "Redis connection error: can't allocate redis context\n");
+    // 集群模式下每个分组有自己的待删除集合，从上次停下的分组开始轮流取出
+    uint32_t first = meta->delete_group;
+    redisReply **replies = group_commands(meta, first, meta->groups, 7, argv);
+    if (!replies) {
+        return -1;
+    }
+
+    *inodes = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)(max > 0 ? max : 1));
+    int ret = *inodes ? 0 : -1;
+    int n = 0;
+    for (uint32_t i = 0; ret == 0 && i < meta->groups; i++) {
+        redisReply *reply = replies[i];
+        if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+            ret = -1;
+            break;
+        }
+        for (size_t j = 0; j < reply->elements && n < max; j++) {
+            (*inodes)[n++] = strtoull(reply->element[j]->str, NULL, 10);
+        }
+        if (n >= max) {
+            meta->delete_group = (first + i + 1) % meta->groups;
+            break;
         }
-        return NULL;
     }
-    return c;
+    free_replies(replies, (int)meta->groups);
+
+    if (ret != 0 || n == 0) {
+        free(*inodes);
+        *inodes = NULL;
+    }
+    *count = n;
+    return ret;
 }
 
-redis_meta_t* redis_meta_new(const char *addr, int port, const char *password, int db) {
-    redis_meta_t *meta = (redis_meta_t*)malloc(sizeof(redis_meta_t));
-    if (!meta) {
-        return NULL;
+int redis_meta_retry_delete(redis_meta_t *meta, uint64_t inode, int delay) {
+    redisReply *reply = meta_command(meta, group_of(meta, inode), "ZADD %s%s XX %lu %lu",
+                                     key_tag(meta, inode), PENDING_DELETE_KEY,
+                                     (uint64_t)time(NULL) + (uint64_t)delay, inode);
+    if (!reply || reply->type == REDIS_REPLY_ERROR) {
+        if (reply) freeReplyObject(reply);
+        return -1;
     }
 
-    meta->ctx = redis_connect(addr, port);
-    if (!meta->ctx) {
-        free(meta);
-        return NULL;
+    freeReplyObject(reply);
+    return 0;
+}
+
+int redis_meta_set_tier(redis_meta_t *meta, uint64_t inode, int cold) {
+    redisReply *reply = meta_write(meta, group_of(meta, inode), "EVALSHA %s 1 %s%s%lu %d",
+                                   meta->script_sha[SCRIPT_SET_TIER], key_tag(meta, inode), NODE_KEY_PREFIX, inode,
+                                     cold ? 1 : 0);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+        if (reply) freeReplyObject(reply);
+        return -1;
     }
 
-    // 如果有密码，认证
-    if (password && strlen(password) > 0) {
-        redisReply *reply = (redisReply*)redisCommand(meta->ctx, "AUTH %s", password);
-        if (!reply || reply->type == REDIS_REPLY_ERROR) {
-            fprintf(stderr, "Redis authentication failed\n");
-            if (reply) freeReplyObject(reply);
-            redisFree(meta->ctx);
-            free(meta);
-            return NULL;
+    int ret = reply->integer == 0 ? 0 : 1;
+    freeReplyObject(reply);
+    return ret;
+}
+
+int redis_meta_stamp_access(redis_meta_t *meta, const access_stamp_t *stamps, int count) {
+    // 每个分组一条流水线
+    int ret = 0;
+    for (uint32_t g = 0; g < meta->groups; g++) {
+        const char *tag = group_tag(meta, g);
+        pipe_begin(meta, g);
+        for (int i = 0; i < count; i++) {
+            if (group_of(meta, stamps[i].inode) != g) {
+                continue;
+            }
+            meta_append(meta, "ZADD %s%s %lld %lu", tag, ACCESS_KEY, (long long)stamps[i].last, stamps[i].inode);
+            if (stamps[i].hot) {
+                meta_append(meta, "SADD %s%s %lu", tag, PROMOTE_KEY, stamps[i].inode);
+            }
+        }
+        if (meta_pipe(meta)->count > 0 && pipe_exec_status(meta) != 0) {
+            ret = -1;
         }
-        freeReplyObject(reply);
     }
+    pipe_reset(meta);
+    return ret;
+}
 
-    // 选择数据库
-    if (db > 0) {
-        redisReply *reply = (redisReply*)redisCommand(meta->ctx, "SELECT %d", db);
-        if (reply) freeReplyObject(reply);
+int redis_meta_access_times(redis_meta_t *meta, const uint64_t *inodes, int count, time_t *times) {
+    int ret = 0;
+    for (uint32_t g = 0; ret == 0 && g < meta->groups; g++) {
+        const char *tag = group_tag(meta, g);
+        pipe_begin(meta, g);
+        for (int i = 0; i < count; i++) {
+            if (group_of(meta, inodes[i]) == g) {
+                meta_append(meta, "ZSCORE %s%s %lu", tag, ACCESS_KEY, inodes[i]);
+            }
+        }
+        if (meta_pipe(meta)->count == 0) {
+            continue;
+        }
+
+        int n;
+        redisReply **replies = pipe_exec(meta, &n);
+        if (!replies) {
+            ret = -1;
+            break;
+        }
+        int j = 0;
+        for (int i = 0; i < count; i++) {
+            if (group_of(meta, inodes[i]) != g) {
+                continue;
+            }
+            redisReply *reply = replies[j++];
+            if (reply->type == REDIS_REPLY_STRING) {
+                times[i] = (time_t)strtoll(reply->str, NULL, 10);
+            } else if (reply->type == REDIS_REPLY_NIL) {
+                times[i] = 0;
+            } else {
+                ret = -1;
+            }
+        }
+        free_replies(replies, n);
     }
+    pipe_reset(meta);
+    return ret;
+}
 
-    return meta;
+int redis_meta_expire_access(redis_meta_t *meta, time_t before) {
+    char max[32];
+    snprintf(max, sizeof(max), "(%lld", (long long)before);
+    const char *argv[] = {"ZREMRANGEBYSCORE", ACCESS_KEY, "-inf", max};
+    redisReply **replies = group_commands(meta, 0, meta->groups, 4, argv);
+    if (!replies) {
+        return -1;
+    }
+
+    int ret = 0;
+    for (uint32_t g = 0; g < meta->groups; g++) {
+        if (!replies[g] || replies[g]->type != REDIS_REPLY_INTEGER) {
+            ret = -1;
+        }
+    }
+    free_replies(replies, (int)meta->groups);
+    return ret;
 }
 
-void redis_meta_free(redis_meta_t *meta) {
-    if (meta) {
-        if (meta->ctx) {
-            redisFree(meta->ctx);
+int redis_meta_take_promotions(redis_meta_t *meta, int max, uint64_t **inodes, int *count) {
+    char limit[16];
+    snprintf(limit, sizeof(limit), "%d", max);
+    const char *argv[] = {"SPOP", PROMOTE_KEY, limit};
+    redisReply **replies = group_commands(meta, 0, meta->groups, 3, argv);
+    if (!replies) {
+        return -1;
+    }
+
+    // 每个分组最多取出 max 个
+    *inodes = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)(max > 0 ? max : 1) * meta->groups);
+    int ret = *inodes ? 0 : -1;
+    int n = 0;
+    for (uint32_t g = 0; ret == 0 && g < meta->groups; g++) {
+        redisReply *reply = replies[g];
+        if (reply && reply->type == REDIS_REPLY_NIL) {
+            continue;
+        }
+        if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+            ret = -1;
+            break;
+        }
+        for (size_t j = 0; j < reply->elements; j++) {
+            (*inodes)[n++] = strtoull(reply->element[j]->str, NULL, 10);
         }
-        free(meta);
     }
+    free_replies(replies, (int)meta->groups);
+
+    if (ret != 0 || n == 0) {
+        free(*inodes);
+        *inodes = NULL;
+    }
+    *count = n;
+    return ret;
 }
 
-uint64_t redis_meta_allocate_inode(redis_meta_t *meta) {
-    redisReply *reply = (redisReply*)redisCommand(meta->ctx, "INCR %s", LOOKUP_COUNTER_KEY);
-    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
-        if (reply) freeReplyObject(reply);
+int redis_meta_finish_deletes(redis_meta_t *meta, const uint64_t *inodes, int count) {
+    if (count <= 0) {
         return 0;
     }
 
-    uint64_t inode = (uint64_t)reply->integer;
-    freeReplyObject(reply);
-    return inode;
+    // 集群模式下同一分组中相邻的节点在一个事务中删除
+    tx_begin(meta, group_of(meta, inodes[0]));
+    for (int i = 0; i < count; i++) {
+        if (tx_switch(meta, group_of(meta, inodes[i])) != 0) {
+            return -1;
+        }
+        append_delete_node(meta, inodes[i]);
+        meta_append(meta, "ZREM %s%s %lu", key_tag(meta, inodes[i]), PENDING_DELETE_KEY, inodes[i]);
+        meta_append(meta, "ZREM %s%s %lu", key_tag(meta, inodes[i]), ACCESS_KEY, inodes[i]);
+    }
+
+    return tx_commit(meta);
 }
 
-int redis_meta_create_node(redis_meta_t *meta, uint64_t parent, const char *name,
-                          uint32_t mode, uint32_t uid, uint32_t gid, node_attr_t **result_attr) {
-    uint64_t inode = redis_meta_allocate_inode(meta);
-    if (inode == 0) {
+int redis_meta_get_usage(redis_meta_t *meta, uint64_t *space, uint64_t *inodes) {
+    // 集群模式下各分组分别计数，statfs 时汇总
+    const char *argv[] = {"HMGET", USAGE_KEY, "space", "inodes"};
+    redisReply **replies = group_commands(meta, 0, meta->groups, 4, argv);
+    if (!replies) {
         return -1;
     }
 
-    node_attr_t *attr = (node_attr_t*)malloc(sizeof(node_attr_t));
-    if (!attr) {
+    int ret = 0;
+    long long values[2] = {0, 0};
+    for (uint32_t g = 0; g < meta->groups; g++) {
+        redisReply *reply = replies[g];
+        if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2) {
+            ret = -1;
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (reply->element[i]->type == REDIS_REPLY_STRING) {
+                values[i] += strtoll(reply->element[i]->str, NULL, 10);
+            }
+        }
+    }
+    free_replies(replies, (int)meta->groups);
+
+    // 防御性处理：负值按 0 返回
+    *space = values[0] > 0 ? (uint64_t)values[0] : 0;
+    *inodes = values[1] > 0 ? (uint64_t)values[1] : 0;
+    return ret;
+}
+
+int redis_meta_get_dir_usage(redis_meta_t *meta, uint64_t inode, dir_usage_t *usage) {
+    redisReply *reply = meta_command(meta, group_of(meta, inode), "HMGET %s%s%lu space files dirs",
+                                     key_tag(meta, inode), DIRSTAT_KEY_PREFIX, inode);
+    if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 3) {
+        if (reply) freeReplyObject(reply);
         return -1;
     }
 
-    uint64_t now = (uint64_t)time(NULL);
-    attr->inode = inode;
-    attr->mode = mode;
-    attr->uid = uid;
-    attr->gid = gid;
-    attr->size = 0;
-    attr->blocks = 0;
-    attr->atime = now;
-    attr->mtime = now;
-    attr->ctime = now;
-    attr->link_target[0] = '\0';
+    int64_t values[3] = {0, 0, 0};
+    for (int i = 0; i < 3; i++) {
+        if (reply->element[i]->type == REDIS_REPLY_STRING) {
+            values[i] = strtoll(reply->element[i]->str, NULL, 10);
+        }
+    }
+    usage->inode = inode;
+    usage->space = values[0];
+    usage->files = values[1];
+    usage->dirs = values[2];
 
-    // 序列化属性
-    char attr_str[1024];
-    snprintf(attr_str, sizeof(attr_str),
-             "%lu:%u:%u:%u:%lu:%lu:%lu:%lu:%lu",
-             attr->inode, attr->mode, attr->uid, attr->gid,
-             attr->size, attr->blocks, attr->atime, attr->mtime, attr->ctime);
+    freeReplyObject(reply);
+    return 0;
+}
 
-    // 使用事务
-    redisAppendCommand(meta->ctx, "SET %s%lu %s", NODE_KEY_PREFIX, inode, attr_str);
-    redisAppendCommand(meta->ctx, "HSET %s%lu %s %lu", DIR_KEY_PREFIX, parent, name, inode);
+int redis_meta_flush_dirstat(redis_meta_t *meta) {
+    // 传播脚本沿父目录链访问任意节点，集群模式下不支持（不启用目录用量统计）
+    if (meta->cluster) {
+        return -1;
+    }
 
-    redisReply *reply1, *reply2;
-    redisGetReply(meta->ctx, (void**)&reply1);
-    redisGetReply(meta->ctx, (void**)&reply2);
+    // 沿 HSCAN 游标逐批取出字段交给脚本传播，每次脚本执行只处理一批，不会长时间阻塞 Redis；
+    // 游标经过之后新增的增量留到下一轮
+    char cursor[32] = "0";
+    int total = 0;
+    do {
+        redisReply *scan = meta_command(meta, 0, "HSCAN %s %s COUNT %d", DIRDELTA_KEY, cursor, META_DIRSTAT_BATCH);
+        if (!scan || scan->type != REDIS_REPLY_ARRAY || scan->elements != 2 ||
+            scan->element[0]->type != REDIS_REPLY_STRING || scan->element[1]->type != REDIS_REPLY_ARRAY) {
+            if (scan) freeReplyObject(scan);
+            return -1;
+        }
+        snprintf(cursor, sizeof(cursor), "%s", scan->element[0]->str);
 
-    int ret = -1;
-    if (reply1 && reply1->type != REDIS_REPLY_ERROR &&
-        reply2 && reply2->type != REDIS_REPLY_ERROR) {
-        ret = 0;
-        *result_attr = attr;
-    } else {
-        free(attr);
+        redisReply *pairs = scan->element[1];
+        size_t count = pairs->elements / 2;
+        int ok = 1;
+        if (count > 0) {
+            int argc = (int)count + 6;
+            const char **argv = (const char**)malloc((size_t)argc * sizeof(char*));
+            if (!argv) {
+                freeReplyObject(scan);
+                return -1;
+            }
+            argv[0] = "EVALSHA";
+            argv[1] = meta->script_sha[SCRIPT_FLUSH_DIRSTAT];
+            argv[2] = "1";
+            argv[3] = DIRDELTA_KEY;
+            argv[4] = NODE_KEY_PREFIX;
+            argv[5] = DIRSTAT_KEY_PREFIX;
+            for (size_t i = 0; i < count; i++) {
+                argv[6 + i] = pairs->element[2 * i]->str;
+            }
+
+            redisReply *reply = meta_command_argv(meta, 0, argc, argv);
+            free(argv);
+            ok = reply && reply->type == REDIS_REPLY_INTEGER;
+            if (ok) {
+                total += (int)reply->integer;
+            }
+            if (reply) freeReplyObject(reply);
+        }
+        freeReplyObject(scan);
+        if (!ok) {
+            return -1;
+        }
+    } while (strcmp(cursor, "0") != 0);
+
+    return total;
+}
+
+// WAIT 返回确认的副本数，WAITAOF 返回 [写入本地 AOF 的节点数, 写入 AOF 的副本数]
+static int wait_satisfied(const redisReply *reply, int local, int replicas) {
+    if (reply->type == REDIS_REPLY_INTEGER) {
+        return reply->integer >= replicas;
+    }
+    return reply->type == REDIS_REPLY_ARRAY && reply->elements == 2 &&
+           reply->element[0]->type == REDIS_REPLY_INTEGER &&
+           reply->element[1]->type == REDIS_REPLY_INTEGER &&
+           reply->element[0]->integer >= local && reply->element[1]->integer >= replicas;
+}
+
+// 在批中文件所在的各个节点上等待之前的写入持久化（单机模式下只有一个节点）
+// 等待可能阻塞到超时，使用各节点连接池中的独立等待连接，不占用其他请求的连接；
+// 各节点的等待同时发出，整批的等待时间取决于最慢的节点
+// WAIT/WAITAOF 只等待发出它的连接最近一次写入时的复制偏移量，本挂载的写入分散在池中的各条连接上，
+// 先在等待连接上写一次同步键，等待的偏移量就不小于这之前全部写入的偏移量
+int redis_meta_wait_durable(redis_meta_t *meta, const uint64_t *inodes, int count,
+                            int local, int replicas, int timeout_ms) {
+    int n = meta->cluster && count > 0 ? count : 1;
+    conn_pool_t **pools = (conn_pool_t**)calloc((size_t)n, sizeof(conn_pool_t*));
+    uint32_t *groups = (uint32_t*)calloc((size_t)n, sizeof(uint32_t));
+    pool_conn_t **conns = (pool_conn_t**)calloc((size_t)n, sizeof(pool_conn_t*));
+    if (!pools || !groups || !conns) {
+        free(pools);
+        free(groups);
+        free(conns);
+        return -1;
+    }
+
+    // 每个节点只等待一次，按连接池的地址排序，同时持有多条等待连接时获取顺序一致
+    int ret = 0;
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        uint32_t group = meta->cluster ? group_of(meta, inodes[i]) : 0;
+        conn_pool_t *pool = group_pool(meta, group);
+        if (!pool) {
+            ret = -1;
+            continue;
+        }
+        int k = m;
+        while (k > 0 && (uintptr_t)pools[k - 1] > (uintptr_t)pool) {
+            k--;
+        }
+        if (k > 0 && pools[k - 1] == pool) {
+            continue;
+        }
+        memmove(&pools[k + 1], &pools[k], sizeof(pools[0]) * (size_t)(m - k));
+        memmove(&groups[k + 1], &groups[k], sizeof(groups[0]) * (size_t)(m - k));
+        pools[k] = pool;
+        groups[k] = group;
+        m++;
+    }
+
+    for (int i = 0; i < m; i++) {
+        conns[i] = conn_pool_get_wait(pools[i]);
+        if (!conns[i]) {
+            ret = -1;
+            continue;
+        }
+        redisAppendCommand(conns[i]->ctx, "INCR %s%s", group_tag(meta, groups[i]), SYNC_KEY);
+        if (local > 0) {
+            redisAppendCommand(conns[i]->ctx, "WAITAOF %d %d %d", local, replicas, timeout_ms);
+        } else {
+            redisAppendCommand(conns[i]->ctx, "WAIT %d %d", replicas, timeout_ms);
+        }
     }
 
-    if (reply1) freeReplyObject(reply1);
-    if (reply2) freeReplyObject(reply2);
+    for (int i = 0; i < m; i++) {
+        if (!conns[i]) {
+            continue;
+        }
+        redisReply *incr = NULL;
+        redisReply *wait = NULL;
+        if (redisGetReply(conns[i]->ctx, (void**)&incr) != REDIS_OK || !incr ||
+            redisGetReply(conns[i]->ctx, (void**)&wait) != REDIS_OK || !wait) {
+            ret = -1;
+        } else if (incr->type == REDIS_REPLY_ERROR) {
+            // 分组迁移到了其他节点：更新槽表，本批按失败处理，下一批发往新的节点
+            conn_pool_t *ask = NULL;
+            if (meta->cluster) {
+                cluster_redirect(meta->cluster, incr, &ask);
+            }
+            ret = -1;
+        } else if (!wait_satisfied(wait, local, replicas)) {
+            ret = -1;
+        }
+        if (incr) freeReplyObject(incr);
+        if (wait) freeReplyObject(wait);
+        conn_pool_put(conns[i]);
+    }
 
+    free(pools);
+    free(groups);
+    free(conns);
     return ret;
 }
 
-int redis_meta_get_node(redis_meta_t *meta, uint64_t inode, node_attr_t **result_attr) {
-    redisReply *reply = (redisReply*)redisCommand(meta->ctx, "GET %s%lu", NODE_KEY_PREFIX, inode);
-    if (!reply || reply->type != REDIS_REPLY_STRING) {
-        if (reply) freeReplyObject(reply);
+// 累加一批节点记录的用量
+static int sum_usage(redis_meta_t *meta, redisReply *keys, uint64_t *space, uint64_t *inodes) {
+    if (keys->elements == 0) {
+        return 0;
+    }
+
+    size_t argc = keys->elements + 1;
+    const char **argv = (const char**)malloc(sizeof(char*) * argc);
+    if (!argv) {
         return -1;
     }
+    argv[0] = "MGET";
+    for (size_t i = 0; i < keys->elements; i++) {
+        argv[i + 1] = keys->element[i]->str;
+    }
 
-    node_attr_t *attr = (node_attr_t*)malloc(sizeof(node_attr_t));
-    if (!attr) {
-        freeReplyObject(reply);
+    redisReply *reply = meta_command_argv(meta, 0, (int)argc, argv);
+    free(argv);
+    if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+        if (reply) freeReplyObject(reply);
         return -1;
     }
 
-    // 解析属性字符串
-    char *str = reply->str;
-    sscanf(str, "%lu:%u:%u:%u:%lu:%lu:%lu:%lu:%lu",
-           &attr->inode, &attr->mode, &attr->uid, &attr->gid,
-           &attr->size, &attr->blocks, &attr->atime, &attr->mtime, &attr->ctime);
+    for (size_t i = 0; i < reply->elements; i++) {
+        if (reply->element[i]->type != REDIS_REPLY_STRING) {
+            continue;
+        }
+        node_attr_t attr;
+        parse_attr(reply->element[i]->str, &attr);
+        *space += usage_space(attr.size);
+        (*inodes)++;
+    }
 
     freeReplyObject(reply);
-    *result_attr = attr;
     return 0;
 }
 
-int redis_meta_update_node(redis_meta_t *meta, const node_attr_t *attr) {
-    char attr_str[1024];
-    snprintf(attr_str, sizeof(attr_str),
-             "%lu:%u:%u:%u:%lu:%lu:%lu:%lu:%lu",
-             attr->inode, attr->mode, attr->uid, attr->gid,
-             attr->size, attr->blocks, attr->atime, attr->mtime, attr->ctime);
-
-    redisReply *reply = (redisReply*)redisCommand(meta->ctx, "SET %s%lu %s",
-                                                  NODE_KEY_PREFIX, attr->inode, attr_str);
-    if (!reply || reply->type == REDIS_REPLY_ERROR) {
+// 返回键是否存在，失败返回 -1
+static int key_exists(redis_meta_t *meta, const char *key) {
+    redisReply *reply = meta_command(meta, 0, "EXISTS %s", key);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
         if (reply) freeReplyObject(reply);
         return -1;
     }
+    int exists = reply->integer > 0;
+    freeReplyObject(reply);
+    return exists;
+}
+
+int redis_meta_init_usage(redis_meta_t *meta) {
+    // 集群模式的卷总是由带计数器的版本创建
+    if (meta->cluster) {
+        return 0;
+    }
+
+    int exists = key_exists(meta, USAGE_KEY);
+    if (exists != 0) {
+        return exists < 0 ? -1 : 0;
+    }
+
+    // 新卷由创建根目录开始计数
+    exists = key_exists(meta, LOOKUP_COUNTER_KEY);
+    if (exists != 1) {
+        return exists < 0 ? -1 : 0;
+    }
+
+    // 旧版本创建的卷没有计数器，扫描一次全部节点记录
+    uint64_t space = 0;
+    uint64_t inodes = 0;
+    char cursor[32] = "0";
+    do {
+        redisReply *reply = meta_command(meta, 0, "SCAN %s MATCH %s* COUNT 1000", cursor, NODE_KEY_PREFIX);
+        if (!reply || reply->type != REDIS_REPLY_ARRAY || reply->elements != 2 ||
+            reply->element[1]->type != REDIS_REPLY_ARRAY) {
+            if (reply) freeReplyObject(reply);
+            return -1;
+        }
+        snprintf(cursor, sizeof(cursor), "%s", reply->element[0]->str);
+        int ret = sum_usage(meta, reply->element[1], &space, &inodes);
+        freeReplyObject(reply);
+        if (ret != 0) {
+            return -1;
+        }
+    } while (strcmp(cursor, "0") != 0);
+
+    // HSETNX 保证多个挂载同时初始化时只有一个结果生效
+    tx_begin(meta, 0);
+    meta_append(meta, "HSETNX %s space %lu", USAGE_KEY, space);
+    meta_append(meta, "HSETNX %s inodes %lu", USAGE_KEY, inodes);
+
+    return tx_commit(meta);
+}
+
+uint64_t redis_meta_reserve_inodes(redis_meta_t *meta, uint32_t count) {
+    // 集群模式下 inode 由各分组的计数器分配，且新节点的分组取决于父目录和名字，不支持预留
+    if (meta->cluster || count == 0) {
+        return 0;
+    }
+
+    redisReply *reply = meta_command(meta, 0, "INCRBY %s %u", LOOKUP_COUNTER_KEY, count);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
+        if (reply) freeReplyObject(reply);
+        return 0;
+    }
 
+    uint64_t last = (uint64_t)reply->integer;
     freeReplyObject(reply);
-    return 0;
+    return last - count + 1;
 }
 
-int redis_meta_lookup(redis_meta_t *meta, uint64_t parent, const char *name, uint64_t *inode) {
-    redisReply *reply = (redisReply*)redisCommand(meta->ctx, "HGET %s%lu %s",
-                                                  DIR_KEY_PREFIX, parent, name);
-    if (!reply || reply->type != REDIS_REPLY_STRING) {
+int redis_meta_apply_journal(redis_meta_t *meta, uint64_t id, const meta_journal_op_t *ops,
+                             int count, uint64_t seq, int *conflicts) {
+    if (meta->cluster) {
+        return -1;
+    }
+
+    int *adjust = (int*)malloc(sizeof(int) * (size_t)(count > 0 ? count : 1));
+    if (!adjust) {
+        return -1;
+    }
+
+    // 与 create_node、update_node 相同的命令，整批放在一个事务中，并记录已应用到的序号
+    // 目录项按条件添加：名字已被其他挂载占用（或父目录已被删除）时这次创建被放弃，不覆盖已有目录项，
+    // 该节点之后的属性修改也因节点不存在而放弃
+    tx_begin(meta, 0);
+    for (int i = 0; i < count; i++) {
+        const node_attr_t *attr = ops[i].attr;
+        adjust[i] = -1;
+        if (ops[i].op == META_JOURNAL_CREATE) {
+            char attr_str[1024];
+            format_attr(attr, attr_str, sizeof(attr_str));
+            int dir = S_ISDIR(attr->mode);
+            // 记录中是应用时的属性，已写入的数据随创建一起计入用量
+            dir_usage_t usage = {attr->inode, (int64_t)usage_space(attr->size), dir ? 0 : 1, dir ? 1 : 0};
+            adjust[i] = tx_index(meta);
+            append_new_entry(meta, ops[i].parent, ops[i].name, attr->inode, dir ? 1 : 0, &usage, attr_str, NULL, 1);
+        } else {
+            append_set_node(meta, attr, 1);
+        }
+    }
+    meta_append(meta, "SET %s%lu %lu", JOURNAL_KEY_PREFIX, id, seq);
+    meta_append(meta, "EXEC");
+
+    int n;
+    redisReply **replies = pipe_exec(meta, &n);
+    if (!replies) {
+        free(adjust);
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < n; i++) {
+        if (replies[i]->type == REDIS_REPLY_ERROR) {
+            ret = -1;
+        }
+    }
+    redisReply *exec = replies[n - 1];
+    if (exec->type != REDIS_REPLY_ARRAY) {
+        ret = -1;
+    }
+
+    // 标记被放弃的创建；父目录变大后分片
+    for (int i = 0; ret == 0 && i < count; i++) {
+        long long entries = 0;
+        if (adjust[i] >= 0 && (size_t)adjust[i] < exec->elements &&
+            exec->element[adjust[i]]->type == REDIS_REPLY_INTEGER) {
+            entries = exec->element[adjust[i]]->integer;
+        }
+        int conflict = entries == ADD_ENTRY_EXISTS || entries == ADD_ENTRY_NO_PARENT;
+        if (conflicts) {
+            conflicts[i] = conflict;
+        }
+        if (adjust[i] >= 0 && !conflict) {
+            grow_dir(meta, ops[i].parent, entries);
+        }
+    }
+
+    free_replies(replies, n);
+    free(adjust);
+    return ret;
+}
+
+int redis_meta_journal_applied(redis_meta_t *meta, uint64_t id, uint64_t *seq) {
+    redisReply *reply = meta_command(meta, 0, "GET %s%lu", JOURNAL_KEY_PREFIX, id);
+    if (!reply || (reply->type != REDIS_REPLY_STRING && reply->type != REDIS_REPLY_NIL)) {
         if (reply) freeReplyObject(reply);
         return -1;
     }
 
-    *inode = (uint64_t)atoll(reply->str);
+    *seq = reply->type == REDIS_REPLY_STRING ? strtoull(reply->str, NULL, 10) : 0;
     freeReplyObject(reply);
     return 0;
 }
 
-int redis_meta_readdir(redis_meta_t *meta, uint64_t inode, dir_entry_t **entries, int *count) {
-    redisReply *reply = (redisReply*)redisCommand(meta->ctx, "HGETALL %s%lu", DIR_KEY_PREFIX, inode);
+int redis_meta_forget_journal(redis_meta_t *meta, uint64_t id) {
+    redisReply *reply = meta_command(meta, 0, "DEL %s%lu", JOURNAL_KEY_PREFIX, id);
+    int ret = reply && reply->type == REDIS_REPLY_INTEGER ? 0 : -1;
+    if (reply) freeReplyObject(reply);
+    return ret;
+}
+
+int redis_meta_get_xattrs(redis_meta_t *meta, uint64_t inode, xattr_list_t **list) {
+    redisReply *reply = meta_read(meta, inode, "HGETALL %s%s%lu",
+                                  key_tag(meta, inode), XATTR_KEY_PREFIX, inode);
     if (!reply || reply->type != REDIS_REPLY_ARRAY) {
         if (reply) freeReplyObject(reply);
         return -1;
     }
 
-    *count = reply->elements / 2;
-    dir_entry_t *result = (dir_entry_t*)malloc(sizeof(dir_entry_t) * (*count));
-    if (!result) {
+    size_t len = 0;
+    for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+        len += reply->element[i]->len + 1 + sizeof(uint32_t) + reply->element[i + 1]->len;
+    }
+
+    xattr_list_t *l = (xattr_list_t*)mempool_alloc(sizeof(xattr_list_t) + len);
+    if (!l) {
         freeReplyObject(reply);
         return -1;
     }
 
-    for (size_t i = 0; i < reply->elements; i += 2) {
-        strncpy(result[i/2].name, reply->element[i]->str, sizeof(result[i/2].name) - 1);
-        result[i/2].inode = (uint64_t)atoll(reply->element[i+1]->str);
-
-        // 获取 mode
-        node_attr_t *attr;
-        if (redis_meta_get_node(meta, result[i/2].inode, &attr) == 0) {
-            result[i/2].mode = attr->mode;
-            node_attr_free(attr);
-        }
+    char *p = l->data;
+    for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+        const redisReply *name = reply->element[i];
+        const redisReply *value = reply->element[i + 1];
+        uint32_t vlen = (uint32_t)value->len;
+        memcpy(p, name->str, name->len);
+        p += name->len;
+        *p++ = '\0';
+        memcpy(p, &vlen, sizeof(vlen));
+        p += sizeof(vlen);
+        memcpy(p, value->str, value->len);
+        p += value->len;
     }
+    l->len = len;
 
     freeReplyObject(reply);
-    *entries = result;
+    *list = l;
     return 0;
 }
 
-int redis_meta_unlink(redis_meta_t *meta, uint64_t parent, const char *name) {
-    redisReply *reply = (redisReply*)redisCommand(meta->ctx, "HDEL %s%lu %s",
-                                                  DIR_KEY_PREFIX, parent, name);
-    if (!reply || reply->type == REDIS_REPLY_ERROR) {
+int redis_meta_set_xattr(redis_meta_t *meta, uint64_t inode, const char *name,
+                         const void *value, size_t size, int flags) {
+    redisReply *reply = meta_write(meta, group_of(meta, inode), "EVALSHA %s 1 %s%s%lu %s %b %d",
+                                   meta->script_sha[SCRIPT_SET_XATTR], key_tag(meta, inode), XATTR_KEY_PREFIX, inode,
+                                   name, value ? value : "", size, flags);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
         if (reply) freeReplyObject(reply);
         return -1;
     }
 
+    int ret = reply->integer == 0 ? 0 : 1;
     freeReplyObject(reply);
-    return 0;
+    return ret;
 }
 
-int redis_meta_delete_node(redis_meta_t *meta, uint64_t inode) {
-    redisReply *reply = (redisReply*)redisCommand(meta->ctx, "DEL %s%lu", NODE_KEY_PREFIX, inode);
-    if (!reply || reply->type == REDIS_REPLY_ERROR) {
+int redis_meta_remove_xattr(redis_meta_t *meta, uint64_t inode, const char *name) {
+    redisReply *reply = meta_write(meta, group_of(meta, inode), "HDEL %s%s%lu %s",
+                                   key_tag(meta, inode), XATTR_KEY_PREFIX, inode, name);
+    if (!reply || reply->type != REDIS_REPLY_INTEGER) {
         if (reply) freeReplyObject(reply);
         return -1;
     }
 
+    int ret = reply->integer > 0 ? 0 : 1;
     freeReplyObject(reply);
-    return 0;
+    return ret;
 }
 
-int redis_meta_rename(redis_meta_t *meta, uint64_t old_parent, const char *old_name,
-                     uint64_t new_parent, const char *new_name) {
-    uint64_t inode;
-    if (redis_meta_lookup(meta, old_parent, old_name, &inode) != 0) {
-        return -1;
+const char* xattr_list_find(const xattr_list_t *list, const char *name, size_t *len) {
+    const char *p = list->data;
+    const char *end = list->data + list->len;
+    while (p < end) {
+        size_t nlen = strlen(p);
+        uint32_t vlen;
+        memcpy(&vlen, p + nlen + 1, sizeof(vlen));
+        const char *value = p + nlen + 1 + sizeof(vlen);
+        if (strcmp(p, name) == 0) {
+            *len = vlen;
+            return value;
+        }
+        p = value + vlen;
     }
+    return NULL;
+}
 
-    // 使用事务
-    redisAppendCommand(meta->ctx, "HDEL %s%lu %s", DIR_KEY_PREFIX, old_parent, old_name);
-    redisAppendCommand(meta->ctx, "HSET %s%lu %s %lu", DIR_KEY_PREFIX, new_parent, new_name, inode);
-
-    redisReply *reply1, *reply2;
-    redisGetReply(meta->ctx, (void**)&reply1);
-    redisGetReply(meta->ctx, (void**)&reply2);
+size_t xattr_list_names(const xattr_list_t *list, char *buf, size_t size) {
+    size_t total = 0;
+    const char *p = list->data;
+    const char *end = list->data + list->len;
+    while (p < end) {
+        size_t nlen = strlen(p) + 1;
+        uint32_t vlen;
+        memcpy(&vlen, p + nlen, sizeof(vlen));
+        total += nlen;
+        p += nlen + sizeof(vlen) + vlen;
+    }
+    if (total > size) {
+        return total;
+    }
 
-    int ret = -1;
-    if (reply1 && reply1->type != REDIS_REPLY_ERROR &&
-        reply2 && reply2->type != REDIS_REPLY_ERROR) {
-        ret = 0;
+    char *out = buf;
+    p = list->data;
+    while (p < end) {
+        size_t nlen = strlen(p) + 1;
+        uint32_t vlen;
+        memcpy(&vlen, p + nlen, sizeof(vlen));
+        memcpy(out, p, nlen);
+        out += nlen;
+        p += nlen + sizeof(vlen) + vlen;
     }
+    return total;
+}
 
-    if (reply1) freeReplyObject(reply1);
-    if (reply2) freeReplyObject(reply2);
+void node_attr_format(const node_attr_t *attr, char *buf, size_t len) {
+    format_attr(attr, buf, len);
+}
 
-    return ret;
+void node_attr_parse(const char *str, node_attr_t *attr) {
+    parse_attr(str, attr);
+}
+
+node_attr_t* node_attr_alloc(void) {
+    return (node_attr_t*)mempool_alloc(sizeof(node_attr_t));
 }
 
 void node_attr_free(node_attr_t *attr) {
-    if (attr) {
-        free(attr);
-    }
+    mempool_free(attr);
+}
+
+void xattr_list_free(xattr_list_t *list) {
+    mempool_free(list);
 }
 
 void dir_entries_free(dir_entry_t *entries, int count) {
@@ -1,12 +1,35 @@
+#define _GNU_SOURCE
 #include "storage.h"
+#include "dedup.h"
+#include "mempool.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <dirent.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+// 数据文件路径的缓冲区大小：base_dir 加上 "/data_<inode>_<index>"
+#define DATA_PATH_SIZE (sizeof(((storage_t*)0)->base_dir) + 48)
+
+// 位于容量层的 inode，不在表中即位于快速层
+struct tier_entry {
+    uint64_t inode;
+    struct tier_entry *next;
+};
 
 storage_t* storage_new(const char *base_dir) {
     if (!base_dir) {
@@ -19,6 +42,20 @@ storage_t* storage_new(const char *base_dir) {
     }
 
     strncpy(storage->base_dir, base_dir, sizeof(storage->base_dir) - 1);
+    storage->cache = NULL;
+    storage->chunk_size = 0;
+    storage->compressed = 0;
+    storage->codec = STORAGE_CODEC_NONE;
+    storage->dedup = NULL;
+    for (int i = 0; i < STORAGE_LOCK_STRIPES; i++) {
+        pthread_rwlock_init(&storage->locks[i], NULL);
+        pthread_rwlock_init(&storage->tier_locks[i], NULL);
+        storage->tier_migrating[i] = 0;
+        storage->tier_gen[i] = 0;
+    }
+    storage->cold_dir[0] = '\0';
+    pthread_rwlock_init(&storage->tier_map_lock, NULL);
+    storage->tier_map = NULL;
 
     // 创建数据目录
     if (mkdir(base_dir, 0755) != 0 && errno != EEXIST) {
@@ -32,163 +69,2309 @@ storage_t* storage_new(const char *base_dir) {
 
 void storage_free(storage_t *storage) {
     if (storage) {
+        block_cache_free(storage->cache);
+        dedup_free(storage->dedup);
+        for (int i = 0; i < STORAGE_LOCK_STRIPES; i++) {
+            pthread_rwlock_destroy(&storage->locks[i]);
+            pthread_rwlock_destroy(&storage->tier_locks[i]);
+        }
+        if (storage->tier_map) {
+            for (int i = 0; i < STORAGE_TIER_BUCKETS; i++) {
+                while (storage->tier_map[i]) {
+                    struct tier_entry *entry = storage->tier_map[i];
+                    storage->tier_map[i] = entry->next;
+                    free(entry);
+                }
+            }
+            free(storage->tier_map);
+        }
+        pthread_rwlock_destroy(&storage->tier_map_lock);
         free(storage);
     }
 }
 
-static char* get_data_path(storage_t *storage, uint64_t inode) {
-    char *path = (char*)malloc(strlen(storage->base_dir) + 32);
-    if (!path) {
-        return NULL;
+int storage_enable_cache(storage_t *storage, size_t capacity) {
+    block_cache_t *cache = block_cache_new(capacity, BLOCK_CACHE_DEFAULT_BLOCK_SIZE);
+    if (!cache) {
+        return -1;
     }
-    sprintf(path, "%s/data_%lu", storage->base_dir, inode);
-    return path;
+
+    block_cache_free(storage->cache);
+    storage->cache = cache;
+    return 0;
 }
 
-ssize_t storage_write(storage_t *storage, uint64_t inode, const void *data, size_t size, off_t offset) {
-    char *path = get_data_path(storage, inode);
-    if (!path) {
+void storage_set_chunk_size(storage_t *storage, uint64_t chunk_size) {
+    storage->chunk_size = chunk_size;
+}
+
+int storage_enable_dedup(storage_t *storage, struct dedup *dedup) {
+    if (!dedup || storage->chunk_size > 0 || storage->compressed || storage->cold_dir[0]) {
         return -1;
     }
 
-    int fd = open(path, O_CREAT | O_WRONLY, 0644);
-    free(path);
+    dedup_free(storage->dedup);
+    storage->dedup = dedup;
+    return 0;
+}
 
-    if (fd < 0) {
-        perror("Failed to open file for writing");
+int storage_codec_available(int codec) {
+    switch (codec) {
+        case STORAGE_CODEC_NONE:
+            return 1;
+#ifdef HAVE_LZ4
+        case STORAGE_CODEC_LZ4:
+            return 1;
+#endif
+#ifdef HAVE_ZSTD
+        case STORAGE_CODEC_ZSTD:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+int storage_enable_compression(storage_t *storage, int codec) {
+    if (!storage_codec_available(codec)) {
         return -1;
     }
 
-    ssize_t written = pwrite(fd, data, size, offset);
-    close(fd);
+    storage->compressed = 1;
+    storage->codec = codec;
+    return 0;
+}
 
-    return written;
+int storage_enable_tiering(storage_t *storage, const char *cold_dir) {
+    if (!cold_dir || !cold_dir[0] || storage->dedup) {
+        return -1;
+    }
+    if (strlen(cold_dir) >= sizeof(storage->cold_dir)) {
+        return -1;
+    }
+
+    if (mkdir(cold_dir, 0755) != 0 && errno != EEXIST) {
+        perror("Failed to create cold data directory");
+        return -1;
+    }
+
+    storage->tier_map = (struct tier_entry**)calloc(STORAGE_TIER_BUCKETS, sizeof(struct tier_entry*));
+    if (!storage->tier_map) {
+        return -1;
+    }
+    strcpy(storage->cold_dir, cold_dir);
+    return 0;
 }
 
-ssize_t storage_read(storage_t *storage, uint64_t inode, void *buf, size_t size, off_t offset) {
-    char *path = get_data_path(storage, inode);
-    if (!path) {
+void storage_set_tier(storage_t *storage, uint64_t inode, int tier) {
+    if (!storage->cold_dir[0]) {
+        return;
+    }
+
+    pthread_rwlock_wrlock(&storage->tier_map_lock);
+    struct tier_entry **link = &storage->tier_map[inode % STORAGE_TIER_BUCKETS];
+    while (*link && (*link)->inode != inode) {
+        link = &(*link)->next;
+    }
+    if (tier == STORAGE_TIER_COLD && !*link) {
+        struct tier_entry *entry = (struct tier_entry*)malloc(sizeof(struct tier_entry));
+        if (entry) {
+            // 内存不足时不记录，打开时会从快速层回退到容量层
+            entry->inode = inode;
+            entry->next = NULL;
+            *link = entry;
+        }
+    } else if (tier != STORAGE_TIER_COLD && *link) {
+        struct tier_entry *entry = *link;
+        *link = entry->next;
+        free(entry);
+    }
+    pthread_rwlock_unlock(&storage->tier_map_lock);
+}
+
+int storage_get_tier(storage_t *storage, uint64_t inode) {
+    if (!storage->cold_dir[0]) {
+        return STORAGE_TIER_HOT;
+    }
+
+    pthread_rwlock_rdlock(&storage->tier_map_lock);
+    const struct tier_entry *entry = storage->tier_map[inode % STORAGE_TIER_BUCKETS];
+    while (entry && entry->inode != inode) {
+        entry = entry->next;
+    }
+    pthread_rwlock_unlock(&storage->tier_map_lock);
+    return entry ? STORAGE_TIER_COLD : STORAGE_TIER_HOT;
+}
+
+static const char* tier_dir(const storage_t *storage, int tier) {
+    return tier == STORAGE_TIER_COLD ? storage->cold_dir : storage->base_dir;
+}
+
+static int tier_count(const storage_t *storage) {
+    return storage->cold_dir[0] ? 2 : 1;
+}
+
+// 分层时每个存储操作在整个过程中持有 inode 的共享锁，迁移换入目标层时持有独占锁
+static void tier_enter(storage_t *storage, uint64_t inode, int write) {
+    if (!storage->cold_dir[0]) {
+        return;
+    }
+    pthread_rwlock_t *lock = &storage->tier_locks[inode % STORAGE_LOCK_STRIPES];
+    if (write) {
+        pthread_rwlock_wrlock(lock);
+    } else {
+        pthread_rwlock_rdlock(lock);
+    }
+}
+
+static void tier_leave(storage_t *storage, uint64_t inode) {
+    if (!storage->cold_dir[0]) {
+        return;
+    }
+    pthread_rwlock_unlock(&storage->tier_locks[inode % STORAGE_LOCK_STRIPES]);
+}
+
+// 修改数据后、释放共享锁前调用：文件正在迁移时增加写入代数，迁移换入前发现后放弃。
+// 在修改完成后检查，未看到迁移标记的修改一定先于迁移的复制完成
+static void tier_modified(storage_t *storage, uint64_t inode) {
+    if (!storage->cold_dir[0]) {
+        return;
+    }
+    size_t stripe = inode % STORAGE_LOCK_STRIPES;
+    if (__atomic_load_n(&storage->tier_migrating[stripe], __ATOMIC_SEQ_CST) == inode) {
+        __atomic_add_fetch(&storage->tier_gen[stripe], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+// 首个后端文件（单文件布局为 data_<inode>，分块布局为第 0 块）作为跨挂载迁移的围栏
+static void anchor_path_in(const storage_t *storage, const char *dir, uint64_t inode, char *path) {
+    if (storage->chunk_size > 0) {
+        snprintf(path, DATA_PATH_SIZE, "%s/data_%lu_0", dir, inode);
+    } else {
+        snprintf(path, DATA_PATH_SIZE, "%s/data_%lu", dir, inode);
+    }
+}
+
+// 其他挂载的迁移换入时持有首个后端文件的排他 flock，修改数据的操作在整个过程中持有它的共享 flock：
+// 换入等待正在进行的修改结束；换入后才取得锁的修改发现文件已被删除（链接数为 0），改到另一层重新取锁。
+// 返回持锁的文件描述符；还没有数据文件（没有可迁移的数据）或不支持 flock 时返回 -1
+static int tier_fence(storage_t *storage, uint64_t inode) {
+    int recorded = storage_get_tier(storage, inode);
+    for (int tier = recorded; ; tier = !tier) {
+        char path[DATA_PATH_SIZE];
+        anchor_path_in(storage, tier_dir(storage, tier), inode, path);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0 && errno == ENOENT) {
+            tier = !tier;
+            anchor_path_in(storage, tier_dir(storage, tier), inode, path);
+            fd = open(path, O_RDONLY);
+        }
+        if (fd < 0) {
+            return -1;
+        }
+
+        struct stat st;
+        if (flock(fd, LOCK_SH) != 0 || fstat(fd, &st) != 0) {
+            close(fd);
+            return -1;
+        }
+        if (st.st_nlink > 0) {
+            if (tier != recorded) {
+                storage_set_tier(storage, inode, tier);
+            }
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+// 修改数据的操作：持有本挂载的分层锁和跨挂载的围栏，返回交给 tier_leave_modify 的围栏
+static int tier_enter_modify(storage_t *storage, uint64_t inode) {
+    if (!storage->cold_dir[0]) {
         return -1;
     }
+    tier_enter(storage, inode, 0);
+    return tier_fence(storage, inode);
+}
+
+static void tier_leave_modify(storage_t *storage, uint64_t inode, int fence) {
+    if (!storage->cold_dir[0]) {
+        return;
+    }
+    tier_modified(storage, inode);
+    if (fence >= 0) {
+        close(fence);
+    }
+    tier_leave(storage, inode);
+}
 
-    int fd = open(path, O_RDONLY);
-    free(path);
+// 写入后失效受影响的缓存块
+// 文件被扩展时，原末尾的短块也必须失效，因此从 min(offset, old_size) 开始
+static void invalidate_written(storage_t *storage, uint64_t inode, uint64_t old_size,
+                               uint64_t offset, uint64_t size) {
+    uint64_t start = offset < old_size ? offset : old_size;
+    uint64_t end = offset + size;
+    size_t block_size = block_cache_block_size(storage->cache);
 
-    if (fd < 0) {
-        if (errno == ENOENT) {
-            // 文件不存在，返回 0
+    // 范围过大时直接失效整个文件，避免逐块查找
+    if (end > start && (end - start) / block_size > 1024) {
+        block_cache_invalidate_inode(storage->cache, inode);
+    } else {
+        block_cache_invalidate_range(storage->cache, inode, start, end - start);
+    }
+}
+
+// 数据文件路径写入调用者栈上的缓冲区，不分配内存
+static void data_path_in(const char *dir, uint64_t inode, char *path) {
+    snprintf(path, DATA_PATH_SIZE, "%s/data_%lu", dir, inode);
+}
+
+// 分块布局下第 index 块的路径
+static void chunk_path_in(const char *dir, uint64_t inode, uint64_t index, char *path) {
+    snprintf(path, DATA_PATH_SIZE, "%s/data_%lu_%lu", dir, inode, index);
+}
+
+// 数据文件在本挂载记录的层中的路径
+static void get_data_path(storage_t *storage, uint64_t inode, char *path) {
+    data_path_in(tier_dir(storage, storage_get_tier(storage, inode)), inode, path);
+}
+
+static void get_chunk_path(storage_t *storage, uint64_t inode, uint64_t index, char *path) {
+    chunk_path_in(tier_dir(storage, storage_get_tier(storage, inode)), inode, index, path);
+}
+
+// 压缩文件的读改写需要互斥，按 (inode, 块号) 选择条带锁；未压缩时不加锁
+static void lock_data(storage_t *storage, uint64_t inode, uint64_t index, int write) {
+    if (!storage->compressed) {
+        return;
+    }
+    pthread_rwlock_t *lock = &storage->locks[(inode * 31 + index) % STORAGE_LOCK_STRIPES];
+    if (write) {
+        pthread_rwlock_wrlock(lock);
+    } else {
+        pthread_rwlock_rdlock(lock);
+    }
+}
+
+static void unlock_data(storage_t *storage, uint64_t inode, uint64_t index) {
+    if (!storage->compressed) {
+        return;
+    }
+    pthread_rwlock_unlock(&storage->locks[(inode * 31 + index) % STORAGE_LOCK_STRIPES]);
+}
+
+// ---------------------------------------------------------------------------
+// 压缩算法
+// ---------------------------------------------------------------------------
+
+// 压缩一块，返回压缩后长度；不可压缩或不支持时返回 0
+static size_t codec_compress(int codec, const char *src, size_t len, char *dst, size_t cap) {
+    switch (codec) {
+#ifdef HAVE_LZ4
+        case STORAGE_CODEC_LZ4: {
+            int n = LZ4_compress_default(src, dst, (int)len, (int)cap);
+            return n > 0 ? (size_t)n : 0;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case STORAGE_CODEC_ZSTD: {
+            size_t n = ZSTD_compress(dst, cap, src, len, 1);
+            return ZSTD_isError(n) ? 0 : n;
+        }
+#endif
+        default:
+            (void)src;
+            (void)len;
+            (void)dst;
+            (void)cap;
+            return 0;
+    }
+}
+
+// 解压一块到 dst（cap 字节），成功返回 0
+static int codec_decompress(int codec, const char *src, size_t len, char *dst, size_t cap) {
+    switch (codec) {
+#ifdef HAVE_LZ4
+        case STORAGE_CODEC_LZ4: {
+            int n = LZ4_decompress_safe(src, dst, (int)len, (int)cap);
+            if (n < 0) {
+                return -1;
+            }
+            memset(dst + n, 0, cap - (size_t)n);
             return 0;
         }
-        perror("Failed to open file for reading");
+#endif
+#ifdef HAVE_ZSTD
+        case STORAGE_CODEC_ZSTD: {
+            size_t n = ZSTD_decompress(dst, cap, src, len);
+            if (ZSTD_isError(n)) {
+                return -1;
+            }
+            memset(dst + n, 0, cap - n);
+            return 0;
+        }
+#endif
+        default:
+            (void)src;
+            (void)len;
+            (void)dst;
+            (void)cap;
+            fprintf(stderr, "Unsupported compression codec %d\n", codec);
+            return -1;
+    }
+}
+
+static int is_zero(const char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// 后端文件：原始文件或分块压缩文件
+//
+// 压缩格式：数据文件中第 i 块固定占用 [i * B, (i + 1) * B) 槽位，只写入压缩后的字节，
+// 槽位其余部分为空洞；索引文件 <path>.idx 以 8 字节逻辑大小开头，之后每块 4 字节：
+// 高 8 位为压缩算法，低 24 位为存储长度，0 表示全零块
+// ---------------------------------------------------------------------------
+
+#define INDEX_HEADER_SIZE 8
+#define ENTRY_LEN(e)   ((size_t)((e) & 0xffffffu))
+#define ENTRY_CODEC(e) ((int)((e) >> 24))
+#define MAKE_ENTRY(codec, len) (((uint32_t)(codec) << 24) | (uint32_t)(len))
+
+typedef struct {
+    int fd;     // 数据文件
+    int ifd;    // 压缩索引（未压缩时为 -1）
+} bfile_t;
+
+static void index_path(const char *path, char *buf, size_t len) {
+    snprintf(buf, len, "%s.idx", path);
+}
+
+// 打开后端文件，失败返回 -1 并保留 errno
+static int bfile_open_path(storage_t *storage, const char *path, int writable, int create, bfile_t *bf) {
+    int flags = writable ? O_RDWR : O_RDONLY;
+    if (create) {
+        flags |= O_CREAT;
+    }
+
+    bf->ifd = -1;
+    bf->fd = open(path, flags, 0644);
+    if (bf->fd < 0) {
         return -1;
     }
 
-    ssize_t nread = pread(fd, buf, size, offset);
-    close(fd);
+    if (storage->compressed) {
+        char ipath[PATH_MAX];
+        index_path(path, ipath, sizeof(ipath));
+        bf->ifd = open(ipath, flags, 0644);
+        if (bf->ifd < 0) {
+            int err = errno;
+            close(bf->fd);
+            errno = err;
+            return -1;
+        }
+    }
 
-    return nread;
+    return 0;
 }
 
-int storage_delete(storage_t *storage, uint64_t inode) {
-    char *path = get_data_path(storage, inode);
-    if (!path) {
+// 分层时数据文件不在记录的层，可能是其他挂载迁移了它：到另一层查找并更正记录，
+// 两层都没有时才在记录的层创建
+static int bfile_open(storage_t *storage, const char *path, int writable, int create, bfile_t *bf) {
+    if (!storage->cold_dir[0]) {
+        return bfile_open_path(storage, path, writable, create, bf);
+    }
+
+    if (bfile_open_path(storage, path, writable, 0, bf) == 0) {
+        return 0;
+    }
+    if (errno != ENOENT) {
+        return -1;
+    }
+
+    // 路径为 <层目录>/<文件名>
+    const char *name = strrchr(path, '/');
+    size_t dir_len = name ? (size_t)(name - path) : 0;
+    int tier = strlen(storage->base_dir) == dir_len && strncmp(path, storage->base_dir, dir_len) == 0 ?
+               STORAGE_TIER_COLD : STORAGE_TIER_HOT;
+    uint64_t inode;
+    if (name && sscanf(name + 1, "data_%lu", &inode) == 1) {
+        char other[DATA_PATH_SIZE];
+        snprintf(other, sizeof(other), "%s%s", tier_dir(storage, tier), name);
+        if (bfile_open_path(storage, other, writable, 0, bf) == 0) {
+            storage_set_tier(storage, inode, tier);
+            return 0;
+        }
+        if (errno != ENOENT) {
+            return -1;
+        }
+    }
+
+    if (!create) {
+        errno = ENOENT;
         return -1;
     }
+    return bfile_open_path(storage, path, writable, 1, bf);
+}
+
+static void bfile_close(bfile_t *bf) {
+    close(bf->fd);
+    if (bf->ifd >= 0) {
+        close(bf->ifd);
+    }
+}
 
+static int bfile_unlink(storage_t *storage, const char *path) {
     int ret = unlink(path);
-    free(path);
+    int err = errno;
+
+    if (storage->compressed) {
+        char ipath[PATH_MAX];
+        index_path(path, ipath, sizeof(ipath));
+        if (unlink(ipath) != 0 && errno != ENOENT && ret == 0) {
+            return -1;
+        }
+    }
+
+    errno = err;
+    return ret;
+}
 
-    if (ret != 0 && errno != ENOENT) {
-        perror("Failed to delete file");
+static int cfile_size(const bfile_t *bf, uint64_t *size) {
+    uint64_t value = 0;
+    ssize_t n = pread(bf->ifd, &value, sizeof(value), 0);
+    if (n < 0) {
         return -1;
     }
+    *size = (n == (ssize_t)sizeof(value)) ? value : 0;
+    return 0;
+}
+
+static int cfile_set_size(const bfile_t *bf, uint64_t size) {
+    return pwrite(bf->ifd, &size, sizeof(size), 0) == (ssize_t)sizeof(size) ? 0 : -1;
+}
 
+static int cfile_entry(const bfile_t *bf, uint64_t index, uint32_t *entry) {
+    *entry = 0;
+    ssize_t n = pread(bf->ifd, entry, sizeof(*entry),
+                      (off_t)(INDEX_HEADER_SIZE + index * sizeof(*entry)));
+    if (n < 0) {
+        return -1;
+    }
+    if (n != (ssize_t)sizeof(*entry)) {
+        *entry = 0;
+    }
     return 0;
 }
 
-int storage_truncate(storage_t *storage, uint64_t inode, uint64_t size) {
-    char *path = get_data_path(storage, inode);
-    if (!path) {
+// 读取并解压一块到 block（B 字节，空洞补零）
+static int cfile_load(const bfile_t *bf, uint64_t index, uint32_t entry, char *block, char *scratch) {
+    size_t len = ENTRY_LEN(entry);
+    int codec = ENTRY_CODEC(entry);
+    if (len == 0) {
+        memset(block, 0, STORAGE_COMPRESS_BLOCK);
+        return 0;
+    }
+
+    char *dst = codec == STORAGE_CODEC_NONE ? block : scratch;
+    if (pread(bf->fd, dst, len, (off_t)(index * STORAGE_COMPRESS_BLOCK)) != (ssize_t)len) {
         return -1;
     }
 
-    // 如果文件不存在，创建空文件
-    if (access(path, F_OK) != 0) {
-        int fd = open(path, O_CREAT | O_WRONLY, 0644);
-        free(path);
-        if (fd < 0) {
-            perror("Failed to create file");
+    if (codec == STORAGE_CODEC_NONE) {
+        memset(block + len, 0, STORAGE_COMPRESS_BLOCK - len);
+        return 0;
+    }
+    return codec_decompress(codec, scratch, len, block, STORAGE_COMPRESS_BLOCK);
+}
+
+// 压缩并写入一块，old_entry 为原索引项，用于释放槽位中不再使用的部分
+static int cfile_store(storage_t *storage, const bfile_t *bf, uint64_t index, uint32_t old_entry,
+                       const char *block, char *scratch) {
+    size_t len = 0;
+    int codec = STORAGE_CODEC_NONE;
+    off_t slot = (off_t)(index * STORAGE_COMPRESS_BLOCK);
+
+    // 全零块只记录为空洞
+    if (!is_zero(block, STORAGE_COMPRESS_BLOCK)) {
+        const char *src = block;
+        len = codec_compress(storage->codec, block, STORAGE_COMPRESS_BLOCK, scratch, STORAGE_COMPRESS_BLOCK);
+        if (len > 0 && len < STORAGE_COMPRESS_BLOCK) {
+            codec = storage->codec;
+            src = scratch;
+        } else {
+            // 不可压缩时原样存储，去掉末尾的零
+            len = STORAGE_COMPRESS_BLOCK;
+            while (block[len - 1] == 0) {
+                len--;
+            }
+        }
+
+        if (pwrite(bf->fd, src, len, slot) != (ssize_t)len) {
             return -1;
         }
-        close(fd);
-    } else {
-        free(path);
     }
 
-    // 重新获取路径（可能在上面被释放）
-    path = get_data_path(storage, inode);
-    if (!path) {
-        return -1;
+    size_t old_len = ENTRY_LEN(old_entry);
+    if (old_len > len) {
+        // 打洞失败（文件系统不支持）只影响空间占用
+        fallocate(bf->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  slot + (off_t)len, (off_t)(old_len - len));
     }
 
-    int ret = truncate(path, (off_t)size);
-    free(path);
+    uint32_t entry = MAKE_ENTRY(codec, len);
+    ssize_t n = pwrite(bf->ifd, &entry, sizeof(entry),
+                       (off_t)(INDEX_HEADER_SIZE + index * sizeof(entry)));
+    return n == (ssize_t)sizeof(entry) ? 0 : -1;
+}
 
-    if (ret != 0) {
-        perror("Failed to truncate file");
+static ssize_t cfile_pread(const bfile_t *bf, void *buf, size_t size, uint64_t offset) {
+    uint64_t file_size;
+    if (cfile_size(bf, &file_size) != 0) {
+        return -1;
+    }
+    if (offset >= file_size) {
+        return 0;
+    }
+    if (size > file_size - offset) {
+        size = (size_t)(file_size - offset);
+    }
+
+    char *block = (char*)mempool_scratch(MEMPOOL_SCRATCH_COMPRESS, 2 * STORAGE_COMPRESS_BLOCK);
+    if (!block) {
         return -1;
     }
+    char *scratch = block + STORAGE_COMPRESS_BLOCK;
 
-    return 0;
+    char *dst = (char*)buf;
+    size_t total = 0;
+    while (total < size) {
+        uint64_t pos = offset + total;
+        uint64_t index = pos / STORAGE_COMPRESS_BLOCK;
+        size_t in_block = (size_t)(pos % STORAGE_COMPRESS_BLOCK);
+        size_t n = STORAGE_COMPRESS_BLOCK - in_block;
+        if (n > size - total) {
+            n = size - total;
+        }
+
+        uint32_t entry;
+        if (cfile_entry(bf, index, &entry) != 0 ||
+            cfile_load(bf, index, entry, block, scratch) != 0) {
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        memcpy(dst + total, block + in_block, n);
+        total += n;
+    }
+
+    return (ssize_t)total;
 }
 
-int storage_sync(storage_t *storage, uint64_t inode) {
-    char *path = get_data_path(storage, inode);
-    if (!path) {
+static ssize_t cfile_pwrite(storage_t *storage, const bfile_t *bf, const void *data, size_t size, uint64_t offset) {
+    uint64_t file_size;
+    if (cfile_size(bf, &file_size) != 0) {
         return -1;
     }
 
-    int fd = open(path, O_RDONLY);
-    free(path);
+    char *block = (char*)mempool_scratch(MEMPOOL_SCRATCH_COMPRESS, 2 * STORAGE_COMPRESS_BLOCK);
+    if (!block) {
+        return -1;
+    }
+    char *scratch = block + STORAGE_COMPRESS_BLOCK;
 
-    if (fd < 0) {
-        if (errno == ENOENT) {
-            return 0;
+    const char *src = (const char*)data;
+    size_t total = 0;
+    while (total < size) {
+        uint64_t pos = offset + total;
+        uint64_t index = pos / STORAGE_COMPRESS_BLOCK;
+        size_t in_block = (size_t)(pos % STORAGE_COMPRESS_BLOCK);
+        size_t n = STORAGE_COMPRESS_BLOCK - in_block;
+        if (n > size - total) {
+            n = size - total;
         }
-        perror("Failed to open file for sync");
+
+        // 整块覆盖无需读取原数据
+        uint32_t entry;
+        if (cfile_entry(bf, index, &entry) != 0 ||
+            (n < STORAGE_COMPRESS_BLOCK && cfile_load(bf, index, entry, block, scratch) != 0)) {
+            break;
+        }
+        memcpy(block + in_block, src + total, n);
+
+        if (cfile_store(storage, bf, index, entry, block, scratch) != 0) {
+            break;
+        }
+        total += n;
+    }
+
+    if (offset + total > file_size && cfile_set_size(bf, offset + total) != 0) {
         return -1;
     }
 
-    int ret = fsync(fd);
-    close(fd);
+    return total > 0 || size == 0 ? (ssize_t)total : -1;
+}
 
-    if (ret != 0) {
-        perror("Failed to sync file");
+static int cfile_truncate(storage_t *storage, const bfile_t *bf, uint64_t size) {
+    uint64_t file_size;
+    if (cfile_size(bf, &file_size) != 0) {
         return -1;
     }
 
+    if (size < file_size) {
+        uint64_t keep = size / STORAGE_COMPRESS_BLOCK;
+        size_t in_block = (size_t)(size % STORAGE_COMPRESS_BLOCK);
+
+        // 最后一块的尾部清零，之后扩展时读到的是零
+        if (in_block > 0) {
+            char *block = (char*)mempool_scratch(MEMPOOL_SCRATCH_COMPRESS, 2 * STORAGE_COMPRESS_BLOCK);
+            if (!block) {
+                return -1;
+            }
+            uint32_t entry;
+            int ret = -1;
+            if (cfile_entry(bf, keep, &entry) == 0 &&
+                cfile_load(bf, keep, entry, block, block + STORAGE_COMPRESS_BLOCK) == 0) {
+                memset(block + in_block, 0, STORAGE_COMPRESS_BLOCK - in_block);
+                ret = cfile_store(storage, bf, keep, entry, block, block + STORAGE_COMPRESS_BLOCK);
+            }
+            if (ret != 0) {
+                return -1;
+            }
+            keep++;
+        }
+
+        if (ftruncate(bf->fd, (off_t)(keep * STORAGE_COMPRESS_BLOCK)) != 0 ||
+            ftruncate(bf->ifd, (off_t)(INDEX_HEADER_SIZE + keep * sizeof(uint32_t))) != 0) {
+            return -1;
+        }
+    }
+
+    return cfile_set_size(bf, size);
+}
+
+static ssize_t bfile_pread(storage_t *storage, const bfile_t *bf, void *buf, size_t size, uint64_t offset) {
+    if (storage->compressed) {
+        return cfile_pread(bf, buf, size, offset);
+    }
+    return pread(bf->fd, buf, size, (off_t)offset);
+}
+
+static ssize_t bfile_pwrite(storage_t *storage, const bfile_t *bf, const void *data, size_t size, uint64_t offset) {
+    if (storage->compressed) {
+        return cfile_pwrite(storage, bf, data, size, offset);
+    }
+    return pwrite(bf->fd, data, size, (off_t)offset);
+}
+
+static int bfile_size(storage_t *storage, const bfile_t *bf, uint64_t *size) {
+    if (storage->compressed) {
+        return cfile_size(bf, size);
+    }
+
+    struct stat st;
+    if (fstat(bf->fd, &st) != 0) {
+        return -1;
+    }
+    *size = (uint64_t)st.st_size;
     return 0;
 }
 
-int storage_get_size(storage_t *storage, uint64_t inode, int64_t *size) {
-    char *path = get_data_path(storage, inode);
-    if (!path) {
+static int bfile_truncate(storage_t *storage, const bfile_t *bf, uint64_t size) {
+    if (storage->compressed) {
+        return cfile_truncate(storage, bf, size);
+    }
+    return ftruncate(bf->fd, (off_t)size);
+}
+
+// 按 mode 同步数据文件和索引文件：
+// START 只发起回写不等待，DATA 为 fdatasync（不等待与读取数据无关的元数据，如时间戳），FULL 为 fsync
+static int fd_sync(int fd, int mode) {
+    switch (mode) {
+        case STORAGE_SYNC_START:
+            return sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+        case STORAGE_SYNC_DATA:
+            return fdatasync(fd);
+        default:
+            return fsync(fd);
+    }
+}
+
+static int bfile_sync(const bfile_t *bf, int mode) {
+    if (fd_sync(bf->fd, mode) != 0) {
+        return -1;
+    }
+    if (bf->ifd >= 0 && fd_sync(bf->ifd, mode) != 0) {
         return -1;
     }
+    return 0;
+}
 
-    struct stat st;
-    int ret = stat(path, &st);
-    free(path);
+// ---------------------------------------------------------------------------
+// 单文件布局：每个文件对应一个 data_<inode>
+// ---------------------------------------------------------------------------
+
+static ssize_t file_pwrite(storage_t *storage, uint64_t inode, const void *data, size_t size, off_t offset) {
+    char path[DATA_PATH_SIZE];
+    get_data_path(storage, inode, path);
+
+    bfile_t bf;
+    int ret = bfile_open(storage, path, 1, 1, &bf);
 
     if (ret != 0) {
-        if (errno == ENOENT) {
-            *size = 0;
-            return 0;
-        }
-        perror("Failed to stat file");
+        perror("Failed to open file for writing");
         return -1;
     }
 
-    *size = st.st_size;
-    return 0;
+    lock_data(storage, inode, 0, 1);
+
+    uint64_t old_size = 0;
+    if (storage->cache) {
+        bfile_size(storage, &bf, &old_size);
+    }
+
+    ssize_t written = bfile_pwrite(storage, &bf, data, size, (uint64_t)offset);
+
+    unlock_data(storage, inode, 0);
+    bfile_close(&bf);
+
+    if (storage->cache) {
+        invalidate_written(storage, inode, old_size, (uint64_t)offset, size);
+    }
+
+    return written;
+}
+
+static ssize_t file_pread(storage_t *storage, uint64_t inode, void *buf, size_t size, off_t offset) {
+    char path[DATA_PATH_SIZE];
+    get_data_path(storage, inode, path);
+
+    bfile_t bf;
+    int ret = bfile_open(storage, path, 0, 0, &bf);
+
+    if (ret != 0) {
+        if (errno == ENOENT) {
+            // 文件不存在，返回 0
+            return 0;
+        }
+        perror("Failed to open file for reading");
+        return -1;
+    }
+
+    lock_data(storage, inode, 0, 0);
+    ssize_t nread = bfile_pread(storage, &bf, buf, size, (uint64_t)offset);
+    unlock_data(storage, inode, 0);
+    bfile_close(&bf);
+
+    return nread;
+}
+
+// ---------------------------------------------------------------------------
+// 分块布局：文件按 chunk_size 切分为 data_<inode>_<index>
+//
+// 不变式：除最后一块外，所有块都是完整大小（空洞部分为稀疏文件），
+// 因此缺失的块即表示文件结束，随机写只需打开被写到的块
+// ---------------------------------------------------------------------------
+
+// 保证 [0, count) 范围内的块都是完整大小
+// 从后往前检查，遇到第一个完整块即可停止（其之前的块由不变式保证完整）
+static int extend_chunks(storage_t *storage, uint64_t inode, uint64_t count) {
+    for (uint64_t index = count; index-- > 0; ) {
+        char path[DATA_PATH_SIZE];
+        get_chunk_path(storage, inode, index, path);
+
+        bfile_t bf;
+        int ret = bfile_open(storage, path, 1, 1, &bf);
+        if (ret != 0) {
+            perror("Failed to create chunk");
+            return -1;
+        }
+
+        lock_data(storage, inode, index, 1);
+        uint64_t size = 0;
+        int full = bfile_size(storage, &bf, &size) == 0 && size >= storage->chunk_size;
+        if (!full) {
+            ret = bfile_truncate(storage, &bf, storage->chunk_size);
+        }
+        unlock_data(storage, inode, index);
+        bfile_close(&bf);
+
+        if (full) {
+            break;
+        }
+        if (ret != 0) {
+            perror("Failed to extend chunk");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// 写入单个块内的数据
+static ssize_t chunk_pwrite(storage_t *storage, uint64_t inode, uint64_t index,
+                            const void *data, size_t size, uint64_t offset) {
+    char path[DATA_PATH_SIZE];
+    get_chunk_path(storage, inode, index, path);
+
+    bfile_t bf;
+    int created = 0;
+    int ret = bfile_open(storage, path, 1, 0, &bf);
+    if (ret != 0 && errno == ENOENT) {
+        // 新块：先把之前的块补齐，再创建本块，崩溃时不会留下缺口
+        if (extend_chunks(storage, inode, index) != 0) {
+            return -1;
+        }
+        // 补齐时可能发现数据已在另一层，新块与之前的块放在同一层
+        get_chunk_path(storage, inode, index, path);
+        ret = bfile_open(storage, path, 1, 1, &bf);
+        created = 1;
+    }
+
+    if (ret != 0) {
+        perror("Failed to open chunk for writing");
+        return -1;
+    }
+
+    lock_data(storage, inode, index, 1);
+
+    uint64_t old_size = 0;
+    if (storage->cache && !created) {
+        bfile_size(storage, &bf, &old_size);
+    }
+
+    ssize_t written = bfile_pwrite(storage, &bf, data, size, offset);
+
+    unlock_data(storage, inode, index);
+    bfile_close(&bf);
+
+    if (storage->cache) {
+        if (created) {
+            // 原文件末尾在之前的块中，且之前的块可能刚被补齐
+            block_cache_invalidate_inode(storage->cache, inode);
+        } else {
+            uint64_t base = index * storage->chunk_size;
+            invalidate_written(storage, inode, base + old_size, base + offset, size);
+        }
+    }
+
+    return written;
+}
+
+static ssize_t chunked_pwrite(storage_t *storage, uint64_t inode, const void *data, size_t size, off_t offset) {
+    const char *src = (const char*)data;
+    size_t total = 0;
+
+    while (total < size) {
+        uint64_t pos = (uint64_t)offset + total;
+        uint64_t index = pos / storage->chunk_size;
+        uint64_t in_chunk = pos % storage->chunk_size;
+        size_t n = (size_t)(storage->chunk_size - in_chunk);
+        if (n > size - total) {
+            n = size - total;
+        }
+
+        ssize_t written = chunk_pwrite(storage, inode, index, src + total, n, in_chunk);
+        if (written < 0) {
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        total += (size_t)written;
+        if ((size_t)written < n) {
+            break;
+        }
+    }
+
+    return (ssize_t)total;
+}
+
+static ssize_t chunked_pread(storage_t *storage, uint64_t inode, void *buf, size_t size, off_t offset) {
+    char *dst = (char*)buf;
+    size_t total = 0;
+
+    while (total < size) {
+        uint64_t pos = (uint64_t)offset + total;
+        uint64_t index = pos / storage->chunk_size;
+        uint64_t in_chunk = pos % storage->chunk_size;
+        size_t n = (size_t)(storage->chunk_size - in_chunk);
+        if (n > size - total) {
+            n = size - total;
+        }
+
+        char path[DATA_PATH_SIZE];
+        get_chunk_path(storage, inode, index, path);
+        bfile_t bf;
+        int ret = bfile_open(storage, path, 0, 0, &bf);
+
+        if (ret != 0) {
+            if (errno == ENOENT) {
+                break;  // 缺失的块即文件结束
+            }
+            perror("Failed to open chunk for reading");
+            return total > 0 ? (ssize_t)total : -1;
+        }
+
+        lock_data(storage, inode, index, 0);
+        ssize_t nread = bfile_pread(storage, &bf, dst + total, n, in_chunk);
+        unlock_data(storage, inode, index);
+        bfile_close(&bf);
+
+        if (nread < 0) {
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        total += (size_t)nread;
+        if ((size_t)nread < n) {
+            break;
+        }
+    }
+
+    return (ssize_t)total;
+}
+
+// 分层时两层都要删除：记录可能过时，迁移中崩溃也会在另一层留下副本
+static int chunked_delete(storage_t *storage, uint64_t inode, uint64_t from) {
+    for (int tier = 0; tier < tier_count(storage); tier++) {
+        for (uint64_t index = from; ; index++) {
+            char path[DATA_PATH_SIZE];
+            chunk_path_in(tier_dir(storage, tier), inode, index, path);
+
+            int ret = bfile_unlink(storage, path);
+
+            if (ret != 0) {
+                if (errno == ENOENT) {
+                    break;
+                }
+                perror("Failed to delete chunk");
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int chunked_truncate(storage_t *storage, uint64_t inode, uint64_t size) {
+    uint64_t count = (size + storage->chunk_size - 1) / storage->chunk_size;
+
+    // 删除超出新大小的块
+    if (chunked_delete(storage, inode, count) != 0) {
+        return -1;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    // 之前的块保持完整，最后一块截断到剩余长度
+    if (extend_chunks(storage, inode, count - 1) != 0) {
+        return -1;
+    }
+
+    char path[DATA_PATH_SIZE];
+    get_chunk_path(storage, inode, count - 1, path);
+    bfile_t bf;
+    int ret = bfile_open(storage, path, 1, 1, &bf);
+    if (ret != 0) {
+        perror("Failed to create chunk");
+        return -1;
+    }
+
+    lock_data(storage, inode, count - 1, 1);
+    ret = bfile_truncate(storage, &bf, size - (count - 1) * storage->chunk_size);
+    unlock_data(storage, inode, count - 1);
+    bfile_close(&bf);
+
+    if (ret != 0) {
+        perror("Failed to truncate chunk");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int chunked_sync(storage_t *storage, uint64_t inode, int mode) {
+    for (uint64_t index = 0; ; index++) {
+        char path[DATA_PATH_SIZE];
+        get_chunk_path(storage, inode, index, path);
+        bfile_t bf;
+        int ret = bfile_open(storage, path, 0, 0, &bf);
+
+        if (ret != 0) {
+            if (errno == ENOENT) {
+                break;
+            }
+            perror("Failed to open chunk for sync");
+            return -1;
+        }
+
+        ret = bfile_sync(&bf, mode);
+        bfile_close(&bf);
+        if (ret != 0) {
+            perror("Failed to sync chunk");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int chunked_get_size(storage_t *storage, uint64_t inode, int64_t *size) {
+    *size = 0;
+    for (uint64_t index = 0; ; index++) {
+        char path[DATA_PATH_SIZE];
+        get_chunk_path(storage, inode, index, path);
+        bfile_t bf;
+        int ret = bfile_open(storage, path, 0, 0, &bf);
+
+        if (ret != 0) {
+            if (errno == ENOENT) {
+                break;
+            }
+            perror("Failed to stat chunk");
+            return -1;
+        }
+
+        uint64_t chunk = 0;
+        ret = bfile_size(storage, &bf, &chunk);
+        bfile_close(&bf);
+        if (ret != 0) {
+            return -1;
+        }
+        *size += (int64_t)chunk;
+    }
+
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// 按布局分发
+// ---------------------------------------------------------------------------
+
+static ssize_t dedup_pwrite(storage_t *storage, uint64_t inode, const void *data, size_t size, off_t offset) {
+    uint64_t old_size = 0;
+    ssize_t written = dedup_write(storage->dedup, inode, data, size, (uint64_t)offset, &old_size);
+    if (written > 0 && storage->cache) {
+        invalidate_written(storage, inode, old_size, (uint64_t)offset, (size_t)written);
+    }
+    return written;
+}
+
+static ssize_t data_pwrite(storage_t *storage, uint64_t inode, const void *data, size_t size, off_t offset) {
+    if (storage->dedup) {
+        return dedup_pwrite(storage, inode, data, size, offset);
+    }
+    if (storage->chunk_size > 0) {
+        return chunked_pwrite(storage, inode, data, size, offset);
+    }
+    return file_pwrite(storage, inode, data, size, offset);
+}
+
+static ssize_t data_pread(storage_t *storage, uint64_t inode, void *buf, size_t size, off_t offset) {
+    if (storage->dedup) {
+        return dedup_read(storage->dedup, inode, buf, size, (uint64_t)offset);
+    }
+    if (storage->chunk_size > 0) {
+        return chunked_pread(storage, inode, buf, size, offset);
+    }
+    return file_pread(storage, inode, buf, size, offset);
+}
+
+// 供组合操作使用的布局分发，调用者已持有分层锁
+static int data_truncate(storage_t *storage, uint64_t inode, uint64_t size);
+static int data_get_size(storage_t *storage, uint64_t inode, int64_t *size);
+
+ssize_t storage_write(storage_t *storage, uint64_t inode, const void *data, size_t size, off_t offset) {
+    int fence = tier_enter_modify(storage, inode);
+    ssize_t written = data_pwrite(storage, inode, data, size, offset);
+    int err = errno;
+    tier_leave_modify(storage, inode, fence);
+    errno = err;
+    return written;
+}
+
+// 经块缓存读取：命中的块直接拷贝；遇到第一个未命中块时，把请求剩余部分覆盖的块
+// 逐块读入缓存块的缓冲区，拷贝给调用者后插入缓存（不经过额外的中间缓冲区）
+static ssize_t storage_read_cached(storage_t *storage, uint64_t inode, void *buf, size_t size, off_t offset) {
+    block_cache_t *cache = storage->cache;
+    size_t block_size = block_cache_block_size(cache);
+    char *out = (char*)buf;
+    size_t total = 0;
+    uint64_t ticket = 0;
+    int filling = 0;
+
+    while (total < size) {
+        uint64_t pos = (uint64_t)offset + total;
+        uint64_t index = pos / block_size;
+        size_t in_block = (size_t)(pos % block_size);
+        size_t want = block_size - in_block;
+        if (want > size - total) {
+            want = size - total;
+        }
+
+        if (!filling) {
+            ssize_t n = block_cache_read(cache, inode, index, out + total, in_block, want);
+            if (n >= 0) {
+                total += (size_t)n;
+                if ((size_t)n < want) {
+                    break;  // 到达文件末尾
+                }
+                continue;
+            }
+            // 未命中，之后的块都从磁盘读取
+            ticket = block_cache_fill_ticket(cache, inode);
+            filling = 1;
+        }
+
+        char *block = (char*)block_cache_alloc(cache);
+        if (!block) {
+            // 无法缓存时直接读入调用者的缓冲区
+            ssize_t len = data_pread(storage, inode, out + total, size - total, (off_t)pos);
+            if (len > 0) {
+                total += (size_t)len;
+            }
+            return total > 0 || len == 0 ? (ssize_t)total : -1;
+        }
+
+        ssize_t len = data_pread(storage, inode, block, block_size, (off_t)(index * block_size));
+        if (len < 0) {
+            block_cache_discard(block);
+            return total > 0 ? (ssize_t)total : -1;
+        }
+
+        size_t copy = 0;
+        if ((size_t)len > in_block) {
+            copy = (size_t)len - in_block;
+            if (copy > want) {
+                copy = want;
+            }
+            memcpy(out + total, block + in_block, copy);
+            total += copy;
+        }
+        block_cache_insert(cache, inode, index, block, (size_t)len, ticket);
+        if ((size_t)len < block_size) {
+            break;  // 到达文件末尾
+        }
+    }
+
+    return (ssize_t)total;
+}
+
+ssize_t storage_read(storage_t *storage, uint64_t inode, void *buf, size_t size, off_t offset) {
+    tier_enter(storage, inode, 0);
+    ssize_t nread;
+    if (storage->cache) {
+        nread = storage_read_cached(storage, inode, buf, size, offset);
+    } else {
+        nread = data_pread(storage, inode, buf, size, offset);
+    }
+    tier_leave(storage, inode);
+    return nread;
+}
+
+// ---------------------------------------------------------------------------
+// 文件间复制
+// ---------------------------------------------------------------------------
+
+// 内核无法在两个后端文件之间复制，需要回退到读写复制
+#define COPY_UNSUPPORTED (-2)
+
+// 读写复制的缓冲区大小
+#define COPY_BUFFER_SIZE (1024 * 1024)
+
+// 在两个未压缩的后端文件之间复制：优先用 FICLONERANGE 共享磁盘块（XFS reflink），
+// 不满足对齐要求或文件系统不支持时使用内核 copy_file_range
+static ssize_t fd_copy_range(int src_fd, uint64_t src_offset, int dst_fd, uint64_t dst_offset, size_t size) {
+    struct file_clone_range range = {
+        .src_fd = src_fd,
+        .src_offset = src_offset,
+        .src_length = size,
+        .dest_offset = dst_offset,
+    };
+    if (ioctl(dst_fd, FICLONERANGE, &range) == 0) {
+        return (ssize_t)size;
+    }
+
+    size_t total = 0;
+    while (total < size) {
+        loff_t in = (loff_t)(src_offset + total);
+        loff_t out = (loff_t)(dst_offset + total);
+        ssize_t n = copy_file_range(src_fd, &in, dst_fd, &out, size - total, 0);
+        if (n < 0) {
+            if (total == 0 && (errno == EXDEV || errno == ENOSYS ||
+                               errno == EOPNOTSUPP || errno == EINVAL)) {
+                return COPY_UNSUPPORTED;
+            }
+            perror("Failed to copy file range");
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        total += (size_t)n;
+    }
+
+    return (ssize_t)total;
+}
+
+static ssize_t file_copy_range(storage_t *storage, uint64_t src, uint64_t src_offset,
+                               uint64_t dst, uint64_t dst_offset, size_t size) {
+    char src_path[DATA_PATH_SIZE];
+    get_data_path(storage, src, src_path);
+    char dst_path[DATA_PATH_SIZE];
+    get_data_path(storage, dst, dst_path);
+
+    bfile_t src_bf, dst_bf;
+    int ret = bfile_open(storage, src_path, 0, 0, &src_bf);
+    if (ret != 0) {
+        // 源文件不存在即为空文件
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    ret = bfile_open(storage, dst_path, 1, 1, &dst_bf);
+    if (ret != 0) {
+        perror("Failed to open file for copy");
+        bfile_close(&src_bf);
+        return -1;
+    }
+
+    ssize_t copied = -1;
+    uint64_t src_size = 0, dst_size = 0;
+    if (bfile_size(storage, &src_bf, &src_size) == 0 && bfile_size(storage, &dst_bf, &dst_size) == 0) {
+        if (src_offset >= src_size) {
+            copied = 0;
+        } else {
+            if (size > src_size - src_offset) {
+                size = (size_t)(src_size - src_offset);
+            }
+
+            // 整个文件复制到空文件（或更短的文件）时直接克隆整个文件
+            if (src_offset == 0 && dst_offset == 0 && size == src_size && dst_size <= src_size &&
+                ioctl(dst_bf.fd, FICLONE, src_bf.fd) == 0) {
+                copied = (ssize_t)size;
+            } else {
+                copied = fd_copy_range(src_bf.fd, src_offset, dst_bf.fd, dst_offset, size);
+            }
+        }
+    }
+
+    bfile_close(&src_bf);
+    bfile_close(&dst_bf);
+    return copied;
+}
+
+// 分块布局下按源块和目标块的边界切分，逐段在块文件之间复制
+static ssize_t chunked_copy_range(storage_t *storage, uint64_t src, uint64_t src_offset,
+                                  uint64_t dst, uint64_t dst_offset, size_t size) {
+    size_t total = 0;
+
+    while (total < size) {
+        uint64_t src_pos = src_offset + total;
+        uint64_t dst_pos = dst_offset + total;
+        uint64_t src_index = src_pos / storage->chunk_size;
+        uint64_t dst_index = dst_pos / storage->chunk_size;
+        uint64_t src_in_chunk = src_pos % storage->chunk_size;
+        uint64_t dst_in_chunk = dst_pos % storage->chunk_size;
+
+        size_t n = size - total;
+        if (n > storage->chunk_size - src_in_chunk) {
+            n = (size_t)(storage->chunk_size - src_in_chunk);
+        }
+        if (n > storage->chunk_size - dst_in_chunk) {
+            n = (size_t)(storage->chunk_size - dst_in_chunk);
+        }
+
+        char path[DATA_PATH_SIZE];
+        get_chunk_path(storage, src, src_index, path);
+        bfile_t src_bf;
+        int ret = bfile_open(storage, path, 0, 0, &src_bf);
+        if (ret != 0) {
+            if (errno == ENOENT) {
+                break;  // 缺失的块即文件结束
+            }
+            perror("Failed to open chunk for copy");
+            return total > 0 ? (ssize_t)total : -1;
+        }
+
+        uint64_t chunk = 0;
+        if (bfile_size(storage, &src_bf, &chunk) != 0 || src_in_chunk >= chunk) {
+            bfile_close(&src_bf);
+            break;
+        }
+        if (n > chunk - src_in_chunk) {
+            n = (size_t)(chunk - src_in_chunk);
+        }
+
+        // 新的目标块：与 chunk_pwrite 一样先补齐之前的块
+        get_chunk_path(storage, dst, dst_index, path);
+        bfile_t dst_bf;
+        ret = bfile_open(storage, path, 1, 0, &dst_bf);
+        if (ret != 0 && errno == ENOENT) {
+            if (extend_chunks(storage, dst, dst_index) == 0) {
+                get_chunk_path(storage, dst, dst_index, path);
+                ret = bfile_open(storage, path, 1, 1, &dst_bf);
+            }
+        }
+        if (ret != 0) {
+            perror("Failed to open chunk for copy");
+            bfile_close(&src_bf);
+            return total > 0 ? (ssize_t)total : -1;
+        }
+
+        ssize_t copied = fd_copy_range(src_bf.fd, src_in_chunk, dst_bf.fd, dst_in_chunk, n);
+        bfile_close(&src_bf);
+        bfile_close(&dst_bf);
+
+        if (copied < 0) {
+            if (copied == COPY_UNSUPPORTED && total == 0) {
+                return COPY_UNSUPPORTED;
+            }
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        total += (size_t)copied;
+        if ((size_t)copied < n) {
+            break;
+        }
+    }
+
+    return (ssize_t)total;
+}
+
+// 经存储层读写复制，适用于所有布局
+static ssize_t generic_copy_range(storage_t *storage, uint64_t src, uint64_t src_offset,
+                                  uint64_t dst, uint64_t dst_offset, size_t size) {
+    size_t buf_size = size < COPY_BUFFER_SIZE ? size : COPY_BUFFER_SIZE;
+    char *buf = (char*)malloc(buf_size);
+    if (!buf) {
+        return -1;
+    }
+
+    size_t total = 0;
+    while (total < size) {
+        size_t n = size - total;
+        if (n > buf_size) {
+            n = buf_size;
+        }
+
+        ssize_t nread = data_pread(storage, src, buf, n, (off_t)(src_offset + total));
+        if (nread <= 0) {
+            if (nread < 0 && total == 0) {
+                free(buf);
+                return -1;
+            }
+            break;
+        }
+
+        ssize_t written = data_pwrite(storage, dst, buf, (size_t)nread, (off_t)(dst_offset + total));
+        if (written < 0) {
+            free(buf);
+            return total > 0 ? (ssize_t)total : -1;
+        }
+        total += (size_t)written;
+        if (written < nread || (size_t)nread < n) {
+            break;
+        }
+    }
+
+    free(buf);
+    return (ssize_t)total;
+}
+
+static ssize_t data_copy_range(storage_t *storage, uint64_t src, uint64_t src_offset,
+                               uint64_t dst, uint64_t dst_offset, size_t size) {
+    // 先按源文件大小截取：同一文件内复制时，写入目标范围可能让源文件变长
+    int64_t src_size;
+    if (data_get_size(storage, src, &src_size) != 0) {
+        return -1;
+    }
+    if (src_offset >= (uint64_t)src_size) {
+        return 0;
+    }
+    if (size > (uint64_t)src_size - src_offset) {
+        size = (size_t)((uint64_t)src_size - src_offset);
+    }
+
+    // 去重存储只复制块映射；压缩格式的块必须经过读写
+    ssize_t copied = COPY_UNSUPPORTED;
+    if (storage->dedup) {
+        copied = dedup_copy(storage->dedup, src, src_offset, dst, dst_offset, size);
+        if (copied == DEDUP_UNALIGNED) {
+            copied = COPY_UNSUPPORTED;
+        }
+    } else if (!storage->compressed) {
+        if (storage->chunk_size > 0) {
+            copied = chunked_copy_range(storage, src, src_offset, dst, dst_offset, size);
+        } else {
+            copied = file_copy_range(storage, src, src_offset, dst, dst_offset, size);
+        }
+    }
+
+    if (copied == COPY_UNSUPPORTED) {
+        // data_pwrite 自行失效缓存
+        return generic_copy_range(storage, src, src_offset, dst, dst_offset, size);
+    }
+
+    if (copied > 0 && storage->cache) {
+        block_cache_invalidate_inode(storage->cache, dst);
+    }
+
+    return copied;
+}
+
+ssize_t storage_copy_range(storage_t *storage, uint64_t src, uint64_t src_offset,
+                           uint64_t dst, uint64_t dst_offset, size_t size) {
+    // 两个文件的分层锁按条带顺序获取，同一条带只获取一次；围栏只需要目标文件的
+    uint64_t first = src % STORAGE_LOCK_STRIPES <= dst % STORAGE_LOCK_STRIPES ? src : dst;
+    uint64_t second = first == src ? dst : src;
+    int same = src % STORAGE_LOCK_STRIPES == dst % STORAGE_LOCK_STRIPES;
+    tier_enter(storage, first, 0);
+    if (!same) {
+        tier_enter(storage, second, 0);
+    }
+    int fence = storage->cold_dir[0] ? tier_fence(storage, dst) : -1;
+    ssize_t copied = data_copy_range(storage, src, src_offset, dst, dst_offset, size);
+    int err = errno;
+    tier_modified(storage, dst);
+    if (fence >= 0) {
+        close(fence);
+    }
+    if (!same) {
+        tier_leave(storage, second);
+    }
+    tier_leave(storage, first);
+    errno = err;
+    return copied;
+}
+
+// ---------------------------------------------------------------------------
+// 预分配、打洞与空洞查找
+// ---------------------------------------------------------------------------
+
+// 支持的 fallocate 模式
+#define FALLOCATE_MODES (FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)
+
+// 查找压缩文件中从 offset 开始的下一个数据块或空洞（全零块）
+static int cfile_seek(const bfile_t *bf, uint64_t offset, int whence, uint64_t *result) {
+    uint64_t file_size;
+    if (cfile_size(bf, &file_size) != 0) {
+        return -1;
+    }
+    if (offset >= file_size) {
+        errno = ENXIO;
+        return -1;
+    }
+
+    // 按批读取索引项
+    uint32_t entries[1024];
+    uint64_t count = (file_size + STORAGE_COMPRESS_BLOCK - 1) / STORAGE_COMPRESS_BLOCK;
+    uint64_t index = offset / STORAGE_COMPRESS_BLOCK;
+    while (index < count) {
+        size_t batch = (size_t)(count - index < 1024 ? count - index : 1024);
+        ssize_t n = pread(bf->ifd, entries, batch * sizeof(uint32_t),
+                          (off_t)(INDEX_HEADER_SIZE + index * sizeof(uint32_t)));
+        if (n < 0) {
+            return -1;
+        }
+        // 索引文件末尾之后的块都是空洞
+        memset((char*)entries + n, 0, batch * sizeof(uint32_t) - (size_t)n);
+
+        for (size_t i = 0; i < batch; i++, index++) {
+            if ((entries[i] != 0) == (whence == SEEK_DATA)) {
+                uint64_t pos = index * STORAGE_COMPRESS_BLOCK;
+                *result = pos > offset ? pos : offset;
+                return 0;
+            }
+        }
+    }
+
+    if (whence == SEEK_DATA) {
+        errno = ENXIO;
+        return -1;
+    }
+    *result = file_size;  // 文件末尾视为空洞
+    return 0;
+}
+
+// 在单个后端文件中查找，没有更多数据时返回 -1 且 errno 为 ENXIO
+static int bfile_seek(storage_t *storage, const bfile_t *bf, uint64_t offset, int whence, uint64_t *result) {
+    if (storage->compressed) {
+        return cfile_seek(bf, offset, whence, result);
+    }
+
+    off_t pos = lseek(bf->fd, (off_t)offset, whence);
+    if (pos < 0) {
+        return -1;
+    }
+    *result = (uint64_t)pos;
+    return 0;
+}
+
+static int file_seek(storage_t *storage, uint64_t inode, uint64_t offset, int whence, uint64_t *result) {
+    char path[DATA_PATH_SIZE];
+    get_data_path(storage, inode, path);
+
+    bfile_t bf;
+    int ret = bfile_open(storage, path, 0, 0, &bf);
+    if (ret != 0) {
+        if (errno == ENOENT) {
+            errno = ENXIO;  // 没有数据文件即空文件
+        }
+        return -1;
+    }
+
+    lock_data(storage, inode, 0, 0);
+    ret = bfile_seek(storage, &bf, offset, whence, result);
+    unlock_data(storage, inode, 0);
+    bfile_close(&bf);
+
+    return ret;
+}
+
+// 分块布局：从 offset 所在块开始逐块查找；除最后一块外都是完整块，
+// 完整块的末尾不是空洞，需要继续查找下一块
+static int chunked_seek(storage_t *storage, uint64_t inode, uint64_t offset, int whence, uint64_t *result) {
+    uint64_t first = offset / storage->chunk_size;
+
+    for (uint64_t index = first; ; index++) {
+        uint64_t base = index * storage->chunk_size;
+        uint64_t local = index == first ? offset - base : 0;
+
+        char path[DATA_PATH_SIZE];
+        get_chunk_path(storage, inode, index, path);
+        bfile_t bf;
+        int ret = bfile_open(storage, path, 0, 0, &bf);
+
+        if (ret != 0) {
+            if (errno != ENOENT) {
+                return -1;
+            }
+            // 缺失的块即文件结束
+            if (whence == SEEK_DATA || index == first) {
+                errno = ENXIO;
+                return -1;
+            }
+            *result = base;
+            return 0;
+        }
+
+        lock_data(storage, inode, index, 0);
+        uint64_t chunk = 0;
+        uint64_t pos = 0;
+        ret = bfile_size(storage, &bf, &chunk);
+        if (ret == 0) {
+            if (local >= chunk) {
+                errno = ENXIO;
+                ret = -1;
+            } else {
+                ret = bfile_seek(storage, &bf, local, whence, &pos);
+            }
+        }
+        unlock_data(storage, inode, index);
+        bfile_close(&bf);
+
+        if (ret != 0) {
+            if (errno != ENXIO) {
+                return -1;
+            }
+            if (whence == SEEK_HOLE) {
+                // 只会发生在 offset 越过文件末尾时
+                if (index == first) {
+                    return -1;
+                }
+                *result = base;
+                return 0;
+            }
+            continue;  // 本块之后没有数据，继续查找下一块
+        }
+
+        if (whence == SEEK_DATA || pos < storage->chunk_size) {
+            *result = base + pos;
+            return 0;
+        }
+    }
+}
+
+int storage_seek(storage_t *storage, uint64_t inode, uint64_t offset, int whence, uint64_t *result) {
+    if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (storage->dedup) {
+        return dedup_seek(storage->dedup, inode, offset, whence, result);
+    }
+
+    tier_enter(storage, inode, 0);
+    int ret;
+    if (storage->chunk_size > 0) {
+        ret = chunked_seek(storage, inode, offset, whence, result);
+    } else {
+        ret = file_seek(storage, inode, offset, whence, result);
+    }
+    int err = errno;
+    tier_leave(storage, inode);
+    errno = err;
+    return ret;
+}
+
+// 未压缩的单文件布局：直接转发给数据文件
+static int file_fallocate(storage_t *storage, uint64_t inode, int mode, uint64_t offset, uint64_t length) {
+    char path[DATA_PATH_SIZE];
+    get_data_path(storage, inode, path);
+
+    bfile_t bf;
+    int ret = bfile_open(storage, path, 1, 1, &bf);
+    if (ret != 0) {
+        perror("Failed to open file for fallocate");
+        return -1;
+    }
+
+    ret = fallocate(bf.fd, mode, (off_t)offset, (off_t)length);
+    bfile_close(&bf);
+    return ret;
+}
+
+// 未压缩的分块布局：按块切分后转发；保持大小的操作只作用于已有的块，
+// 会扩展文件的操作与写入一样先补齐之前的块
+static int chunked_fallocate(storage_t *storage, uint64_t inode, int mode, uint64_t offset, uint64_t length) {
+    uint64_t end = offset + length;
+    int keep_size = (mode & FALLOC_FL_KEEP_SIZE) != 0;
+
+    if (keep_size) {
+        int64_t size;
+        if (chunked_get_size(storage, inode, &size) != 0) {
+            return -1;
+        }
+        if (end > (uint64_t)size) {
+            end = (uint64_t)size;
+        }
+    }
+
+    for (uint64_t pos = offset; pos < end; ) {
+        uint64_t index = pos / storage->chunk_size;
+        uint64_t local = pos % storage->chunk_size;
+        uint64_t n = storage->chunk_size - local;
+        if (n > end - pos) {
+            n = end - pos;
+        }
+
+        char path[DATA_PATH_SIZE];
+        get_chunk_path(storage, inode, index, path);
+        bfile_t bf;
+        int ret = bfile_open(storage, path, 1, 0, &bf);
+        if (ret != 0 && errno == ENOENT && !keep_size) {
+            if (extend_chunks(storage, inode, index) == 0) {
+                get_chunk_path(storage, inode, index, path);
+                ret = bfile_open(storage, path, 1, 1, &bf);
+            }
+        }
+        if (ret != 0) {
+            perror("Failed to open chunk for fallocate");
+            return -1;
+        }
+
+        ret = fallocate(bf.fd, mode, (off_t)local, (off_t)n);
+        bfile_close(&bf);
+        if (ret != 0) {
+            return -1;
+        }
+        pos += n;
+    }
+
+    return 0;
+}
+
+// 压缩格式和去重存储中全零块即空洞，打洞和清零通过写入零实现
+static int zero_fill(storage_t *storage, uint64_t inode, uint64_t offset, uint64_t end) {
+    size_t buf_size = end - offset < COPY_BUFFER_SIZE ? (size_t)(end - offset) : COPY_BUFFER_SIZE;
+    char *zeros = (char*)calloc(1, buf_size);
+    if (!zeros) {
+        return -1;
+    }
+
+    int ret = 0;
+    for (uint64_t pos = offset; pos < end; ) {
+        size_t n = end - pos < buf_size ? (size_t)(end - pos) : buf_size;
+        if (data_pwrite(storage, inode, zeros, n, (off_t)pos) != (ssize_t)n) {
+            ret = -1;
+            break;
+        }
+        pos += n;
+    }
+
+    free(zeros);
+    return ret;
+}
+
+static int data_fallocate(storage_t *storage, uint64_t inode, int mode, uint64_t offset, uint64_t length) {
+    if (!storage->compressed && !storage->dedup) {
+        int ret;
+        if (storage->chunk_size > 0) {
+            ret = chunked_fallocate(storage, inode, mode, offset, length);
+        } else {
+            ret = file_fallocate(storage, inode, mode, offset, length);
+        }
+        if (storage->cache) {
+            block_cache_invalidate_inode(storage->cache, inode);
+        }
+        return ret;
+    }
+
+    // 压缩块和去重块的存储空间无法预先分配，只调整文件大小
+    int64_t size;
+    if (data_get_size(storage, inode, &size) != 0) {
+        return -1;
+    }
+
+    uint64_t end = offset + length;
+    if (mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)) {
+        if ((mode & FALLOC_FL_KEEP_SIZE) && end > (uint64_t)size) {
+            end = (uint64_t)size;
+        }
+        return offset < end ? zero_fill(storage, inode, offset, end) : 0;
+    }
+
+    if (!(mode & FALLOC_FL_KEEP_SIZE) && end > (uint64_t)size) {
+        return data_truncate(storage, inode, end);
+    }
+    return 0;
+}
+
+int storage_fallocate(storage_t *storage, uint64_t inode, int mode, uint64_t offset, uint64_t length) {
+    if ((mode & ~FALLOCATE_MODES) != 0) {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    if (length == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fence = tier_enter_modify(storage, inode);
+    int ret = data_fallocate(storage, inode, mode, offset, length);
+    int err = errno;
+    tier_leave_modify(storage, inode, fence);
+    errno = err;
+    return ret;
+}
+
+int storage_delete(storage_t *storage, uint64_t inode) {
+    int ret = 0;
+
+    int fence = tier_enter_modify(storage, inode);
+    if (storage->dedup) {
+        ret = dedup_delete(storage->dedup, inode);
+    } else if (storage->chunk_size > 0) {
+        ret = chunked_delete(storage, inode, 0);
+    } else {
+        for (int tier = 0; tier < tier_count(storage); tier++) {
+            char path[DATA_PATH_SIZE];
+            data_path_in(tier_dir(storage, tier), inode, path);
+
+            if (bfile_unlink(storage, path) != 0 && errno != ENOENT) {
+                perror("Failed to delete file");
+                ret = -1;
+            }
+        }
+    }
+    tier_leave_modify(storage, inode, fence);
+    storage_set_tier(storage, inode, STORAGE_TIER_HOT);
+
+    if (storage->cache) {
+        block_cache_invalidate_inode(storage->cache, inode);
+    }
+
+    return ret;
+}
+
+static int data_truncate(storage_t *storage, uint64_t inode, uint64_t size) {
+    int ret;
+
+    if (storage->dedup) {
+        ret = dedup_truncate(storage->dedup, inode, size);
+    } else if (storage->chunk_size > 0) {
+        ret = chunked_truncate(storage, inode, size);
+    } else {
+        char path[DATA_PATH_SIZE];
+        get_data_path(storage, inode, path);
+
+        // 如果文件不存在，创建空文件
+        bfile_t bf;
+        ret = bfile_open(storage, path, 1, 1, &bf);
+        if (ret != 0) {
+            perror("Failed to create file");
+            return -1;
+        }
+
+        lock_data(storage, inode, 0, 1);
+        ret = bfile_truncate(storage, &bf, size);
+        unlock_data(storage, inode, 0);
+        bfile_close(&bf);
+
+        if (ret != 0) {
+            perror("Failed to truncate file");
+        }
+    }
+
+    if (storage->cache) {
+        block_cache_invalidate_inode(storage->cache, inode);
+    }
+
+    return ret == 0 ? 0 : -1;
+}
+
+int storage_truncate(storage_t *storage, uint64_t inode, uint64_t size) {
+    int fence = tier_enter_modify(storage, inode);
+    int ret = data_truncate(storage, inode, size);
+    tier_leave_modify(storage, inode, fence);
+    return ret;
+}
+
+static int data_sync(storage_t *storage, uint64_t inode, int mode) {
+    if (storage->dedup) {
+        // 块文件由整个文件系统一起同步，无法只发起某个文件的回写
+        return mode == STORAGE_SYNC_START ? 0 : dedup_sync(storage->dedup);
+    }
+    if (storage->chunk_size > 0) {
+        return chunked_sync(storage, inode, mode);
+    }
+
+    char path[DATA_PATH_SIZE];
+    get_data_path(storage, inode, path);
+
+    bfile_t bf;
+    int ret = bfile_open(storage, path, 0, 0, &bf);
+
+    if (ret != 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        perror("Failed to open file for sync");
+        return -1;
+    }
+
+    ret = bfile_sync(&bf, mode);
+    bfile_close(&bf);
+
+    if (ret != 0) {
+        perror("Failed to sync file");
+        return -1;
+    }
+
+    return 0;
+}
+
+int storage_sync(storage_t *storage, uint64_t inode, int mode) {
+    tier_enter(storage, inode, 0);
+    int ret = data_sync(storage, inode, mode);
+    tier_leave(storage, inode);
+    return ret;
+}
+
+static int data_get_size(storage_t *storage, uint64_t inode, int64_t *size) {
+    if (storage->dedup) {
+        uint64_t value = 0;
+        if (dedup_get_size(storage->dedup, inode, &value) != 0) {
+            return -1;
+        }
+        *size = (int64_t)value;
+        return 0;
+    }
+    if (storage->chunk_size > 0) {
+        return chunked_get_size(storage, inode, size);
+    }
+
+    char path[DATA_PATH_SIZE];
+    get_data_path(storage, inode, path);
+
+    bfile_t bf;
+    int ret = bfile_open(storage, path, 0, 0, &bf);
+
+    if (ret != 0) {
+        if (errno == ENOENT) {
+            *size = 0;
+            return 0;
+        }
+        perror("Failed to stat file");
+        return -1;
+    }
+
+    uint64_t value = 0;
+    ret = bfile_size(storage, &bf, &value);
+    bfile_close(&bf);
+    if (ret != 0) {
+        return -1;
+    }
+
+    *size = (int64_t)value;
+    return 0;
+}
+
+int storage_get_size(storage_t *storage, uint64_t inode, int64_t *size) {
+    tier_enter(storage, inode, 0);
+    int ret = data_get_size(storage, inode, size);
+    tier_leave(storage, inode);
+    return ret;
+}
+
+// ---------------------------------------------------------------------------
+// 分层存储：新文件写入快速层，后台按访问情况在两层之间整体迁移文件的后端文件
+// ---------------------------------------------------------------------------
+
+// 迁移中的一个后端文件（压缩格式的 .idx 单独作为一项）
+typedef struct {
+    char name[64];
+    struct stat st;     // 源文件的状态，换入前用来确认没有被修改
+} tier_file_t;
+
+// 列出 inode 在 dir 中的后端文件，*chunks 为数据文件数（单文件布局为 0 或 1）
+static int tier_list_files(storage_t *storage, const char *dir, uint64_t inode,
+                           tier_file_t **files, size_t *count, uint64_t *chunks) {
+    size_t cap = 0;
+    *files = NULL;
+    *count = 0;
+    *chunks = 0;
+
+    for (uint64_t index = 0; storage->chunk_size > 0 || index == 0; index++) {
+        char path[DATA_PATH_SIZE];
+        if (storage->chunk_size > 0) {
+            chunk_path_in(dir, inode, index, path);
+        } else {
+            data_path_in(dir, inode, path);
+        }
+
+        for (int part = 0; part < (storage->compressed ? 2 : 1); part++) {
+            if (*count == cap) {
+                cap = cap ? cap * 2 : 8;
+                tier_file_t *grown = (tier_file_t*)realloc(*files, cap * sizeof(tier_file_t));
+                if (!grown) {
+                    free(*files);
+                    *files = NULL;
+                    return -1;
+                }
+                *files = grown;
+            }
+
+            tier_file_t *file = &(*files)[*count];
+            snprintf(file->name, sizeof(file->name), part ? "%s.idx" : "%s", strrchr(path, '/') + 1);
+            char full[PATH_MAX];
+            snprintf(full, sizeof(full), "%s/%s", dir, file->name);
+            if (stat(full, &file->st) != 0) {
+                if (errno == ENOENT && part == 0) {
+                    return 0;   // 缺失的块即文件结束
+                }
+                free(*files);
+                *files = NULL;
+                return -1;
+            }
+            (*count)++;
+        }
+        (*chunks)++;
+    }
+
+    return 0;
+}
+
+// 删除 inode 在 dir 中从第 from 块开始的后端文件
+static void tier_discard(storage_t *storage, const char *dir, uint64_t inode, uint64_t from) {
+    for (uint64_t index = from; storage->chunk_size > 0 || index == 0; index++) {
+        char path[DATA_PATH_SIZE];
+        if (storage->chunk_size > 0) {
+            chunk_path_in(dir, inode, index, path);
+        } else {
+            data_path_in(dir, inode, path);
+        }
+        if (bfile_unlink(storage, path) != 0 && errno == ENOENT) {
+            break;
+        }
+    }
+}
+
+// 复制为 dst 并落盘，跳过全零的部分以保留空洞
+static int tier_copy_file(const char *src, const char *dst, off_t size) {
+    int in = open(src, O_RDONLY);
+    if (in < 0) {
+        return -1;
+    }
+    int out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    char *buf = out >= 0 ? (char*)malloc(COPY_BUFFER_SIZE) : NULL;
+    if (!buf) {
+        int err = out >= 0 ? ENOMEM : errno;
+        if (out >= 0) {
+            close(out);
+        }
+        close(in);
+        errno = err;
+        return -1;
+    }
+
+    int ret = 0;
+    for (off_t pos = 0; pos < size; ) {
+        ssize_t n = pread(in, buf, COPY_BUFFER_SIZE, pos);
+        if (n <= 0) {
+            ret = n < 0 ? -1 : 0;
+            break;
+        }
+        if (!is_zero(buf, (size_t)n) && pwrite(out, buf, (size_t)n, pos) != n) {
+            ret = -1;
+            break;
+        }
+        pos += n;
+    }
+    if (ret == 0 && (ftruncate(out, size) != 0 || fdatasync(out) != 0)) {
+        ret = -1;
+    }
+
+    int err = errno;
+    free(buf);
+    close(out);
+    close(in);
+    errno = err;
+    return ret;
+}
+
+// 其他挂载直接修改后端文件，只能从文件状态发现。只迁移 STORAGE_TIER_SETTLE 秒内没有修改过的文件，
+// 复制期间的修改一定带有更晚的时间戳；本挂载的修改另由写入代数发现
+static int same_stat(const struct stat *a, const struct stat *b) {
+    return a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+           a->st_ctim.tv_sec == b->st_ctim.tv_sec && a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+static void sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static int tier_migrate_files(storage_t *storage, uint64_t inode, int from, int tier,
+                              const char *src_dir, const char *dst_dir, uint64_t gen);
+
+int storage_migrate(storage_t *storage, uint64_t inode, int tier) {
+    if (!storage->cold_dir[0] || (tier != STORAGE_TIER_HOT && tier != STORAGE_TIER_COLD)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int from = storage_get_tier(storage, inode);
+    const char *src_dir = tier_dir(storage, from);
+    const char *dst_dir = tier_dir(storage, tier);
+
+    // 先标记正在迁移再读取源文件，之后本挂载对该文件的修改都会增加写入代数
+    size_t stripe = inode % STORAGE_LOCK_STRIPES;
+    __atomic_store_n(&storage->tier_migrating[stripe], inode, __ATOMIC_SEQ_CST);
+    uint64_t gen = __atomic_load_n(&storage->tier_gen[stripe], __ATOMIC_SEQ_CST);
+    int ret = tier_migrate_files(storage, inode, from, tier, src_dir, dst_dir, gen);
+    __atomic_store_n(&storage->tier_migrating[stripe], 0, __ATOMIC_SEQ_CST);
+    return ret;
+}
+
+// storage_migrate 的实现，gen 为标记迁移时的写入代数
+static int tier_migrate_files(storage_t *storage, uint64_t inode, int from, int tier,
+                              const char *src_dir, const char *dst_dir, uint64_t gen) {
+    tier_file_t *files;
+    size_t count;
+    uint64_t chunks;
+    time_t listed = time(NULL);
+    if (tier_list_files(storage, src_dir, inode, &files, &count, &chunks) != 0) {
+        return -1;
+    }
+
+    if (from == tier) {
+        // 迁移在换入后、删除源文件前崩溃时两层都有副本，以节点记录中的层为准
+        if (count > 0) {
+            tier_enter(storage, inode, 1);
+            tier_discard(storage, tier_dir(storage, !tier), inode, 0);
+            tier_leave(storage, inode);
+        }
+        free(files);
+        return 0;
+    }
+    if (count == 0) {
+        // 记录的层中没有数据：空文件，或已被其他挂载迁移
+        free(files);
+        tier_list_files(storage, dst_dir, inode, &files, &count, &chunks);
+        if (count > 0) {
+            storage_set_tier(storage, inode, tier);
+        }
+        free(files);
+        return 0;
+    }
+
+    // 刚被修改的文件与之后的修改可能时间戳相同，留到下一轮
+    for (size_t i = 0; i < count; i++) {
+        if (files[i].st.st_mtime >= listed - STORAGE_TIER_SETTLE ||
+            files[i].st.st_ctime >= listed - STORAGE_TIER_SETTLE) {
+            free(files);
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    // 不持锁复制，读写照常进行
+    int ret = 0;
+    size_t copied = 0;
+    for (; copied < count; copied++) {
+        char src[PATH_MAX], tmp[PATH_MAX];
+        snprintf(src, sizeof(src), "%s/%s", src_dir, files[copied].name);
+        snprintf(tmp, sizeof(tmp), "%s/%s.tmp", dst_dir, files[copied].name);
+        if (tier_copy_file(src, tmp, files[copied].st.st_size) != 0) {
+            ret = -1;
+            break;
+        }
+    }
+
+    // 换入：确认源文件在复制期间没有被修改（写入代数未变、文件状态相同、没有新增块），
+    // 否则放弃，由调用者稍后重试。首个后端文件的排他 flock 等待其他挂载正在进行的修改结束，
+    // 并让换入期间到达的修改等待，之后它们发现源文件已删除，改到目标层
+    size_t renamed = 0;
+    if (ret == 0) {
+        tier_enter(storage, inode, 1);
+        char anchor[PATH_MAX];
+        snprintf(anchor, sizeof(anchor), "%s/%s", src_dir, files[0].name);
+        int fence = open(anchor, O_RDONLY);
+        if (fence < 0 || flock(fence, LOCK_EX) != 0) {
+            errno = EAGAIN;
+            ret = -1;
+        }
+        if (ret == 0 && __atomic_load_n(&storage->tier_gen[inode % STORAGE_LOCK_STRIPES], __ATOMIC_SEQ_CST) != gen) {
+            errno = EAGAIN;
+            ret = -1;
+        }
+        for (size_t i = 0; ret == 0 && i < count; i++) {
+            char src[PATH_MAX];
+            snprintf(src, sizeof(src), "%s/%s", src_dir, files[i].name);
+            struct stat st;
+            if (stat(src, &st) != 0 || !same_stat(&st, &files[i].st)) {
+                errno = EAGAIN;
+                ret = -1;
+                break;
+            }
+        }
+        if (ret == 0 && storage->chunk_size > 0) {
+            char next[DATA_PATH_SIZE];
+            chunk_path_in(src_dir, inode, chunks, next);
+            if (access(next, F_OK) == 0) {
+                errno = EAGAIN;
+                ret = -1;
+            }
+        }
+
+        if (ret == 0) {
+            // 目标层中多出的块是之前崩溃遗留的旧副本
+            tier_discard(storage, dst_dir, inode, storage->chunk_size > 0 ? chunks : 1);
+            for (; renamed < count; renamed++) {
+                char tmp[PATH_MAX], dst[PATH_MAX];
+                snprintf(tmp, sizeof(tmp), "%s/%s.tmp", dst_dir, files[renamed].name);
+                snprintf(dst, sizeof(dst), "%s/%s", dst_dir, files[renamed].name);
+                if (rename(tmp, dst) != 0) {
+                    ret = -1;
+                    break;
+                }
+            }
+        }
+
+        if (ret == 0) {
+            // 目标落盘后才删除源文件，之后读写都到目标层
+            sync_dir(dst_dir);
+            storage_set_tier(storage, inode, tier);
+            for (size_t i = 0; i < count; i++) {
+                char src[PATH_MAX];
+                snprintf(src, sizeof(src), "%s/%s", src_dir, files[i].name);
+                unlink(src);
+            }
+        } else {
+            // 已换入的部分是源文件的副本，删除后源文件仍然完整
+            int err = errno;
+            for (size_t i = 0; i < renamed; i++) {
+                char dst[PATH_MAX];
+                snprintf(dst, sizeof(dst), "%s/%s", dst_dir, files[i].name);
+                unlink(dst);
+            }
+            errno = err;
+        }
+        if (fence >= 0) {
+            close(fence);
+        }
+        tier_leave(storage, inode);
+    }
+
+    if (ret != 0) {
+        int err = errno;
+        for (size_t i = renamed; i <= copied && i < count; i++) {
+            char tmp[PATH_MAX];
+            snprintf(tmp, sizeof(tmp), "%s/%s.tmp", dst_dir, files[i].name);
+            unlink(tmp);
+        }
+        errno = err;
+    }
+
+    free(files);
+    return ret;
+}
+
+int storage_list_tier(storage_t *storage, int tier, uint64_t **inodes, int *count) {
+    *inodes = NULL;
+    *count = 0;
+
+    DIR *dir = opendir(tier_dir(storage, tier));
+    if (!dir) {
+        return -1;
+    }
+
+    // 每个文件取 data_<inode>（分块布局为第 0 块），跳过索引和迁移中的临时文件
+    int cap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint64_t inode, index = 0;
+        int len = 0;
+        int matched = storage->chunk_size > 0 ?
+                      sscanf(entry->d_name, "data_%lu_%lu%n", &inode, &index, &len) == 2 :
+                      sscanf(entry->d_name, "data_%lu%n", &inode, &len) == 1;
+        if (!matched || entry->d_name[len] != '\0' || index != 0) {
+            continue;
+        }
+
+        if (*count == cap) {
+            cap = cap ? cap * 2 : 256;
+            uint64_t *grown = (uint64_t*)realloc(*inodes, (size_t)cap * sizeof(uint64_t));
+            if (!grown) {
+                closedir(dir);
+                free(*inodes);
+                *inodes = NULL;
+                *count = 0;
+                return -1;
+            }
+            *inodes = grown;
+        }
+        (*inodes)[(*count)++] = inode;
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+int storage_access_time(storage_t *storage, uint64_t inode, time_t *last) {
+    tier_file_t *files;
+    size_t count;
+    uint64_t chunks;
+    if (tier_list_files(storage, tier_dir(storage, storage_get_tier(storage, inode)), inode,
+                        &files, &count, &chunks) != 0) {
+        return -1;
+    }
+
+    *last = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (files[i].st.st_atime > *last) {
+            *last = files[i].st.st_atime;
+        }
+        if (files[i].st.st_mtime > *last) {
+            *last = files[i].st.st_mtime;
+        }
+    }
+    free(files);
+
+    return count > 0 ? 0 : -1;
 }
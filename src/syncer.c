@@ -0,0 +1,161 @@
+#include "syncer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+// 排队中的同步请求，位于调用者的栈上，批次完成前调用者一直等待
+typedef struct sync_waiter {
+    uint64_t inode;
+    int datasync;
+    int result;
+    int done;
+    struct sync_waiter *next;
+} sync_waiter_t;
+
+struct syncer {
+    storage_t *storage;
+    redis_meta_t *meta;
+    int aof;
+    int replicas;
+    int timeout_ms;
+    int failing;                // 元数据持久化等待失败，只报告一次
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    sync_waiter_t *pending;     // 等待下一批的请求
+    int running;                // 有调用者正在执行一批
+};
+
+syncer_t* syncer_new(storage_t *storage, redis_meta_t *meta, int aof, int replicas, int timeout_ms) {
+    syncer_t *syncer = (syncer_t*)calloc(1, sizeof(syncer_t));
+    if (!syncer) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&syncer->lock, NULL);
+    pthread_cond_init(&syncer->done, NULL);
+    syncer->storage = storage;
+    syncer->meta = meta;
+    syncer->aof = aof;
+    syncer->replicas = replicas > 0 ? replicas : 0;
+    syncer->timeout_ms = timeout_ms > 0 ? timeout_ms : SYNCER_WAIT_TIMEOUT;
+
+    return syncer;
+}
+
+void syncer_free(syncer_t *syncer) {
+    if (!syncer) {
+        return;
+    }
+
+    pthread_mutex_destroy(&syncer->lock);
+    pthread_cond_destroy(&syncer->done);
+    free(syncer);
+}
+
+// 执行一批同步，结果写入各请求（此时请求已移出队列，只有执行者访问）
+static void run_batch(syncer_t *syncer, sync_waiter_t *batch) {
+    int count = 0;
+    for (sync_waiter_t *w = batch; w; w = w->next) {
+        count++;
+    }
+
+    uint64_t *inodes = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)count);
+    int *modes = (int*)malloc(sizeof(int) * (size_t)count);
+    int *results = (int*)malloc(sizeof(int) * (size_t)count);
+    if (!inodes || !modes || !results) {
+        free(inodes);
+        free(modes);
+        free(results);
+        for (sync_waiter_t *w = batch; w; w = w->next) {
+            w->result = -EIO;
+        }
+        return;
+    }
+
+    // 同一文件只同步一次，有一个请求需要 fsync 时按 fsync 同步
+    int n = 0;
+    for (sync_waiter_t *w = batch; w; w = w->next) {
+        int mode = w->datasync ? STORAGE_SYNC_DATA : STORAGE_SYNC_FULL;
+        int j = 0;
+        while (j < n && inodes[j] != w->inode) {
+            j++;
+        }
+        if (j == n) {
+            inodes[n] = w->inode;
+            modes[n] = mode;
+            n++;
+        } else if (mode > modes[j]) {
+            modes[j] = mode;
+        }
+    }
+
+    // 多个文件时先一起发起回写，设备可以并行处理，再逐个等待完成
+    if (n > 1) {
+        for (int j = 0; j < n; j++) {
+            storage_sync(syncer->storage, inodes[j], STORAGE_SYNC_START);
+        }
+    }
+    for (int j = 0; j < n; j++) {
+        results[j] = storage_sync(syncer->storage, inodes[j], modes[j]) == 0 ? 0 : -EIO;
+    }
+
+    // 整批共用一次元数据持久化等待
+    int meta_ret = 0;
+    if (syncer->aof || syncer->replicas > 0) {
+        meta_ret = redis_meta_wait_durable(syncer->meta, inodes, n, syncer->aof ? 1 : 0,
+                                           syncer->replicas, syncer->timeout_ms);
+        if (meta_ret != 0 && !syncer->failing) {
+            fprintf(stderr, "Metadata did not become durable within %d ms\n", syncer->timeout_ms);
+        }
+        syncer->failing = meta_ret != 0;
+    }
+
+    for (sync_waiter_t *w = batch; w; w = w->next) {
+        int j = 0;
+        while (inodes[j] != w->inode) {
+            j++;
+        }
+        w->result = meta_ret != 0 ? -EIO : results[j];
+    }
+
+    free(inodes);
+    free(modes);
+    free(results);
+}
+
+int syncer_sync(syncer_t *syncer, uint64_t inode, int datasync) {
+    sync_waiter_t self = {inode, datasync, 0, 0, NULL};
+
+    pthread_mutex_lock(&syncer->lock);
+    self.next = syncer->pending;
+    syncer->pending = &self;
+
+    // 正在执行的一批开始之后才到达的请求不能算入其中，等它完成后由下一个执行者带走整个队列
+    while (!self.done) {
+        if (syncer->running) {
+            pthread_cond_wait(&syncer->done, &syncer->lock);
+            continue;
+        }
+
+        sync_waiter_t *batch = syncer->pending;
+        syncer->pending = NULL;
+        syncer->running = 1;
+        pthread_mutex_unlock(&syncer->lock);
+
+        run_batch(syncer, batch);
+
+        pthread_mutex_lock(&syncer->lock);
+        while (batch) {
+            sync_waiter_t *next = batch->next;
+            batch->done = 1;
+            batch = next;
+        }
+        syncer->running = 0;
+        pthread_cond_broadcast(&syncer->done);
+    }
+    pthread_mutex_unlock(&syncer->lock);
+
+    return self.result;
+}
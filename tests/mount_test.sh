@@ -0,0 +1,330 @@
+#!/bin/bash
+
+# Simple-FS-C 挂载测试：在临时目录挂载文件系统，并发执行容易出现竞争的操作后检查结果
+#
+# 需要已编译的 ./simplefs-c、运行中的 redis-server、redis-cli 和 fusermount3
+# 使用 Redis 数据库 $REDIS_DB（默认 15），每个用例开始前清空该数据库
+# 每个用例的名字以它覆盖的需求编号开头，如 [user-030]
+#
+#   make test
+#   REDIS_PORT=6380 REDIS_DB=9 ./tests/mount_test.sh
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BIN=${BIN:-$ROOT/simplefs-c}
+REDIS_ADDR=${REDIS_ADDR:-localhost}
+REDIS_PORT=${REDIS_PORT:-6379}
+REDIS_DB=${REDIS_DB:-15}
+
+# 等待一组并发操作的秒数，超时视为死锁
+TIMEOUT=${TIMEOUT:-120}
+
+MOUNTS=()
+DAEMONS=()
+FAILED=0
+CASE=""
+
+redis() {
+    redis-cli -h "$REDIS_ADDR" -p "$REDIS_PORT" -n "$REDIS_DB" "$@"
+}
+
+fail() {
+    echo "  失败: $*"
+    FAILED=$((FAILED + 1))
+}
+
+# 挂载：mount_fs 挂载点 数据目录 [其他选项...]
+mount_fs() {
+    local mnt=$1 data=$2
+    shift 2
+    mkdir -p "$mnt" "$data"
+    local log="$WORK/$(echo "$CASE" | tr ' ' '-')-$(basename "$mnt").log"
+    "$BIN" --redis-addr "$REDIS_ADDR" --redis-port "$REDIS_PORT" --redis-db "$REDIS_DB" \
+        --data-dir "$data" --mountpoint "$mnt" -f "$@" >> "$log" 2>&1 &
+    DAEMONS+=($!)
+    MOUNTS+=("$mnt")
+    for i in $(seq 100); do
+        if mountpoint -q "$mnt"; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "挂载失败: $mnt"
+    cat "$log"
+    exit 1
+}
+
+# 卸载全部挂载并等待进程退出（退出前应用日志、写入访问时间）
+unmount_all() {
+    for mnt in "${MOUNTS[@]}"; do
+        fusermount3 -u "$mnt" 2>/dev/null
+    done
+    for pid in "${DAEMONS[@]}"; do
+        wait "$pid" 2>/dev/null
+    done
+    MOUNTS=()
+    DAEMONS=()
+}
+
+# 开始一个用例：卸载上一个用例的挂载，清空数据库和数据目录
+begin() {
+    CASE=$1
+    echo "== $CASE"
+    unmount_all
+    redis FLUSHDB > /dev/null
+    rm -rf "$WORK/data" "$WORK/cold"
+}
+
+# 等待 pid 全部退出，超时时杀掉它们；返回失败（包括超时）的进程数
+wait_pids() {
+    local deadline=$((SECONDS + TIMEOUT))
+    local pid
+    for pid in "$@"; do
+        while kill -0 "$pid" 2>/dev/null && [ $SECONDS -lt $deadline ]; do
+            sleep 0.1
+        done
+    done
+
+    local failed=0
+    for pid in "$@"; do
+        if kill -0 "$pid" 2>/dev/null; then
+            kill "$pid" 2>/dev/null
+            echo "  超时: 进程 $pid 在 $TIMEOUT 秒内没有结束"
+        fi
+        wait "$pid" 2>/dev/null || failed=$((failed + 1))
+    done
+    return $failed
+}
+
+# 等待命令成功，最多 $1 秒
+wait_until() {
+    local limit=$1
+    shift
+    for i in $(seq $((limit * 10))); do
+        if "$@"; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+no_pending_deletes() {
+    [ "$(redis ZCARD delfiles)" = "0" ]
+}
+
+cold_tier_used() {
+    [ -n "$(find "$WORK/cold" -type f 2>/dev/null | head -1)" ]
+}
+
+# user-027 内联文件的并发写入与提升：两个挂载交替写入同一文件的不同位置，合计超过内联阈值，
+# 其中一个写入触发提升；重新挂载后每个位置都必须是写入的数据（不能被提升丢失）
+test_inline_promotion() {
+    begin "[user-027] inline writes racing promotion"
+    mount_fs "$WORK/a" "$WORK/data" --inline-threshold 4096
+    mount_fs "$WORK/b" "$WORK/data" --inline-threshold 4096
+
+    local letters=(A B C D E F G H I J K L M N O P)
+    rm -f "$WORK/expect"
+    for slot in $(seq 0 15); do
+        printf '%*s' 512 '' | tr ' ' "${letters[$slot]}" > "$WORK/slot$slot"
+        dd if="$WORK/slot$slot" of="$WORK/expect" bs=512 seek=$slot conv=notrunc status=none
+    done
+
+    for round in $(seq 20); do
+        : > "$WORK/a/inline$round"
+        local pids=()
+        for slot in $(seq 0 15); do
+            local mnt=$([ $((slot % 2)) -eq 0 ] && echo a || echo b)
+            dd if="$WORK/slot$slot" of="$WORK/$mnt/inline$round" bs=512 seek=$slot conv=notrunc status=none &
+            pids+=($!)
+        done
+        wait_pids "${pids[@]}" || fail "round $round: 写入失败"
+    done
+
+    unmount_all
+    mount_fs "$WORK/a" "$WORK/data" --inline-threshold 4096
+    for round in $(seq 20); do
+        cmp -s "$WORK/expect" "$WORK/a/inline$round" || fail "inline$round 的内容与写入的不一致"
+    done
+}
+
+# user-042 属性修改与写入并发：chmod 只修改权限，不能把写入扩展的大小改回旧值
+test_attr_changes() {
+    begin "[user-042] attribute changes racing writes"
+    mount_fs "$WORK/a" "$WORK/data"
+
+    local f="$WORK/a/attr"
+    : > "$f"
+    ( for i in $(seq 200); do printf '%01024d' 0 >> "$f" || exit 1; done ) &
+    local writer=$!
+    ( for i in $(seq 200); do chmod 600 "$f" && chmod 644 "$f" || exit 1; done ) &
+    local changer=$!
+    ( for i in $(seq 200); do truncate -s 0 "$WORK/a/attr-trunc" && echo x >> "$WORK/a/attr-trunc" || exit 1; done ) &
+    local truncater=$!
+    wait_pids $writer $changer $truncater || fail "写入、chmod 或截断失败"
+    chmod 640 "$f"
+
+    unmount_all
+    mount_fs "$WORK/a" "$WORK/data"
+    local got=$(stat -c '%s %a' "$f")
+    [ "$got" = "204800 640" ] || fail "大小和权限为 $got，应为 204800 640"
+    [ "$(cat "$WORK/a/attr-trunc")" = "x" ] || fail "截断后追加的内容不正确"
+}
+
+# user-044 日志中的创建与另一个挂载的同名创建冲突：每个名字只留下一个文件，
+# 全部删除并回收后用量回到初始值，被丢弃的节点也要回收
+test_journal_conflicts() {
+    begin "[user-044] journaled creates conflicting with another mount"
+    mount_fs "$WORK/a" "$WORK/data" --journal
+    mount_fs "$WORK/b" "$WORK/data"
+
+    local space=$(redis HGET usage space)
+    local inodes=$(redis HGET usage inodes)
+
+    local pids=()
+    for i in $(seq 100); do
+        head -c 8192 /dev/urandom > "$WORK/a/dup$i" &
+        pids+=($!)
+        head -c 8192 /dev/urandom > "$WORK/b/dup$i" &
+        pids+=($!)
+    done
+    # 同名创建失败（EEXIST）是允许的结果
+    wait_pids "${pids[@]}"
+
+    unmount_all
+    mount_fs "$WORK/a" "$WORK/data"
+    local count=$(ls "$WORK/a" | grep -c '^dup')
+    [ "$count" = "100" ] || fail "留下 $count 个文件，应为 100"
+
+    rm -f "$WORK/a"/dup*
+    wait_until 60 no_pending_deletes || fail "待删除的节点没有回收"
+    [ "$(redis HGET usage space)" = "$space" ] || fail "删除后已用空间为 $(redis HGET usage space)，应为 $space"
+    [ "$(redis HGET usage inodes)" = "$inodes" ] || fail "删除后节点数为 $(redis HGET usage inodes)，应为 $inodes"
+}
+
+# user-030 去重卷上读取与覆盖并发：旧块在读取期间被释放时重新读取块映射，读取不能失败；
+# 同一数据目录的第二个挂载被拒绝
+test_dedup_reads() {
+    begin "[user-030] dedup reads racing overwrites"
+    mount_fs "$WORK/a" "$WORK/data" --dedup
+
+    mkdir -p "$WORK/b"
+    timeout 10 "$BIN" --redis-addr "$REDIS_ADDR" --redis-port "$REDIS_PORT" --redis-db "$REDIS_DB" \
+        --data-dir "$WORK/data" --mountpoint "$WORK/b" -f --dedup > /dev/null 2>&1
+    local status=$?
+    if [ $status -eq 0 ] || [ $status -eq 124 ] || mountpoint -q "$WORK/b"; then
+        fusermount3 -u "$WORK/b" 2>/dev/null
+        fail "同一去重数据目录的第二个挂载没有被拒绝"
+    fi
+
+    head -c 1048576 /dev/urandom > "$WORK/v1"
+    head -c 1048576 /dev/urandom > "$WORK/v2"
+    cp "$WORK/v1" "$WORK/a/f"
+
+    ( for i in $(seq 50); do
+          dd if="$WORK/v2" of="$WORK/a/f" bs=128k conv=notrunc status=none &&
+          dd if="$WORK/v1" of="$WORK/a/f" bs=128k conv=notrunc status=none || exit 1
+      done ) &
+    local writer=$!
+    local pids=($writer)
+    for r in $(seq 4); do
+        ( while kill -0 $writer 2>/dev/null; do cat "$WORK/a/f" > /dev/null || exit 1; done ) &
+        pids+=($!)
+    done
+    wait_pids "${pids[@]}" || fail "覆盖或读取失败"
+
+    unmount_all
+    mount_fs "$WORK/a" "$WORK/data" --dedup
+    cmp -s "$WORK/v1" "$WORK/a/f" || fail "最后写入的内容不一致"
+}
+
+# user-050 QoS：一个租户的大量写入不能让另一个租户的小操作等不到执行槽
+test_qos() {
+    begin "[user-050] QoS tenants sharing data slots"
+    mount_fs "$WORK/a" "$WORK/data" --qos dir --qos-data-slots 2 --qos-meta-slots 2
+    mkdir "$WORK/a/t1" "$WORK/a/t2"
+
+    local pids=()
+    for i in $(seq 4); do
+        dd if=/dev/zero of="$WORK/a/t1/big$i" bs=1M count=64 status=none &
+        pids+=($!)
+    done
+    ( for i in $(seq 200); do
+          echo "$i" > "$WORK/a/t2/small$i" && [ "$(cat "$WORK/a/t2/small$i")" = "$i" ] || exit 1
+      done ) &
+    pids+=($!)
+    wait_pids "${pids[@]}" || fail "租户的操作失败或超时"
+}
+
+# user-049 分层迁移与写入并发：降级期间本挂载和另一个挂载追加的数据都不能丢失
+test_tier_migration() {
+    begin "[user-049] writes racing tier migration"
+    local tier="--cold-dir $WORK/cold --tier-cold-after 1"
+    mount_fs "$WORK/a" "$WORK/data" $tier
+
+    head -c 1048576 /dev/urandom > "$WORK/base"
+    head -c 65536 /dev/urandom > "$WORK/tail"
+    cat "$WORK/base" "$WORK/tail" > "$WORK/expect"
+    for i in $(seq 20); do
+        cp "$WORK/base" "$WORK/a/tier$i"
+    done
+
+    # 重新挂载后迁移线程立即扫描，已经空闲的文件开始降级
+    # 迁移不选择 2 秒内修改过的文件
+    unmount_all
+    sleep 3
+    mount_fs "$WORK/a" "$WORK/data" $tier
+    mount_fs "$WORK/b" "$WORK/data" --cold-dir "$WORK/cold" --tier-cold-after 0
+    local pids=()
+    for i in $(seq 1 2 20); do
+        local mnt=$([ $((i % 4)) -eq 1 ] && echo a || echo b)
+        cat "$WORK/tail" >> "$WORK/$mnt/tier$i" &
+        pids+=($!)
+    done
+    wait_pids "${pids[@]}" || fail "追加失败"
+    wait_until 60 cold_tier_used || fail "没有文件降级到容量层"
+
+    unmount_all
+    mount_fs "$WORK/a" "$WORK/data" $tier
+    for i in $(seq 20); do
+        local want="$WORK/base"
+        if [ $((i % 2)) -eq 1 ]; then
+            want="$WORK/expect"
+        fi
+        cmp -s "$want" "$WORK/a/tier$i" || fail "tier$i 的内容不一致"
+    done
+}
+
+if [ ! -x "$BIN" ]; then
+    echo "错误: 未找到 $BIN，请先运行 make"
+    exit 1
+fi
+for cmd in redis-cli fusermount3 mountpoint; do
+    if ! command -v $cmd &> /dev/null; then
+        echo "错误: 未找到 $cmd"
+        exit 1
+    fi
+done
+if [ "$(redis PING 2>/dev/null)" != "PONG" ]; then
+    echo "错误: 无法连接 Redis $REDIS_ADDR:$REDIS_PORT"
+    exit 1
+fi
+
+WORK=$(mktemp -d /tmp/simplefs-test.XXXXXX)
+# 有检查失败时保留挂载日志
+trap 'unmount_all; redis FLUSHDB > /dev/null; [ $FAILED -eq 0 ] && rm -rf "$WORK"' EXIT
+
+test_inline_promotion
+test_attr_changes
+test_journal_conflicts
+test_dedup_reads
+test_qos
+test_tier_migration
+
+unmount_all
+echo ""
+if [ $FAILED -ne 0 ]; then
+    echo "$FAILED 项检查失败，挂载日志在 $WORK"
+    exit 1
+fi
+echo "全部通过"